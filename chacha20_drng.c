@@ -25,7 +25,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "chacha20_drng.h"
 
@@ -35,11 +45,11 @@
 			* zero, the API is not considered stable
 			* and can change without a bump of the
 			* major version). */
-#define MINVERSION 3   /* API compatible, ABI may change,
+#define MINVERSION 4   /* API compatible, ABI may change,
 			* functional enhancements only, consumer
 			* can be left unchanged if enhancements are
 			* not considered. */
-#define PATCHLEVEL 2   /* API / ABI compatible, no functional
+#define PATCHLEVEL 0   /* API / ABI compatible, no functional
 			* changes, no enhancements, bug fixes
 			* only. */
 
@@ -56,12 +66,29 @@
 #define min(x, y) ((x < y) ? x : y)
 #define __aligned(x) __attribute__((aligned(x)))
 
-static inline void memset_secure(void *s, int c, uint32_t n)
+static inline void memset_secure(void *s, int c, size_t n)
 {
 	memset(s, c, n);
 	__asm__ __volatile__("" : : "r" (s) : "memory");
 }
 
+/* XOR of len bytes of src into dst, neither needs to be aligned */
+static inline void xor_bytes(uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+	uint64_t d, k;
+
+	for (; len >= sizeof(d); len -= sizeof(d)) {
+		memcpy(&d, dst, sizeof(d));
+		memcpy(&k, src, sizeof(k));
+		d ^= k;
+		memcpy(dst, &d, sizeof(d));
+		dst += sizeof(d);
+		src += sizeof(k);
+	}
+	while (len--)
+		*dst++ ^= *src++;
+}
+
 static inline void get_time(time_t *sec, uint32_t *nsec)
 {
 	struct timespec time;
@@ -90,11 +117,23 @@ static inline uint32_t _bswap32(uint32_t x)
 	return ((rol32(x, 8) & 0x00ff00ffL) | (ror32(x, 8) & 0xff00ff00L));
 }
 
+static inline uint64_t _bswap64(uint64_t x)
+{
+	return ((uint64_t)_bswap32((uint32_t)x) << 32) |
+		_bswap32((uint32_t)(x >> 32));
+}
+
 /* Endian dependent byte swap operations.  */
 #if __BYTE_ORDER__ ==  __ORDER_BIG_ENDIAN__
 # define le_bswap32(x) _bswap32(x)
+# define le_bswap64(x) _bswap64(x)
+# define be_bswap32(x) ((uint32_t)(x))
+# define be_bswap64(x) ((uint64_t)(x))
 #elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 # define le_bswap32(x) ((uint32_t)(x))
+# define le_bswap64(x) ((uint64_t)(x))
+# define be_bswap32(x) _bswap32(x)
+# define be_bswap64(x) _bswap64(x)
 #else
 #error "Endianess not defined"
 #endif
@@ -129,10 +168,10 @@ struct chacha20_state {
 #define CHACHA20_BLOCK_SIZE sizeof(struct chacha20_state)
 #define CHACHA20_BLOCK_SIZE_WORDS (CHACHA20_BLOCK_SIZE / sizeof(uint32_t))
 
-/* ChaCha20 block function according to RFC 7539 section 2.3 */
-static void chacha20_block(uint32_t *state, uint32_t *stream)
+/* ChaCha20 rounds of RFC 7539 section 2.3 without the final state addition */
+static inline void chacha20_rounds(const uint32_t *state, uint32_t *ws)
 {
-	uint32_t i, ws[CHACHA20_BLOCK_SIZE_WORDS], *out = stream;
+	uint32_t i;
 
 	for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++)
 		ws[i] = state[i];
@@ -186,6 +225,14 @@ static void chacha20_block(uint32_t *state, uint32_t *stream)
 		ws[3]  += ws[4];  ws[14] = rol32(ws[14] ^ ws[3],   8);
 		ws[9]  += ws[14]; ws[4]  = rol32(ws[4]  ^ ws[9],   7);
 	}
+}
+
+/* ChaCha20 block function according to RFC 7539 section 2.3 */
+static void chacha20_block(uint32_t *state, uint32_t *stream)
+{
+	uint32_t i, ws[CHACHA20_BLOCK_SIZE_WORDS], *out = stream;
+
+	chacha20_rounds(state, ws);
 
 	for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++)
 		out[i] = le_bswap32(ws[i] + state[i]);
@@ -193,6 +240,73 @@ static void chacha20_block(uint32_t *state, uint32_t *stream)
 	state[12]++;
 }
 
+/*
+ * ChaCha20 block function XORing the key stream block into the 4 byte aligned
+ * buffer inout instead of storing it.
+ */
+static void chacha20_block_xor(uint32_t *state, uint32_t *inout)
+{
+	uint32_t i, ws[CHACHA20_BLOCK_SIZE_WORDS];
+
+	chacha20_rounds(state, ws);
+
+	for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++)
+		inout[i] ^= le_bswap32(ws[i] + state[i]);
+
+	state[12]++;
+}
+
+/*
+ * Number of independent ChaCha20 states processed in parallel by
+ * chacha20_block_multi: one lane of a 128 bit vector per state which maps to
+ * SSE2 on x86-64 and NEON on ARM64 without any -march option. On other
+ * architectures, the compiler lowers the vector operations to scalar code.
+ */
+#define CHACHA20_MULTI_LANES 4
+
+typedef uint32_t chacha20_vec_t
+	__attribute__((vector_size(CHACHA20_MULTI_LANES * sizeof(uint32_t))));
+
+#define chacha20_vec_rol(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define chacha20_vec_qr(ws, a, b, c, d)					\
+	do {								\
+		ws[a] += ws[b]; ws[d] = chacha20_vec_rol(ws[d] ^ ws[a], 16); \
+		ws[c] += ws[d]; ws[b] = chacha20_vec_rol(ws[b] ^ ws[c], 12); \
+		ws[a] += ws[b]; ws[d] = chacha20_vec_rol(ws[d] ^ ws[a],  8); \
+		ws[c] += ws[d]; ws[b] = chacha20_vec_rol(ws[b] ^ ws[c],  7); \
+	} while (0)
+
+/*
+ * ChaCha20 block function on CHACHA20_MULTI_LANES states in transposed
+ * layout: state[i] holds word i of all states. The result is the block in
+ * host byte order including the final state addition. Contrary to
+ * chacha20_block, the counter is not incremented.
+ */
+static void chacha20_block_multi(const chacha20_vec_t *state,
+				 chacha20_vec_t *ws)
+{
+	uint32_t i;
+
+	for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++)
+		ws[i] = state[i];
+
+	for (i = 0; i < 10; i++) {
+		chacha20_vec_qr(ws, 0, 4,  8, 12);
+		chacha20_vec_qr(ws, 1, 5,  9, 13);
+		chacha20_vec_qr(ws, 2, 6, 10, 14);
+		chacha20_vec_qr(ws, 3, 7, 11, 15);
+
+		chacha20_vec_qr(ws, 0, 5, 10, 15);
+		chacha20_vec_qr(ws, 1, 6, 11, 12);
+		chacha20_vec_qr(ws, 2, 7,  8, 13);
+		chacha20_vec_qr(ws, 3, 4,  9, 14);
+	}
+
+	for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++)
+		ws[i] += state[i];
+}
+
 static inline int drng_chacha20_selftest_one(struct chacha20_state *state,
 					     uint32_t *expected)
 {
@@ -236,7 +350,11 @@ static int drng_chacha20_selftest(void)
 #ifdef GETRANDOM
 
 #include <limits.h>
-static int drng_getrandom_get(uint8_t *buf, uint32_t buflen)
+#ifndef GRND_NONBLOCK
+# define GRND_NONBLOCK	0x0001
+#endif
+
+static int drng_getrandom_get(uint8_t *buf, uint32_t buflen, int nonblock)
 {
 	uint32_t len = 0;
 	ssize_t ret;
@@ -245,7 +363,8 @@ static int drng_getrandom_get(uint8_t *buf, uint32_t buflen)
 		return 0;
 
 	do {
-		ret = syscall(__NR_getrandom, (buf + len), (buflen - len), 0);
+		ret = syscall(__NR_getrandom, (buf + len), (buflen - len),
+			      nonblock ? GRND_NONBLOCK : 0);
 		if (0 < ret)
 			len += ret;
 	} while ((0 < ret || EINTR == errno || ERESTART == errno)
@@ -255,16 +374,25 @@ static int drng_getrandom_get(uint8_t *buf, uint32_t buflen)
 }
 
 #else
-static int drng_getrandom_get(uint8_t *buf, uint32_t buflen)
+static int drng_getrandom_get(uint8_t *buf, uint32_t buflen, int nonblock)
 {
 	(void)buf;
 	(void)buflen;
+	(void)nonblock;
 
 	return 0;
 }
 
 #endif
 
+/*
+ * The Jitter RNG and /dev/random seed sources keep global state shared by all
+ * DRNG handles. The lock serializes its use and the reference counter of
+ * the DRNG handles defines when it is released.
+ */
+static pthread_mutex_t drng_seed_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t drng_seed_users = 0;
+
 /*************************** Jitter RNG seed source ***************************/
 #ifdef JENT
 
@@ -306,29 +434,37 @@ static void drng_jent_dealloc(void)
 	jent_noise_source.initialized = 0;
 }
 
-static int drng_jent_get(uint8_t *buf, uint32_t buflen)
+/* The Jitter RNG never blocks indefinitely, its duration is bounded */
+static int drng_jent_get(uint8_t *buf, uint32_t buflen, int nonblock)
 {
-	if (!jent_noise_source.initialized) {
-		int ret = drng_jent_alloc();
+	int ret = 0;
 
+	(void)nonblock;
+
+	pthread_mutex_lock(&drng_seed_lock);
+	if (!jent_noise_source.initialized) {
+		ret = drng_jent_alloc();
 		if (ret)
-			return ret;
+			goto out;
 
 		jent_noise_source.initialized = 1;
 	}
 
 	if (jent_noise_source.initialized > 0)
-		return jent_read_entropy(jent_noise_source.ec,
-					 (char *)buf, buflen);
+		ret = jent_read_entropy(jent_noise_source.ec,
+					(char *)buf, buflen);
 
-	return 0;
+out:
+	pthread_mutex_unlock(&drng_seed_lock);
+	return ret;
 }
 
 #else
-static int drng_jent_get(uint8_t *buf, uint32_t buflen)
+static int drng_jent_get(uint8_t *buf, uint32_t buflen, int nonblock)
 {
 	(void)buf;
 	(void)buflen;
+	(void)nonblock;
 
 	return 0;
 }
@@ -346,6 +482,7 @@ static void drng_jent_dealloc(void)
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 
 static int random_fd = -1;
 
@@ -358,27 +495,42 @@ static int drng_random_alloc(void)
 	return 0;
 }
 
-static int drng_random_get(uint8_t *buf, uint32_t buflen)
+static int drng_random_get(uint8_t *buf, uint32_t buflen, int nonblock)
 {
 	uint32_t len = 0;
 	ssize_t ret;
+	int fd;
+
+	if (buflen > INT_MAX)
+		return 0;
 
+	pthread_mutex_lock(&drng_seed_lock);
 	if (random_fd == -1) {
 		int ret = drng_random_alloc();
 
-		if (ret)
+		if (ret) {
+			pthread_mutex_unlock(&drng_seed_lock);
 			return ret;
+		}
 	}
+	fd = random_fd;
 
-	if (buflen > INT_MAX)
-		return 0;
+	if (nonblock) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		if (poll(&pfd, 1, 0) != 1) {
+			pthread_mutex_unlock(&drng_seed_lock);
+			return 0;
+		}
+	}
 
 	do {
-		ret = read(random_fd, (buf + len), (buflen - len));
+		ret = read(fd, (buf + len), (buflen - len));
 		if (0 < ret)
 			len += ret;
 	} while ((0 < ret || EINTR == errno || ERESTART == errno)
 		 && buflen > len);
+	pthread_mutex_unlock(&drng_seed_lock);
 
 	return len;
 }
@@ -393,10 +545,11 @@ static void drng_random_dealloc(void)
 }
 
 #else
-static int drng_random_get(uint8_t *buf, uint32_t buflen)
+static int drng_random_get(uint8_t *buf, uint32_t buflen, int nonblock)
 {
 	(void)buf;
 	(void)buflen;
+	(void)nonblock;
 
 	return 0;
 }
@@ -407,14 +560,390 @@ static void drng_random_dealloc(void)
 }
 #endif
 
+/* Reference the global seed source state for a new DRNG handle */
+static void drng_seed_sources_get(void)
+{
+	pthread_mutex_lock(&drng_seed_lock);
+	drng_seed_users++;
+	pthread_mutex_unlock(&drng_seed_lock);
+}
+
+/* Release the global seed source state with the last DRNG handle */
+static void drng_seed_sources_put(void)
+{
+	pthread_mutex_lock(&drng_seed_lock);
+	if (drng_seed_users && !--drng_seed_users) {
+		drng_jent_dealloc();
+		drng_random_dealloc();
+	}
+	pthread_mutex_unlock(&drng_seed_lock);
+}
+
 /******************************* ChaCha20 DRNG *******************************/
 
+struct drng_prefetch;
+struct drng_seeder;
+
 struct chacha20_drng {
+	struct drng_chacha20_bits bits;	/* must be first, see chacha20_drng.h */
 	struct chacha20_state chacha20;
 	time_t last_seeded;
 	uint64_t generated_bytes;
+	struct drng_prefetch *prefetch;
+	uint64_t reseed_ns;	/* decaying maximum of the reseed duration */
+	uint32_t fork_gen;	/* fork generation the state is seeded in */
+	uint32_t seed_pending;	/* full seed expected from the seeder */
+	struct drng_seeder *seeder;
+	struct drng_borrow *borrow;
+#ifdef STATISTICS
+	struct drng_chacha20_stats stats;
+#endif
+};
+
+/* No deadline for the generation of random numbers */
+#define DRNG_NO_DEADLINE	UINT64_MAX
+
+/*
+ * Hard limits up to which a reseed may be deferred by
+ * drng_chacha20_get_deadline.
+ */
+#define DRNG_DEFER_MAX_SECONDS	3600
+#define DRNG_DEFER_MAX_BYTES	(1ULL<<32)
+
+#ifndef MADV_WIPEONFORK
+# define MADV_WIPEONFORK	18
+#endif
+
+/*
+ * Fork detection: the DRNG states reside in memory that the kernel wipes in
+ * the child (MADV_WIPEONFORK, Linux 4.14 and later) and the pthread_atfork
+ * handler increments the fork generation in the child. A state whose fork
+ * generation does not match - either because it was wiped or because
+ * MADV_WIPEONFORK is not supported - is replaced by a new state seeded in
+ * the child. The generation 0 is never used.
+ */
+static uint32_t drng_fork_gen = 1;
+static pthread_once_t drng_fork_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Mappings owned by a DRNG handle besides the handle itself - prefetch state
+ * and buffers, borrow buffer and seeder. The kernel wipes the pointers to
+ * them together with the handle in a child process, so they are recorded in
+ * this list in ordinary memory as well: the child releases the mappings it
+ * inherited with the list. It holds a handful of entries per handle.
+ */
+struct drng_mapping {
+	struct drng_mapping *next;
+	const struct chacha20_drng *owner;	/* NULL once abandoned */
+	void *mem;
+	size_t len;
+	int fd;			/* closed together with the mapping if >= 0 */
+	int sources;		/* seed source reference of a seeder thread */
+	uint32_t fork_gen;	/* fork generation of the allocation */
+};
+
+static struct drng_mapping *drng_mappings;
+static pthread_mutex_t drng_mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The list is consistent in the child even if another thread modified it */
+static void drng_fork_prepare(void)
+{
+	pthread_mutex_lock(&drng_mappings_lock);
+}
+
+static void drng_fork_parent(void)
+{
+	pthread_mutex_unlock(&drng_mappings_lock);
+}
+
+/*
+ * The seeder threads of the parent do not exist in the child: their seed
+ * source references are dropped here as the handles referring to the
+ * seeders may have been wiped. Only the calling thread exists in the child,
+ * so the seed source lock is reinitialized in case a thread of the parent
+ * held it.
+ */
+static void drng_fork_child(void)
+{
+	struct drng_mapping *m;
+
+	pthread_mutex_init(&drng_seed_lock, NULL);
+	for (m = drng_mappings; m; m = m->next) {
+		if (!m->sources)
+			continue;
+		m->sources = 0;
+		if (drng_seed_users && !--drng_seed_users) {
+			drng_jent_dealloc();
+			drng_random_dealloc();
+		}
+	}
+
+	pthread_mutex_unlock(&drng_mappings_lock);
+	if (!++drng_fork_gen)
+		drng_fork_gen = 1;
+}
+
+static void drng_fork_register(void)
+{
+	pthread_atfork(drng_fork_prepare, drng_fork_parent, drng_fork_child);
+}
+
+/* Page-aligned memory for DRNG states, locked if permitted */
+static void *drng_state_alloc(size_t len)
+{
+	void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	/* Older kernels reject the advice, the fork generation remains */
+	madvise(mem, len, MADV_WIPEONFORK);
+
+	/* prevent paging out of the memory state to swap space */
+	if (mlock(mem, len) && errno != EPERM && errno != EAGAIN) {
+		int err = errno;
+
+		munmap(mem, len);
+		errno = err;
+		return NULL;
+	}
+
+	return mem;
+}
+
+static void drng_state_free(void *mem, size_t len)
+{
+	memset_secure(mem, 0, len);
+	munmap(mem, len);
+}
+
+/* Memory for DRNG states owned by a handle, see struct drng_mapping */
+static void *drng_mapping_alloc(const struct chacha20_drng *owner, size_t len)
+{
+	struct drng_mapping *m = malloc(sizeof(*m));
+	void *mem;
+
+	if (!m)
+		return NULL;
+
+	mem = drng_state_alloc(len);
+	if (!mem) {
+		int err = errno;
+
+		free(m);
+		errno = err;
+		return NULL;
+	}
+
+	m->owner = owner;
+	m->mem = mem;
+	m->len = len;
+	m->fd = -1;
+	m->sources = 0;
+	m->fork_gen = drng_fork_gen;
+
+	pthread_mutex_lock(&drng_mappings_lock);
+	m->next = drng_mappings;
+	drng_mappings = m;
+	pthread_mutex_unlock(&drng_mappings_lock);
+
+	return mem;
+}
+
+/* Entry of the mapping - the caller must hold drng_mappings_lock */
+static struct drng_mapping **drng_mapping_find(const void *mem)
+{
+	struct drng_mapping **m;
+
+	for (m = &drng_mappings; *m; m = &(*m)->next) {
+		if ((*m)->mem == mem)
+			break;
+	}
+
+	return m;
+}
+
+/* File descriptor to be closed when a child releases the mapping */
+static void drng_mapping_set_fd(const void *mem, int fd)
+{
+	struct drng_mapping **m;
+
+	pthread_mutex_lock(&drng_mappings_lock);
+	m = drng_mapping_find(mem);
+	if (*m)
+		(*m)->fd = fd;
+	pthread_mutex_unlock(&drng_mappings_lock);
+}
+
+/*
+ * Record whether the seeder thread using the mapping holds a seed source
+ * reference. The flag is set after the reference is taken and cleared before
+ * it is dropped, so a child never drops a reference twice.
+ */
+static void drng_mapping_set_sources(const void *mem, int sources)
+{
+	struct drng_mapping **m;
+
+	pthread_mutex_lock(&drng_mappings_lock);
+	m = drng_mapping_find(mem);
+	if (*m)
+		(*m)->sources = sources;
+	pthread_mutex_unlock(&drng_mappings_lock);
+}
+
+/* The mapping is released by a thread after its handle was destroyed */
+static void drng_mapping_abandon(const void *mem)
+{
+	struct drng_mapping **m;
+
+	pthread_mutex_lock(&drng_mappings_lock);
+	m = drng_mapping_find(mem);
+	if (*m)
+		(*m)->owner = NULL;
+	pthread_mutex_unlock(&drng_mappings_lock);
+}
+
+static void drng_mapping_free(void *mem, size_t len)
+{
+	struct drng_mapping **m, *found;
+
+	pthread_mutex_lock(&drng_mappings_lock);
+	m = drng_mapping_find(mem);
+	found = *m;
+	if (found)
+		*m = found->next;
+	pthread_mutex_unlock(&drng_mappings_lock);
+
+	free(found);
+	drng_state_free(mem, len);
+}
+
+/*
+ * Release the mappings a child process inherited for the handle, including
+ * those abandoned to a thread, which does not exist in the child. Mappings
+ * still referenced by a handle that was not wiped are already released.
+ */
+static void drng_mapping_fork(const struct chacha20_drng *owner)
+{
+	struct drng_mapping **m = &drng_mappings, *found;
+
+	pthread_mutex_lock(&drng_mappings_lock);
+	while (*m) {
+		found = *m;
+		if ((found->owner != owner && found->owner) ||
+		    found->fork_gen == drng_fork_gen) {
+			m = &found->next;
+			continue;
+		}
+
+		*m = found->next;
+		if (found->fd >= 0)
+			close(found->fd);
+		munmap(found->mem, found->len);
+		free(found);
+	}
+	pthread_mutex_unlock(&drng_mappings_lock);
+}
+
+static inline uint64_t drng_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Trigger of a reseed operation */
+enum drng_reseed_reason {
+	DRNG_RESEED_NONE = 0,
+	DRNG_RESEED_TIME = DRNG_CHACHA20_RESEED_TIME,
+	DRNG_RESEED_BYTES = DRNG_CHACHA20_RESEED_BYTES,
+	DRNG_RESEED_EXPLICIT = DRNG_CHACHA20_RESEED_EXPLICIT,
+	DRNG_RESEED_FORK = DRNG_CHACHA20_RESEED_FORK,
+	DRNG_RESEED_BACKGROUND = DRNG_CHACHA20_RESEED_BACKGROUND,
 };
 
+/*
+ * Runtime statistics: the counters are per handle and non-atomic. Without
+ * STATISTICS, all accounting including the time stamps is compiled out.
+ */
+#ifdef STATISTICS
+
+static inline uint64_t drng_stats_time(void)
+{
+	return drng_time_ns();
+}
+
+static inline void drng_stats_hist(uint64_t *hist, uint64_t ns)
+{
+	uint32_t bucket = ns ? (63 - __builtin_clzll(ns)) : 0;
+
+	if (bucket >= DRNG_CHACHA20_STATS_BUCKETS)
+		bucket = DRNG_CHACHA20_STATS_BUCKETS - 1;
+	hist[bucket]++;
+}
+
+# define drng_stats_add(drng, field, val)	((drng)->stats.field += (val))
+# define drng_stats_latency(drng, field, start)				\
+	drng_stats_hist((drng)->stats.field, drng_stats_time() - (start))
+
+#else /* STATISTICS */
+
+static inline uint64_t drng_stats_time(void)
+{
+	return 0;
+}
+
+# define drng_stats_add(drng, field, val)	do { (void)(val); } while (0)
+# define drng_stats_latency(drng, field, start)	do { (void)(start); } while (0)
+
+#endif /* STATISTICS */
+
+/*
+ * Event notification: a registered callback costs one load and a branch per
+ * event if no callback is registered. The USDT probes are NOPs until a tracer
+ * attaches.
+ */
+static void (*drng_event_cb)(const struct drng_chacha20_event *ev,
+			     void *priv) = NULL;
+static void *drng_event_priv = NULL;
+
+static void drng_event_call(uint32_t type, struct chacha20_drng *drng,
+			    uint32_t arg, uint32_t len, int ret)
+{
+	void (*cb)(const struct drng_chacha20_event *ev, void *priv) =
+		__atomic_load_n(&drng_event_cb, __ATOMIC_ACQUIRE);
+	struct drng_chacha20_event ev;
+
+	if (!cb)
+		return;
+
+	ev.type = type;
+	ev.arg = arg;
+	ev.len = len;
+	ev.ret = ret;
+	ev.drng = drng;
+	cb(&ev, __atomic_load_n(&drng_event_priv, __ATOMIC_RELAXED));
+}
+
+#ifdef USDT
+# include <sys/sdt.h>
+# define drng_usdt(name, drng, arg, len, ret)				\
+	DTRACE_PROBE4(chacha20_drng, name, drng, arg, len, ret)
+#else
+# define drng_usdt(name, drng, arg, len, ret)	do { } while (0)
+#endif
+
+#define drng_event(name, type, drng, arg, len, ret)			\
+	do {								\
+		drng_usdt(name, drng, arg, len, ret);			\
+		if (__builtin_expect(					\
+			__atomic_load_n(&drng_event_cb, __ATOMIC_RELAXED) != \
+			NULL, 0))					\
+			drng_event_call(type, drng, arg, len, ret);	\
+	} while (0)
+
 /**
  * Update of the ChaCha20 state by generating one ChaCha20 block which is
  * equal to the state of the ChaCha20. The generated block is XORed into
@@ -447,6 +976,50 @@ static inline void drng_chacha20_update(struct chacha20_state *chacha20,
 	/* Leave counter untouched as it is start value is undefined in RFC */
 }
 
+/**
+ * Absorb full key size chunks of seed data with the same result as the
+ * byte-wise XOR followed by drng_chacha20_update for each chunk in
+ * drng_chacha20_seed. The chunks are XORed word-wise into the key, only the
+ * key part of the ChaCha20 block is computed and the ChaCha20 working state
+ * is zeroized once after the last chunk.
+ *
+ * Note, the double le_bswap32 of drng_chacha20_update cancels out, i.e. the
+ * key is XORed with the ChaCha20 block words in host byte order.
+ */
+static void drng_chacha20_absorb(struct chacha20_state *chacha20,
+				 const uint8_t *inbuf, uint32_t chunks)
+{
+	uint32_t i, w, ws[CHACHA20_BLOCK_SIZE_WORDS];
+	uint32_t *state = &chacha20->constants[0];
+
+	while (chunks--) {
+		/* The key is a byte array in memory: XOR in memory order */
+		for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++) {
+			memcpy(&w, inbuf + i * sizeof(w), sizeof(w));
+			chacha20->key.u[i] ^= w;
+		}
+		inbuf += CHACHA20_KEY_SIZE;
+
+		chacha20_rounds(state, ws);
+		/* Add the state before the key is modified */
+		for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++)
+			ws[i] += state[i];
+		for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++)
+			chacha20->key.u[i] ^= ws[i];
+
+		/* Counter increment of chacha20_block, nonce of the update */
+		chacha20->counter++;
+		chacha20->nonce[0]++;
+		if (chacha20->nonce[0] == 0) {
+			chacha20->nonce[1]++;
+			if (chacha20->nonce[1] == 0)
+				chacha20->nonce[2]++;
+		}
+	}
+
+	memset_secure(ws, 0, sizeof(ws));
+}
+
 /**
  * Seed the ChaCha20 DRNG by injecting the input data into the key part of
  * the ChaCha20 state. If the input data is longer than the ChaCha20 key size,
@@ -462,6 +1035,14 @@ static inline void drng_chacha20_update(struct chacha20_state *chacha20,
 static int drng_chacha20_seed(struct chacha20_state *chacha20,
 			      const uint8_t *inbuf, uint32_t inbuflen)
 {
+	if (inbuflen >= CHACHA20_KEY_SIZE) {
+		uint32_t chunks = inbuflen / CHACHA20_KEY_SIZE;
+
+		drng_chacha20_absorb(chacha20, inbuf, chunks);
+		inbuf += chunks * CHACHA20_KEY_SIZE;
+		inbuflen -= chunks * CHACHA20_KEY_SIZE;
+	}
+
 	while (inbuflen) {
 		uint32_t i, todo = min(inbuflen, CHACHA20_KEY_SIZE);
 
@@ -527,34 +1108,178 @@ static int drng_chacha20_generate(struct chacha20_state *chacha20,
 	return 0;
 }
 
-static int drng_chacha20_rng_selftest(struct chacha20_drng *drng)
+/**
+ * XOR variant of drng_chacha20_generate: the stream output of ChaCha20 is
+ * XORed into the caller's buffer. Aligned full blocks are XORed by the block
+ * function itself, other data is XORed from a stack buffer. The state update
+ * at the end is identical to drng_chacha20_generate, i.e. the state after
+ * this call equals the state after drng_chacha20_generate of the same length.
+ */
+static int drng_chacha20_generate_xor(struct chacha20_state *chacha20,
+				      uint8_t *inout, uint32_t len)
 {
-	int ret;
-	uint8_t outbuf[CHACHA20_KEY_SIZE * 2] __aligned(sizeof(uint32_t));
-	uint8_t seed[CHACHA20_KEY_SIZE * 2] = {
-		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
-		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
-		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
-		0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
-		0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
-		0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
-		0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
-	};
+	uint32_t aligned_buf[(CHACHA20_BLOCK_SIZE / sizeof(uint32_t))];
+	uint32_t used = CHACHA20_BLOCK_SIZE_WORDS;
+	int zeroize_buf = 0;
 
-	/*
-	 * Expected result when ChaCha20 DRNG state is zero:
-	 *	* constants are set to "expand 32-byte k"
-	 *	* remaining state is 0
-	 * and pulling one ChaCha20 DRNG block.
-	 */
-	static const uint8_t expected_block[CHACHA20_KEY_SIZE] = {
-		0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90,
-		0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
-		0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a,
-		0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7 };
+	while (len >= CHACHA20_BLOCK_SIZE) {
+		if ((unsigned long)inout & (sizeof(aligned_buf[0]) - 1)) {
+			chacha20_block(&chacha20->constants[0], aligned_buf);
+			xor_bytes(inout, (uint8_t *)aligned_buf,
+				  CHACHA20_BLOCK_SIZE);
+			zeroize_buf = 1;
+		} else {
+			chacha20_block_xor(&chacha20->constants[0],
+					   (uint32_t *)inout);
+		}
 
-	/*
+		inout += CHACHA20_BLOCK_SIZE;
+		len -= CHACHA20_BLOCK_SIZE;
+	}
+
+	if (len) {
+		chacha20_block(&chacha20->constants[0], aligned_buf);
+		xor_bytes(inout, (uint8_t *)aligned_buf, len);
+		used = ((len + sizeof(aligned_buf[0]) - 1) /
+			sizeof(aligned_buf[0]));
+		zeroize_buf = 1;
+	}
+
+	drng_chacha20_update(chacha20, aligned_buf, used);
+
+	if (zeroize_buf)
+		memset_secure(aligned_buf, 0, sizeof(aligned_buf));
+
+	return 0;
+}
+
+/* Deterministic increment of the nonces in all lanes as drng_chacha20_update */
+static inline void drng_chacha20_nonce_inc_multi(chacha20_vec_t *state)
+{
+	chacha20_vec_t carry;
+
+	state[13] += 1;
+	carry = (chacha20_vec_t)(state[13] == 0) & 1;
+	state[14] += carry;
+	carry &= (chacha20_vec_t)(state[14] == 0);
+	state[15] += carry;
+}
+
+/**
+ * Time stamp seeding followed by the generation of at most one block for up
+ * to CHACHA20_MULTI_LANES ChaCha20 states at once. Each lane performs exactly
+ * the operations of drng_chacha20_seed with the time stamp followed by
+ * drng_chacha20_generate, i.e. the output and the new state of each lane are
+ * identical to those of the one-state code path.
+ *
+ * The states are transposed into the vector lanes on entry and back into
+ * the handles on exit. Unused lanes operate on a zero state which is
+ * discarded.
+ */
+static void drng_chacha20_generate_multi(struct chacha20_state **chacha20,
+					 uint8_t **outbufs, uint32_t outbuflen,
+					 uint32_t nsec, uint32_t num)
+{
+	chacha20_vec_t state[CHACHA20_BLOCK_SIZE_WORDS];
+	chacha20_vec_t ws[CHACHA20_BLOCK_SIZE_WORDS];
+	uint32_t out[CHACHA20_BLOCK_SIZE_WORDS];
+	uint32_t i, l, used = ((outbuflen + sizeof(out[0]) - 1) /
+			       sizeof(out[0]));
+
+	for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++) {
+		for (l = 0; l < num; l++)
+			state[i][l] = (&chacha20[l]->constants[0])[i];
+		for (; l < CHACHA20_MULTI_LANES; l++)
+			state[i][l] = 0;
+	}
+
+	/* drng_chacha20_seed: time stamp into the key, update of the state */
+	state[4] ^= nsec;
+	chacha20_block_multi(state, ws);
+	state[12] += 1;
+	for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++)
+		state[4 + i] ^= ws[i];
+	drng_chacha20_nonce_inc_multi(state);
+
+	/* drng_chacha20_generate: one block of output */
+	chacha20_block_multi(state, ws);
+	state[12] += 1;
+	for (l = 0; l < num; l++) {
+		for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++)
+			out[i] = le_bswap32(ws[i][l]);
+		memcpy(outbufs[l], out, outbuflen);
+	}
+
+	/* drng_chacha20_update: the new key from unused words or a new block */
+	if (CHACHA20_BLOCK_SIZE_WORDS - used < CHACHA20_KEY_SIZE_WORDS) {
+		chacha20_block_multi(state, ws);
+		state[12] += 1;
+		used = 0;
+	}
+	for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++)
+		state[4 + i] ^= ws[i + used];
+	drng_chacha20_nonce_inc_multi(state);
+
+	for (i = 0; i < CHACHA20_BLOCK_SIZE_WORDS; i++) {
+		for (l = 0; l < num; l++)
+			(&chacha20[l]->constants[0])[i] = state[i][l];
+	}
+
+	memset_secure(state, 0, sizeof(state));
+	memset_secure(ws, 0, sizeof(ws));
+	memset_secure(out, 0, sizeof(out));
+}
+
+/* Number of ChaCha20 block operations of drng_chacha20_seed */
+static inline uint32_t drng_chacha20_seed_blocks(uint32_t inbuflen)
+{
+	return (inbuflen + CHACHA20_KEY_SIZE - 1) / CHACHA20_KEY_SIZE;
+}
+
+/*
+ * Number of ChaCha20 block operations of drng_chacha20_generate: one per
+ * started block plus one for the update unless the last block has enough
+ * unused words left for the new key.
+ */
+static inline uint32_t drng_chacha20_generate_blocks(uint32_t outbuflen)
+{
+	uint32_t rem = outbuflen & (CHACHA20_BLOCK_SIZE - 1);
+	uint32_t used = (rem + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+	return (outbuflen + CHACHA20_BLOCK_SIZE - 1) / CHACHA20_BLOCK_SIZE +
+	       ((!rem ||
+		 CHACHA20_BLOCK_SIZE_WORDS - used < CHACHA20_KEY_SIZE_WORDS) ?
+		1 : 0);
+}
+
+static int drng_chacha20_rng_selftest(struct chacha20_drng *drng)
+{
+	int ret;
+	uint8_t outbuf[CHACHA20_KEY_SIZE * 2] __aligned(sizeof(uint32_t));
+	uint8_t seed[CHACHA20_KEY_SIZE * 2] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+		0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+		0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+		0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+		0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	};
+
+	/*
+	 * Expected result when ChaCha20 DRNG state is zero:
+	 *	* constants are set to "expand 32-byte k"
+	 *	* remaining state is 0
+	 * and pulling one ChaCha20 DRNG block.
+	 */
+	static const uint8_t expected_block[CHACHA20_KEY_SIZE] = {
+		0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90,
+		0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+		0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a,
+		0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7 };
+
+	/*
 	 * Expected result when ChaCha20 DRNG state is zero:
 	 *	* constants are set to "expand 32-byte k"
 	 *	* remaining state is 0
@@ -647,36 +1372,12 @@ static int drng_chacha20_rng_selftest(struct chacha20_drng *drng)
 
 static void drng_chacha20_dealloc(struct chacha20_drng *drng)
 {
-	memset_secure(drng, 0, sizeof(*drng));
-	free(drng);
+	drng_state_free(drng, sizeof(*drng));
 }
 
-/**
- * Allocation of the DRBG state
- */
-static int drng_chacha20_alloc(struct chacha20_drng **out)
+/* Fresh state with the ChaCha20 constants */
+static void drng_chacha20_state_init(struct chacha20_drng *drng)
 {
-	struct chacha20_drng *drng;
-	uint32_t i, v = 0;
-	int ret = 0;
-
-	if (drng_chacha20_selftest()) {
-		return -EFAULT;
-	}
-
-	ret = posix_memalign((void *)&drng, CHACHA20_DRNG_ALIGNMENT,
-			     sizeof(*drng));
-	if (ret) {
-		return -ret;
-	}
-
-	/* prevent paging out of the memory state to swap space */
-	ret = mlock(drng, sizeof(*drng));
-	if (ret && errno != EPERM && errno != EAGAIN) {
-		ret = -errno;
-		goto err;
-	}
-
 	memset(drng, 0, sizeof(*drng));
 
 	/* String "expand 32-byte k" */
@@ -684,12 +1385,13 @@ static int drng_chacha20_alloc(struct chacha20_drng **out)
 	drng->chacha20.constants[1] = 0x3320646e;
 	drng->chacha20.constants[2] = 0x79622d32;
 	drng->chacha20.constants[3] = 0x6b206574;
+}
 
-	ret = drng_chacha20_rng_selftest(drng);
-	if (ret)
-		goto err;
+/* Update the state with time stamps */
+static void drng_chacha20_state_time(struct chacha20_drng *drng)
+{
+	uint32_t i, v = 0;
 
-	/* Update the state left by the self test */
 	for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++) {
 		get_time(NULL, &v);
 		drng->chacha20.key.u[i] ^= v;
@@ -699,162 +1401,4289 @@ static int drng_chacha20_alloc(struct chacha20_drng **out)
 		get_time(NULL, &v);
 		drng->chacha20.nonce[i] ^= v;
 	}
-
-	*out = drng;
-
-	return 0;
-
-err:
-	drng_chacha20_dealloc(drng);
-	return ret;
 }
 
-/***************************** ChaCha20 DRNG API *****************************/
-
-DSO_PUBLIC
-int drng_chacha20_reseed(struct chacha20_drng *drng, const uint8_t *inbuf,
-			 uint32_t inbuflen)
+/**
+ * Initialization of the DRBG state in allocated memory
+ */
+static int drng_chacha20_setup(struct chacha20_drng *drng)
 {
-	uint8_t seed[CHACHA20_KEY_SIZE * 2];
-	int ret;
-	uint32_t collected = 0;
-
-	/* Entropy assumption: 1 data bit delivers one bit of entropy */
-	ret = drng_getrandom_get(seed, CHACHA20_KEY_SIZE);
-	if (ret < 0)
-		return ret;
+	int ret = 0;
 
+	ret = drng_chacha20_selftest();
+	drng_event(selftest, DRNG_CHACHA20_EVENT_SELFTEST, NULL,
+		   DRNG_CHACHA20_SELFTEST_BLOCK, 0, ret);
 	if (ret) {
-		collected = ret;
-
-		ret = drng_chacha20_seed(&drng->chacha20, seed,
-					 CHACHA20_KEY_SIZE);
-		if (ret)
-			return ret;
+		return -EFAULT;
 	}
 
-	/* Entropy assumption: 2 data bits deliver one bit of entropy */
-	ret = drng_jent_get(seed, sizeof(seed));
-	if (ret < 0)
+	drng_chacha20_state_init(drng);
+
+	ret = drng_chacha20_rng_selftest(drng);
+	drng_event(selftest, DRNG_CHACHA20_EVENT_SELFTEST, NULL,
+		   DRNG_CHACHA20_SELFTEST_DRNG, 0, ret);
+	if (ret)
 		return ret;
 
-	if (ret) {
-		collected += ret;
+	/* Update the state left by the self test */
+	drng_chacha20_state_time(drng);
 
-		ret = drng_chacha20_seed(&drng->chacha20, seed, sizeof(seed));
-		if (ret)
-			return ret;
-	}
+	pthread_once(&drng_fork_once, drng_fork_register);
+	drng->fork_gen = drng_fork_gen;
 
-	/* Entropy assumption: 1 data bit delivers one bit of entropy */
-	ret = drng_random_get(seed, CHACHA20_KEY_SIZE);
-	if (ret < 0)
-		return ret;
+	drng_seed_sources_get();
 
-	if (ret) {
-		collected += ret;
+	return 0;
+}
 
-		ret = drng_chacha20_seed(&drng->chacha20, seed,
-					 CHACHA20_KEY_SIZE);
-		if (ret)
-			return ret;
-	}
+/**
+ * Allocation of the DRBG state
+ */
+static int drng_chacha20_alloc(struct chacha20_drng **out)
+{
+	struct chacha20_drng *drng;
+	int ret = 0;
 
-	memset_secure(seed, 0, sizeof(seed));
+	drng = drng_state_alloc(sizeof(*drng));
+	if (!drng)
+		return -errno;
 
-	/* Internal noise sources must have delivered sufficient information */
-	if (collected < CHACHA20_KEY_SIZE)
-		return -EFAULT;
+	ret = drng_chacha20_setup(drng);
+	if (ret)
+		goto err;
 
-	if (inbuf && inbuflen)
-		ret = drng_chacha20_seed(&drng->chacha20, inbuf, inbuflen);
+	*out = drng;
 
-	get_time(&drng->last_seeded, NULL);
-	drng->generated_bytes = 0;
+	return 0;
 
+err:
+	drng_chacha20_dealloc(drng);
 	return ret;
 }
 
-DSO_PUBLIC
-void drng_chacha20_destroy(struct chacha20_drng *drng)
+static int drng_chacha20_reseed_reason(struct chacha20_drng *drng,
+				       const uint8_t *inbuf, uint32_t inbuflen,
+				       enum drng_reseed_reason reason,
+				       int nonblock);
+
+/*
+ * Reseed if:
+ *	* last seeding was more than 600 seconds ago
+ *	* more than 1<<30 bytes were generated since last reseed
+ */
+static inline enum drng_reseed_reason
+drng_chacha20_reseed_due(struct chacha20_drng *drng, time_t now)
 {
-	drng_jent_dealloc();
-	drng_random_dealloc();
-	drng_chacha20_dealloc(drng);
+	if ((now - drng->last_seeded) > 600)
+		return DRNG_RESEED_TIME;
+	if (drng->generated_bytes > (1<<30))
+		return DRNG_RESEED_BYTES;
+	return DRNG_RESEED_NONE;
 }
 
-DSO_PUBLIC
-int drng_chacha20_init(struct chacha20_drng **drng)
+/*
+ * Perform a due reseed within the deadline. The reseed is deferred if its
+ * expected duration does not fit into the deadline or if the seed sources
+ * cannot deliver data without blocking. A deferral is only possible up to the
+ * hard limits, beyond them the caller gets -EAGAIN.
+ *
+ * @return 0 if reseeded, DRNG_CHACHA20_RESEED_DEFERRED if deferred, < 0 on
+ *	   error
+ */
+static int drng_chacha20_reseed_deadline(struct chacha20_drng *drng,
+					 const uint8_t *inbuf,
+					 uint32_t inbuflen,
+					 enum drng_reseed_reason reason,
+					 time_t now, uint64_t deadline_ns)
 {
-	int ret = drng_chacha20_alloc(drng);
-
-	if (ret)
-		return ret;
+	int ret, may_defer;
+
+	if (deadline_ns == DRNG_NO_DEADLINE)
+		return drng_chacha20_reseed_reason(drng, inbuf, inbuflen,
+						   reason, 0);
+
+	may_defer = ((now - drng->last_seeded) <= DRNG_DEFER_MAX_SECONDS &&
+		     drng->generated_bytes <= DRNG_DEFER_MAX_BYTES);
+
+	if (drng_time_ns() + drng->reseed_ns > deadline_ns) {
+		if (!may_defer)
+			return -EAGAIN;
+		/*
+		 * Let the estimate decay slowly so that a single slow reseed
+		 * does not prevent all further reseed attempts.
+		 */
+		drng->reseed_ns -= drng->reseed_ns >> 6;
+		drng_stats_add(drng, reseeds_deferred, 1);
+		return DRNG_CHACHA20_RESEED_DEFERRED;
+	}
 
-	ret = drng_chacha20_reseed(*drng, NULL, 0);
-	if (ret) {
-		drng_chacha20_destroy(*drng);
-		return ret;
+	ret = drng_chacha20_reseed_reason(drng, inbuf, inbuflen, reason, 1);
+	if (ret < 0 && may_defer) {
+		drng_stats_add(drng, reseeds_deferred, 1);
+		return DRNG_CHACHA20_RESEED_DEFERRED;
 	}
 
-	return 0;
+	return ret;
 }
 
-DSO_PUBLIC
-int drng_chacha20_get(struct chacha20_drng *drng, uint8_t *outbuf,
-		      uint32_t outbuflen)
+static int drng_prefetch_reseed(struct chacha20_drng *drng);
+
+/*
+ * Due reseed and time stamp seeding preceding each generation. A reseed is
+ * handed on to the refill thread of the prefetch buffers.
+ *
+ * @return 0 or DRNG_CHACHA20_RESEED_DEFERRED upon success, < 0 on error
+ */
+static int drng_chacha20_get_prepare(struct chacha20_drng *drng,
+				     uint64_t deadline_ns)
 {
+	enum drng_reseed_reason reason;
 	time_t now = 0;
 	uint32_t nsec;
-	int ret;
+	int ret, deferred = 0;
 
 	get_time(&now, &nsec);
 
-	/*
-	 * Reseed if:
-	 *	* last seeding was more than 600 seconds ago
-	 *	* more than 1<<30 bytes were generated since last reseed
-	 */
-	if (((now - drng->last_seeded) > 600) ||
-	    (drng->generated_bytes > (1<<30))) {
-		ret = drng_chacha20_reseed(drng, (uint8_t *)&nsec,
-					   sizeof(nsec));
-
-		if (ret)
+	reason = drng_chacha20_reseed_due(drng, now);
+	if (reason) {
+		ret = drng_chacha20_reseed_deadline(drng, (uint8_t *)&nsec,
+						    sizeof(nsec), reason, now,
+						    deadline_ns);
+		if (ret < 0)
 			return ret;
+		deferred = ret;
+	}
+
+	if (reason && !deferred) {
 		drng->last_seeded = now;
 		drng->generated_bytes = 0;
+		if (drng->prefetch) {
+			ret = drng_prefetch_reseed(drng);
+			if (ret)
+				return ret;
+		}
 	} else {
 		ret = drng_chacha20_seed(&drng->chacha20, (uint8_t *)&nsec,
 					 sizeof(nsec));
 		if (ret)
 			return ret;
+		drng_stats_add(drng, blocks,
+			       drng_chacha20_seed_blocks(sizeof(nsec)));
 	}
 
+	return deferred;
+}
+
+/* Generation of random numbers without the prefetch buffers */
+static int drng_chacha20_get_sync(struct chacha20_drng *drng, uint8_t *outbuf,
+				  uint32_t outbuflen, uint64_t deadline_ns)
+{
+	int ret, deferred = drng_chacha20_get_prepare(drng, deadline_ns);
+
+	if (deferred < 0)
+		return deferred;
+
 	ret = drng_chacha20_generate(&drng->chacha20, outbuf, outbuflen);
 	if (ret)
 		return ret;
+	drng_stats_add(drng, blocks, drng_chacha20_generate_blocks(outbuflen));
 
 	drng->generated_bytes += outbuflen;
 
+	return deferred;
+}
+
+/* XOR of random numbers into the caller's buffer from the DRNG state */
+static int drng_chacha20_xor_sync(struct chacha20_drng *drng, uint8_t *inout,
+				  uint32_t len)
+{
+	int ret = drng_chacha20_get_prepare(drng, DRNG_NO_DEADLINE);
+
+	if (ret < 0)
+		return ret;
+
+	ret = drng_chacha20_generate_xor(&drng->chacha20, inout, len);
+	if (ret)
+		return ret;
+	drng_stats_add(drng, blocks, drng_chacha20_generate_blocks(len));
+
+	drng->generated_bytes += len;
+
 	return 0;
 }
 
-DSO_PUBLIC
-int drng_chacha20_versionstring(char *buf, size_t buflen)
+/********************** ChaCha20 DRNG background seeding **********************/
+
+/* Seed of the blocking getrandom, Jitter RNG and /dev/random seed sources */
+#define DRNG_SEEDER_SIZE	(CHACHA20_KEY_SIZE * 4)
+
+enum drng_seeder_state {
+	DRNG_SEEDER_RUNNING,
+	DRNG_SEEDER_DONE,
+	DRNG_SEEDER_ABANDONED,
+};
+
+/*
+ * The seeder thread collects the full seed from the seed sources - waiting
+ * for them as long as necessary - without touching the DRNG state. The
+ * thread owning the handle absorbs the seed at the next use of the handle.
+ * When the handle is destroyed while the seed sources still block, the
+ * thread is detached and releases the seeder itself.
+ */
+struct drng_seeder {
+	pthread_t thread;
+	int efd;		/* readable once the handle is fully seeded */
+	int state;		/* enum drng_seeder_state */
+	int joined;		/* no thread to be joined */
+	int ret;
+	uint32_t len;
+	uint8_t seed[DRNG_SEEDER_SIZE];
+};
+
+static void drng_seeder_dealloc(struct drng_seeder *s)
 {
-	return snprintf(buf, buflen, "ChaCha20 DRNG %d.%d.%d",
-			MAJVERSION, MINVERSION, PATCHLEVEL);
+	if (s->efd >= 0)
+		close(s->efd);
+	drng_mapping_free(s, sizeof(*s));
 }
 
-DSO_PUBLIC
-uint32_t drng_chacha20_version(void)
+static void *drng_seeder_thread(void *arg)
 {
-	uint32_t version = 0;
+	struct drng_seeder *s = arg;
+	uint32_t collected = 0;
+	int ret;
 
-	version =  MAJVERSION * 1000000;
-	version += MINVERSION * 10000;
-	version += PATCHLEVEL * 100;
+	/* Same entropy assumptions as drng_chacha20_reseed_reason */
+	ret = drng_getrandom_get(s->seed, CHACHA20_KEY_SIZE, 0);
+	if (ret > 0)
+		collected += ret;
+	ret = drng_jent_get(s->seed + collected, CHACHA20_KEY_SIZE * 2, 0);
+	if (ret > 0)
+		collected += ret;
+	ret = drng_random_get(s->seed + collected, CHACHA20_KEY_SIZE, 0);
+	if (ret > 0)
+		collected += ret;
+	drng_mapping_set_sources(s, 0);
+	drng_seed_sources_put();
 
-	return version;
+	s->len = collected;
+	s->ret = collected < CHACHA20_KEY_SIZE ? -EFAULT : 0;
+	eventfd_write(s->efd, 1);
+
+	if (__atomic_exchange_n(&s->state, DRNG_SEEDER_DONE,
+				__ATOMIC_ACQ_REL) == DRNG_SEEDER_ABANDONED)
+		drng_seeder_dealloc(s);
+
+	return NULL;
 }
+
+/* Start the seeder thread, the handle is not fully seeded until it is done */
+static int drng_seeder_start(struct chacha20_drng *drng)
+{
+	struct drng_seeder *s;
+	int ret;
+
+	s = drng_mapping_alloc(drng, sizeof(*s));
+	if (!s)
+		return -errno;
+
+	s->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (s->efd < 0) {
+		ret = -errno;
+		drng_seeder_dealloc(s);
+		return ret;
+	}
+	drng_mapping_set_fd(s, s->efd);
+
+	/* The thread keeps the seed sources alive beyond the handle */
+	drng_seed_sources_get();
+	drng_mapping_set_sources(s, 1);
+	ret = -pthread_create(&s->thread, NULL, drng_seeder_thread, s);
+	if (ret) {
+		drng_mapping_set_sources(s, 0);
+		drng_seed_sources_put();
+		drng_seeder_dealloc(s);
+		return ret;
+	}
+
+	drng->seeder = s;
+	drng->seed_pending = 1;
+
+	return 0;
+}
+
+static void drng_seeder_free(struct chacha20_drng *drng)
+{
+	struct drng_seeder *s = drng->seeder;
+
+	if (!s)
+		return;
+
+	drng->seeder = NULL;
+	drng->seed_pending = 0;
+	drng_mapping_abandon(s);
+	if (__atomic_exchange_n(&s->state, DRNG_SEEDER_ABANDONED,
+				__ATOMIC_ACQ_REL) == DRNG_SEEDER_RUNNING) {
+		/* The seed sources may block indefinitely */
+		pthread_detach(s->thread);
+		return;
+	}
+
+	if (!s->joined)
+		pthread_join(s->thread, NULL);
+	drng_seeder_dealloc(s);
+}
+
+/*
+ * The seeder thread of the parent does not exist in a child process, its
+ * seed source reference is dropped by drng_fork_child.
+ */
+static void drng_seeder_fork(struct chacha20_drng *drng)
+{
+	struct drng_seeder *s = drng->seeder;
+
+	if (!s)
+		return;
+
+	drng->seeder = NULL;
+	drng->seed_pending = 0;
+	drng_seeder_dealloc(s);
+}
+
+/********************* ChaCha20 DRNG borrowed random numbers ******************/
+
+/*
+ * Random numbers handed out by drng_chacha20_borrow without copying them. The
+ * consumed part of the buffer is wiped. The buffer resides in MADV_WIPEONFORK
+ * memory like the handle.
+ */
+struct drng_borrow {
+	uint8_t buf[DRNG_CHACHA20_BORROW_SIZE];
+	uint32_t pos;		/* offset of the first unconsumed byte */
+};
+
+/*
+ * Random numbers generated before a reseed of the handle must not be used:
+ * the buffer and the bit reservoir filled from it are wiped.
+ */
+static void drng_borrow_discard(struct chacha20_drng *drng)
+{
+	struct drng_borrow *b = drng->borrow;
+
+	memset_secure(&drng->bits, 0, sizeof(drng->bits));
+
+	if (!b)
+		return;
+
+	memset_secure(b->buf + b->pos, 0, sizeof(b->buf) - b->pos);
+	b->pos = sizeof(b->buf);
+}
+
+static void drng_borrow_free(struct chacha20_drng *drng)
+{
+	if (!drng->borrow)
+		return;
+
+	drng_mapping_free(drng->borrow, sizeof(*drng->borrow));
+	drng->borrow = NULL;
+}
+
+/************************ ChaCha20 DRNG prefetch thread ***********************/
+
+#define DRNG_PREFETCH_MAX_BUFSIZE	(1<<26)
+
+/*
+ * The refill thread owns a ChaCha20 state of its own that is seeded from the
+ * DRNG handle. It fills whichever of the two buffers is empty. After each
+ * buffer the state is updated (i.e. the key is rotated) by
+ * drng_chacha20_generate.
+ *
+ * The consumer side and the refill thread synchronize on the lock only to
+ * exchange the fill state of the buffers - the keystream generation and the
+ * copying of the data happen outside of the lock, because a buffer is either
+ * owned by the refill thread (fill == 0) or by the consumer (fill > 0).
+ */
+struct drng_prefetch {
+	struct chacha20_state chacha20;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t *buf[2];
+	uint32_t fill[2];	/* bytes available in buffer, 0 if empty */
+	uint32_t pos;		/* consumer read position in buf[cur] */
+	uint32_t cur;		/* buffer read by consumer */
+	uint32_t bufsize;
+	uint32_t epoch;		/* incremented when buffers are discarded */
+	uint8_t seed[CHACHA20_KEY_SIZE];
+	int seed_pending;
+	enum drng_reseed_reason reseed_due;	/* only accessed by consumer */
+	int stop;
+	uint64_t underruns;
+};
+
+static void drng_prefetch_dealloc(struct drng_prefetch *pf)
+{
+	unsigned int i;
+
+	for (i = 0; i < 2; i++) {
+		if (pf->buf[i])
+			drng_mapping_free(pf->buf[i], pf->bufsize);
+	}
+
+	drng_mapping_free(pf, sizeof(*pf));
+}
+
+static void *drng_prefetch_thread(void *arg)
+{
+	struct drng_prefetch *pf = arg;
+	uint8_t seed[CHACHA20_KEY_SIZE];
+
+	pthread_mutex_lock(&pf->lock);
+	while (!pf->stop) {
+		uint32_t i, epoch, nsec = 0;
+		int reseed = 0;
+
+		/* Refill the buffer the consumer waits for first */
+		if (!pf->fill[pf->cur])
+			i = pf->cur;
+		else if (!pf->fill[pf->cur ^ 1])
+			i = pf->cur ^ 1;
+		else {
+			pthread_cond_wait(&pf->cond, &pf->lock);
+			continue;
+		}
+
+		if (pf->seed_pending) {
+			memcpy(seed, pf->seed, sizeof(seed));
+			memset_secure(pf->seed, 0, sizeof(pf->seed));
+			pf->seed_pending = 0;
+			reseed = 1;
+		}
+		epoch = pf->epoch;
+		pthread_mutex_unlock(&pf->lock);
+
+		if (reseed) {
+			drng_chacha20_seed(&pf->chacha20, seed, sizeof(seed));
+			memset_secure(seed, 0, sizeof(seed));
+		}
+
+		/* Continuous reseed with a time stamp once per buffer */
+		get_time(NULL, &nsec);
+		drng_chacha20_seed(&pf->chacha20, (uint8_t *)&nsec,
+				   sizeof(nsec));
+		drng_chacha20_generate(&pf->chacha20, pf->buf[i], pf->bufsize);
+
+		pthread_mutex_lock(&pf->lock);
+		/* Data generated before a reseed of the handle is discarded */
+		if (epoch == pf->epoch)
+			pf->fill[i] = pf->bufsize;
+		else
+			memset_secure(pf->buf[i], 0, pf->bufsize);
+	}
+	pthread_mutex_unlock(&pf->lock);
+
+	memset_secure(seed, 0, sizeof(seed));
+
+	return NULL;
+}
+
+/*
+ * Hand new key material from the handle to the refill thread and discard the
+ * prefetched data. This is invoked after the handle was reseeded.
+ */
+static int drng_prefetch_reseed(struct chacha20_drng *drng)
+{
+	struct drng_prefetch *pf = drng->prefetch;
+	int ret;
+
+	pthread_mutex_lock(&pf->lock);
+	ret = drng_chacha20_generate(&drng->chacha20, pf->seed,
+				     sizeof(pf->seed));
+	drng_stats_add(drng, blocks,
+		       drng_chacha20_generate_blocks(sizeof(pf->seed)));
+	if (!ret) {
+		pf->seed_pending = 1;
+		pf->epoch++;
+		pf->reseed_due = DRNG_RESEED_NONE;
+		memset_secure(pf->buf[0], 0, pf->fill[0]);
+		memset_secure(pf->buf[1], 0, pf->fill[1]);
+		pf->fill[0] = pf->fill[1] = 0;
+		pf->pos = 0;
+		pthread_cond_signal(&pf->cond);
+	}
+	pthread_mutex_unlock(&pf->lock);
+
+	return ret;
+}
+
+static int drng_prefetch_get(struct chacha20_drng *drng, uint8_t *outbuf,
+			     uint32_t outbuflen, uint64_t deadline_ns)
+{
+	struct drng_prefetch *pf = drng->prefetch;
+	time_t now = 0;
+	uint32_t len = outbuflen;
+	int ret, deferred = 0;
+
+	/* Enforce the reseed thresholds of the handle */
+	if (pf->reseed_due) {
+		get_time(&now, NULL);
+		ret = drng_chacha20_reseed_deadline(drng, NULL, 0,
+						    pf->reseed_due, now,
+						    deadline_ns);
+		if (ret < 0)
+			return ret;
+		deferred = ret;
+		if (!deferred) {
+			ret = drng_prefetch_reseed(drng);
+			if (ret)
+				return ret;
+			pf->reseed_due = DRNG_RESEED_NONE;
+		}
+	}
+
+	pthread_mutex_lock(&pf->lock);
+	while (len) {
+		uint32_t todo;
+
+		if (pf->pos == pf->fill[pf->cur]) {
+			/* Current buffer is exhausted: hand it to the thread */
+			if (pf->fill[pf->cur]) {
+				pf->fill[pf->cur] = 0;
+				pthread_cond_signal(&pf->cond);
+			}
+			pf->pos = 0;
+			if (!pf->fill[pf->cur ^ 1])
+				break;
+			pf->cur ^= 1;
+
+			/*
+			 * The reseed thresholds are checked once per buffer to
+			 * keep the time stamp off the fast path.
+			 */
+			drng->generated_bytes += pf->bufsize;
+			get_time(&now, NULL);
+			if (!pf->reseed_due)
+				pf->reseed_due =
+					drng_chacha20_reseed_due(drng, now);
+		}
+
+		todo = min(len, pf->fill[pf->cur] - pf->pos);
+		pthread_mutex_unlock(&pf->lock);
+
+		/* The consumer owns buf[cur] while fill[cur] > 0 */
+		memcpy(outbuf, pf->buf[pf->cur] + pf->pos, todo);
+		memset_secure(pf->buf[pf->cur] + pf->pos, 0, todo);
+		outbuf += todo;
+		len -= todo;
+
+		pthread_mutex_lock(&pf->lock);
+		pf->pos += todo;
+	}
+	pthread_mutex_unlock(&pf->lock);
+
+	if (!len)
+		return deferred;
+
+	/* Underrun: generate the remainder synchronously */
+	pf->underruns++;
+	ret = drng_chacha20_get_sync(drng, outbuf, len, deadline_ns);
+	if (ret < 0)
+		return ret;
+
+	return deferred | ret;
+}
+
+static void drng_prefetch_free(struct chacha20_drng *drng)
+{
+	struct drng_prefetch *pf = drng->prefetch;
+
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->stop = 1;
+	pthread_cond_signal(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+	pthread_join(pf->thread, NULL);
+
+	pthread_cond_destroy(&pf->cond);
+	pthread_mutex_destroy(&pf->lock);
+	drng->prefetch = NULL;
+	drng_prefetch_dealloc(pf);
+}
+
+/*
+ * Replace the state inherited from the parent process by a newly seeded one.
+ * The prefetch and seeder threads do not exist in the child. Their memory
+ * and the borrow buffer are released via the handle if it was not wiped by
+ * the kernel, otherwise via the list of mappings.
+ */
+static int drng_chacha20_fork_reset(struct chacha20_drng *drng)
+{
+	struct drng_prefetch *pf = drng->prefetch;
+	int ret;
+
+	if (pf)
+		drng_prefetch_dealloc(pf);
+	drng_seeder_fork(drng);
+	drng_borrow_free(drng);
+	drng_mapping_fork(drng);
+
+	drng_chacha20_state_init(drng);
+	drng_chacha20_state_time(drng);
+
+	ret = drng_chacha20_reseed_reason(drng, NULL, 0, DRNG_RESEED_FORK, 0);
+	if (ret)
+		return ret;
+
+	drng->fork_gen = drng_fork_gen;
+
+	return 0;
+}
+
+/* Single load and compare in the steady state */
+static inline int drng_fork_check(struct chacha20_drng *drng)
+{
+	if (__builtin_expect(drng->fork_gen !=
+			     __atomic_load_n(&drng_fork_gen, __ATOMIC_RELAXED),
+			     0))
+		return drng_chacha20_fork_reset(drng);
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_prefetch_enable(struct chacha20_drng *drng, uint32_t bufsize,
+				  int cpu)
+{
+	struct drng_prefetch *pf;
+	pthread_attr_t attr;
+	unsigned int i;
+	int ret;
+
+	ret = drng_fork_check(drng);
+	if (ret)
+		return ret;
+	if (drng->prefetch)
+		return -EBUSY;
+	if (!bufsize || bufsize > DRNG_PREFETCH_MAX_BUFSIZE)
+		return -EINVAL;
+	if (cpu >= CPU_SETSIZE)
+		return -EINVAL;
+
+	/* Round up to full ChaCha20 blocks */
+	bufsize = (bufsize + CHACHA20_BLOCK_SIZE - 1) &
+		  ~(CHACHA20_BLOCK_SIZE - 1);
+
+	/* The prefetched random numbers must not be inherited by a child */
+	pf = drng_mapping_alloc(drng, sizeof(*pf));
+	if (!pf)
+		return -errno;
+	pf->bufsize = bufsize;
+
+	for (i = 0; i < 2; i++) {
+		pf->buf[i] = drng_mapping_alloc(drng, bufsize);
+		if (!pf->buf[i]) {
+			ret = -errno;
+			drng_prefetch_dealloc(pf);
+			return ret;
+		}
+	}
+
+	/* The state of the refill thread is derived from the handle */
+	memcpy(pf->chacha20.constants, drng->chacha20.constants,
+	       sizeof(pf->chacha20.constants));
+	ret = drng_chacha20_get_sync(drng, pf->seed, sizeof(pf->seed),
+				     DRNG_NO_DEADLINE);
+	if (ret) {
+		drng_prefetch_dealloc(pf);
+		return ret;
+	}
+	pf->seed_pending = 1;
+
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+
+	pthread_attr_init(&attr);
+	if (cpu >= 0) {
+		cpu_set_t cpuset;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu, &cpuset);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+	}
+	ret = -pthread_create(&pf->thread, &attr, drng_prefetch_thread, pf);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		pthread_cond_destroy(&pf->cond);
+		pthread_mutex_destroy(&pf->lock);
+		drng_prefetch_dealloc(pf);
+		return ret;
+	}
+
+	drng->prefetch = pf;
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_prefetch_disable(struct chacha20_drng *drng)
+{
+	drng_prefetch_free(drng);
+}
+
+DSO_PUBLIC
+uint64_t drng_chacha20_prefetch_underruns(struct chacha20_drng *drng)
+{
+	return drng->prefetch ? drng->prefetch->underruns : 0;
+}
+
+/************************** ChaCha20 DRNG children ****************************/
+
+#define DRNG_CHILD_MAX_BYTES	(1<<30)
+
+/* struct chacha20_drng_child must be able to hold a ChaCha20 state */
+typedef char drng_child_state_size_check[
+	(sizeof(((struct chacha20_drng_child *)0)->state) ==
+	 sizeof(struct chacha20_state)) ? 1 : -1];
+
+static inline struct chacha20_state *
+drng_child_state(struct chacha20_drng_child *child)
+{
+	return (struct chacha20_state *)child->state;
+}
+
+/*
+ * Derive the child state with one ChaCha20 block operation. The first
+ * CHACHA20_KEY_SIZE bytes of the block are used as child key, the remainder
+ * updates the parent state.
+ */
+static void drng_chacha20_split_state(struct chacha20_state *parent,
+				      struct chacha20_drng_child *child)
+{
+	struct chacha20_state *c = drng_child_state(child);
+	uint32_t i, tmp[CHACHA20_BLOCK_SIZE_WORDS];
+
+	chacha20_block(&parent->constants[0], tmp);
+
+	memcpy(c->constants, parent->constants, sizeof(c->constants));
+	for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++)
+		c->key.u[i] = le_bswap32(tmp[i]);
+	c->counter = 0;
+	c->nonce[0] = c->nonce[1] = c->nonce[2] = 0;
+	child->generated_bytes = 0;
+
+	drng_chacha20_update(parent, tmp, CHACHA20_KEY_SIZE_WORDS);
+	memset_secure(tmp, 0, sizeof(tmp));
+}
+
+DSO_PUBLIC
+int drng_chacha20_split(struct chacha20_drng *parent,
+			struct chacha20_drng_child *child)
+{
+	int ret = drng_fork_check(parent);
+
+	if (ret)
+		return ret;
+
+	drng_chacha20_split_state(&parent->chacha20, child);
+	parent->generated_bytes += CHACHA20_BLOCK_SIZE;
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_child_split(struct chacha20_drng_child *parent,
+			      struct chacha20_drng_child *child)
+{
+	if (parent->generated_bytes > DRNG_CHILD_MAX_BYTES)
+		return -EAGAIN;
+
+	drng_chacha20_split_state(drng_child_state(parent), child);
+	parent->generated_bytes += CHACHA20_BLOCK_SIZE;
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_child_get(struct chacha20_drng_child *child,
+			    uint8_t *outbuf, uint32_t outbuflen)
+{
+	int ret;
+
+	if (child->generated_bytes > DRNG_CHILD_MAX_BYTES)
+		return -EAGAIN;
+
+	ret = drng_chacha20_generate(drng_child_state(child), outbuf,
+				     outbuflen);
+	if (ret)
+		return ret;
+
+	child->generated_bytes += outbuflen;
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_child_zero(struct chacha20_drng_child *child)
+{
+	memset_secure(child, 0, sizeof(*child));
+}
+
+/******************** ChaCha20 deterministic stream mode *********************/
+
+#define DRNG_DET_MAGIC		0x44455432	/* "DET2" */
+
+/*
+ * The state words 12 and 13 hold the 64 bit block counter: chacha20.counter
+ * is the lower and chacha20.nonce[0] the upper half. The words 14 and 15
+ * hold the stream identifier.
+ */
+struct chacha20_drng_det {
+	struct chacha20_state chacha20;
+	uint32_t keystream[CHACHA20_BLOCK_SIZE_WORDS];
+	uint64_t keystream_block;	/* block held in keystream */
+	int keystream_valid;
+	uint64_t block;			/* block of the next byte */
+	uint32_t pos;			/* offset of next byte in block */
+};
+
+static inline uint32_t drng_det_load_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void drng_det_store_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static void drng_det_setkey(struct chacha20_drng_det *det, const uint8_t *key,
+			    uint64_t stream)
+{
+	uint32_t i;
+
+	/* String "expand 32-byte k" */
+	det->chacha20.constants[0] = 0x61707865;
+	det->chacha20.constants[1] = 0x3320646e;
+	det->chacha20.constants[2] = 0x79622d32;
+	det->chacha20.constants[3] = 0x6b206574;
+
+	for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++)
+		det->chacha20.key.u[i] = drng_det_load_le32(key + i * 4);
+
+	det->chacha20.nonce[1] = (uint32_t)stream;
+	det->chacha20.nonce[2] = (uint32_t)(stream >> 32);
+	det->keystream_valid = 0;
+}
+
+/* Generate the key stream block with the given 64 bit block number */
+static inline void drng_det_block(struct chacha20_drng_det *det,
+				  uint64_t block, uint32_t *out)
+{
+	det->chacha20.counter = (uint32_t)block;
+	det->chacha20.nonce[0] = (uint32_t)(block >> 32);
+	chacha20_block(&det->chacha20.constants[0], out);
+}
+
+/* Known-answer test using RFC 7539 section 2.3.2 in the 64 bit layout */
+static int drng_det_selftest(struct chacha20_drng_det *det)
+{
+	static const uint8_t key[CHACHA20_KEY_SIZE] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f };
+	static const uint8_t expected[CHACHA20_BLOCK_SIZE] = {
+		0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+		0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+		0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+		0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+		0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+		0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+		0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+		0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e };
+	uint32_t result[CHACHA20_BLOCK_SIZE_WORDS];
+	int ret;
+
+	/* RFC counter 1 and nonce 09000000 4a000000 00000000 */
+	drng_det_setkey(det, key, 0x4a000000);
+	drng_det_block(det, (0x09000000ULL << 32) | 1, result);
+
+	ret = memcmp(result, expected, sizeof(expected));
+	memset_secure(result, 0, sizeof(result));
+
+	return ret ? -EFAULT : 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_det_init(struct chacha20_drng_det **det, const uint8_t *key,
+			   uint32_t keylen, uint64_t stream)
+{
+	struct chacha20_drng_det *d;
+	int ret;
+
+	if (!key || keylen != CHACHA20_KEY_SIZE)
+		return -EINVAL;
+
+	ret = drng_chacha20_selftest();
+	drng_event(selftest, DRNG_CHACHA20_EVENT_SELFTEST, NULL,
+		   DRNG_CHACHA20_SELFTEST_BLOCK, 0, ret);
+	if (ret)
+		return -EFAULT;
+
+	ret = posix_memalign((void *)&d, CHACHA20_DRNG_ALIGNMENT, sizeof(*d));
+	if (ret)
+		return -ret;
+
+	/* prevent paging out of the key to swap space */
+	ret = mlock(d, sizeof(*d));
+	if (ret && errno != EPERM && errno != EAGAIN) {
+		ret = -errno;
+		free(d);
+		return ret;
+	}
+
+	memset(d, 0, sizeof(*d));
+
+	ret = drng_det_selftest(d);
+	drng_event(selftest, DRNG_CHACHA20_EVENT_SELFTEST, NULL,
+		   DRNG_CHACHA20_SELFTEST_DET, 0, ret);
+	if (ret) {
+		drng_chacha20_det_destroy(d);
+		return ret;
+	}
+
+	drng_det_setkey(d, key, stream);
+	d->block = 0;
+	d->pos = 0;
+
+	*det = d;
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_det_destroy(struct chacha20_drng_det *det)
+{
+	if (!det)
+		return;
+
+	memset_secure(det, 0, sizeof(*det));
+	free(det);
+}
+
+DSO_PUBLIC
+int drng_chacha20_det_get(struct chacha20_drng_det *det, uint8_t *outbuf,
+			  uint32_t outbuflen)
+{
+	while (outbuflen) {
+		uint32_t todo;
+
+		if (det->pos || outbuflen < CHACHA20_BLOCK_SIZE) {
+			/* Partial block: serve from the cached block */
+			if (!det->keystream_valid ||
+			    det->keystream_block != det->block) {
+				drng_det_block(det, det->block,
+					       det->keystream);
+				det->keystream_block = det->block;
+				det->keystream_valid = 1;
+			}
+
+			todo = min(outbuflen, CHACHA20_BLOCK_SIZE - det->pos);
+			memcpy(outbuf, (uint8_t *)det->keystream + det->pos,
+			       todo);
+			det->pos += todo;
+			if (det->pos == CHACHA20_BLOCK_SIZE) {
+				det->pos = 0;
+				det->block++;
+			}
+		} else {
+			/* Full blocks are written directly when aligned */
+			if ((unsigned long)outbuf &
+			    (sizeof(det->keystream[0]) - 1)) {
+				drng_det_block(det, det->block,
+					       det->keystream);
+				det->keystream_block = det->block;
+				det->keystream_valid = 1;
+				memcpy(outbuf, det->keystream,
+				       CHACHA20_BLOCK_SIZE);
+			} else {
+				drng_det_block(det, det->block,
+					       (uint32_t *)outbuf);
+			}
+			todo = CHACHA20_BLOCK_SIZE;
+			det->block++;
+		}
+
+		outbuf += todo;
+		outbuflen -= todo;
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_det_xor(struct chacha20_drng_det *det, uint8_t *inout,
+			  uint32_t len)
+{
+	while (len) {
+		uint32_t todo;
+
+		if (det->pos || len < CHACHA20_BLOCK_SIZE ||
+		    ((unsigned long)inout & (sizeof(det->keystream[0]) - 1))) {
+			/* Partial or unaligned block: XOR the cached block */
+			if (!det->keystream_valid ||
+			    det->keystream_block != det->block) {
+				drng_det_block(det, det->block,
+					       det->keystream);
+				det->keystream_block = det->block;
+				det->keystream_valid = 1;
+			}
+
+			todo = min(len, CHACHA20_BLOCK_SIZE - det->pos);
+			xor_bytes(inout, (uint8_t *)det->keystream + det->pos,
+				  todo);
+			det->pos += todo;
+			if (det->pos == CHACHA20_BLOCK_SIZE) {
+				det->pos = 0;
+				det->block++;
+			}
+		} else {
+			/* Aligned full blocks are XORed by the block function */
+			det->chacha20.counter = (uint32_t)det->block;
+			det->chacha20.nonce[0] = (uint32_t)(det->block >> 32);
+			chacha20_block_xor(&det->chacha20.constants[0],
+					   (uint32_t *)inout);
+			todo = CHACHA20_BLOCK_SIZE;
+			det->block++;
+		}
+
+		inout += todo;
+		len -= todo;
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_det_seek(struct chacha20_drng_det *det, uint64_t offset)
+{
+	det->block = offset / CHACHA20_BLOCK_SIZE;
+	det->pos = (uint32_t)(offset % CHACHA20_BLOCK_SIZE);
+}
+
+DSO_PUBLIC
+uint64_t drng_chacha20_det_tell(struct chacha20_drng_det *det)
+{
+	return det->block * CHACHA20_BLOCK_SIZE + det->pos;
+}
+
+/*
+ * State format (all integers in little endian):
+ *	magic (4) | key (32) | stream (8) | block (8) | pos (4)
+ */
+DSO_PUBLIC
+void drng_chacha20_det_save(struct chacha20_drng_det *det,
+			    uint8_t state[DRNG_CHACHA20_DET_STATELEN])
+{
+	uint32_t i;
+
+	drng_det_store_le32(state, DRNG_DET_MAGIC);
+	for (i = 0; i < CHACHA20_KEY_SIZE_WORDS; i++)
+		drng_det_store_le32(state + 4 + i * 4, det->chacha20.key.u[i]);
+	drng_det_store_le32(state + 36, det->chacha20.nonce[1]);
+	drng_det_store_le32(state + 40, det->chacha20.nonce[2]);
+	drng_det_store_le32(state + 44, (uint32_t)det->block);
+	drng_det_store_le32(state + 48, (uint32_t)(det->block >> 32));
+	drng_det_store_le32(state + 52, det->pos);
+}
+
+DSO_PUBLIC
+int drng_chacha20_det_restore(struct chacha20_drng_det *det,
+			      const uint8_t state[DRNG_CHACHA20_DET_STATELEN])
+{
+	uint32_t pos = drng_det_load_le32(state + 52);
+
+	if (drng_det_load_le32(state) != DRNG_DET_MAGIC ||
+	    pos >= CHACHA20_BLOCK_SIZE)
+		return -EINVAL;
+
+	drng_det_setkey(det, state + 4,
+			(uint64_t)drng_det_load_le32(state + 36) |
+			((uint64_t)drng_det_load_le32(state + 40) << 32));
+	det->block = (uint64_t)drng_det_load_le32(state + 44) |
+		     ((uint64_t)drng_det_load_le32(state + 48) << 32);
+	det->pos = pos;
+
+	return 0;
+}
+
+/***************************** ChaCha20 DRNG API *****************************/
+
+/* Obtain data from one seed source and inject it into the DRNG state */
+static int drng_chacha20_seed_source(struct chacha20_drng *drng,
+				     int (*get)(uint8_t *buf, uint32_t buflen,
+						int nonblock),
+				     unsigned int source, uint8_t *seed,
+				     uint32_t seedlen, int nonblock)
+{
+	uint64_t start = drng_stats_time();
+	int ret = get(seed, seedlen, nonblock);
+
+	drng_stats_add(drng, source_ns[source], drng_stats_time() - start);
+	drng_event(seed__source, DRNG_CHACHA20_EVENT_SEED_SOURCE, drng, source,
+		   ret > 0 ? (uint32_t)ret : 0, ret < 0 ? ret : 0);
+	if (ret <= 0)
+		return ret;
+
+	drng_stats_add(drng, source_bytes[source], ret);
+	drng_stats_add(drng, blocks, drng_chacha20_seed_blocks(seedlen));
+
+	if (drng_chacha20_seed(&drng->chacha20, seed, seedlen))
+		return -EFAULT;
+
+	return ret;
+}
+
+static int drng_chacha20_reseed_reason(struct chacha20_drng *drng,
+				       const uint8_t *inbuf, uint32_t inbuflen,
+				       enum drng_reseed_reason reason,
+				       int nonblock)
+{
+	uint8_t seed[CHACHA20_KEY_SIZE * 2];
+	uint64_t start = drng_time_ns(), duration;
+	int ret;
+	uint32_t collected = 0;
+
+	drng_event(reseed__start, DRNG_CHACHA20_EVENT_RESEED_START, drng,
+		   reason, 0, 0);
+
+	switch (reason) {
+	case DRNG_RESEED_TIME:
+		drng_stats_add(drng, reseeds_time, 1);
+		break;
+	case DRNG_RESEED_BYTES:
+		drng_stats_add(drng, reseeds_bytes, 1);
+		break;
+	default:
+		drng_stats_add(drng, reseeds_explicit, 1);
+		break;
+	}
+
+	/* Entropy assumption: 1 data bit delivers one bit of entropy */
+	ret = drng_chacha20_seed_source(drng, drng_getrandom_get,
+					DRNG_CHACHA20_SRC_GETRANDOM, seed,
+					CHACHA20_KEY_SIZE, nonblock);
+	if (ret < 0)
+		goto out;
+	collected += ret;
+
+	/* Entropy assumption: 2 data bits deliver one bit of entropy */
+	ret = drng_chacha20_seed_source(drng, drng_jent_get,
+					DRNG_CHACHA20_SRC_JENT, seed,
+					sizeof(seed), nonblock);
+	if (ret < 0)
+		goto out;
+	collected += ret;
+
+	/* Entropy assumption: 1 data bit delivers one bit of entropy */
+	ret = drng_chacha20_seed_source(drng, drng_random_get,
+					DRNG_CHACHA20_SRC_DEVRANDOM, seed,
+					CHACHA20_KEY_SIZE, nonblock);
+	if (ret < 0)
+		goto out;
+	collected += ret;
+
+	/* Internal noise sources must have delivered sufficient information */
+	if (collected < CHACHA20_KEY_SIZE) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = 0;
+	if (inbuf && inbuflen) {
+		ret = drng_chacha20_seed(&drng->chacha20, inbuf, inbuflen);
+		drng_stats_add(drng, blocks,
+			       drng_chacha20_seed_blocks(inbuflen));
+	}
+
+	get_time(&drng->last_seeded, NULL);
+	drng->generated_bytes = 0;
+
+	/* Borrowed data must not survive any reseed, automatic or explicit */
+	drng_borrow_discard(drng);
+
+	/* A full reseed supersedes the seed expected from the seeder */
+	if (drng->seed_pending) {
+		drng->seed_pending = 0;
+		eventfd_write(drng->seeder->efd, 1);
+	}
+
+out:
+	memset_secure(seed, 0, sizeof(seed));
+	if (ret)
+		drng_stats_add(drng, reseed_failures, 1);
+	drng_stats_latency(drng, reseed_latency, start);
+
+	/* Decaying maximum used to decide whether a reseed fits a deadline */
+	duration = drng_time_ns() - start;
+	drng->reseed_ns -= drng->reseed_ns >> 3;
+	if (duration > drng->reseed_ns)
+		drng->reseed_ns = duration;
+
+	drng_event(reseed__end, DRNG_CHACHA20_EVENT_RESEED_END, drng, reason,
+		   0, ret);
+
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_reseed(struct chacha20_drng *drng, const uint8_t *inbuf,
+			 uint32_t inbuflen)
+{
+	int ret = drng_fork_check(drng);
+
+	if (ret)
+		return ret;
+
+	ret = drng_chacha20_reseed_reason(drng, inbuf, inbuflen,
+					  DRNG_RESEED_EXPLICIT, 0);
+
+	/* Prefetched data must not survive a reseed */
+	if (!ret && drng->prefetch)
+		ret = drng_prefetch_reseed(drng);
+
+	return ret;
+}
+
+DSO_PUBLIC
+void drng_chacha20_destroy(struct chacha20_drng *drng)
+{
+	drng_prefetch_free(drng);
+	drng_seeder_free(drng);
+	drng_borrow_free(drng);
+	drng_seed_sources_put();
+	drng_chacha20_dealloc(drng);
+}
+
+DSO_PUBLIC
+int drng_chacha20_init(struct chacha20_drng **drng)
+{
+	int ret = drng_chacha20_alloc(drng);
+
+	if (ret)
+		return ret;
+
+	ret = drng_chacha20_reseed(*drng, NULL, 0);
+	if (ret) {
+		drng_chacha20_destroy(*drng);
+		return ret;
+	}
+
+	return 0;
+}
+
+/****************** ChaCha20 DRNG non-blocking initialization ******************/
+
+/*
+ * Seed data the getrandom system call and /dev/random deliver without
+ * blocking - the Jitter RNG is left to the seeder as its initialization
+ * takes long.
+ *
+ * @return bytes obtained from the seed sources
+ */
+static uint32_t drng_chacha20_seed_nonblock(struct chacha20_drng *drng)
+{
+	uint8_t seed[CHACHA20_KEY_SIZE];
+	uint32_t collected = 0;
+	int ret;
+
+	ret = drng_chacha20_seed_source(drng, drng_getrandom_get,
+					DRNG_CHACHA20_SRC_GETRANDOM, seed,
+					sizeof(seed), 1);
+	if (ret > 0)
+		collected += ret;
+	ret = drng_chacha20_seed_source(drng, drng_random_get,
+					DRNG_CHACHA20_SRC_DEVRANDOM, seed,
+					sizeof(seed), 1);
+	if (ret > 0)
+		collected += ret;
+	memset_secure(seed, 0, sizeof(seed));
+
+	get_time(&drng->last_seeded, NULL);
+	drng->generated_bytes = 0;
+
+	return collected;
+}
+
+/*
+ * Absorb the full seed once the seeder thread is done. A failed seeder leaves
+ * the seed pending until a full reseed succeeds.
+ *
+ * @return 1 if absorbed, 0 if the seeder is still running, < 0 on error
+ */
+static int drng_seeder_complete(struct chacha20_drng *drng)
+{
+	struct drng_seeder *s = drng->seeder;
+	int ret;
+
+	if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != DRNG_SEEDER_DONE)
+		return 0;
+
+	if (!s->joined) {
+		pthread_join(s->thread, NULL);
+		s->joined = 1;
+	}
+	if (s->ret)
+		return s->ret;
+
+	drng_event(reseed__start, DRNG_CHACHA20_EVENT_RESEED_START, drng,
+		   DRNG_RESEED_BACKGROUND, 0, 0);
+	drng_stats_add(drng, reseeds_explicit, 1);
+	drng_stats_add(drng, blocks, drng_chacha20_seed_blocks(s->len));
+	ret = drng_chacha20_seed(&drng->chacha20, s->seed, s->len);
+	memset_secure(s->seed, 0, sizeof(s->seed));
+	if (!ret) {
+		get_time(&drng->last_seeded, NULL);
+		drng->generated_bytes = 0;
+		drng->seed_pending = 0;
+	} else {
+		s->ret = ret;
+	}
+	drng_event(reseed__end, DRNG_CHACHA20_EVENT_RESEED_END, drng,
+		   DRNG_RESEED_BACKGROUND, 0, ret);
+
+	/* Prefetched and borrowed data must not survive a reseed */
+	if (!ret)
+		drng_borrow_discard(drng);
+	if (!ret && drng->prefetch)
+		ret = drng_prefetch_reseed(drng);
+
+	return ret ? ret : 1;
+}
+
+DSO_PUBLIC
+int drng_chacha20_init_nonblock(struct chacha20_drng **drng)
+{
+	int ret = drng_chacha20_alloc(drng);
+
+	if (ret)
+		return ret;
+
+	if (drng_chacha20_seed_nonblock(*drng) >= CHACHA20_KEY_SIZE)
+		return 0;
+
+	ret = drng_seeder_start(*drng);
+	if (ret) {
+		drng_chacha20_destroy(*drng);
+		*drng = NULL;
+	}
+
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_seeded(struct chacha20_drng *drng)
+{
+	int ret = drng_fork_check(drng);
+
+	if (ret)
+		return ret;
+
+	if (!drng->seed_pending)
+		return 1;
+
+	return drng_seeder_complete(drng);
+}
+
+DSO_PUBLIC
+int drng_chacha20_seeded_fd(struct chacha20_drng *drng)
+{
+	struct drng_seeder *s;
+	int ret = drng_fork_check(drng);
+
+	if (ret)
+		return ret;
+	if (drng->seeder)
+		return drng->seeder->efd;
+
+	/* Fully seeded handle: the eventfd is readable right away */
+	s = drng_mapping_alloc(drng, sizeof(*s));
+	if (!s)
+		return -errno;
+	s->state = DRNG_SEEDER_DONE;
+	s->efd = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (s->efd < 0) {
+		ret = -errno;
+		drng_mapping_free(s, sizeof(*s));
+		return ret;
+	}
+	drng_mapping_set_fd(s, s->efd);
+	s->joined = 1;
+	drng->seeder = s;
+
+	return s->efd;
+}
+
+/************************** ChaCha20 DRNG seed file ***************************/
+
+#define DRNG_SEEDFILE_SIZE	(CHACHA20_KEY_SIZE * 2)
+
+/* Read or write the complete seed at the start of the file */
+static int drng_seedfile_io(int fd, uint8_t *seed, int write)
+{
+	uint32_t len = 0;
+	ssize_t ret;
+
+	while (len < DRNG_SEEDFILE_SIZE) {
+		if (write)
+			ret = pwrite(fd, seed + len, DRNG_SEEDFILE_SIZE - len,
+				     len);
+		else
+			ret = pread(fd, seed + len, DRNG_SEEDFILE_SIZE - len,
+				    len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (!ret)
+			break;
+		len += ret;
+	}
+
+	return len;
+}
+
+/* Open and lock the seed file against concurrent readers and writers */
+static int drng_seedfile_open(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+
+	if (fd < 0)
+		return -errno;
+
+	while (flock(fd, LOCK_EX)) {
+		if (errno != EINTR) {
+			int ret = -errno;
+
+			close(fd);
+			return ret;
+		}
+	}
+
+	return fd;
+}
+
+/* Replace the seed file content with new random numbers of the DRNG */
+static int drng_seedfile_store(struct chacha20_drng *drng, int fd)
+{
+	uint8_t seed[DRNG_SEEDFILE_SIZE];
+	int ret;
+
+	ret = drng_chacha20_get_sync(drng, seed, sizeof(seed),
+				     DRNG_NO_DEADLINE);
+	if (ret)
+		goto out;
+
+	ret = drng_seedfile_io(fd, seed, 1);
+	if (ret >= 0 && ret != DRNG_SEEDFILE_SIZE)
+		ret = -EIO;
+	if (ret < 0)
+		goto out;
+
+	ret = 0;
+	if (ftruncate(fd, DRNG_SEEDFILE_SIZE) || fsync(fd))
+		ret = -errno;
+
+out:
+	memset_secure(seed, 0, sizeof(seed));
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_init_seedfile(struct chacha20_drng **drng, const char *path)
+{
+	uint8_t seed[DRNG_SEEDFILE_SIZE];
+	struct chacha20_drng *d;
+	uint32_t collected;
+	int fd, ret, seedfile = 0;
+
+	if (!path)
+		return -EINVAL;
+
+	ret = drng_chacha20_alloc(drng);
+	if (ret)
+		return ret;
+	d = *drng;
+
+	fd = drng_seedfile_open(path);
+	if (fd < 0) {
+		ret = fd;
+		goto err;
+	}
+
+	/* A short or new seed file does not contribute */
+	ret = drng_seedfile_io(fd, seed, 0);
+	if (ret == DRNG_SEEDFILE_SIZE) {
+		ret = drng_chacha20_seed(&d->chacha20, seed, sizeof(seed));
+		if (ret)
+			goto out;
+		drng_stats_add(d, blocks,
+			       drng_chacha20_seed_blocks(sizeof(seed)));
+		seedfile = 1;
+	}
+
+	collected = drng_chacha20_seed_nonblock(d);
+
+	/*
+	 * The seed must never be used twice: the file is overwritten before
+	 * random numbers are handed out. If this is not possible or no seed
+	 * is present at all, the handle is seeded as by drng_chacha20_init.
+	 */
+	ret = (!seedfile && collected < CHACHA20_KEY_SIZE) ? -ENODATA :
+		drng_seedfile_store(d, fd);
+	if (ret) {
+		ret = drng_chacha20_reseed(d, NULL, 0);
+		if (!ret)
+			drng_seedfile_store(d, fd);
+	} else if (collected < CHACHA20_KEY_SIZE) {
+		ret = drng_seeder_start(d);
+	}
+
+out:
+	memset_secure(seed, 0, sizeof(seed));
+	close(fd);
+	if (!ret)
+		return 0;
+err:
+	drng_chacha20_destroy(d);
+	*drng = NULL;
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_seedfile_write(struct chacha20_drng *drng, const char *path)
+{
+	int fd, ret;
+
+	if (!path)
+		return -EINVAL;
+
+	ret = drng_fork_check(drng);
+	if (ret)
+		return ret;
+
+	fd = drng_seedfile_open(path);
+	if (fd < 0)
+		return fd;
+
+	ret = drng_seedfile_store(drng, fd);
+	close(fd);
+
+	return ret;
+}
+
+/* With xor set, the random numbers are XORed into outbuf */
+static int drng_chacha20_get_common(struct chacha20_drng *drng,
+				    uint8_t *outbuf, uint32_t outbuflen,
+				    uint64_t deadline_ns, int xor)
+{
+	uint64_t start;
+	int ret;
+
+	drng_event(get__entry, DRNG_CHACHA20_EVENT_GET_ENTRY, drng, 0,
+		   outbuflen, 0);
+	start = drng_stats_time();
+
+	ret = drng_fork_check(drng);
+	if (ret)
+		goto out;
+
+	/* Only errors after the seed was absorbed concern the caller */
+	if (__builtin_expect(drng->seed_pending, 0)) {
+		ret = drng_seeder_complete(drng);
+		if (ret < 0 && !drng->seed_pending)
+			goto out;
+	}
+
+	if (xor)
+		ret = drng_chacha20_xor_sync(drng, outbuf, outbuflen);
+	else if (drng->prefetch)
+		ret = drng_prefetch_get(drng, outbuf, outbuflen, deadline_ns);
+	else
+		ret = drng_chacha20_get_sync(drng, outbuf, outbuflen,
+					     deadline_ns);
+
+	if (ret >= 0) {
+		drng_stats_add(drng, get_calls, 1);
+		drng_stats_add(drng, generated_bytes, outbuflen);
+		drng_stats_latency(drng, get_latency, start);
+	}
+
+out:
+	drng_event(get__exit, DRNG_CHACHA20_EVENT_GET_EXIT, drng, 0,
+		   outbuflen, ret);
+
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_get(struct chacha20_drng *drng, uint8_t *outbuf,
+		      uint32_t outbuflen)
+{
+	return drng_chacha20_get_common(drng, outbuf, outbuflen,
+					DRNG_NO_DEADLINE, 0);
+}
+
+DSO_PUBLIC
+int drng_chacha20_get_deadline(struct chacha20_drng *drng, uint8_t *outbuf,
+			       uint32_t outbuflen, uint64_t deadline_ns)
+{
+	/* UINT64_MAX is the internal marker for the absence of a deadline */
+	if (deadline_ns == DRNG_NO_DEADLINE)
+		deadline_ns--;
+
+	return drng_chacha20_get_common(drng, outbuf, outbuflen, deadline_ns,
+					0);
+}
+
+DSO_PUBLIC
+int drng_chacha20_xor(struct chacha20_drng *drng, uint8_t *inout, uint32_t len)
+{
+	return drng_chacha20_get_common(drng, inout, len, DRNG_NO_DEADLINE, 1);
+}
+
+DSO_PUBLIC
+void drng_chacha20_set_event_cb(void (*cb)(const struct drng_chacha20_event *ev,
+					   void *priv),
+				void *priv)
+{
+	__atomic_store_n(&drng_event_priv, priv, __ATOMIC_RELAXED);
+	__atomic_store_n(&drng_event_cb, cb, __ATOMIC_RELEASE);
+}
+
+DSO_PUBLIC
+int drng_chacha20_get_stats(struct chacha20_drng *drng,
+			    struct drng_chacha20_stats *stats)
+{
+#ifdef STATISTICS
+	memcpy(stats, &drng->stats, sizeof(*stats));
+	return 0;
+#else
+	(void)drng;
+	(void)stats;
+	return -EOPNOTSUPP;
+#endif
+}
+
+DSO_PUBLIC
+int drng_chacha20_versionstring(char *buf, size_t buflen)
+{
+	return snprintf(buf, buflen, "ChaCha20 DRNG %d.%d.%d",
+			MAJVERSION, MINVERSION, PATCHLEVEL);
+}
+
+DSO_PUBLIC
+uint32_t drng_chacha20_version(void)
+{
+	uint32_t version = 0;
+
+	version =  MAJVERSION * 1000000;
+	version += MINVERSION * 10000;
+	version += PATCHLEVEL * 100;
+
+	return version;
+}
+
+/**************** ChaCha20 DRNG multi-instance generation *******************/
+
+/*
+ * Handles which need more than the time stamp seeding and the generation take
+ * the regular code path: a pending fork reset or background seed, a due
+ * reseed and the prefetch buffers.
+ */
+static inline int drng_multi_direct(struct chacha20_drng *drng, time_t now)
+{
+	return (drng->fork_gen !=
+		__atomic_load_n(&drng_fork_gen, __ATOMIC_RELAXED) ||
+		drng->seed_pending || drng->prefetch ||
+		drng_chacha20_reseed_due(drng, now) != DRNG_RESEED_NONE);
+}
+
+/* Generation for the handles collected in the lanes */
+static void drng_multi_flush(struct chacha20_drng **lanes, uint8_t **outbufs,
+			     uint32_t outbuflen, uint32_t nsec, uint32_t num,
+			     uint64_t start)
+{
+	struct chacha20_state *chacha20[CHACHA20_MULTI_LANES];
+	uint32_t l;
+
+	if (!num)
+		return;
+
+	/* A single handle does not benefit from the vector lanes */
+	if (num == 1) {
+		drng_chacha20_seed(&lanes[0]->chacha20, (uint8_t *)&nsec,
+				   sizeof(nsec));
+		drng_chacha20_generate(&lanes[0]->chacha20, outbufs[0],
+				       outbuflen);
+	} else {
+		for (l = 0; l < num; l++)
+			chacha20[l] = &lanes[l]->chacha20;
+		drng_chacha20_generate_multi(chacha20, outbufs, outbuflen,
+					     nsec, num);
+	}
+
+	for (l = 0; l < num; l++) {
+		struct chacha20_drng *drng = lanes[l];
+
+		drng->generated_bytes += outbuflen;
+		drng_stats_add(drng, blocks,
+			       drng_chacha20_seed_blocks(sizeof(nsec)) +
+			       drng_chacha20_generate_blocks(outbuflen));
+		drng_stats_add(drng, get_calls, 1);
+		drng_stats_add(drng, generated_bytes, outbuflen);
+		drng_stats_latency(drng, get_latency, start);
+		drng_event(get__exit, DRNG_CHACHA20_EVENT_GET_EXIT, drng, 0,
+			   outbuflen, 0);
+	}
+}
+
+DSO_PUBLIC
+int drng_chacha20_get_multi(struct chacha20_drng **drngs, uint8_t **outbufs,
+			    uint32_t outbuflen, uint32_t num)
+{
+	struct chacha20_drng *lanes[CHACHA20_MULTI_LANES];
+	uint8_t *lane_outbufs[CHACHA20_MULTI_LANES];
+	uint64_t start;
+	time_t now = 0;
+	uint32_t i, l, n = 0, nsec;
+	int ret;
+
+	if (!drngs || !outbufs)
+		return -EINVAL;
+
+	/* Requests of more than one block are served by the block loop */
+	if (!outbuflen || outbuflen > CHACHA20_BLOCK_SIZE) {
+		for (i = 0; i < num; i++) {
+			ret = drng_chacha20_get(drngs[i], outbufs[i],
+						outbuflen);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	start = drng_stats_time();
+	get_time(&now, &nsec);
+
+	for (i = 0; i < num; i++) {
+		struct chacha20_drng *drng = drngs[i];
+
+		/* A handle may only occupy one lane at a time */
+		for (l = 0; l < n; l++) {
+			if (lanes[l] == drng) {
+				drng_multi_flush(lanes, lane_outbufs,
+						 outbuflen, nsec, n, start);
+				n = 0;
+				break;
+			}
+		}
+
+		if (drng_multi_direct(drng, now)) {
+			ret = drng_chacha20_get_common(drng, outbufs[i],
+						       outbuflen,
+						       DRNG_NO_DEADLINE, 0);
+			if (ret) {
+				drng_multi_flush(lanes, lane_outbufs,
+						 outbuflen, nsec, n, start);
+				return ret;
+			}
+			continue;
+		}
+
+		drng_event(get__entry, DRNG_CHACHA20_EVENT_GET_ENTRY, drng, 0,
+			   outbuflen, 0);
+		lanes[n] = drng;
+		lane_outbufs[n] = outbufs[i];
+		if (++n == CHACHA20_MULTI_LANES) {
+			drng_multi_flush(lanes, lane_outbufs, outbuflen, nsec,
+					 n, start);
+			n = 0;
+		}
+	}
+
+	drng_multi_flush(lanes, lane_outbufs, outbuflen, nsec, n, start);
+
+	return 0;
+}
+
+/******************* ChaCha20 DRNG borrowed random numbers API *****************/
+
+DSO_PUBLIC
+int drng_chacha20_borrow(struct chacha20_drng *drng, const uint8_t **ptr,
+			 uint32_t *len)
+{
+	struct drng_borrow *b;
+	enum drng_reseed_reason reason;
+	time_t now = 0;
+	uint32_t need;
+	int ret;
+
+	if (!ptr || !len || *len > DRNG_CHACHA20_BORROW_SIZE)
+		return -EINVAL;
+	need = *len ? *len : 1;
+
+	ret = drng_fork_check(drng);
+	if (ret)
+		return ret;
+
+	if (!drng->borrow) {
+		drng->borrow = drng_mapping_alloc(drng, sizeof(*drng->borrow));
+		if (!drng->borrow)
+			return -errno;
+		drng->borrow->pos = sizeof(drng->borrow->buf);
+	}
+	b = drng->borrow;
+
+	/* The refill performs a due reseed before data older than it is used */
+	get_time(&now, NULL);
+	reason = drng_chacha20_reseed_due(drng, now);
+	if (reason != DRNG_RESEED_NONE) {
+		drng_borrow_discard(drng);
+		/* The prefetch buffers only check the thresholds per buffer */
+		if (drng->prefetch && !drng->prefetch->reseed_due)
+			drng->prefetch->reseed_due = reason;
+	}
+
+	if (sizeof(b->buf) - b->pos < need) {
+		/* A remainder too short for the caller is discarded */
+		drng_borrow_discard(drng);
+		ret = drng_chacha20_get_common(drng, b->buf, sizeof(b->buf),
+					       DRNG_NO_DEADLINE, 0);
+		if (ret)
+			return ret;
+		b->pos = 0;
+	}
+
+	*ptr = b->buf + b->pos;
+	*len = sizeof(b->buf) - b->pos;
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_consume(struct chacha20_drng *drng, uint32_t n)
+{
+	struct drng_borrow *b = drng->borrow;
+
+	if (!b || n > sizeof(b->buf) - b->pos)
+		return -EINVAL;
+
+	memset_secure(b->buf + b->pos, 0, n);
+	b->pos += n;
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_bits_refill(struct chacha20_drng *drng, uint32_t nbits,
+			      uint64_t *bits)
+{
+	struct drng_chacha20_bits *r = &drng->bits;
+	const uint8_t *ptr;
+	uint64_t word, val;
+	uint32_t len = sizeof(word), need;
+	int ret;
+
+	if (!nbits || nbits > 64 || !bits)
+		return -EINVAL;
+
+	/* Resets the reservoir in a child process */
+	ret = drng_fork_check(drng);
+	if (ret)
+		return ret;
+
+	if (r->avail >= nbits) {
+		val = r->word;
+		r->word = (nbits == 64) ? 0 : r->word >> nbits;
+		r->avail -= nbits;
+		*bits = (nbits == 64) ? val : val & ((1ULL << nbits) - 1);
+		return 0;
+	}
+
+	/* The remaining bits form the low part, a new word the high part */
+	ret = drng_chacha20_borrow(drng, &ptr, &len);
+	if (ret)
+		return ret;
+	memcpy(&word, ptr, sizeof(word));
+	drng_chacha20_consume(drng, sizeof(word));
+
+	val = r->word;
+	need = nbits - r->avail;
+	if (need < 64)
+		val |= (word & ((1ULL << need) - 1)) << r->avail;
+	else
+		val = word;
+	*bits = val;
+
+	r->word = (need == 64) ? 0 : word >> need;
+	r->avail = 64 - need;
+	r->fork_gen = drng->fork_gen;
+	r->fork_gen_ref = &drng_fork_gen;
+
+	memset_secure(&word, 0, sizeof(word));
+
+	return 0;
+}
+
+DSO_PUBLIC
+const uint32_t *drng_chacha20_fork_gen_ref(void)
+{
+	pthread_once(&drng_fork_once, drng_fork_register);
+
+	return &drng_fork_gen;
+}
+
+/******************** ChaCha20 DRNG shuffle and sampling *********************/
+
+/* Maximum number of 32 bit random numbers obtained with one DRNG request */
+#define DRNG_RAND_WORDS		256
+
+/* Batched random numbers for the bounded integer generation */
+struct drng_rand {
+	struct chacha20_drng *drng;
+	uint32_t pos;
+	uint32_t len;
+	uint32_t next;		/* random numbers of the next request */
+	uint32_t buf[DRNG_RAND_WORDS];
+};
+
+/*
+ * The first DRNG request is limited to the expected number of random numbers
+ * to keep small requests cheap, all further requests fill the entire buffer.
+ */
+static inline void drng_rand_init(struct drng_rand *r,
+				  struct chacha20_drng *drng, size_t expected)
+{
+	r->drng = drng;
+	r->pos = 0;
+	r->len = 0;
+	r->next = DRNG_RAND_WORDS;
+	if (expected < DRNG_RAND_WORDS)
+		r->next = (expected < 16) ? 16 : (uint32_t)expected;
+}
+
+static inline void drng_rand_fini(struct drng_rand *r)
+{
+	memset_secure(r->buf, 0, sizeof(r->buf));
+}
+
+static inline int drng_rand_u32(struct drng_rand *r, uint32_t *val)
+{
+	if (r->pos == r->len) {
+		int ret = drng_chacha20_get(r->drng, (uint8_t *)r->buf,
+					    r->next * sizeof(r->buf[0]));
+
+		if (ret < 0)
+			return ret;
+		r->pos = 0;
+		r->len = r->next;
+		r->next = DRNG_RAND_WORDS;
+	}
+
+	*val = r->buf[r->pos++];
+	return 0;
+}
+
+/*
+ * Unbiased integer in [0, bound) with the multiply-shift method of
+ * D. Lemire: the product of the random number and the bound is only rejected
+ * if its lower half falls into the 2^32 mod bound biased values. The
+ * division computing the threshold is only needed in the rare case that the
+ * lower half is below the bound.
+ */
+static inline int drng_rand_bounded32(struct drng_rand *r, uint32_t bound,
+				      uint32_t *val)
+{
+	uint64_t m;
+	uint32_t x;
+	int ret = drng_rand_u32(r, &x);
+
+	if (ret)
+		return ret;
+
+	m = (uint64_t)x * bound;
+	if ((uint32_t)m < bound) {
+		/* 2^32 mod bound */
+		uint32_t threshold = (0U - bound) % bound;
+
+		while ((uint32_t)m < threshold) {
+			ret = drng_rand_u32(r, &x);
+			if (ret)
+				return ret;
+			m = (uint64_t)x * bound;
+		}
+	}
+
+	*val = (uint32_t)(m >> 32);
+	return 0;
+}
+
+/*
+ * Two unbiased integers in [0, bound1) and [0, bound2) from one 32 bit random
+ * number following the batched ranged integer generation of
+ * N. Brackett-Rozinsky and D. Lemire: the lower half of the first product is
+ * multiplied with the second bound, the rejection is performed on the lower
+ * half of the second product with the product of both bounds. The product of
+ * the bounds must not exceed 2^32.
+ */
+static inline int drng_rand_bounded32x2(struct drng_rand *r, uint32_t bound1,
+					uint32_t bound2, uint32_t *val1,
+					uint32_t *val2)
+{
+	uint64_t product = (uint64_t)bound1 * bound2, m1, m2;
+	uint32_t x;
+	int ret;
+
+	for (;;) {
+		ret = drng_rand_u32(r, &x);
+		if (ret)
+			return ret;
+
+		m1 = (uint64_t)x * bound1;
+		m2 = (uint64_t)(uint32_t)m1 * bound2;
+		if ((uint32_t)m2 >= product)
+			break;
+		/* 2^32 mod product */
+		if ((uint32_t)m2 >= (uint32_t)((0x100000000ULL - product) %
+					       product))
+			break;
+	}
+
+	*val1 = (uint32_t)(m1 >> 32);
+	*val2 = (uint32_t)(m2 >> 32);
+	return 0;
+}
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 drng_uint128_t;
+#endif
+
+/* Unbiased integer in [0, bound) for bounds of up to 64 bits */
+static int drng_rand_bounded64(struct drng_rand *r, uint64_t bound,
+			       uint64_t *val)
+{
+	uint32_t lo, hi;
+	uint64_t x;
+	int ret;
+
+	if (bound <= UINT32_MAX) {
+		ret = drng_rand_bounded32(r, (uint32_t)bound, &lo);
+		*val = lo;
+		return ret;
+	}
+
+#ifdef __SIZEOF_INT128__
+	{
+		drng_uint128_t m;
+
+		ret = drng_rand_u32(r, &lo);
+		if (!ret)
+			ret = drng_rand_u32(r, &hi);
+		if (ret)
+			return ret;
+		x = ((uint64_t)hi << 32) | lo;
+		m = (drng_uint128_t)x * bound;
+		if ((uint64_t)m < bound) {
+			/* 2^64 mod bound */
+			uint64_t threshold = (0ULL - bound) % bound;
+
+			while ((uint64_t)m < threshold) {
+				ret = drng_rand_u32(r, &lo);
+				if (!ret)
+					ret = drng_rand_u32(r, &hi);
+				if (ret)
+					return ret;
+				x = ((uint64_t)hi << 32) | lo;
+				m = (drng_uint128_t)x * bound;
+			}
+		}
+		*val = (uint64_t)(m >> 64);
+	}
+#else
+	{
+		/* 2^64 mod bound */
+		uint64_t threshold = (0ULL - bound) % bound;
+
+		do {
+			ret = drng_rand_u32(r, &lo);
+			if (!ret)
+				ret = drng_rand_u32(r, &hi);
+			if (ret)
+				return ret;
+			x = ((uint64_t)hi << 32) | lo;
+		} while (x < threshold);
+		*val = x % bound;
+	}
+#endif
+
+	return 0;
+}
+
+/* Copy one array element, common element sizes are copied as integers */
+static inline void drng_elem_copy(uint8_t *dst, const uint8_t *src,
+				  size_t size)
+{
+	switch (size) {
+	case sizeof(uint32_t):
+		memcpy(dst, src, sizeof(uint32_t));
+		break;
+	case sizeof(uint64_t):
+		memcpy(dst, src, sizeof(uint64_t));
+		break;
+	default:
+		memcpy(dst, src, size);
+		break;
+	}
+}
+
+static inline void drng_elem_swap(uint8_t *base, size_t i, size_t j,
+				  size_t size)
+{
+	uint8_t *a = base + i * size, *b = base + j * size;
+	uint8_t tmp[64];
+
+	switch (size) {
+	case sizeof(uint32_t):
+	case sizeof(uint64_t):
+		drng_elem_copy(tmp, a, size);
+		drng_elem_copy(a, b, size);
+		drng_elem_copy(b, tmp, size);
+		break;
+	default:
+		while (size) {
+			size_t todo = min(size, sizeof(tmp));
+
+			memcpy(tmp, a, todo);
+			memcpy(a, b, todo);
+			memcpy(b, tmp, todo);
+			a += todo;
+			b += todo;
+			size -= todo;
+		}
+		break;
+	}
+}
+
+/* Largest range for which two bounded integers are drawn from 32 bits */
+#define DRNG_SHUFFLE_PAIR_MAX	65536
+
+/*
+ * Fisher-Yates shuffle: the last element of the unshuffled part [0, i) is
+ * swapped with a random element of that part.
+ */
+static int drng_shuffle_fy(struct drng_rand *r, uint8_t *base, size_t nmemb,
+			   size_t size)
+{
+	size_t i = nmemb;
+	int ret;
+
+	while (i > DRNG_SHUFFLE_PAIR_MAX) {
+		uint64_t j;
+
+		ret = drng_rand_bounded64(r, i, &j);
+		if (ret)
+			return ret;
+		drng_elem_swap(base, i - 1, (size_t)j, size);
+		i--;
+	}
+
+	while (i > 2) {
+		uint32_t j1, j2;
+
+		ret = drng_rand_bounded32x2(r, (uint32_t)i, (uint32_t)(i - 1),
+					    &j1, &j2);
+		if (ret)
+			return ret;
+		drng_elem_swap(base, i - 1, j1, size);
+		drng_elem_swap(base, i - 2, j2, size);
+		i -= 2;
+	}
+
+	if (i == 2) {
+		uint32_t j;
+
+		ret = drng_rand_bounded32(r, 2, &j);
+		if (ret)
+			return ret;
+		drng_elem_swap(base, 1, j, size);
+	}
+
+	return 0;
+}
+
+/* Number of buckets of one distribution pass of the blocked shuffle */
+#define DRNG_SHUFFLE_BUCKETS	256
+
+/* Last level cache size if it cannot be obtained from the system */
+#define DRNG_SHUFFLE_LLC_DEFAULT	(8UL << 20)
+
+static size_t drng_llc_size(void)
+{
+	static size_t llc_size;
+	size_t size = __atomic_load_n(&llc_size, __ATOMIC_RELAXED);
+
+	if (!size) {
+		long val = -1;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+		val = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+		size = (val > 0) ? (size_t)val : DRNG_SHUFFLE_LLC_DEFAULT;
+		__atomic_store_n(&llc_size, size, __ATOMIC_RELAXED);
+	}
+
+	return size;
+}
+
+/*
+ * Cache-blocked shuffle of arrays larger than block_bytes: every element is
+ * assigned to one of DRNG_SHUFFLE_BUCKETS buckets with a random byte and
+ * copied to its bucket in a temporary array. Each bucket is shuffled on its
+ * own, recursively if it is still larger than block_bytes. As the bucket
+ * assignment is uniform and independent, and each bucket is permuted
+ * uniformly, the concatenation of the buckets is a uniform permutation.
+ *
+ * The random accesses of the Fisher-Yates shuffle are thus confined to
+ * buckets fitting into the cache, the distribution pass accesses memory
+ * sequentially apart from the writes to the DRNG_SHUFFLE_BUCKETS buckets.
+ */
+static int drng_shuffle_blocked(struct drng_rand *r, uint8_t *base,
+				size_t nmemb, size_t size, size_t block_bytes)
+{
+	size_t count[DRNG_SHUFFLE_BUCKETS], pos[DRNG_SHUFFLE_BUCKETS];
+	size_t i, start, todo;
+	uint8_t *bucket, *tmp;
+	int ret = 0;
+
+	if (nmemb < 2 || nmemb * size <= block_bytes)
+		return drng_shuffle_fy(r, base, nmemb, size);
+
+	bucket = malloc(nmemb);
+	tmp = malloc(nmemb * size);
+	if (!bucket || !tmp) {
+		free(bucket);
+		free(tmp);
+		return drng_shuffle_fy(r, base, nmemb, size);
+	}
+
+	for (i = 0; i < nmemb; i += todo) {
+		todo = min(nmemb - i, (size_t)1 << 30);
+		ret = drng_chacha20_get(r->drng, bucket + i, (uint32_t)todo);
+		if (ret < 0)
+			goto out;
+	}
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < nmemb; i++)
+		count[bucket[i]]++;
+	for (i = 0, start = 0; i < DRNG_SHUFFLE_BUCKETS; i++) {
+		pos[i] = start;
+		start += count[i];
+	}
+	for (i = 0; i < nmemb; i++)
+		drng_elem_copy(tmp + pos[bucket[i]]++ * size, base + i * size,
+			       size);
+
+	for (i = 0, start = 0; i < DRNG_SHUFFLE_BUCKETS; i++) {
+		ret = drng_shuffle_blocked(r, tmp + start * size, count[i],
+					   size, block_bytes);
+		if (ret)
+			break;
+		start += count[i];
+	}
+
+	/* Also on error, all elements are present in tmp */
+	memcpy(base, tmp, nmemb * size);
+
+out:
+	memset_secure(bucket, 0, nmemb);
+	free(bucket);
+	free(tmp);
+	return ret;
+}
+
+static int drng_shuffle(struct chacha20_drng *drng, void *base, size_t nmemb,
+			size_t size, size_t block_bytes)
+{
+	struct drng_rand r;
+	int ret;
+
+	if (!size || nmemb > SIZE_MAX / size)
+		return -EINVAL;
+	if (nmemb < 2)
+		return 0;
+
+	drng_rand_init(&r, drng, nmemb);
+	ret = drng_shuffle_blocked(&r, base, nmemb, size, block_bytes);
+	drng_rand_fini(&r);
+
+	return ret;
+}
+
+#define DRNG_SAMPLE_AUTO	0
+#define DRNG_SAMPLE_BITMAP	1
+#define DRNG_SAMPLE_HASH	2
+
+/* Open addressing hash table of the selected indices */
+struct drng_sample_set {
+	size_t *slot;
+	uint64_t mask;
+	unsigned int shift;
+};
+
+#define DRNG_SAMPLE_EMPTY	SIZE_MAX
+
+/* Insert the index unless it is present, return 1 if it was present */
+static inline int drng_sample_set_insert(struct drng_sample_set *set,
+					 size_t idx)
+{
+	/* Fibonacci hashing spreads consecutive indices */
+	uint64_t h = ((uint64_t)idx * 0x9e3779b97f4a7c15ULL) >> set->shift;
+
+	while (set->slot[h] != DRNG_SAMPLE_EMPTY) {
+		if (set->slot[h] == idx)
+			return 1;
+		h = (h + 1) & set->mask;
+	}
+	set->slot[h] = idx;
+
+	return 0;
+}
+
+/*
+ * Robert Floyd's sampling: for j in [n - k, n), a random t in [0, j] is
+ * selected, or j itself if t was already selected. This yields a uniformly
+ * distributed subset with exactly k random numbers. The subset is finally
+ * shuffled as the order of Floyd's algorithm is not uniform.
+ */
+static int drng_sample(struct chacha20_drng *drng, size_t n, size_t k,
+		       size_t *out, int method)
+{
+	struct drng_rand r;
+	struct drng_sample_set set = { NULL, 0, 0 };
+	uint64_t *bitmap = NULL;
+	size_t i, j, mapsize = 0;
+	int ret = 0;
+
+	if (k > n)
+		return -EINVAL;
+	if (!k)
+		return 0;
+
+	if (method == DRNG_SAMPLE_AUTO)
+		method = (n / 8 <= k * sizeof(*out)) ? DRNG_SAMPLE_BITMAP :
+						       DRNG_SAMPLE_HASH;
+
+	if (method == DRNG_SAMPLE_BITMAP) {
+		mapsize = (n / 64 + 1) * sizeof(uint64_t);
+		bitmap = calloc(1, mapsize);
+		if (!bitmap)
+			return -ENOMEM;
+	} else {
+		unsigned int bits = 1;
+
+		/* Load factor of at most 1/2 */
+		while (bits < 63 && ((uint64_t)1 << bits) < (uint64_t)k * 2)
+			bits++;
+		if (((uint64_t)1 << bits) > SIZE_MAX / sizeof(*set.slot))
+			return -ENOMEM;
+		mapsize = ((size_t)1 << bits) * sizeof(*set.slot);
+		set.slot = malloc(mapsize);
+		if (!set.slot)
+			return -ENOMEM;
+		memset(set.slot, 0xff, mapsize);
+		set.mask = ((uint64_t)1 << bits) - 1;
+		set.shift = 64 - bits;
+	}
+
+	/* Indices of more than 32 bits consume two random numbers */
+	drng_rand_init(&r, drng, (n > UINT32_MAX) ? k * 3 : k * 2);
+
+	for (i = 0, j = n - k; j < n; i++, j++) {
+		uint64_t t;
+
+		ret = drng_rand_bounded64(&r, (uint64_t)j + 1, &t);
+		if (ret)
+			goto out;
+
+		if (bitmap) {
+			if (bitmap[t / 64] & ((uint64_t)1 << (t % 64)))
+				t = j;
+			bitmap[t / 64] |= (uint64_t)1 << (t % 64);
+		} else if (drng_sample_set_insert(&set, (size_t)t)) {
+			/* j cannot be present as all previous t are < j */
+			drng_sample_set_insert(&set, j);
+			t = j;
+		}
+		out[i] = (size_t)t;
+	}
+
+	ret = drng_shuffle_fy(&r, (uint8_t *)out, k, sizeof(*out));
+
+out:
+	drng_rand_fini(&r);
+	if (bitmap) {
+		memset_secure(bitmap, 0, mapsize);
+		free(bitmap);
+	} else {
+		memset_secure(set.slot, 0, mapsize);
+		free(set.slot);
+	}
+
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_shuffle(struct chacha20_drng *drng, void *base, size_t nmemb,
+			  size_t size)
+{
+	return drng_shuffle(drng, base, nmemb, size, drng_llc_size());
+}
+
+DSO_PUBLIC
+int drng_chacha20_sample_indices(struct chacha20_drng *drng, size_t n, size_t k,
+				 size_t *out)
+{
+	return drng_sample(drng, n, k, out, DRNG_SAMPLE_AUTO);
+}
+
+/********************* ChaCha20 DRNG tokens and UUIDs ************************/
+
+/* Maximum number of random bytes obtained with one DRNG request */
+#define DRNG_TOKEN_BUFSIZE	4096
+
+/* Batched random bytes for the token and UUID generation */
+struct drng_bytes {
+	struct chacha20_drng *drng;
+	uint64_t remain;	/* expected bytes of the batch not yet obtained */
+	uint32_t pos;
+	uint32_t len;
+	uint32_t used;		/* high-water mark of the buffer */
+	uint8_t buf[DRNG_TOKEN_BUFSIZE];
+};
+
+static inline void drng_bytes_init(struct drng_bytes *b,
+				   struct chacha20_drng *drng,
+				   uint64_t expected)
+{
+	b->drng = drng;
+	b->remain = expected;
+	b->pos = 0;
+	b->len = 0;
+	b->used = 0;
+}
+
+static inline void drng_bytes_fini(struct drng_bytes *b)
+{
+	memset_secure(b->buf, 0, b->used);
+}
+
+/*
+ * One DRNG request covers the random bytes of the batch not yet obtained up to
+ * the buffer size, i.e. the random bytes of a batch of up to
+ * DRNG_TOKEN_BUFSIZE bytes are generated with one run of the key stream.
+ */
+static int drng_bytes_refill(struct drng_bytes *b, uint32_t n)
+{
+	uint32_t left = b->len - b->pos, want, todo;
+	int ret;
+
+	want = (uint32_t)min(b->remain, DRNG_TOKEN_BUFSIZE);
+	if (want < n)
+		want = n;
+	todo = want - left;
+
+	memmove(b->buf, b->buf + b->pos, left);
+	ret = drng_chacha20_get(b->drng, b->buf + left, todo);
+	if (ret < 0)
+		return ret;
+
+	b->pos = 0;
+	b->len = want;
+	if (b->used < want)
+		b->used = want;
+	b->remain -= min(b->remain, todo);
+	return 0;
+}
+
+/* Obtain n <= DRNG_TOKEN_BUFSIZE contiguous unused random bytes */
+static inline int drng_bytes_get(struct drng_bytes *b, uint32_t n,
+				 const uint8_t **p)
+{
+	if (b->len - b->pos < n) {
+		int ret = drng_bytes_refill(b, n);
+
+		if (ret < 0)
+			return ret;
+	}
+
+	*p = b->buf + b->pos;
+	b->pos += n;
+	return 0;
+}
+
+/*
+ * The encoders process 8 characters at once as bytes of a 64 bit word (SIMD
+ * within a register) without table lookups or data dependent branches.
+ */
+#define DRNG_SWAR_ONES		0x0101010101010101ULL
+#define DRNG_SWAR_HIGH		0x8080808080808080ULL
+
+/* Bytewise addition modulo 256 without carries into the next byte */
+static inline uint64_t drng_swar_add(uint64_t a, uint64_t b)
+{
+	return ((a & ~DRNG_SWAR_HIGH) + (b & ~DRNG_SWAR_HIGH)) ^
+	       ((a ^ b) & DRNG_SWAR_HIGH);
+}
+
+/* Bytes with a value of at least t are set to 1, others to 0 - for x < 128 */
+static inline uint64_t drng_swar_ge(uint64_t x, uint8_t t)
+{
+	return ((x + DRNG_SWAR_ONES * (uint8_t)(128 - t)) >> 7) &
+	       DRNG_SWAR_ONES;
+}
+
+/*
+ * Lower case hexadecimal encoding of len characters, len must be a multiple
+ * of 8: the nibbles of 4 bytes are spread to one byte each in output order
+ * and the bytes with a value above 9 receive the additional offset to 'a'.
+ */
+static void drng_hex_encode(const uint8_t *in, char *out, uint32_t len)
+{
+	uint32_t x;
+	uint64_t v;
+
+	for (; len; len -= 8, in += 4, out += 8) {
+		memcpy(&x, in, sizeof(x));
+		v = le_bswap32(x);
+		v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+		v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+		v = ((v >> 4) & 0x000f000f000f000fULL) |
+		    ((v & 0x000f000f000f000fULL) << 8);
+		v += DRNG_SWAR_ONES * '0' +
+		     drng_swar_ge(v, 10) * ('a' - '0' - 10);
+		v = le_bswap64(v);
+		memcpy(out, &v, sizeof(v));
+	}
+}
+
+/*
+ * Base64url encoding (RFC 4648 section 5) of len characters, len must be a
+ * multiple of 8: the 6 bit groups of 6 bytes are spread to one byte each.
+ * Within the ranges A-Z, a-z, 0-9, '-' and '_' the offset from the value to
+ * the character is constant, every range boundary adds its difference to
+ * the offset of the values above it.
+ */
+static void drng_b64url_encode(const uint8_t *in, char *out, uint32_t len)
+{
+	uint64_t v, off;
+	uint32_t t1, t2;
+
+	for (; len; len -= 8, in += 6, out += 8) {
+		t1 = (uint32_t)in[0] << 16 | (uint32_t)in[1] << 8 | in[2];
+		t2 = (uint32_t)in[3] << 16 | (uint32_t)in[4] << 8 | in[5];
+		v = (uint64_t)((t1 >> 18) | ((t1 >> 12) & 0x3f) << 8 |
+			       ((t1 >> 6) & 0x3f) << 16 | (t1 & 0x3f) << 24) |
+		    (uint64_t)((t2 >> 18) | ((t2 >> 12) & 0x3f) << 8 |
+			       ((t2 >> 6) & 0x3f) << 16 | (t2 & 0x3f) << 24) << 32;
+
+		off = DRNG_SWAR_ONES * 'A';
+		off = drng_swar_add(off, drng_swar_ge(v, 26) *
+				    (uint8_t)('a' - 26 - 'A'));
+		off = drng_swar_add(off, drng_swar_ge(v, 52) *
+				    (uint8_t)('0' - 52 - ('a' - 26)));
+		off = drng_swar_add(off, drng_swar_ge(v, 62) *
+				    (uint8_t)('-' - 62 - ('0' - 52)));
+		off = drng_swar_add(off, drng_swar_ge(v, 63) *
+				    (uint8_t)('_' - 63 - ('-' - 62)));
+		v = le_bswap64(drng_swar_add(v, off));
+		memcpy(out, &v, sizeof(v));
+	}
+}
+
+#define DRNG_TOKEN_HEX		0
+#define DRNG_TOKEN_BASE64URL	1
+#define DRNG_TOKEN_ALPHABET	2
+
+/* Random bytes per 8 characters */
+#define DRNG_TOKEN_GROUP(enc)	(((enc) == DRNG_TOKEN_HEX) ? 4 : 6)
+
+/* Characters encoded at once, the random bytes fit into the buffer */
+#define DRNG_TOKEN_CHUNK	4096
+
+/* Random bytes consumed by an encoded string of len characters */
+static inline uint32_t drng_token_bytes(unsigned int enc, uint32_t len)
+{
+	if (enc == DRNG_TOKEN_HEX)
+		return (len + 1) / 2;
+	return (len / 8) * 6 + ((len % 8) * 3 + 3) / 4;
+}
+
+static int drng_token_encode(struct drng_bytes *b, unsigned int enc,
+			     char *out, uint32_t len)
+{
+	const uint8_t *p;
+	uint8_t in[6] = { 0 };
+	char tmp[8];
+	uint32_t todo;
+	int ret;
+
+	while (len >= 8) {
+		todo = min(len, DRNG_TOKEN_CHUNK) & ~7U;
+		ret = drng_bytes_get(b, todo / 8 * DRNG_TOKEN_GROUP(enc), &p);
+		if (ret)
+			return ret;
+		if (enc == DRNG_TOKEN_HEX)
+			drng_hex_encode(p, out, todo);
+		else
+			drng_b64url_encode(p, out, todo);
+		out += todo;
+		len -= todo;
+	}
+
+	/* Trailing characters are encoded from a zero-padded group */
+	if (len) {
+		todo = drng_token_bytes(enc, len);
+		ret = drng_bytes_get(b, todo, &p);
+		if (ret)
+			return ret;
+		memcpy(in, p, todo);
+		if (enc == DRNG_TOKEN_HEX)
+			drng_hex_encode(in, tmp, 8);
+		else
+			drng_b64url_encode(in, tmp, 8);
+		memcpy(out, tmp, len);
+		memset_secure(in, 0, sizeof(in));
+		memset_secure(tmp, 0, sizeof(tmp));
+	}
+
+	return 0;
+}
+
+/* Characters drawn from an alphabet by rejection sampling */
+struct drng_alphabet {
+	const char *chars;
+	uint32_t size;
+	uint32_t width;		/* random bytes per character */
+	uint32_t thresh;	/* rejected lower product halves */
+};
+
+/*
+ * Lemire's multiply-shift method with 8 bit random numbers where at most
+ * 1/16 of them are rejected, otherwise with 16 bit random numbers. Alphabet
+ * sizes which are powers of 2 never reject.
+ */
+static int drng_alphabet_init(struct drng_alphabet *a, const char *alphabet)
+{
+	size_t size;
+
+	if (!alphabet)
+		return -EINVAL;
+	size = strlen(alphabet);
+	/* A byte alphabet has at most 256 distinct characters */
+	if (size < 2 || size > 256)
+		return -EINVAL;
+
+	a->chars = alphabet;
+	a->size = (uint32_t)size;
+	a->width = 1;
+	a->thresh = 256 % a->size;
+	if (a->thresh * 16 > 256) {
+		a->width = 2;
+		a->thresh = 65536 % a->size;
+	}
+	return 0;
+}
+
+/*
+ * Random numbers for all missing characters are obtained at once, rejected
+ * characters are drawn again in the next round.
+ */
+static int drng_token_alphabet(struct drng_bytes *b,
+			       const struct drng_alphabet *a, char *out,
+			       uint32_t len)
+{
+	const uint8_t *p;
+	uint32_t i = 0, j, todo, prod;
+	uint32_t mask = (a->width == 1) ? 0xff : 0xffff;
+	int ret;
+
+	while (i < len) {
+		todo = min(len - i, DRNG_TOKEN_BUFSIZE / a->width);
+		ret = drng_bytes_get(b, todo * a->width, &p);
+		if (ret)
+			return ret;
+		for (j = 0; j < todo; j++, p += a->width) {
+			prod = p[0];
+			if (a->width == 2)
+				prod = (prod << 8) | p[1];
+			prod *= a->size;
+			if ((prod & mask) >= a->thresh)
+				out[i++] = a->chars[prod >> (8 * a->width)];
+		}
+	}
+
+	return 0;
+}
+
+static int drng_tokens(struct chacha20_drng *drng, const char *alphabet,
+		       unsigned int enc, char *out, uint32_t len,
+		       uint32_t count)
+{
+	struct drng_bytes b;
+	struct drng_alphabet a = { NULL, 0, 0, 0 };
+	uint64_t expected;
+	size_t stride = (size_t)len + 1;
+	uint32_t i;
+	int ret = 0;
+
+	if (!out || !len)
+		return -EINVAL;
+
+	switch (enc) {
+	case DRNG_TOKEN_HEX:
+	case DRNG_TOKEN_BASE64URL:
+		expected = drng_token_bytes(enc, len);
+		break;
+	default:
+		ret = drng_alphabet_init(&a, alphabet);
+		if (ret)
+			return ret;
+		expected = (uint64_t)len * a.width;
+		/* Add the expected rejections */
+		expected += (expected * a.thresh) >> (8 * a.width);
+		break;
+	}
+
+	drng_bytes_init(&b, drng, expected * count);
+	for (i = 0; i < count; i++) {
+		char *str = out + i * stride;
+
+		if (enc == DRNG_TOKEN_ALPHABET)
+			ret = drng_token_alphabet(&b, &a, str, len);
+		else
+			ret = drng_token_encode(&b, enc, str, len);
+		if (ret)
+			break;
+		str[len] = '\0';
+	}
+	drng_bytes_fini(&b);
+
+	if (ret)
+		memset_secure(out, 0, count * stride);
+	return ret;
+}
+
+/*
+ * UUID version 4 and 7 as defined in RFC 9562: the random bits are obtained
+ * for the entire batch. The 48 bit millisecond time stamp of version 7 is
+ * sampled once per batch.
+ */
+static int drng_uuid(struct chacha20_drng *drng, char *out, uint32_t count,
+		     unsigned int version)
+{
+	struct drng_bytes b;
+	const uint8_t *p;
+	uint8_t u[16];
+	char hex[32];
+	uint32_t i, rnd = 16;
+	int ret = 0;
+
+	if (!out)
+		return -EINVAL;
+
+	if (version == 7) {
+		time_t sec = 0;
+		uint32_t nsec = 0;
+		uint64_t ms;
+
+		get_time(&sec, &nsec);
+		ms = (uint64_t)sec * 1000 + nsec / 1000000;
+		for (i = 0; i < 6; i++)
+			u[i] = (uint8_t)(ms >> (40 - 8 * i));
+		rnd = 10;
+	}
+
+	drng_bytes_init(&b, drng, (uint64_t)rnd * count);
+	for (i = 0; i < count; i++) {
+		char *str = out + (size_t)i * DRNG_CHACHA20_UUID_STRLEN;
+
+		ret = drng_bytes_get(&b, rnd, &p);
+		if (ret)
+			break;
+		memcpy(u + sizeof(u) - rnd, p, rnd);
+		u[6] = (uint8_t)((u[6] & 0x0f) | (version << 4));
+		u[8] = (uint8_t)((u[8] & 0x3f) | 0x80);
+
+		drng_hex_encode(u, hex, sizeof(hex));
+		memcpy(str, hex, 8);
+		str[8] = '-';
+		memcpy(str + 9, hex + 8, 4);
+		str[13] = '-';
+		memcpy(str + 14, hex + 12, 4);
+		str[18] = '-';
+		memcpy(str + 19, hex + 16, 4);
+		str[23] = '-';
+		memcpy(str + 24, hex + 20, 12);
+		str[36] = '\0';
+	}
+	drng_bytes_fini(&b);
+	memset_secure(u, 0, sizeof(u));
+	memset_secure(hex, 0, sizeof(hex));
+
+	if (ret)
+		memset_secure(out, 0, (size_t)count * DRNG_CHACHA20_UUID_STRLEN);
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_uuid4(struct chacha20_drng *drng, char *out, uint32_t count)
+{
+	return drng_uuid(drng, out, count, 4);
+}
+
+DSO_PUBLIC
+int drng_chacha20_uuid7(struct chacha20_drng *drng, char *out, uint32_t count)
+{
+	return drng_uuid(drng, out, count, 7);
+}
+
+DSO_PUBLIC
+int drng_chacha20_hex(struct chacha20_drng *drng, char *out, uint32_t len,
+		      uint32_t count)
+{
+	return drng_tokens(drng, NULL, DRNG_TOKEN_HEX, out, len, count);
+}
+
+DSO_PUBLIC
+int drng_chacha20_base64url(struct chacha20_drng *drng, char *out,
+			    uint32_t len, uint32_t count)
+{
+	return drng_tokens(drng, NULL, DRNG_TOKEN_BASE64URL, out, len, count);
+}
+
+DSO_PUBLIC
+int drng_chacha20_token(struct chacha20_drng *drng, const char *alphabet,
+			char *out, uint32_t len, uint32_t count)
+{
+	return drng_tokens(drng, alphabet, DRNG_TOKEN_ALPHABET, out, len,
+			   count);
+}
+
+/************************** ChaCha20 DRNG NUMA pool ***************************/
+
+#define DRNG_POOL_MAX_GENS	64	/* generators per node */
+#define DRNG_POOL_SLICE		(2UL << 20)
+#define DRNG_POOL_PARALLEL_MIN	(2 * DRNG_POOL_SLICE)
+
+/* Memory policy of mbind(2), the library does not depend on libnuma */
+#define DRNG_MPOL_PREFERRED	1
+
+struct drng_pool_gen {
+	struct chacha20_drng drng;
+	pthread_mutex_t lock;
+} __aligned(64);
+
+struct drng_pool_node {
+	int id;			/* NUMA node number */
+	int ret;
+	cpu_set_t cpus;
+	uint32_t ngens;
+	uint32_t ready;		/* initialized generators */
+	struct drng_pool_gen *gens;
+	size_t maplen;
+};
+
+struct chacha20_drng_pool {
+	uint32_t nnodes;
+	uint16_t cpu_node[CPU_SETSIZE];	/* node index of every CPU */
+	uint16_t cpu_gen[CPU_SETSIZE];	/* preferred generator of every CPU */
+	struct drng_pool_node node[];
+};
+
+/* Parse a sysfs list of the form "0-3,8,10-11" */
+static int drng_pool_read_list(const char *path, cpu_set_t *set)
+{
+	char line[4096], *p = line;
+	ssize_t len;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -errno;
+	len = read(fd, line, sizeof(line) - 1);
+	close(fd);
+	if (len < 0)
+		return -EIO;
+	line[len] = '\0';
+
+	CPU_ZERO(set);
+	while (*p && *p != '\n') {
+		char *end;
+		long first = strtol(p, &end, 10), last;
+
+		if (end == p || first < 0)
+			return -EINVAL;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -EINVAL;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+		p = end;
+		if (*p == ',')
+			p++;
+	}
+
+	return 0;
+}
+
+/* The pages are allocated on the node when they are touched first */
+static void drng_pool_mbind(void *addr, size_t len, int node)
+{
+#ifdef SYS_mbind
+	unsigned long mask = 1UL << node;
+
+	/* Without the system call, the first touch places the memory */
+	if (node < (int)(sizeof(mask) * 8))
+		syscall(SYS_mbind, addr, len, DRNG_MPOL_PREFERRED, &mask,
+			sizeof(mask) * 8 + 1, 0);
+#else
+	(void)addr;
+	(void)len;
+	(void)node;
+#endif
+}
+
+/*
+ * Start a thread on the CPUs of a node, without the permission to change the
+ * CPU affinity the thread runs unpinned.
+ */
+static int drng_pool_thread(pthread_t *thread, const cpu_set_t *cpus,
+			    void *(*fn)(void *), void *arg)
+{
+	pthread_attr_t attr;
+	int ret = pthread_attr_init(&attr);
+
+	if (!ret) {
+		pthread_attr_setaffinity_np(&attr, sizeof(*cpus), cpus);
+		ret = pthread_create(thread, &attr, fn, arg);
+		pthread_attr_destroy(&attr);
+	}
+	if (ret)
+		ret = pthread_create(thread, NULL, fn, arg);
+
+	return -ret;
+}
+
+/* Executed on the node to place the generators with the first touch */
+static void *drng_pool_node_init(void *arg)
+{
+	struct drng_pool_node *n = arg;
+	void *mem;
+	uint32_t i;
+
+	mem = mmap(NULL, n->maplen, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		n->ret = -errno;
+		return NULL;
+	}
+	drng_pool_mbind(mem, n->maplen, n->id);
+	madvise(mem, n->maplen, MADV_WIPEONFORK);
+
+	/* prevent paging out of the memory state to swap space */
+	if (mlock(mem, n->maplen) && errno != EPERM && errno != EAGAIN) {
+		n->ret = -errno;
+		munmap(mem, n->maplen);
+		return NULL;
+	}
+	n->gens = mem;
+
+	for (i = 0; i < n->ngens; i++) {
+		struct drng_pool_gen *gen = &n->gens[i];
+
+		n->ret = drng_chacha20_setup(&gen->drng);
+		if (n->ret)
+			break;
+		pthread_mutex_init(&gen->lock, NULL);
+		n->ready++;
+
+		n->ret = drng_chacha20_reseed(&gen->drng, NULL, 0);
+		if (n->ret)
+			break;
+	}
+
+	return NULL;
+}
+
+static void drng_pool_node_fini(struct drng_pool_node *n)
+{
+	uint32_t i;
+
+	if (!n->gens)
+		return;
+
+	for (i = 0; i < n->ready; i++) {
+		pthread_mutex_destroy(&n->gens[i].lock);
+		drng_seed_sources_put();
+	}
+	memset_secure(n->gens, 0, n->maplen);
+	munmap(n->gens, n->maplen);
+	n->gens = NULL;
+}
+
+/*
+ * The NUMA nodes with CPUs the process may execute on - without NUMA support
+ * all CPUs form node 0.
+ */
+static int drng_pool_topology(cpu_set_t *nodes, cpu_set_t *allowed)
+{
+	int ret;
+
+	if (sched_getaffinity(0, sizeof(*allowed), allowed))
+		return -errno;
+
+	ret = drng_pool_read_list("/sys/devices/system/node/online", nodes);
+	if (ret == -ENOENT) {
+		CPU_ZERO(nodes);
+		CPU_SET(0, nodes);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+static int drng_pool_node_cpus(int node, const cpu_set_t *allowed,
+			       cpu_set_t *cpus)
+{
+	char path[64];
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	ret = drng_pool_read_list(path, cpus);
+	if (ret == -ENOENT && !node) {
+		*cpus = *allowed;
+		return 0;
+	}
+	if (ret)
+		return ret;
+
+	CPU_AND(cpus, cpus, allowed);
+	return 0;
+}
+
+static inline struct drng_pool_node *
+drng_pool_local(struct chacha20_drng_pool *pool, uint32_t *gen)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		cpu = 0;
+	*gen = pool->cpu_gen[cpu];
+	return &pool->node[pool->cpu_node[cpu]];
+}
+
+/*
+ * Another generator of the node is used if the preferred one is busy, only
+ * if all generators are busy the caller waits for the preferred one.
+ */
+static int drng_pool_node_get(struct drng_pool_node *n, uint32_t gen,
+			      uint8_t *outbuf, uint32_t outbuflen)
+{
+	struct drng_pool_gen *g = NULL;
+	uint32_t i;
+	int ret;
+
+	gen %= n->ngens;
+	for (i = 0; i < n->ngens; i++) {
+		g = &n->gens[(gen + i) % n->ngens];
+		if (!pthread_mutex_trylock(&g->lock))
+			break;
+	}
+	if (i == n->ngens) {
+		g = &n->gens[gen];
+		pthread_mutex_lock(&g->lock);
+	}
+
+	ret = drng_chacha20_get(&g->drng, outbuf, outbuflen);
+	pthread_mutex_unlock(&g->lock);
+
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_pool_alloc(struct chacha20_drng_pool **pool,
+			     uint32_t per_node)
+{
+	struct chacha20_drng_pool *p;
+	cpu_set_t nodes, allowed, cpus;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	uint32_t nnodes = 0, i;
+	int node, cpu, ret;
+
+	if (per_node > DRNG_POOL_MAX_GENS)
+		return -EINVAL;
+	if (pagesize <= 0)
+		pagesize = 4096;
+
+	ret = drng_pool_topology(&nodes, &allowed);
+	if (ret)
+		return ret;
+
+	p = calloc(1, sizeof(*p) +
+		      (size_t)CPU_COUNT(&nodes) * sizeof(p->node[0]));
+	if (!p)
+		return -ENOMEM;
+
+	/* Memory-only nodes and nodes without allowed CPUs are skipped */
+	for (node = 0; node < CPU_SETSIZE; node++) {
+		struct drng_pool_node *n = &p->node[nnodes];
+		uint32_t rank = 0;
+
+		if (!CPU_ISSET(node, &nodes) ||
+		    drng_pool_node_cpus(node, &allowed, &cpus) ||
+		    !CPU_COUNT(&cpus))
+			continue;
+
+		n->id = node;
+		n->cpus = cpus;
+		n->ngens = per_node ? per_node : (uint32_t)CPU_COUNT(&cpus);
+		if (n->ngens > DRNG_POOL_MAX_GENS)
+			n->ngens = DRNG_POOL_MAX_GENS;
+		n->maplen = (n->ngens * sizeof(struct drng_pool_gen) +
+			     (size_t)pagesize - 1) & ~((size_t)pagesize - 1);
+
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (!CPU_ISSET(cpu, &cpus))
+				continue;
+			p->cpu_node[cpu] = (uint16_t)nnodes;
+			p->cpu_gen[cpu] = (uint16_t)(rank++ % n->ngens);
+		}
+		nnodes++;
+	}
+	if (!nnodes) {
+		free(p);
+		return -ENODEV;
+	}
+	p->nnodes = nnodes;
+
+	/*
+	 * CPUs outside of the allowed set use node 0, their cpu_gen spreads
+	 * them over the generators of node 0 (modulo its number of generators
+	 * in drng_pool_node_get).
+	 */
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed)) {
+			p->cpu_node[cpu] = 0;
+			p->cpu_gen[cpu] = (uint16_t)cpu;
+		}
+	}
+
+	for (i = 0; i < nnodes; i++) {
+		pthread_t thread;
+
+		if (drng_pool_thread(&thread, &p->node[i].cpus,
+				     drng_pool_node_init, &p->node[i]))
+			drng_pool_node_init(&p->node[i]);
+		else
+			pthread_join(thread, NULL);
+		if (p->node[i].ret) {
+			ret = p->node[i].ret;
+			break;
+		}
+	}
+
+	if (ret) {
+		drng_chacha20_pool_free(p);
+		return ret;
+	}
+
+	*pool = p;
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_pool_free(struct chacha20_drng_pool *pool)
+{
+	uint32_t i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->nnodes; i++)
+		drng_pool_node_fini(&pool->node[i]);
+	free(pool);
+}
+
+DSO_PUBLIC
+uint32_t drng_chacha20_pool_nodes(struct chacha20_drng_pool *pool)
+{
+	return pool->nnodes;
+}
+
+DSO_PUBLIC
+int drng_chacha20_pool_cpu_node(struct chacha20_drng_pool *pool, uint32_t cpu)
+{
+	if (cpu >= CPU_SETSIZE)
+		return -EINVAL;
+
+	return pool->cpu_node[cpu];
+}
+
+DSO_PUBLIC
+int drng_chacha20_pool_get(struct chacha20_drng_pool *pool, uint8_t *outbuf,
+			   uint32_t outbuflen)
+{
+	uint32_t gen;
+	struct drng_pool_node *n = drng_pool_local(pool, &gen);
+
+	return drng_pool_node_get(n, gen, outbuf, outbuflen);
+}
+
+DSO_PUBLIC
+int drng_chacha20_pool_get_node(struct chacha20_drng_pool *pool, uint32_t node,
+				uint8_t *outbuf, uint32_t outbuflen)
+{
+	uint32_t gen;
+
+	if (node >= pool->nnodes)
+		return -EINVAL;
+
+	drng_pool_local(pool, &gen);
+	return drng_pool_node_get(&pool->node[node], gen, outbuf, outbuflen);
+}
+
+/* Slices of a bulk fill written by one generator of a node */
+struct drng_pool_work {
+	struct drng_pool_node *node;
+	uint32_t nidx;		/* node index */
+	uint32_t worker;	/* worker index on the node */
+	uint32_t workers;	/* workers on the node */
+	const uint16_t *slice_node;
+	size_t nslices;
+	uint8_t *buf;
+	size_t len;
+	pthread_t thread;
+	int started;
+	int ret;
+};
+
+static void *drng_pool_fill_worker(void *arg)
+{
+	struct drng_pool_work *w = arg;
+	struct drng_pool_gen *gen = &w->node->gens[w->worker];
+	size_t s, k = 0;
+
+	pthread_mutex_lock(&gen->lock);
+	for (s = 0; s < w->nslices && !w->ret; s++) {
+		size_t off = s * DRNG_POOL_SLICE;
+
+		if (w->slice_node[s] != w->nidx)
+			continue;
+		if (k++ % w->workers != w->worker)
+			continue;
+		w->ret = drng_chacha20_get(&gen->drng, w->buf + off,
+				(uint32_t)min(w->len - off, DRNG_POOL_SLICE));
+	}
+	pthread_mutex_unlock(&gen->lock);
+
+	return NULL;
+}
+
+/*
+ * The node of every slice is the node of its first page. Slices without
+ * memory are assigned in contiguous blocks to the nodes and are placed on
+ * them by the first touch of the writing worker.
+ */
+static void drng_pool_slice_nodes(struct chacha20_drng_pool *pool,
+				  uint8_t *buf, size_t nslices,
+				  uint16_t *slice_node)
+{
+	void **pages = malloc(nslices * sizeof(*pages));
+	int *status = malloc(nslices * sizeof(*status));
+	size_t s;
+	long ret = -1;
+	uint32_t i;
+
+	if (pages && status) {
+		for (s = 0; s < nslices; s++) {
+			pages[s] = buf + s * DRNG_POOL_SLICE;
+			status[s] = -ENOENT;
+		}
+#ifdef SYS_move_pages
+		ret = syscall(SYS_move_pages, 0, nslices, pages, NULL, status,
+			      0);
+#endif
+	}
+
+	for (s = 0; s < nslices; s++) {
+		slice_node[s] = (uint16_t)(s * pool->nnodes / nslices);
+		if (ret < 0 || status[s] < 0)
+			continue;
+		for (i = 0; i < pool->nnodes; i++) {
+			if (pool->node[i].id == status[s])
+				slice_node[s] = (uint16_t)i;
+		}
+	}
+
+	free(pages);
+	free(status);
+}
+
+DSO_PUBLIC
+int drng_chacha20_pool_fill(struct chacha20_drng_pool *pool, void *buf,
+			    size_t len)
+{
+	struct drng_pool_work *work;
+	uint8_t *out = buf;
+	uint16_t *slice_node;
+	size_t nslices, s, nwork = 0, *per_node;
+	uint32_t i, w;
+	int ret = 0;
+
+	if (len < DRNG_POOL_PARALLEL_MIN) {
+		for (s = 0; s < len && !ret; s += DRNG_POOL_SLICE)
+			ret = drng_chacha20_pool_get(pool, out + s,
+				(uint32_t)min(len - s, DRNG_POOL_SLICE));
+		return ret;
+	}
+
+	nslices = (len + DRNG_POOL_SLICE - 1) / DRNG_POOL_SLICE;
+	slice_node = malloc(nslices * sizeof(*slice_node));
+	per_node = calloc(pool->nnodes, sizeof(*per_node));
+	work = calloc((size_t)pool->nnodes * DRNG_POOL_MAX_GENS,
+		      sizeof(*work));
+	if (!slice_node || !per_node || !work) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	drng_pool_slice_nodes(pool, out, nslices, slice_node);
+	for (s = 0; s < nslices; s++)
+		per_node[slice_node[s]]++;
+
+	/* One worker per generator of the node as long as slices are left */
+	for (i = 0; i < pool->nnodes; i++) {
+		struct drng_pool_node *n = &pool->node[i];
+		uint32_t workers = (uint32_t)min((size_t)n->ngens, per_node[i]);
+
+		for (w = 0; w < workers; w++, nwork++) {
+			struct drng_pool_work *wk = &work[nwork];
+
+			wk->node = n;
+			wk->nidx = i;
+			wk->worker = w;
+			wk->workers = workers;
+			wk->slice_node = slice_node;
+			wk->nslices = nslices;
+			wk->buf = out;
+			wk->len = len;
+			if (!drng_pool_thread(&wk->thread, &n->cpus,
+					      drng_pool_fill_worker, wk))
+				wk->started = 1;
+		}
+	}
+
+	/* Workers without a thread are executed by the caller */
+	for (s = 0; s < nwork; s++) {
+		if (work[s].started)
+			pthread_join(work[s].thread, NULL);
+		else
+			drng_pool_fill_worker(&work[s]);
+		if (work[s].ret && !ret)
+			ret = work[s].ret;
+	}
+
+out:
+	free(slice_node);
+	free(per_node);
+	free(work);
+	return ret;
+}
+
+/************************ ChaCha20 DRNG daemon client ************************/
+
+struct chacha20_drng_client {
+	int fd;
+};
+
+static int drng_chacha20_client_request(struct chacha20_drng_client *client,
+					uint32_t type, uint32_t count,
+					uint64_t bound, void *outbuf,
+					uint32_t outbuflen)
+{
+	struct drng_chacha20_client_req req;
+	struct drng_chacha20_client_rsp rsp;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t ret;
+
+	req.type = type;
+	req.count = count;
+	req.bound = bound;
+
+	do {
+		ret = send(client->fd, &req, sizeof(req), MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+	if (ret != sizeof(req))
+		return -EIO;
+
+	iov[0].iov_base = &rsp;
+	iov[0].iov_len = sizeof(rsp);
+	iov[1].iov_base = outbuf;
+	iov[1].iov_len = outbuflen;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	do {
+		ret = recvmsg(client->fd, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+	if (ret < (ssize_t)sizeof(rsp) || (msg.msg_flags & MSG_TRUNC))
+		return -EIO;
+	if (rsp.status)
+		return (rsp.status < 0) ? rsp.status : -EIO;
+	if (rsp.len != outbuflen || (size_t)ret != sizeof(rsp) + outbuflen)
+		return -EIO;
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_client_connect(struct chacha20_drng_client **client,
+				 const char *path)
+{
+	struct chacha20_drng_client *c;
+	struct sockaddr_un addr;
+	int ret;
+
+	if (!path)
+		path = DRNG_CHACHA20_CLIENT_SOCKET;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	c = malloc(sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (c->fd < 0) {
+		ret = -errno;
+		free(c);
+		return ret;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ret = -errno;
+		close(c->fd);
+		free(c);
+		return ret;
+	}
+
+	*client = c;
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_client_disconnect(struct chacha20_drng_client *client)
+{
+	if (!client)
+		return;
+
+	close(client->fd);
+	free(client);
+}
+
+DSO_PUBLIC
+int drng_chacha20_client_get(struct chacha20_drng_client *client,
+			     uint8_t *outbuf, uint32_t outbuflen)
+{
+	while (outbuflen) {
+		uint32_t todo = min(outbuflen, DRNG_CHACHA20_CLIENT_MAXLEN);
+		int ret = drng_chacha20_client_request(client,
+						DRNG_CHACHA20_CLIENT_BYTES,
+						todo, 0, outbuf, todo);
+
+		if (ret)
+			return ret;
+
+		outbuf += todo;
+		outbuflen -= todo;
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_client_get_u32(struct chacha20_drng_client *client,
+				 uint32_t *out, uint32_t count, uint32_t bound)
+{
+	static const uint32_t max = DRNG_CHACHA20_CLIENT_MAXLEN /
+				    sizeof(uint32_t);
+
+	while (count) {
+		uint32_t todo = min(count, max);
+		int ret = drng_chacha20_client_request(client,
+						DRNG_CHACHA20_CLIENT_U32,
+						todo, bound, out,
+						todo * sizeof(uint32_t));
+
+		if (ret)
+			return ret;
+
+		out += todo;
+		count -= todo;
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_client_get_u64(struct chacha20_drng_client *client,
+				 uint64_t *out, uint32_t count, uint64_t bound)
+{
+	static const uint32_t max = DRNG_CHACHA20_CLIENT_MAXLEN /
+				    sizeof(uint64_t);
+
+	while (count) {
+		uint32_t todo = min(count, max);
+		int ret = drng_chacha20_client_request(client,
+						DRNG_CHACHA20_CLIENT_U64,
+						todo, bound, out,
+						todo * sizeof(uint64_t));
+
+		if (ret)
+			return ret;
+
+		out += todo;
+		count -= todo;
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_client_get_double(struct chacha20_drng_client *client,
+				    double *out, uint32_t count)
+{
+	static const uint32_t max = DRNG_CHACHA20_CLIENT_MAXLEN /
+				    sizeof(double);
+
+	while (count) {
+		uint32_t todo = min(count, max);
+		int ret = drng_chacha20_client_request(client,
+						DRNG_CHACHA20_CLIENT_DOUBLE,
+						todo, 0, out,
+						todo * sizeof(double));
+
+		if (ret)
+			return ret;
+
+		out += todo;
+		count -= todo;
+	}
+
+	return 0;
+}
+
+/******************* ChaCha20 DRNG shared memory distribution *****************/
+
+#define DRNG_SHM_MAGIC		0x43433230	/* "CC20" */
+#define DRNG_SHM_MIN_RINGSIZE	4096
+#define DRNG_SHM_CACHELINE	64
+
+/* Control data shared by the producer and all consumers */
+struct drng_shm_hdr {
+	uint32_t magic;
+	uint32_t ringsize;
+	uint32_t low_watermark;
+	uint32_t stop;
+	uint32_t producer_sleeping;
+	uint32_t doorbell;	/* futex the producer sleeps on */
+} __aligned(DRNG_SHM_CACHELINE);
+
+/*
+ * Control data of one ring buffer followed by the ring buffer data. The
+ * producer and consumer owned fields are placed on separate cache lines.
+ */
+struct drng_shm_ring {
+	uint64_t head __aligned(DRNG_SHM_CACHELINE);	/* bytes produced */
+	uint32_t seq;		/* futex the consumer sleeps on */
+	uint32_t refill;	/* refill requested by consumer */
+	uint64_t tail __aligned(DRNG_SHM_CACHELINE);	/* bytes consumed */
+	uint32_t consumer_sleeping;
+} __aligned(DRNG_SHM_CACHELINE);
+
+/*
+ * Producer view of one ring buffer. The head is never read back from the
+ * shared memory which is writable by the consumer.
+ */
+struct drng_shm_prod_ring {
+	int fd;
+	struct drng_shm_ring *ring;
+	uint64_t head;
+};
+
+struct chacha20_drng_shm_producer {
+	int fd;
+	struct drng_shm_hdr *hdr;
+	uint32_t consumers;
+	uint32_t ringsize;
+	uint32_t mask;
+	struct drng_shm_prod_ring rings[];
+};
+
+struct chacha20_drng_shm {
+	struct drng_shm_hdr *hdr;
+	struct drng_shm_ring *ring;
+	uint8_t *data;
+	uint64_t tail;
+	uint32_t mask;
+	uint32_t low_watermark;
+};
+
+static inline long drng_futex(uint32_t *uaddr, int op, uint32_t val)
+{
+	return syscall(__NR_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static inline size_t drng_shm_ringlen(uint32_t ringsize)
+{
+	return sizeof(struct drng_shm_ring) + ringsize;
+}
+
+/* Allocate a sealed and mapped memfd of the given size */
+static int drng_shm_memfd(size_t len, void **map)
+{
+	void *mem;
+	int fd, ret;
+
+	fd = memfd_create("chacha20_drng_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, (off_t)len) < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	/* Consumers must not be able to pull the memory from the producer */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) <
+	    0) {
+		ret = -errno;
+		goto err;
+	}
+
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		ret = -errno;
+		goto err;
+	}
+
+	/* prevent paging out of the random numbers to swap space */
+	if (mlock(mem, len) && errno != EPERM && errno != EAGAIN) {
+		ret = -errno;
+		munmap(mem, len);
+		goto err;
+	}
+
+	*map = mem;
+
+	return fd;
+
+err:
+	close(fd);
+	return ret;
+}
+
+/* Consumer side: ask the producer to refill, wake it only if it sleeps */
+static inline void drng_shm_request_refill(struct drng_shm_hdr *hdr,
+					   struct drng_shm_ring *ring)
+{
+	if (__atomic_exchange_n(&ring->refill, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	__atomic_add_fetch(&hdr->doorbell, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->producer_sleeping, __ATOMIC_SEQ_CST))
+		drng_futex(&hdr->doorbell, FUTEX_WAKE, 1);
+}
+
+/* Producer side: top up one ring buffer */
+static int drng_shm_fill(struct chacha20_drng_shm_producer *p,
+			 struct drng_shm_prod_ring *pr,
+			 struct chacha20_drng *drng)
+{
+	struct drng_shm_ring *ring = pr->ring;
+	uint8_t *data = (uint8_t *)ring + sizeof(*ring);
+	uint64_t head = pr->head, used;
+	uint32_t free;
+	int ret;
+
+	/* Clear the request first so that a concurrent request is not lost */
+	__atomic_store_n(&ring->refill, 0, __ATOMIC_SEQ_CST);
+
+	/* The tail is consumer controlled, a bogus value must not overflow */
+	used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (used > p->ringsize)
+		used = p->ringsize;
+	free = p->ringsize - (uint32_t)used;
+	if (!free)
+		return 0;
+
+	while (free) {
+		uint32_t off = (uint32_t)head & p->mask;
+		uint32_t todo = min(free, p->ringsize - off);
+
+		ret = drng_chacha20_get(drng, data + off, todo);
+		if (ret)
+			return ret;
+
+		head += todo;
+		free -= todo;
+	}
+
+	pr->head = head;
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->consumer_sleeping, __ATOMIC_SEQ_CST))
+		drng_futex(&ring->seq, FUTEX_WAKE, 1);
+
+	return 0;
+}
+
+static int drng_shm_refill_pending(struct chacha20_drng_shm_producer *p)
+{
+	uint32_t i;
+
+	for (i = 0; i < p->consumers; i++) {
+		if (__atomic_load_n(&p->rings[i].ring->refill,
+				    __ATOMIC_SEQ_CST))
+			return 1;
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_shm_producer_alloc(
+			struct chacha20_drng_shm_producer **producer,
+			uint32_t consumers, uint32_t ringsize,
+			uint32_t low_watermark)
+{
+	struct chacha20_drng_shm_producer *p;
+	uint32_t size = DRNG_SHM_MIN_RINGSIZE, i;
+	void *mem;
+	int ret;
+
+	if (!consumers || ringsize > (1U<<31))
+		return -EINVAL;
+
+	while (size < ringsize)
+		size <<= 1;
+	if (!low_watermark)
+		low_watermark = size / 2;
+	if (low_watermark > size)
+		return -EINVAL;
+
+	p = calloc(1, sizeof(*p) + (size_t)consumers * sizeof(p->rings[0]));
+	if (!p)
+		return -ENOMEM;
+
+	p->consumers = consumers;
+	p->ringsize = size;
+	p->mask = size - 1;
+	for (i = 0; i < consumers; i++)
+		p->rings[i].fd = -1;
+
+	p->fd = drng_shm_memfd(sizeof(struct drng_shm_hdr), &mem);
+	if (p->fd < 0) {
+		ret = p->fd;
+		goto err;
+	}
+	p->hdr = mem;
+
+	/* One memfd per ring: a consumer cannot access the other rings */
+	for (i = 0; i < consumers; i++) {
+		struct drng_shm_prod_ring *pr = &p->rings[i];
+
+		pr->fd = drng_shm_memfd(drng_shm_ringlen(size), &mem);
+		if (pr->fd < 0) {
+			ret = pr->fd;
+			goto err;
+		}
+		pr->ring = mem;
+		pr->ring->refill = 1;
+	}
+
+	p->hdr->ringsize = size;
+	p->hdr->low_watermark = low_watermark;
+	__atomic_store_n(&p->hdr->magic, DRNG_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	*producer = p;
+
+	return 0;
+
+err:
+	drng_chacha20_shm_producer_free(p);
+	return ret;
+}
+
+DSO_PUBLIC
+int drng_chacha20_shm_producer_fd(struct chacha20_drng_shm_producer *producer)
+{
+	return producer->fd;
+}
+
+DSO_PUBLIC
+int drng_chacha20_shm_producer_ring_fd(
+			struct chacha20_drng_shm_producer *producer,
+			uint32_t consumer)
+{
+	if (consumer >= producer->consumers)
+		return -EINVAL;
+
+	return producer->rings[consumer].fd;
+}
+
+DSO_PUBLIC
+int drng_chacha20_shm_producer_run(struct chacha20_drng_shm_producer *producer,
+				   struct chacha20_drng *drng)
+{
+	struct drng_shm_hdr *hdr = producer->hdr;
+	uint32_t i;
+	int ret;
+
+	while (!__atomic_load_n(&hdr->stop, __ATOMIC_SEQ_CST)) {
+		uint32_t doorbell;
+
+		for (i = 0; i < producer->consumers; i++) {
+			ret = drng_shm_fill(producer, &producer->rings[i],
+					    drng);
+			if (ret)
+				return ret;
+		}
+
+		/*
+		 * Announce the sleep before checking for new refill requests
+		 * so that no wakeup of a consumer is lost.
+		 */
+		__atomic_store_n(&hdr->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+		doorbell = __atomic_load_n(&hdr->doorbell, __ATOMIC_SEQ_CST);
+		if (!drng_shm_refill_pending(producer) &&
+		    !__atomic_load_n(&hdr->stop, __ATOMIC_SEQ_CST))
+			drng_futex(&hdr->doorbell, FUTEX_WAIT, doorbell);
+		__atomic_store_n(&hdr->producer_sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_shm_producer_stop(
+			struct chacha20_drng_shm_producer *producer)
+{
+	struct drng_shm_hdr *hdr = producer->hdr;
+	uint32_t i;
+
+	__atomic_store_n(&hdr->stop, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&hdr->doorbell, 1, __ATOMIC_SEQ_CST);
+	drng_futex(&hdr->doorbell, FUTEX_WAKE, INT_MAX);
+
+	for (i = 0; i < producer->consumers; i++) {
+		struct drng_shm_ring *ring = producer->rings[i].ring;
+
+		__atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+		drng_futex(&ring->seq, FUTEX_WAKE, INT_MAX);
+	}
+}
+
+DSO_PUBLIC
+void drng_chacha20_shm_producer_free(
+			struct chacha20_drng_shm_producer *producer)
+{
+	size_t ringlen;
+	uint32_t i;
+
+	if (!producer)
+		return;
+
+	ringlen = drng_shm_ringlen(producer->ringsize);
+	for (i = 0; i < producer->consumers; i++) {
+		struct drng_shm_prod_ring *pr = &producer->rings[i];
+
+		if (pr->fd < 0)
+			continue;
+		memset_secure(pr->ring, 0, ringlen);
+		munmap(pr->ring, ringlen);
+		close(pr->fd);
+	}
+
+	if (producer->hdr) {
+		munmap(producer->hdr, sizeof(*producer->hdr));
+		close(producer->fd);
+	}
+	free(producer);
+}
+
+DSO_PUBLIC
+int drng_chacha20_shm_attach(struct chacha20_drng_shm **shm, int fd,
+			     int ring_fd)
+{
+	struct chacha20_drng_shm *c;
+	struct drng_shm_hdr hdr;
+	struct stat sb;
+	int ret;
+
+	if (fstat(fd, &sb) < 0)
+		return -errno;
+	if ((uint64_t)sb.st_size < sizeof(hdr) ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return -EINVAL;
+	if (hdr.magic != DRNG_SHM_MAGIC ||
+	    hdr.ringsize < DRNG_SHM_MIN_RINGSIZE ||
+	    (hdr.ringsize & (hdr.ringsize - 1)))
+		return -EINVAL;
+	if (fstat(ring_fd, &sb) < 0)
+		return -errno;
+	if ((uint64_t)sb.st_size < drng_shm_ringlen(hdr.ringsize))
+		return -EINVAL;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->hdr = mmap(NULL, sizeof(hdr), PROT_READ | PROT_WRITE, MAP_SHARED,
+		      fd, 0);
+	if (c->hdr == MAP_FAILED) {
+		ret = -errno;
+		free(c);
+		return ret;
+	}
+
+	c->ring = mmap(NULL, drng_shm_ringlen(hdr.ringsize),
+		       PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+	if (c->ring == MAP_FAILED) {
+		ret = -errno;
+		munmap(c->hdr, sizeof(hdr));
+		free(c);
+		return ret;
+	}
+
+	c->data = (uint8_t *)c->ring + sizeof(*c->ring);
+	c->tail = __atomic_load_n(&c->ring->tail, __ATOMIC_ACQUIRE);
+	c->mask = hdr.ringsize - 1;
+	c->low_watermark = hdr.low_watermark;
+
+	*shm = c;
+
+	return 0;
+}
+
+DSO_PUBLIC
+int drng_chacha20_shm_get(struct chacha20_drng_shm *shm, uint8_t *outbuf,
+			  uint32_t outbuflen)
+{
+	struct drng_shm_hdr *hdr = shm->hdr;
+	struct drng_shm_ring *ring = shm->ring;
+
+	while (outbuflen) {
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint32_t avail = (uint32_t)(head - shm->tail);
+
+		if (!avail) {
+			uint32_t seq;
+
+			if (__atomic_load_n(&hdr->stop, __ATOMIC_SEQ_CST))
+				return -EPIPE;
+
+			/* Underrun: sleep until the producer refilled */
+			drng_shm_request_refill(hdr, ring);
+			__atomic_store_n(&ring->consumer_sleeping, 1,
+					 __ATOMIC_SEQ_CST);
+			seq = __atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) ==
+			    shm->tail &&
+			    !__atomic_load_n(&hdr->stop, __ATOMIC_SEQ_CST))
+				drng_futex(&ring->seq, FUTEX_WAIT, seq);
+			__atomic_store_n(&ring->consumer_sleeping, 0,
+					 __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		while (avail && outbuflen) {
+			uint32_t off = (uint32_t)shm->tail & shm->mask;
+			uint32_t todo = min(min(avail, outbuflen),
+					    shm->mask + 1 - off);
+
+			memcpy(outbuf, shm->data + off, todo);
+			memset_secure(shm->data + off, 0, todo);
+			outbuf += todo;
+			outbuflen -= todo;
+			avail -= todo;
+			shm->tail += todo;
+		}
+
+		__atomic_store_n(&ring->tail, shm->tail, __ATOMIC_RELEASE);
+
+		if (avail < shm->low_watermark)
+			drng_shm_request_refill(hdr, ring);
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_shm_detach(struct chacha20_drng_shm *shm)
+{
+	if (!shm)
+		return;
+
+	munmap(shm->ring, drng_shm_ringlen(shm->mask + 1));
+	munmap(shm->hdr, sizeof(*shm->hdr));
+	free(shm);
+}
+
+/************************ Internal benchmark interface ************************/
+#ifdef CHACHA20_DRNG_INTERNALS
+
+#include "chacha20_drng_internals.h"
+
+DSO_PUBLIC
+void drng_chacha20_int_block(struct chacha20_drng *drng, uint32_t *stream)
+{
+	chacha20_block(&drng->chacha20.constants[0], stream);
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_seed(struct chacha20_drng *drng, const uint8_t *inbuf,
+			   uint32_t inbuflen)
+{
+	return drng_chacha20_seed(&drng->chacha20, inbuf, inbuflen);
+}
+
+DSO_PUBLIC
+void drng_chacha20_int_update(struct chacha20_drng *drng)
+{
+	drng_chacha20_update(&drng->chacha20, NULL, CHACHA20_BLOCK_SIZE_WORDS);
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_generate(struct chacha20_drng *drng, uint8_t *outbuf,
+			       uint32_t outbuflen)
+{
+	return drng_chacha20_generate(&drng->chacha20, outbuf, outbuflen);
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_generate_xor(struct chacha20_drng *drng, uint8_t *inout,
+				   uint32_t len)
+{
+	return drng_chacha20_generate_xor(&drng->chacha20, inout, len);
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_generate_multi(struct chacha20_drng **drngs,
+				     uint8_t **outbufs, uint32_t outbuflen,
+				     uint32_t nsec, uint32_t num)
+{
+	struct chacha20_state *chacha20[CHACHA20_MULTI_LANES];
+	uint32_t i, l;
+
+	if (!outbuflen || outbuflen > CHACHA20_BLOCK_SIZE)
+		return -EINVAL;
+
+	for (i = 0; i < num; i += CHACHA20_MULTI_LANES) {
+		uint32_t todo = min(num - i, CHACHA20_MULTI_LANES);
+
+		for (l = 0; l < todo; l++)
+			chacha20[l] = &drngs[i + l]->chacha20;
+		drng_chacha20_generate_multi(chacha20, outbufs + i, outbuflen,
+					     nsec, todo);
+	}
+
+	return 0;
+}
+
+DSO_PUBLIC
+void drng_chacha20_int_copy(struct chacha20_drng *dst,
+			    const struct chacha20_drng *src)
+{
+	memcpy(&dst->chacha20, &src->chacha20, sizeof(dst->chacha20));
+}
+
+DSO_PUBLIC
+void drng_chacha20_int_get_time(time_t *sec, uint32_t *nsec)
+{
+	get_time(sec, nsec);
+}
+
+DSO_PUBLIC
+void drng_chacha20_int_age(struct chacha20_drng *drng, uint32_t seconds)
+{
+	time_t now = 0;
+
+	get_time(&now, NULL);
+	drng->last_seeded = now - seconds;
+}
+
+DSO_PUBLIC
+void drng_chacha20_int_generated(struct chacha20_drng *drng, uint64_t bytes)
+{
+	drng->generated_bytes = bytes;
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_seeder_start(struct chacha20_drng *drng)
+{
+	if (drng->seeder)
+		return -EBUSY;
+
+	return drng_seeder_start(drng);
+}
+
+DSO_PUBLIC
+void drng_chacha20_int_seed_lock(int lock)
+{
+	if (lock)
+		pthread_mutex_lock(&drng_seed_lock);
+	else
+		pthread_mutex_unlock(&drng_seed_lock);
+}
+
+DSO_PUBLIC
+uint32_t drng_chacha20_int_seed_users(void)
+{
+	uint32_t users;
+
+	pthread_mutex_lock(&drng_seed_lock);
+	users = drng_seed_users;
+	pthread_mutex_unlock(&drng_seed_lock);
+
+	return users;
+}
+
+DSO_PUBLIC
+uint32_t drng_chacha20_int_prefetch_epoch(struct chacha20_drng *drng)
+{
+	struct drng_prefetch *pf = drng->prefetch;
+	uint32_t epoch;
+
+	if (!pf)
+		return 0;
+
+	pthread_mutex_lock(&pf->lock);
+	epoch = pf->epoch;
+	pthread_mutex_unlock(&pf->lock);
+
+	return epoch;
+}
+
+DSO_PUBLIC
+uint32_t drng_chacha20_int_mappings(const struct chacha20_drng *drng)
+{
+	struct drng_mapping *m;
+	uint32_t num = 0;
+
+	pthread_mutex_lock(&drng_mappings_lock);
+	for (m = drng_mappings; m; m = m->next) {
+		if (m->owner == drng)
+			num++;
+	}
+	pthread_mutex_unlock(&drng_mappings_lock);
+
+	return num;
+}
+
+DSO_PUBLIC
+void drng_chacha20_int_shm_corrupt(struct chacha20_drng_shm *shm)
+{
+	struct drng_shm_ring *ring = shm->ring;
+
+	__atomic_store_n(&ring->tail,
+			 __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) + 1,
+			 __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->refill, 0, __ATOMIC_SEQ_CST);
+	drng_shm_request_refill(shm->hdr, ring);
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_getrandom(uint8_t *buf, uint32_t buflen)
+{
+#ifdef GETRANDOM
+	return drng_getrandom_get(buf, buflen, 0);
+#else
+	(void)buf;
+	(void)buflen;
+	return -EOPNOTSUPP;
+#endif
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_jent(uint8_t *buf, uint32_t buflen)
+{
+#ifdef JENT
+	return drng_jent_get(buf, buflen, 0);
+#else
+	(void)buf;
+	(void)buflen;
+	return -EOPNOTSUPP;
+#endif
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_devrandom(uint8_t *buf, uint32_t buflen)
+{
+#ifdef DEVRANDOM
+	return drng_random_get(buf, buflen, 0);
+#else
+	(void)buf;
+	(void)buflen;
+	return -EOPNOTSUPP;
+#endif
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_shuffle(struct chacha20_drng *drng, void *base,
+			      size_t nmemb, size_t size, size_t block_bytes)
+{
+	return drng_shuffle(drng, base, nmemb, size, block_bytes);
+}
+
+DSO_PUBLIC
+int drng_chacha20_int_sample(struct chacha20_drng *drng, size_t n, size_t k,
+			     size_t *out, int method)
+{
+	return drng_sample(drng, n, k, out, method);
+}
+
+#endif /* CHACHA20_DRNG_INTERNALS */
@@ -49,6 +49,13 @@ struct chacha20_drng;
  *
  * The memory is pinned so that the DRNG state cannot be swapped out to disk.
  *
+ * The handle is fork-safe: its memory is wiped in a child process
+ * (MADV_WIPEONFORK) and the child reseeds the handle with its next use
+ * transparently, a pthread_atfork handler marks the handle stale with
+ * kernels lacking MADV_WIPEONFORK. A prefetch thread is not present in the
+ * child, prefetching is disabled for inherited handles. The child handles of
+ * drng_chacha20_split() and the deterministic stream handles are not covered.
+ *
  * As part of the allocation, the seed source is initialized.
  *
  * The state of the DRNG is automatically seeded from the internal
@@ -59,6 +66,95 @@ struct chacha20_drng;
  */
 int drng_chacha20_init(struct chacha20_drng **drng);
 
+/**
+ * drng_chacha20_init_seedfile() - Initialization seeded from a seed file
+ *
+ * @drng: [out] cipher handle allocated by the function
+ * @path: [in] path name of the seed file - it is created with the access mode
+ *	  0600 if it does not exist
+ *
+ * Variant of drng_chacha20_init() for early boot and freshly started
+ * containers where the seed sources may block for a long time. The seed
+ * written by drng_chacha20_seedfile_write() during the previous run is read
+ * from the file and mixed into the state together with the data the
+ * getrandom system call and /dev/random deliver without blocking. The Jitter
+ * RNG is not used at this point.
+ *
+ * The seed file is locked with flock(2) and overwritten with new random
+ * numbers of the DRNG before the function returns, so that a seed is never
+ * used twice. If the seed file does not hold a complete seed or cannot be
+ * overwritten, the handle is seeded from the seed sources as with
+ * drng_chacha20_init().
+ *
+ * Unless getrandom and /dev/random already delivered sufficient data, the
+ * full seed from all seed sources is completed in the background as
+ * documented for drng_chacha20_init_nonblock().
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_init_seedfile(struct chacha20_drng **drng, const char *path);
+
+/**
+ * drng_chacha20_init_nonblock() - Initialization without waiting for seed
+ *
+ * @drng: [out] cipher handle allocated by the function
+ *
+ * Variant of drng_chacha20_init() which returns immediately: the state is
+ * seeded with the data the getrandom system call (GRND_NONBLOCK) and
+ * /dev/random deliver without blocking. If this is less than the key size,
+ * the handle is not fully seeded and a background thread collects the full
+ * seed from all seed sources, waiting for them as long as necessary. The
+ * seed is absorbed by the next drng_chacha20_get() or drng_chacha20_seeded()
+ * call after the thread is done, or superseded by a successful
+ * drng_chacha20_reseed().
+ *
+ * Random numbers of a handle that is not fully seeded must only be used for
+ * purposes which are not security critical.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_init_nonblock(struct chacha20_drng **drng);
+
+/**
+ * drng_chacha20_seeded() - Query whether the handle is fully seeded
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ *
+ * @return 1 if fully seeded, 0 if the background seeding is still pending,
+ *	   < 0 if the background seeding failed
+ */
+int drng_chacha20_seeded(struct chacha20_drng *drng);
+
+/**
+ * drng_chacha20_seeded_fd() - Obtain an eventfd signaling the full seed
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ *
+ * The returned eventfd becomes readable (POLLIN) when the background seeding
+ * has finished or the handle was fully reseeded otherwise - it is readable
+ * right away for a fully seeded handle. Afterwards drng_chacha20_seeded()
+ * reports the result. The file descriptor is owned by the handle and closed
+ * by drng_chacha20_destroy(), the caller must not read from or close it.
+ *
+ * @return file descriptor upon success; < 0 on error
+ */
+int drng_chacha20_seeded_fd(struct chacha20_drng *drng);
+
+/**
+ * drng_chacha20_seedfile_write() - Store a new seed in the seed file
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @path: [in] path name of the seed file
+ *
+ * The seed file is replaced with random numbers of the DRNG and synced to
+ * disk. The function should be invoked during a clean shutdown and
+ * periodically, e.g. every hour, so that an unclean shutdown still leaves a
+ * seed for drng_chacha20_init_seedfile().
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_seedfile_write(struct chacha20_drng *drng, const char *path);
+
 /**
  * drng_chacha20_destroy() - Secure deletion of the ChaCha20 DRNG cipher handle
  *
@@ -100,6 +196,166 @@ void drng_chacha20_destroy(struct chacha20_drng *drng);
 int drng_chacha20_get(struct chacha20_drng *drng, uint8_t *outbuf,
 		      uint32_t outbuflen);
 
+/* Return code of drng_chacha20_get_deadline() for a deferred reseed */
+#define DRNG_CHACHA20_RESEED_DEFERRED	1
+
+/**
+ * drng_chacha20_get_deadline() - Obtain random numbers within a deadline
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @outbuf: [out] allocated buffer that is to be filled with random numbers
+ * @outbuflen: [in] length of outbuf indicating the size of the random
+ *	number byte string to be generated
+ * @deadline_ns: [in] absolute deadline in nanoseconds of CLOCK_MONOTONIC
+ *
+ * This call operates like drng_chacha20_get() with the exception of the
+ * automated reseed: a due reseed is only performed if the duration of the
+ * previous reseed operations indicates that it completes before the deadline.
+ * The seed sources are queried without blocking. Otherwise, the reseed is
+ * deferred to the next call and the random numbers are generated from the
+ * current state.
+ *
+ * A reseed can only be deferred until the last reseed is 3600 seconds ago or
+ * 4GB of random numbers were generated. Beyond these limits, no random
+ * numbers are generated if the reseed cannot be performed. The caller then
+ * has to reseed the handle with drng_chacha20_reseed() or
+ * drng_chacha20_get() outside of its time-critical path.
+ *
+ * The deadline covers the reseed only. The generation of the random numbers
+ * itself is always performed.
+ *
+ * @return 0 upon success; DRNG_CHACHA20_RESEED_DEFERRED upon success with a
+ *	   deferred reseed; -EAGAIN if the reseed cannot be deferred any
+ *	   further; < 0 on other errors
+ */
+int drng_chacha20_get_deadline(struct chacha20_drng *drng, uint8_t *outbuf,
+			       uint32_t outbuflen, uint64_t deadline_ns);
+
+/**
+ * drng_chacha20_get_multi() - Obtain random numbers from many handles at once
+ *
+ * @drngs: [in] array of allocated ChaCha20 cipher handles
+ * @outbufs: [out] array of buffers, outbufs[i] is filled with random numbers
+ *	     of drngs[i]
+ * @outbuflen: [in] length of each of the buffers
+ * @num: [in] number of handles and buffers
+ *
+ * This call operates like drng_chacha20_get() invoked for each handle in
+ * turn and is intended for applications holding many handles which each
+ * request small amounts of random numbers, such as one handle per network
+ * connection.
+ *
+ * For requests of at most 64 bytes, the ChaCha20 block operations of four
+ * handles are computed in parallel in the lanes of one vector register. The
+ * output and the new state of each handle are identical to those of
+ * drng_chacha20_get() with the same time stamp: one time stamp is obtained
+ * per call and mixed into all handles. Handles with a due reseed, with
+ * prefetching enabled or after fork(2) are served by drng_chacha20_get().
+ * Larger requests are always served by drng_chacha20_get().
+ *
+ * All handles are used by the calling thread, i.e. none of them must be used
+ * by another thread during the call. A handle may occur multiple times in
+ * the array.
+ *
+ * @return 0 upon success; < 0 on error - the random numbers of the handles
+ *	   preceding the failed handle are generated, the following buffers
+ *	   are not touched
+ */
+int drng_chacha20_get_multi(struct chacha20_drng **drngs, uint8_t **outbufs,
+			    uint32_t outbuflen, uint32_t num);
+
+/**
+ * drng_chacha20_xor() - XOR random numbers into a buffer
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @inout: [in/out] buffer the random numbers are XORed into
+ * @len: [in] length of inout
+ *
+ * This call operates like drng_chacha20_get() but XORs the random numbers
+ * into the buffer instead of overwriting it, e.g. to scramble memory or mask
+ * data. Full blocks at a 4 byte aligned address are XORed by the ChaCha20
+ * block operation directly without an intermediate buffer, other data is
+ * XORed from a block on the stack. The state update after the operation is
+ * the same as for drng_chacha20_get(). The random numbers are always
+ * generated from the state of the handle, prefetched random numbers are not
+ * used.
+ *
+ * The masking cannot be reverted as the random numbers cannot be generated
+ * again. Use drng_chacha20_det_xor() for a mask that must be removed later.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_xor(struct chacha20_drng *drng, uint8_t *inout, uint32_t len);
+
+/* Size of the buffer of drng_chacha20_borrow() */
+#define DRNG_CHACHA20_BORROW_SIZE	4096
+
+/**
+ * drng_chacha20_borrow() - Access random numbers without copying them
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @ptr: [out] start of the random numbers
+ * @len: [in/out] on input, the number of random numbers the caller needs at
+ *	 least - 0 is treated as 1, at most DRNG_CHACHA20_BORROW_SIZE; on
+ *	 output, the number of random numbers available at ptr
+ *
+ * The random numbers are generated into a buffer of the handle with
+ * DRNG_CHACHA20_BORROW_SIZE bytes and exposed read-only, so a caller parsing
+ * random numbers right away, e.g. into bounded integers or bits, saves the
+ * copy of drng_chacha20_get(). The buffer is refilled by drng_chacha20_get()
+ * once fewer than the requested number of bytes are left, the remainder is
+ * discarded.
+ *
+ * Every byte the caller used must be marked with drng_chacha20_consume()
+ * before the next call on the handle - otherwise it is handed out again. The
+ * following rules apply:
+ *
+ * * The window is only valid until the next call on the handle. Any
+ *   drng_chacha20_consume(), drng_chacha20_borrow(), reseed or
+ *   drng_chacha20_destroy() may wipe or replace its content.
+ *
+ * * Like all other operations, the window belongs to the thread using the
+ *   handle and must not be read by other threads.
+ *
+ * * Any reseed -- automatic, explicit or the completion of the background
+ *   seeding -- discards the unconsumed random numbers. Once a reseed is due,
+ *   drng_chacha20_borrow() refills the buffer after performing it. In a
+ *   child process after fork(2), the buffer is wiped and refilled from the
+ *   new state.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_borrow(struct chacha20_drng *drng, const uint8_t **ptr,
+			 uint32_t *len);
+
+/**
+ * drng_chacha20_consume() - Mark borrowed random numbers as used
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @n: [in] number of bytes at the start of the window of
+ *     drng_chacha20_borrow() the caller used
+ *
+ * The consumed bytes are wiped and the window is advanced by n bytes. The
+ * remaining random numbers are returned by the next drng_chacha20_borrow().
+ *
+ * @return 0 upon success; -EINVAL if n exceeds the window
+ */
+int drng_chacha20_consume(struct chacha20_drng *drng, uint32_t n);
+
+/**
+ * drng_chacha20_fork_gen_ref() - Obtain the fork generation of the process
+ *
+ * The fork generation changes in the child process after fork(2). Random
+ * numbers the caller buffers outside of a DRNG handle, e.g. the C++ API,
+ * must be discarded once the value at the returned location differs from
+ * the value read when they were obtained - otherwise parent and child hand
+ * out the same random numbers. Reading the location is as cheap as reading a
+ * global variable.
+ *
+ * @return location of the fork generation, valid for the process lifetime
+ */
+const uint32_t *drng_chacha20_fork_gen_ref(void);
+
 /**
  * drng_chacha20_reseed() - Reseed the ChaCha20 DRNG
  *
@@ -116,6 +372,728 @@ int drng_chacha20_get(struct chacha20_drng *drng, uint8_t *outbuf,
 int drng_chacha20_reseed(struct chacha20_drng *drng, const uint8_t *inbuf,
 			 uint32_t inbuflen);
 
+/**
+ * drng_chacha20_prefetch_enable() - Enable prefetching of random numbers
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @bufsize: [in] size of each of the two prefetch buffers in bytes -
+ *	     rounded up to a multiple of the ChaCha20 block size
+ * @cpu: [in] CPU the refill thread is bound to - a negative value leaves
+ *	 the refill thread unbound
+ *
+ * A background thread keeps two buffers filled with random numbers. The
+ * thread operates on a ChaCha20 state of its own which is seeded from the
+ * DRNG handle. After each buffer, this state is updated to ensure
+ * backtracking resistance, and before each buffer a time stamp is mixed into
+ * it.
+ *
+ * With prefetching enabled, drng_chacha20_get() copies the random numbers
+ * from the ready buffer and erases the copied data. If no prefetched data
+ * is available, the random numbers are generated synchronously. When the
+ * handle is reseeded, the prefetched data is discarded and the state of the
+ * refill thread is seeded with new data from the handle.
+ *
+ * The DRNG handle itself must still be used by one thread at a time. The
+ * prefetch buffers are wiped in a child process after fork(2), prefetching
+ * must be enabled again by the child.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_prefetch_enable(struct chacha20_drng *drng, uint32_t bufsize,
+				  int cpu);
+
+/**
+ * drng_chacha20_prefetch_disable() - Disable prefetching of random numbers
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ *
+ * The refill thread is terminated and the prefetch buffers are securely
+ * erased. drng_chacha20_destroy() implies this operation.
+ */
+void drng_chacha20_prefetch_disable(struct chacha20_drng *drng);
+
+/**
+ * drng_chacha20_prefetch_underruns() - Number of prefetch buffer underruns
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ *
+ * @return number of drng_chacha20_get() calls which had to generate random
+ *	   numbers synchronously because the prefetch buffers were empty
+ */
+uint64_t drng_chacha20_prefetch_underruns(struct chacha20_drng *drng);
+
+/**
+ * DOC: ChaCha20 DRNG bit API
+ *
+ * Random bits for coin flips, masks and other decisions consuming only a few
+ * bits each. Every handle holds a reservoir of up to 64 random bits which is
+ * refilled from the buffer of drng_chacha20_borrow(). The inline functions
+ * serve a request from the reservoir without a function call into the
+ * library; only the refill is performed by drng_chacha20_bits_refill().
+ *
+ * struct drng_chacha20_bits is placed at the start of every DRNG handle for
+ * this purpose. Its members are private to the library and must not be
+ * accessed by the caller.
+ */
+
+struct drng_chacha20_bits {
+	uint64_t word;			/* unused random bits from the LSB */
+	uint32_t avail;			/* number of unused bits in word */
+	uint32_t fork_gen;		/* fork generation of the bits */
+	const uint32_t *fork_gen_ref;	/* current fork generation */
+};
+
+/**
+ * drng_chacha20_bits_refill() - Obtain random bits with a reservoir refill
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @nbits: [in] number of random bits - 1 to 64
+ * @bits: [out] the random bits in the least significant bits
+ *
+ * Out-of-line part of drng_chacha20_get_bits() - use that function instead.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_bits_refill(struct chacha20_drng *drng, uint32_t nbits,
+			      uint64_t *bits);
+
+/**
+ * drng_chacha20_get_bits() - Obtain random bits
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @nbits: [in] number of random bits - 1 to 64
+ * @bits: [out] the random bits in the least significant bits, the other bits
+ *	  are zero
+ *
+ * The bits are taken from the reservoir of the handle and removed from it.
+ * The reservoir is discarded by a reseed and after fork(2) like the buffer
+ * of drng_chacha20_borrow(), whose window is invalidated by a refill.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+static inline int drng_chacha20_get_bits(struct chacha20_drng *drng,
+					 uint32_t nbits, uint64_t *bits)
+{
+	struct drng_chacha20_bits *r = (struct drng_chacha20_bits *)drng;
+
+	/* The reservoir of a handle wiped in a child process is empty */
+	if (__builtin_expect(nbits - 1 < 63 && r->avail >= nbits &&
+			     *r->fork_gen_ref == r->fork_gen, 1)) {
+		*bits = r->word & ((1ULL << nbits) - 1);
+		r->word >>= nbits;
+		r->avail -= nbits;
+		return 0;
+	}
+
+	return drng_chacha20_bits_refill(drng, nbits, bits);
+}
+
+/**
+ * drng_chacha20_get_bool() - Obtain a random bit
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ *
+ * @return 0 or 1 upon success; < 0 on error
+ */
+static inline int drng_chacha20_get_bool(struct chacha20_drng *drng)
+{
+	uint64_t bit;
+	int ret = drng_chacha20_get_bits(drng, 1, &bit);
+
+	return ret ? ret : (int)bit;
+}
+
+/**
+ * DOC: ChaCha20 DRNG runtime statistics
+ *
+ * When the library is compiled with STATISTICS, each DRNG handle maintains
+ * counters about its operation. The counters are not atomic: they are updated
+ * by the thread using the handle and must be read by that thread as well.
+ */
+
+#define DRNG_CHACHA20_STATS_BUCKETS	32
+
+/* Seed sources reported in struct drng_chacha20_stats */
+#define DRNG_CHACHA20_SRC_GETRANDOM	0
+#define DRNG_CHACHA20_SRC_JENT		1
+#define DRNG_CHACHA20_SRC_DEVRANDOM	2
+#define DRNG_CHACHA20_SRC_MAX		3
+
+/**
+ * struct drng_chacha20_stats - runtime statistics of a DRNG handle
+ *
+ * @generated_bytes: bytes returned by drng_chacha20_get()
+ * @get_calls: number of drng_chacha20_get() calls
+ * @blocks: ChaCha20 block operations performed on the state of the handle --
+ *	    the blocks of a prefetch thread are not included
+ * @reseeds_time: reseeds triggered because the last seed is too old
+ * @reseeds_bytes: reseeds triggered because too many bytes were generated
+ * @reseeds_explicit: reseeds by drng_chacha20_init(), drng_chacha20_reseed(),
+ *		      of a handle inherited by a child process and the full
+ *		      seed of the background seeding thread
+ * @reseed_failures: failed reseed operations
+ * @reseeds_deferred: drng_chacha20_get_deadline() calls deferring a due
+ *		      reseed
+ * @source_bytes: bytes obtained from each seed source, indexed by
+ *		  DRNG_CHACHA20_SRC_*
+ * @source_ns: nanoseconds spent in each seed source
+ * @get_latency: histogram of the drng_chacha20_get() latency -- bucket i
+ *		 counts calls taking [2^i, 2^(i+1)) nanoseconds, bucket 0 also
+ *		 counts calls below one nanosecond and the last bucket all
+ *		 calls taking longer
+ * @reseed_latency: histogram of the reseed latency using the same buckets
+ */
+struct drng_chacha20_stats {
+	uint64_t generated_bytes;
+	uint64_t get_calls;
+	uint64_t blocks;
+	uint64_t reseeds_time;
+	uint64_t reseeds_bytes;
+	uint64_t reseeds_explicit;
+	uint64_t reseed_failures;
+	uint64_t reseeds_deferred;
+	uint64_t source_bytes[DRNG_CHACHA20_SRC_MAX];
+	uint64_t source_ns[DRNG_CHACHA20_SRC_MAX];
+	uint64_t get_latency[DRNG_CHACHA20_STATS_BUCKETS];
+	uint64_t reseed_latency[DRNG_CHACHA20_STATS_BUCKETS];
+};
+
+/**
+ * drng_chacha20_get_stats() - Obtain the runtime statistics of a handle
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @stats: [out] statistics since the allocation of the handle
+ *
+ * @return 0 upon success; -EOPNOTSUPP if the library was compiled without
+ *	   STATISTICS
+ */
+int drng_chacha20_get_stats(struct chacha20_drng *drng,
+			    struct drng_chacha20_stats *stats);
+
+/**
+ * DOC: ChaCha20 DRNG event notification
+ *
+ * The processing stages of the DRNG can be observed with a callback
+ * registered with drng_chacha20_set_event_cb(). When the library is compiled
+ * with USDT, the same events are also available as static tracepoints of the
+ * provider chacha20_drng (get__entry, get__exit, reseed__start, reseed__end,
+ * seed__source, selftest). Every tracepoint has the arguments of
+ * struct drng_chacha20_event in the order drng, arg, len, ret.
+ */
+
+/* Event types */
+#define DRNG_CHACHA20_EVENT_GET_ENTRY		0
+#define DRNG_CHACHA20_EVENT_GET_EXIT		1
+#define DRNG_CHACHA20_EVENT_RESEED_START	2
+#define DRNG_CHACHA20_EVENT_RESEED_END		3
+#define DRNG_CHACHA20_EVENT_SEED_SOURCE		4
+#define DRNG_CHACHA20_EVENT_SELFTEST		5
+
+/* Reseed triggers reported by the reseed events */
+#define DRNG_CHACHA20_RESEED_TIME		1
+#define DRNG_CHACHA20_RESEED_BYTES		2
+#define DRNG_CHACHA20_RESEED_EXPLICIT		3
+#define DRNG_CHACHA20_RESEED_FORK		4
+#define DRNG_CHACHA20_RESEED_BACKGROUND		5
+
+/* Self tests reported by the self test event */
+#define DRNG_CHACHA20_SELFTEST_BLOCK		0
+#define DRNG_CHACHA20_SELFTEST_DRNG		1
+#define DRNG_CHACHA20_SELFTEST_DET		2
+
+/**
+ * struct drng_chacha20_event - event of the ChaCha20 DRNG
+ *
+ * @type: event type DRNG_CHACHA20_EVENT_*
+ * @arg: reseed trigger DRNG_CHACHA20_RESEED_* for the reseed events, seed
+ *	 source DRNG_CHACHA20_SRC_* for the seed source event, self test
+ *	 DRNG_CHACHA20_SELFTEST_* for the self test event, 0 otherwise
+ * @len: requested bytes for the get events, bytes delivered by the seed
+ *	 source for the seed source event, 0 otherwise
+ * @ret: return code of the operation for the get exit, reseed end, seed
+ *	 source and self test events, 0 otherwise
+ * @drng: DRNG handle the event relates to, NULL for the self test event
+ */
+struct drng_chacha20_event {
+	uint32_t type;
+	uint32_t arg;
+	uint32_t len;
+	int32_t ret;
+	struct chacha20_drng *drng;
+};
+
+/**
+ * drng_chacha20_set_event_cb() - Register a callback for DRNG events
+ *
+ * @cb: [in] callback invoked synchronously by the thread processing the
+ *	     event, NULL unregisters the callback
+ * @priv: [in] pointer handed to the callback
+ *
+ * One callback is registered for the entire process. The callback must not
+ * invoke the DRNG API itself. The registration is not synchronized with DRNG
+ * operations running in parallel: such operations may still invoke the
+ * previous callback.
+ */
+void drng_chacha20_set_event_cb(void (*cb)(const struct drng_chacha20_event *ev,
+					   void *priv),
+				void *priv);
+
+/**
+ * DOC: ChaCha20 DRNG child API
+ *
+ * A child DRNG is derived from a parent DRNG with drng_chacha20_split(). The
+ * derivation costs one ChaCha20 block operation: the first half of the
+ * generated block forms the key of the child, the second half is XORed into
+ * the key of the parent. Thus, neither the child can deduce the state of the
+ * parent nor the parent the state of the child. No system call and no self
+ * test is performed and the child does not need to be allocated, i.e. it can
+ * reside on the stack of a task.
+ *
+ * Reseed inheritance: a child never accesses the noise sources. Its entropy
+ * is inherited from the parent at the time of the split. A reseed of the
+ * parent after the split does not affect existing children. A child performs
+ * the same backtracking resistance update as the DRNG after every request.
+ * After 1<<30 bytes, a child refuses to generate more data with -EAGAIN and
+ * a new child must be split off. Children are intended to be short-lived,
+ * e.g. for the duration of a task. Grandchildren split off from a child
+ * inherit the entropy of the child and start with a new budget.
+ *
+ * The fields of struct chacha20_drng_child are private to the library.
+ */
+
+struct chacha20_drng_child {
+	uint32_t state[16];
+	uint64_t generated_bytes;
+};
+
+/**
+ * drng_chacha20_split() - Derive a child DRNG from a DRNG
+ *
+ * @parent: [in] allocated ChaCha20 cipher handle
+ * @child: [out] child DRNG to be initialized
+ *
+ * The derivation counts towards the reseed threshold of the parent, but the
+ * parent is not reseeded by this function.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_split(struct chacha20_drng *parent,
+			struct chacha20_drng_child *child);
+
+/**
+ * drng_chacha20_child_split() - Derive a child DRNG from a child DRNG
+ *
+ * @parent: [in] initialized child DRNG
+ * @child: [out] child DRNG to be initialized
+ *
+ * @return 0 upon success; -EAGAIN if the budget of the parent is exhausted
+ */
+int drng_chacha20_child_split(struct chacha20_drng_child *parent,
+			      struct chacha20_drng_child *child);
+
+/**
+ * drng_chacha20_child_get() - Obtain random numbers from a child DRNG
+ *
+ * @child: [in] initialized child DRNG
+ * @outbuf: [out] allocated buffer that is to be filled with random numbers
+ * @outbuflen: [in] length of outbuf
+ *
+ * @return 0 upon success; -EAGAIN if the budget of the child is exhausted
+ */
+int drng_chacha20_child_get(struct chacha20_drng_child *child,
+			    uint8_t *outbuf, uint32_t outbuflen);
+
+/**
+ * drng_chacha20_child_zero() - Secure deletion of a child DRNG
+ *
+ * @child: [in] child DRNG to be erased
+ */
+void drng_chacha20_child_zero(struct chacha20_drng_child *child);
+
+/**
+ * DOC: ChaCha20 deterministic stream API
+ *
+ * The deterministic stream mode is intended for reproducible simulations
+ * and the generation of synthetic data. Contrary to the ChaCha20 DRNG, the
+ * output only depends on a caller-provided key and stream identifier: no
+ * noise sources are used, no time stamps are mixed in and no backtracking
+ * resistance update is performed. Thus, the same key always produces the same
+ * bytes and anybody who knows the key can recompute all output. The mode must
+ * therefore not be used for generating cryptographic keys.
+ *
+ * The output is the plain ChaCha20 key stream using a 64 bit block counter
+ * (state words 12 and 13) and a 64 bit stream identifier (state words 14
+ * and 15). Any byte offset of the stream can be selected in O(1), which
+ * allows many workers to generate disjoint regions of one logical stream in
+ * parallel.
+ */
+
+/* Size of the key of the deterministic stream mode */
+#define DRNG_CHACHA20_DET_KEYLEN	32
+
+/* Size of the state exported with drng_chacha20_det_save */
+#define DRNG_CHACHA20_DET_STATELEN	56
+
+struct chacha20_drng_det;
+
+/**
+ * drng_chacha20_det_init() - Allocate a deterministic stream handle
+ *
+ * @det: [out] handle allocated by the function
+ * @key: [in] key of DRNG_CHACHA20_DET_KEYLEN bytes
+ * @keylen: [in] length of key - must be DRNG_CHACHA20_DET_KEYLEN
+ * @stream: [in] identifier of the stream - different identifiers with the same
+ *	    key produce independent streams
+ *
+ * Before the allocation is performed, a self test of the ChaCha20 cipher
+ * is executed. The stream is positioned at offset 0.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_det_init(struct chacha20_drng_det **det, const uint8_t *key,
+			   uint32_t keylen, uint64_t stream);
+
+/**
+ * drng_chacha20_det_destroy() - Secure deletion of deterministic stream handle
+ *
+ * @det: [in] handle to be deallocated
+ */
+void drng_chacha20_det_destroy(struct chacha20_drng_det *det);
+
+/**
+ * drng_chacha20_det_get() - Obtain the next bytes of the stream
+ *
+ * @det: [in] allocated deterministic stream handle
+ * @outbuf: [out] allocated buffer that is to be filled with the stream bytes
+ * @outbuflen: [in] length of outbuf
+ *
+ * The stream position is advanced by outbuflen bytes. Splitting a request
+ * into multiple requests does not change the generated bytes.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_det_get(struct chacha20_drng_det *det, uint8_t *outbuf,
+			  uint32_t outbuflen);
+
+/**
+ * drng_chacha20_det_xor() - XOR the next bytes of the stream into a buffer
+ *
+ * @det: [in] allocated deterministic stream handle
+ * @inout: [in/out] buffer the stream bytes are XORed into
+ * @len: [in] length of inout
+ *
+ * This call operates like drng_chacha20_det_get() but XORs the stream bytes
+ * into the buffer. Full blocks at a 4 byte aligned address are XORed by the
+ * ChaCha20 block operation directly. The buffer can be processed with
+ * multiple calls of arbitrary length. Applying the same stream position
+ * again restores the original data, e.g. to unmask a record after
+ * drng_chacha20_det_seek().
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_det_xor(struct chacha20_drng_det *det, uint8_t *inout,
+			  uint32_t len);
+
+/**
+ * drng_chacha20_det_seek() - Set the stream position
+ *
+ * @det: [in] allocated deterministic stream handle
+ * @offset: [in] byte offset of the next byte to be generated - byte offset
+ *	    N is found in ChaCha20 block N / 64
+ */
+void drng_chacha20_det_seek(struct chacha20_drng_det *det, uint64_t offset);
+
+/**
+ * drng_chacha20_det_tell() - Obtain the stream position
+ *
+ * @det: [in] allocated deterministic stream handle
+ *
+ * @return byte offset of the next byte to be generated
+ */
+uint64_t drng_chacha20_det_tell(struct chacha20_drng_det *det);
+
+/**
+ * drng_chacha20_det_save() - Export the state of the stream
+ *
+ * @det: [in] allocated deterministic stream handle
+ * @state: [out] buffer of DRNG_CHACHA20_DET_STATELEN bytes
+ *
+ * The exported state contains the key, the stream identifier and the stream
+ * position in a host-independent format. It must be protected like the key.
+ */
+void drng_chacha20_det_save(struct chacha20_drng_det *det,
+			    uint8_t state[DRNG_CHACHA20_DET_STATELEN]);
+
+/**
+ * drng_chacha20_det_restore() - Import the state of the stream
+ *
+ * @det: [in] allocated deterministic stream handle
+ * @state: [in] state exported with drng_chacha20_det_save()
+ *
+ * The handle continues the stream at the exported position. The operation
+ * does not allocate memory and does not perform a self test.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_det_restore(struct chacha20_drng_det *det,
+			      const uint8_t state[DRNG_CHACHA20_DET_STATELEN]);
+
+/**
+ * DOC: ChaCha20 DRNG shuffle and sampling API
+ *
+ * Random permutations and random subsets generated with a ChaCha20 DRNG
+ * handle. The random numbers are obtained from the DRNG in batches and are
+ * converted into unbiased bounded integers without divisions in the common
+ * case. Two bounded integers are derived from one 32 bit random number while
+ * the product of their ranges fits into 32 bits.
+ */
+
+/**
+ * drng_chacha20_shuffle() - Randomly permute an array
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @base: [in/out] array to be permuted
+ * @nmemb: [in] number of array elements
+ * @size: [in] size of one array element in bytes
+ *
+ * All permutations of the array are equally likely. Arrays fitting into the
+ * last level cache are shuffled in place with the Fisher-Yates algorithm.
+ * Larger arrays are distributed into random buckets which are shuffled
+ * individually in cache, which requires a temporary copy of the array. If
+ * the temporary memory cannot be allocated, the array is shuffled in place.
+ *
+ * @return 0 upon success; < 0 on error - the array content is then
+ *	   undefined, but no element is lost
+ */
+int drng_chacha20_shuffle(struct chacha20_drng *drng, void *base, size_t nmemb,
+			  size_t size);
+
+/**
+ * drng_chacha20_sample_indices() - Select distinct random indices
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @n: [in] size of the population - the indices are in the range [0, n)
+ * @k: [in] number of indices to select - must not be larger than n
+ * @out: [out] array of k elements receiving the indices
+ *
+ * Every subset of k indices is equally likely and the selected indices are
+ * stored in random order. Robert Floyd's algorithm is used which requires
+ * O(k) random numbers. The selected indices are tracked with a bitmap of n
+ * bits if it is not larger than out, otherwise with a hash table of O(k)
+ * entries.
+ *
+ * @return 0 upon success; -EINVAL if k > n; -ENOMEM if the tracking memory
+ *	   cannot be allocated; < 0 on other errors
+ */
+int drng_chacha20_sample_indices(struct chacha20_drng *drng, size_t n, size_t k,
+				 size_t *out);
+
+/**
+ * DOC: ChaCha20 DRNG token and UUID API
+ *
+ * Batches of random strings generated with a ChaCha20 DRNG handle: UUIDs,
+ * hexadecimal and base64url encoded tokens as well as tokens of characters
+ * from an arbitrary alphabet. The random bytes of a batch are obtained from
+ * the DRNG with one request per 4096 bytes and are converted to the
+ * characters with word-wise (SIMD within a register) encoders. The random
+ * bytes are zeroized after use.
+ *
+ * Every function writes @count strings with a terminating NUL character
+ * consecutively to @out. If an error occurs, @out is zeroized.
+ */
+
+/* Length of a UUID string including the terminating NUL character */
+#define DRNG_CHACHA20_UUID_STRLEN	37
+
+/**
+ * drng_chacha20_uuid4() - Generate random UUIDs
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @out: [out] buffer of @count * DRNG_CHACHA20_UUID_STRLEN bytes receiving
+ *	 the UUID strings
+ * @count: [in] number of UUIDs to be generated
+ *
+ * The UUIDs have version 4 as defined in RFC 9562, i.e. they carry 122 random
+ * bits, and are formatted in lower case, e.g.
+ * "0f8fad5b-d9cb-469f-a165-70867728950e".
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_uuid4(struct chacha20_drng *drng, char *out, uint32_t count);
+
+/**
+ * drng_chacha20_uuid7() - Generate time-ordered UUIDs
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @out: [out] buffer of @count * DRNG_CHACHA20_UUID_STRLEN bytes receiving
+ *	 the UUID strings
+ * @count: [in] number of UUIDs to be generated
+ *
+ * The UUIDs have version 7 as defined in RFC 9562: the Unix time stamp in
+ * milliseconds is followed by 74 random bits. All UUIDs of one batch carry
+ * the same time stamp, they are therefore not ordered among each other.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_uuid7(struct chacha20_drng *drng, char *out, uint32_t count);
+
+/**
+ * drng_chacha20_hex() - Generate hexadecimal tokens
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @out: [out] buffer of @count * (@len + 1) bytes receiving the tokens
+ * @len: [in] number of characters of one token
+ * @count: [in] number of tokens to be generated
+ *
+ * Every lower case hexadecimal character carries 4 random bits.
+ *
+ * @return 0 upon success; -EINVAL if @len is 0; < 0 on other errors
+ */
+int drng_chacha20_hex(struct chacha20_drng *drng, char *out, uint32_t len,
+		      uint32_t count);
+
+/**
+ * drng_chacha20_base64url() - Generate base64url tokens
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @out: [out] buffer of @count * (@len + 1) bytes receiving the tokens
+ * @len: [in] number of characters of one token
+ * @count: [in] number of tokens to be generated
+ *
+ * Every character of the URL and file name safe base64 alphabet of RFC 4648
+ * carries 6 random bits, no padding characters are added.
+ *
+ * @return 0 upon success; -EINVAL if @len is 0; < 0 on other errors
+ */
+int drng_chacha20_base64url(struct chacha20_drng *drng, char *out,
+			    uint32_t len, uint32_t count);
+
+/**
+ * drng_chacha20_token() - Generate tokens from an alphabet
+ *
+ * @drng: [in] allocated ChaCha20 cipher handle
+ * @alphabet: [in] NUL-terminated string of the characters to choose from,
+ *	      the characters should be distinct
+ * @out: [out] buffer of @count * (@len + 1) bytes receiving the tokens
+ * @len: [in] number of characters of one token
+ * @count: [in] number of tokens to be generated
+ *
+ * Every character of a token is selected from the alphabet with equal
+ * probability: random numbers which would cause a bias are rejected.
+ *
+ * @return 0 upon success; -EINVAL if @len is 0 or the alphabet has less than
+ *	   2 or more than 256 characters; < 0 on other errors
+ */
+int drng_chacha20_token(struct chacha20_drng *drng, const char *alphabet,
+			char *out, uint32_t len, uint32_t count);
+
+/**
+ * DOC: ChaCha20 DRNG NUMA pool API
+ *
+ * A pool holds a set of ChaCha20 DRNG instances for every NUMA node with
+ * CPUs the process may execute on. The memory of the instances of a node is
+ * bound to the node with mbind(2) and initialized by a thread executing on
+ * the node, i.e. even without a NUMA memory policy the instances are placed
+ * on the node by the first touch. The memory is locked with mlock(2).
+ *
+ * Requests are served by an instance of the node of the calling CPU. The
+ * instances of the pool are protected by locks, the pool can be used by
+ * multiple threads concurrently. Without NUMA support all CPUs form node 0.
+ */
+
+struct chacha20_drng_pool;
+
+/**
+ * drng_chacha20_pool_alloc() - Allocate a NUMA pool of ChaCha20 DRNGs
+ *
+ * @pool: [out] pool handle allocated by the function
+ * @per_node: [in] instances per NUMA node, at most 64 - if 0, one instance
+ *	      per CPU of the node is allocated, at most 64
+ *
+ * All instances are seeded during the allocation.
+ *
+ * @return 0 upon success; -ENODEV if no node with CPUs is found; < 0 on
+ *	   other errors
+ */
+int drng_chacha20_pool_alloc(struct chacha20_drng_pool **pool,
+			     uint32_t per_node);
+
+/**
+ * drng_chacha20_pool_free() - Zeroize and free a NUMA pool
+ *
+ * @pool: [in] pool handle to be deallocated
+ */
+void drng_chacha20_pool_free(struct chacha20_drng_pool *pool);
+
+/**
+ * drng_chacha20_pool_nodes() - Number of NUMA nodes of the pool
+ *
+ * @pool: [in] allocated pool handle
+ *
+ * The nodes are referenced by their index in the range [0, nodes).
+ *
+ * @return number of nodes
+ */
+uint32_t drng_chacha20_pool_nodes(struct chacha20_drng_pool *pool);
+
+/**
+ * drng_chacha20_pool_cpu_node() - Node index of a CPU
+ *
+ * @pool: [in] allocated pool handle
+ * @cpu: [in] CPU number
+ *
+ * @return node index serving requests issued on @cpu; < 0 on error
+ */
+int drng_chacha20_pool_cpu_node(struct chacha20_drng_pool *pool, uint32_t cpu);
+
+/**
+ * drng_chacha20_pool_get() - Obtain random numbers from the local node
+ *
+ * @pool: [in] allocated pool handle
+ * @outbuf: [out] allocated buffer that is to be filled with random numbers
+ * @outbuflen: [in] length of outbuf
+ *
+ * The request is served by the preferred instance of the calling CPU on its
+ * node. If that instance is busy, another idle instance of the node is used.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_pool_get(struct chacha20_drng_pool *pool, uint8_t *outbuf,
+			   uint32_t outbuflen);
+
+/**
+ * drng_chacha20_pool_get_node() - Obtain random numbers from a given node
+ *
+ * @pool: [in] allocated pool handle
+ * @node: [in] node index
+ * @outbuf: [out] allocated buffer that is to be filled with random numbers
+ * @outbuflen: [in] length of outbuf
+ *
+ * @return 0 upon success; -EINVAL if the node index is invalid; < 0 on other
+ *	   errors
+ */
+int drng_chacha20_pool_get_node(struct chacha20_drng_pool *pool, uint32_t node,
+				uint8_t *outbuf, uint32_t outbuflen);
+
+/**
+ * drng_chacha20_pool_fill() - Fill a large buffer in parallel
+ *
+ * @pool: [in] allocated pool handle
+ * @buf: [out] buffer that is to be filled with random numbers
+ * @len: [in] length of buf
+ *
+ * The buffer is divided into slices of 2 MB. Every slice is written by a
+ * thread executing on the node holding the memory of the slice, using one
+ * instance of that node. Slices not yet backed by memory are distributed in
+ * contiguous blocks over the nodes and are placed on them by the first
+ * touch. The instances of a node write their slices in parallel. Buffers of
+ * less than 4 MB are filled by the calling thread from the local node.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_pool_fill(struct chacha20_drng_pool *pool, void *buf,
+			    size_t len);
+
 /**
  * drng_chacha20_versionstring() - obtain version string of ChaCha20 DRNG
  *
@@ -147,6 +1125,274 @@ int drng_chacha20_versionstring(char *buf, size_t buflen);
  */
 uint32_t drng_chacha20_version(void);
 
+/**
+ * DOC: ChaCha20 DRNG daemon client API
+ *
+ * The chacha20_drngd daemon found in the daemon/ directory serves random
+ * numbers from one long-running ChaCha20 DRNG instance via a SOCK_SEQPACKET
+ * Unix domain socket. Short-lived processes which only need a few random
+ * bytes can use the API calls below instead of paying the initialization
+ * cost of drng_chacha20_init().
+ *
+ * The wire protocol is defined by struct drng_chacha20_client_req and
+ * struct drng_chacha20_client_rsp: every request is one datagram holding
+ * a struct drng_chacha20_client_req. The daemon answers with one datagram
+ * holding a struct drng_chacha20_client_rsp immediately followed by
+ * len bytes of data. At most DRNG_CHACHA20_CLIENT_MAXLEN bytes of data
+ * can be requested with one datagram. The integers are transported in the
+ * byte order of the local host.
+ */
+
+/* Default location of the socket of the chacha20_drngd daemon */
+#define DRNG_CHACHA20_CLIENT_SOCKET	"/run/chacha20_drngd.socket"
+
+/* Maximum number of data bytes the daemon returns with one datagram */
+#define DRNG_CHACHA20_CLIENT_MAXLEN	65536
+
+/* Request types */
+#define DRNG_CHACHA20_CLIENT_BYTES	0 /* count random bytes */
+#define DRNG_CHACHA20_CLIENT_U32	1 /* count uint32_t values < bound */
+#define DRNG_CHACHA20_CLIENT_U64	2 /* count uint64_t values < bound */
+#define DRNG_CHACHA20_CLIENT_DOUBLE	3 /* count double values in [0, 1) */
+
+struct drng_chacha20_client_req {
+	uint32_t type;
+	uint32_t count;
+	uint64_t bound;		/* 0 requests the full range of the type */
+};
+
+struct drng_chacha20_client_rsp {
+	int32_t status;		/* 0 upon success; < 0 errno value on error */
+	uint32_t len;		/* number of data bytes following */
+};
+
+struct chacha20_drng_client;
+
+/**
+ * drng_chacha20_client_connect() - Connect to the chacha20_drngd daemon
+ *
+ * @client: [out] client handle allocated by the function
+ * @path: [in] path name of the daemon socket - if NULL,
+ *	  DRNG_CHACHA20_CLIENT_SOCKET is used
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_client_connect(struct chacha20_drng_client **client,
+				 const char *path);
+
+/**
+ * drng_chacha20_client_disconnect() - Close the connection to the daemon
+ *
+ * @client: [in] client handle to be deallocated
+ */
+void drng_chacha20_client_disconnect(struct chacha20_drng_client *client);
+
+/**
+ * drng_chacha20_client_get() - Obtain random numbers from the daemon
+ *
+ * @client: [in] connected client handle
+ * @outbuf: [out] allocated buffer that is to be filled with random numbers
+ * @outbuflen: [in] length of outbuf
+ *
+ * Requests larger than DRNG_CHACHA20_CLIENT_MAXLEN are split into multiple
+ * requests transparently.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_client_get(struct chacha20_drng_client *client,
+			     uint8_t *outbuf, uint32_t outbuflen);
+
+/**
+ * drng_chacha20_client_get_u32() - Obtain uniformly distributed integers
+ *
+ * @client: [in] connected client handle
+ * @out: [out] array that is to be filled with the random integers
+ * @count: [in] number of integers to be generated
+ * @bound: [in] exclusive upper bound of the integers - 0 implies that the
+ *	   full range of uint32_t is used
+ *
+ * The daemon uses rejection sampling, i.e. the integers are unbiased.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_client_get_u32(struct chacha20_drng_client *client,
+				 uint32_t *out, uint32_t count, uint32_t bound);
+
+/**
+ * drng_chacha20_client_get_u64() - Obtain uniformly distributed integers
+ *
+ * @client: [in] connected client handle
+ * @out: [out] array that is to be filled with the random integers
+ * @count: [in] number of integers to be generated
+ * @bound: [in] exclusive upper bound of the integers - 0 implies that the
+ *	   full range of uint64_t is used
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_client_get_u64(struct chacha20_drng_client *client,
+				 uint64_t *out, uint32_t count, uint64_t bound);
+
+/**
+ * drng_chacha20_client_get_double() - Obtain uniformly distributed doubles
+ *
+ * @client: [in] connected client handle
+ * @out: [out] array that is to be filled with the random values
+ * @count: [in] number of values to be generated
+ *
+ * Each value is taken from the interval [0, 1) with 53 bits of precision.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_client_get_double(struct chacha20_drng_client *client,
+				    double *out, uint32_t count);
+
+/**
+ * DOC: ChaCha20 DRNG shared memory API
+ *
+ * A producer process operates one ChaCha20 DRNG instance and fills one
+ * single-producer/single-consumer ring buffer per consumer process with
+ * random numbers. Each ring buffer resides in a memfd shared memory region
+ * of its own, a further memfd holds the control data shared by all
+ * consumers. The file descriptors are inherited by forked consumer processes
+ * or handed to other processes via SCM_RIGHTS.
+ *
+ * A consumer obtains random numbers with drng_chacha20_shm_get() which
+ * copies the data out of its ring buffer and zeroizes the consumed slots
+ * without any system call. Only when the fill level of the ring buffer
+ * falls below the low watermark, the producer is woken up. The consumer
+ * sleeps only when its ring buffer is empty.
+ *
+ * The producer keeps the geometry of the ring buffers and their fill levels
+ * in its private memory, i.e. a consumer corrupting the shared memory cannot
+ * cause the producer to access memory out of bounds. Yet, each consumer can
+ * stop the producer via the control data. Thus, the shared memory
+ * distribution must only be used among processes that trust each other.
+ * Each ring buffer must only be used by one consumer thread at a time.
+ */
+
+struct chacha20_drng_shm_producer;
+struct chacha20_drng_shm;
+
+/**
+ * drng_chacha20_shm_producer_alloc() - Allocate the shared memory region
+ *
+ * @producer: [out] producer handle allocated by the function
+ * @consumers: [in] number of consumer ring buffers
+ * @ringsize: [in] size of each ring buffer in bytes - rounded up to the
+ *	      next power of two, at least 4096
+ * @low_watermark: [in] fill level in bytes below which a consumer requests a
+ *		   refill of its ring buffer - if 0, half of the ring buffer
+ *		   size is used
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_shm_producer_alloc(
+			struct chacha20_drng_shm_producer **producer,
+			uint32_t consumers, uint32_t ringsize,
+			uint32_t low_watermark);
+
+/**
+ * drng_chacha20_shm_producer_fd() - Obtain file descriptor of control data
+ *
+ * @producer: [in] allocated producer handle
+ *
+ * The file descriptor is to be handed to drng_chacha20_shm_attach() of all
+ * consumers. It is opened with O_CLOEXEC.
+ *
+ * @return file descriptor of the memfd holding the control data
+ */
+int drng_chacha20_shm_producer_fd(struct chacha20_drng_shm_producer *producer);
+
+/**
+ * drng_chacha20_shm_producer_ring_fd() - Obtain file descriptor of a ring
+ *
+ * @producer: [in] allocated producer handle
+ * @consumer: [in] index of the ring buffer
+ *
+ * The file descriptor is to be handed to drng_chacha20_shm_attach() of the
+ * one consumer using the ring buffer only. It is opened with O_CLOEXEC.
+ *
+ * @return file descriptor of the memfd holding the ring buffer; -EINVAL if
+ *	   the index is not smaller than the number of consumers
+ */
+int drng_chacha20_shm_producer_ring_fd(
+			struct chacha20_drng_shm_producer *producer,
+			uint32_t consumer);
+
+/**
+ * drng_chacha20_shm_producer_run() - Fill the ring buffers
+ *
+ * @producer: [in] allocated producer handle
+ * @drng: [in] allocated ChaCha20 DRNG handle used to generate the data
+ *
+ * The function fills all ring buffers and sleeps until a consumer requests a
+ * refill. It only returns after drng_chacha20_shm_producer_stop() was called
+ * or if the DRNG fails.
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_shm_producer_run(struct chacha20_drng_shm_producer *producer,
+				   struct chacha20_drng *drng);
+
+/**
+ * drng_chacha20_shm_producer_stop() - Stop the producer
+ *
+ * @producer: [in] allocated producer handle
+ *
+ * The stop request is stored in the shared memory region. Thus, the function
+ * can also be invoked by another process than the one executing
+ * drng_chacha20_shm_producer_run(). Consumers waiting for data are woken up
+ * and receive an error.
+ */
+void drng_chacha20_shm_producer_stop(
+			struct chacha20_drng_shm_producer *producer);
+
+/**
+ * drng_chacha20_shm_producer_free() - Release the shared memory region
+ *
+ * @producer: [in] producer handle to be deallocated
+ *
+ * The ring buffers are securely erased.
+ */
+void drng_chacha20_shm_producer_free(
+			struct chacha20_drng_shm_producer *producer);
+
+/**
+ * drng_chacha20_shm_attach() - Attach a consumer to its ring buffer
+ *
+ * @shm: [out] consumer handle allocated by the function
+ * @fd: [in] file descriptor obtained with drng_chacha20_shm_producer_fd()
+ * @ring_fd: [in] file descriptor of the ring buffer used by the consumer
+ *	     obtained with drng_chacha20_shm_producer_ring_fd()
+ *
+ * @return 0 upon success; < 0 on error
+ */
+int drng_chacha20_shm_attach(struct chacha20_drng_shm **shm, int fd,
+			     int ring_fd);
+
+/**
+ * drng_chacha20_shm_get() - Obtain random numbers from the ring buffer
+ *
+ * @shm: [in] attached consumer handle
+ * @outbuf: [out] allocated buffer that is to be filled with random numbers
+ * @outbuflen: [in] length of outbuf
+ *
+ * The data is copied out of the ring buffer and the consumed slots are
+ * zeroized. The call only enters the kernel when the ring buffer runs low
+ * or is empty.
+ *
+ * @return 0 upon success; -EPIPE if the producer was stopped
+ */
+int drng_chacha20_shm_get(struct chacha20_drng_shm *shm, uint8_t *outbuf,
+			  uint32_t outbuflen);
+
+/**
+ * drng_chacha20_shm_detach() - Detach the consumer from the ring buffer
+ *
+ * @shm: [in] consumer handle to be deallocated
+ */
+void drng_chacha20_shm_detach(struct chacha20_drng_shm *shm);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _CHACHA20_DRNG_HPP
+#define _CHACHA20_DRNG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <system_error>
+#include <type_traits>
+
+#if __cplusplus >= 202002L
+# include <span>
+#endif
+
+#include "chacha20_drng.h"
+
+/**
+ * DOC: ChaCha20 DRNG C++ API
+ *
+ * Header-only C++11 wrapper of a ChaCha20 DRNG handle satisfying the
+ * UniformRandomBitGenerator requirements, i.e. it can be used with the
+ * <random> distributions and std::shuffle.
+ *
+ * Random numbers are obtained from the DRNG in batches of BufferSize bytes
+ * and handed out from the buffer by the inline operator(). Consumed bytes
+ * are zeroized. Errors of the C API are reported with std::system_error
+ * carrying the positive errno value.
+ *
+ * A handle must not be used by multiple threads concurrently, use
+ * drng_chacha20::thread_drng() to obtain a handle per thread. The C handle
+ * reseeds itself in a child after fork(2) and the buffer inherited by the
+ * child is dropped once the fork generation of drng_chacha20_fork_gen_ref()
+ * changed, so parent and child never return the same random numbers.
+ */
+namespace drng_chacha20 {
+
+template <typename UIntType, std::size_t BufferSize = 4096>
+class basic_drng {
+	static_assert(std::is_same<UIntType, uint32_t>::value ||
+		      std::is_same<UIntType, uint64_t>::value,
+		      "result_type must be uint32_t or uint64_t");
+	static_assert(BufferSize >= sizeof(UIntType) &&
+		      BufferSize % sizeof(UIntType) == 0 &&
+		      BufferSize <= UINT32_MAX,
+		      "BufferSize must be a multiple of the result size");
+
+public:
+	typedef UIntType result_type;
+
+	static constexpr result_type min()
+	{
+		return 0;
+	}
+
+	static constexpr result_type max()
+	{
+		return std::numeric_limits<result_type>::max();
+	}
+
+	/* Allocate and seed the DRNG, throws std::system_error on failure */
+	basic_drng()
+		: drng_(nullptr), fork_gen_ref_(drng_chacha20_fork_gen_ref()),
+		  fork_gen_(0), pos_(BufferSize)
+	{
+		int ret = drng_chacha20_init(&drng_);
+
+		if (ret)
+			throw std::system_error(-ret, std::generic_category(),
+						"drng_chacha20_init");
+	}
+
+	~basic_drng()
+	{
+		release();
+	}
+
+	basic_drng(const basic_drng &) = delete;
+	basic_drng &operator=(const basic_drng &) = delete;
+
+	/* The moved-from object has no DRNG handle and must not be used */
+	basic_drng(basic_drng &&other) noexcept
+		: drng_(other.drng_), fork_gen_ref_(other.fork_gen_ref_),
+		  fork_gen_(other.fork_gen_), pos_(other.pos_)
+	{
+		std::memcpy(buf_ + pos_, other.buf_ + pos_, BufferSize - pos_);
+		other.drng_ = nullptr;
+		other.discard();
+	}
+
+	basic_drng &operator=(basic_drng &&other) noexcept
+	{
+		if (this != &other) {
+			release();
+			drng_ = other.drng_;
+			fork_gen_ref_ = other.fork_gen_ref_;
+			fork_gen_ = other.fork_gen_;
+			pos_ = other.pos_;
+			std::memcpy(buf_ + pos_, other.buf_ + pos_,
+				    BufferSize - pos_);
+			other.drng_ = nullptr;
+			other.discard();
+		}
+		return *this;
+	}
+
+	/*
+	 * Return one random number, refills the buffer if it is exhausted or
+	 * was inherited from the parent process
+	 */
+	result_type operator()()
+	{
+		result_type val;
+
+		if (BufferSize - pos_ < sizeof(val) ||
+		    *fork_gen_ref_ != fork_gen_)
+			refill();
+		std::memcpy(&val, buf_ + pos_, sizeof(val));
+		std::memset(buf_ + pos_, 0, sizeof(val));
+		pos_ += sizeof(val);
+
+		return val;
+	}
+
+	/*
+	 * Fill the memory with random numbers: the buffered random numbers
+	 * are used first, requests of at least BufferSize bytes are served
+	 * directly by the DRNG without copying through the buffer.
+	 */
+	void fill(void *out, std::size_t len)
+	{
+		uint8_t *p = static_cast<uint8_t *>(out);
+
+		if (*fork_gen_ref_ != fork_gen_)
+			discard();
+
+		while (len) {
+			std::size_t todo;
+
+			if (pos_ == BufferSize && len >= BufferSize) {
+				todo = len < UINT32_MAX ? len : UINT32_MAX;
+				get(p, todo);
+			} else {
+				if (pos_ == BufferSize)
+					refill();
+				todo = BufferSize - pos_;
+				if (todo > len)
+					todo = len;
+				std::memcpy(p, buf_ + pos_, todo);
+				std::memset(buf_ + pos_, 0, todo);
+				pos_ += todo;
+			}
+			p += todo;
+			len -= todo;
+		}
+	}
+
+#if __cplusplus >= 202002L
+	template <typename T, std::size_t Extent>
+	void fill(std::span<T, Extent> out)
+	{
+		static_assert(std::is_integral<T>::value ||
+			      std::is_same<T, std::byte>::value,
+			      "span elements must be integers or std::byte");
+		fill(out.data(), out.size_bytes());
+	}
+#endif
+
+	/* Reseed the DRNG with optional additional data, drops the buffer */
+	void reseed(const void *seed = nullptr, uint32_t seedlen = 0)
+	{
+		int ret = drng_chacha20_reseed(drng_,
+				static_cast<const uint8_t *>(seed), seedlen);
+
+		discard();
+		if (ret)
+			throw std::system_error(-ret, std::generic_category(),
+						"drng_chacha20_reseed");
+	}
+
+	/* Zeroize the buffered random numbers */
+	void discard() noexcept
+	{
+		memset_secure(buf_ + pos_, BufferSize - pos_);
+		pos_ = BufferSize;
+	}
+
+	struct chacha20_drng *native_handle() noexcept
+	{
+		return drng_;
+	}
+
+private:
+	struct chacha20_drng *drng_;
+	const uint32_t *fork_gen_ref_;
+	uint32_t fork_gen_;	/* fork generation the buffer was filled in */
+	std::size_t pos_;
+	alignas(64) uint8_t buf_[BufferSize];
+
+	/* Not optimized away even if the object is destroyed afterwards */
+	static void memset_secure(void *s, std::size_t n) noexcept
+	{
+		std::memset(s, 0, n);
+		__asm__ __volatile__("" : : "r" (s) : "memory");
+	}
+
+	void get(uint8_t *out, std::size_t len)
+	{
+		int ret = drng_chacha20_get(drng_, out,
+					    static_cast<uint32_t>(len));
+
+		if (ret)
+			throw std::system_error(-ret, std::generic_category(),
+						"drng_chacha20_get");
+	}
+
+	/* Kept out of line so that operator() stays small enough to inline */
+	__attribute__((noinline)) void refill()
+	{
+		get(buf_, BufferSize);
+		fork_gen_ = *fork_gen_ref_;
+		pos_ = 0;
+	}
+
+	void release() noexcept
+	{
+		discard();
+		if (drng_)
+			drng_chacha20_destroy(drng_);
+		drng_ = nullptr;
+	}
+};
+
+typedef basic_drng<uint32_t> drng32;
+typedef basic_drng<uint64_t> drng64;
+
+/*
+ * DRNG handle of the calling thread allocated at first use and destroyed at
+ * thread exit.
+ */
+template <typename UIntType = uint64_t>
+inline basic_drng<UIntType> &thread_drng()
+{
+	thread_local basic_drng<UIntType> drng;
+
+	return drng;
+}
+
+} /* namespace drng_chacha20 */
+
+#endif /* _CHACHA20_DRNG_HPP */
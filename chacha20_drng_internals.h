@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _CHACHA20_DRNG_INTERNALS_H
+#define _CHACHA20_DRNG_INTERNALS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#include "chacha20_drng.h"
+
+/*
+ * Access to the internal processing stages of the ChaCha20 DRNG for the
+ * benchmark and test applications. These functions are only present when
+ * chacha20_drng.c is compiled with CHACHA20_DRNG_INTERNALS. They are not part
+ * of the library API and must not be used by regular consumers.
+ */
+
+/* Size of one ChaCha20 block in bytes */
+#define DRNG_CHACHA20_INT_BLOCKSIZE	64
+
+/* ChaCha20 block operation on the DRNG state, stream must be 64 bytes */
+void drng_chacha20_int_block(struct chacha20_drng *drng, uint32_t *stream);
+
+/* Seed the DRNG state with the given data without querying seed sources */
+int drng_chacha20_int_seed(struct chacha20_drng *drng, const uint8_t *inbuf,
+			   uint32_t inbuflen);
+
+/* Update of the DRNG state with one ChaCha20 block operation */
+void drng_chacha20_int_update(struct chacha20_drng *drng);
+
+/* Generate random numbers without the reseed and prefetch handling */
+int drng_chacha20_int_generate(struct chacha20_drng *drng, uint8_t *outbuf,
+			       uint32_t outbuflen);
+
+/*
+ * Time stamp seeding and generation of drng_chacha20_get_multi in the vector
+ * lanes without the reseed handling, outbuflen must be 1 to 64 bytes
+ */
+int drng_chacha20_int_generate_multi(struct chacha20_drng **drngs,
+				     uint8_t **outbufs, uint32_t outbuflen,
+				     uint32_t nsec, uint32_t num);
+
+/* Copy the ChaCha20 state of src into dst to compare code paths */
+void drng_chacha20_int_copy(struct chacha20_drng *dst,
+			    const struct chacha20_drng *src);
+
+/* XOR variant of drng_chacha20_int_generate */
+int drng_chacha20_int_generate_xor(struct chacha20_drng *drng, uint8_t *inout,
+				   uint32_t len);
+
+/* Time stamp used for the reseed interval handling */
+void drng_chacha20_int_get_time(time_t *sec, uint32_t *nsec);
+
+/* Set the time of the last seed operation to the given seconds in the past */
+void drng_chacha20_int_age(struct chacha20_drng *drng, uint32_t seconds);
+
+/* Set the number of bytes generated since the last seed operation */
+void drng_chacha20_int_generated(struct chacha20_drng *drng, uint64_t bytes);
+
+/* Start the background seeding of a handle without a seeder */
+int drng_chacha20_int_seeder_start(struct chacha20_drng *drng);
+
+/* Hold (lock != 0) or release the lock serializing the seed sources */
+void drng_chacha20_int_seed_lock(int lock);
+
+/* References to the seed sources held by handles and seeder threads */
+uint32_t drng_chacha20_int_seed_users(void);
+
+/* Number of reseeds of the prefetch buffers, 0 without prefetching */
+uint32_t drng_chacha20_int_prefetch_epoch(struct chacha20_drng *drng);
+
+/* Number of mappings recorded for the handle besides the handle itself */
+uint32_t drng_chacha20_int_mappings(const struct chacha20_drng *drng);
+
+/* Store a tail ahead of the head into the ring buffer and request a refill */
+void drng_chacha20_int_shm_corrupt(struct chacha20_drng_shm *shm);
+
+/*
+ * Seed sources: return the number of bytes obtained, < 0 on error and
+ * -EOPNOTSUPP if the seed source is not compiled in.
+ */
+int drng_chacha20_int_getrandom(uint8_t *buf, uint32_t buflen);
+int drng_chacha20_int_jent(uint8_t *buf, uint32_t buflen);
+int drng_chacha20_int_devrandom(uint8_t *buf, uint32_t buflen);
+
+/*
+ * drng_chacha20_shuffle with the given size of the cache blocks instead of
+ * the last level cache size - SIZE_MAX always shuffles in place
+ */
+int drng_chacha20_int_shuffle(struct chacha20_drng *drng, void *base,
+			      size_t nmemb, size_t size, size_t block_bytes);
+
+/* drng_chacha20_sample_indices with the given tracking of selected indices */
+#define DRNG_CHACHA20_INT_SAMPLE_AUTO	0
+#define DRNG_CHACHA20_INT_SAMPLE_BITMAP	1
+#define DRNG_CHACHA20_INT_SAMPLE_HASH	2
+int drng_chacha20_int_sample(struct chacha20_drng *drng, size_t n, size_t k,
+			     size_t *out, int method);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CHACHA20_DRNG_INTERNALS_H */
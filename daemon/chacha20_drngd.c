@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * chacha20_drngd -- serve random numbers from one ChaCha20 DRNG instance
+ *
+ * All requests received from all clients during one event loop round are
+ * collected and satisfied with one multi-block generation pass of the
+ * master DRNG. Bulk requests of DRNGD_CHILD_THRESHOLD bytes or more are not
+ * added to the batch but are served from a child DRNG that is split off the
+ * master DRNG for the requesting client on first use. This way one bulk
+ * consumer does not inflate the batch.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "chacha20_drng.h"
+
+#define DRNGD_MAX_EVENTS	64
+#define DRNGD_BATCH_SIZE	(1<<20)	/* max bytes of one generation pass */
+#define DRNGD_BATCH_REQS	1024	/* max requests of one generation pass */
+#define DRNGD_REQS_PER_ROUND	16	/* fairness limit per client and round */
+#define DRNGD_CHILD_THRESHOLD	4096	/* requests served by client child */
+#define DRNGD_SEEDFILE_INTERVAL	3600	/* seconds between seed file writes */
+
+struct drngd_client {
+	int fd;
+	int dead;
+	int has_child;
+	struct chacha20_drng_child child;
+	struct drngd_client *next_dead;
+};
+
+struct drngd_req {
+	struct drngd_client *client;
+	struct drng_chacha20_client_req req;
+	uint32_t len;
+	uint32_t offset;
+};
+
+struct drngd {
+	int lfd;
+	int efd;
+	struct chacha20_drng *master;
+	uint8_t *batchbuf;
+	uint32_t batchlen;
+	struct drngd_req reqs[DRNGD_BATCH_REQS];
+	uint32_t nreqs;
+	struct drngd_client *dead;
+	const char *seedfile;
+	time_t seedfile_next;
+};
+
+static volatile sig_atomic_t drngd_stop = 0;
+
+static void drngd_sighandler(int sig)
+{
+	(void)sig;
+	drngd_stop = 1;
+}
+
+static inline void memset_secure(void *s, int c, uint32_t n)
+{
+	memset(s, c, n);
+	__asm__ __volatile__("" : : "r" (s) : "memory");
+}
+
+/* Number of data bytes of the answer to a request, 0 if request is invalid */
+static uint32_t drngd_req_len(struct drng_chacha20_client_req *req)
+{
+	uint64_t len;
+
+	switch (req->type) {
+	case DRNG_CHACHA20_CLIENT_BYTES:
+		len = req->count;
+		break;
+	case DRNG_CHACHA20_CLIENT_U32:
+		if (req->bound > UINT32_MAX)
+			return 0;
+		len = (uint64_t)req->count * sizeof(uint32_t);
+		break;
+	case DRNG_CHACHA20_CLIENT_U64:
+		len = (uint64_t)req->count * sizeof(uint64_t);
+		break;
+	case DRNG_CHACHA20_CLIENT_DOUBLE:
+		len = (uint64_t)req->count * sizeof(double);
+		break;
+	default:
+		return 0;
+	}
+
+	if (len > DRNG_CHACHA20_CLIENT_MAXLEN)
+		return 0;
+
+	return (uint32_t)len;
+}
+
+/*
+ * Convert the random bytes in buf into the requested type in place. Values
+ * rejected by the bounded integer conversion are replaced with new random
+ * numbers from drng.
+ */
+static int drngd_convert(struct chacha20_drng *drng,
+			 struct drng_chacha20_client_req *req, uint8_t *buf)
+{
+	uint32_t i;
+	int ret = 0;
+
+	switch (req->type) {
+	case DRNG_CHACHA20_CLIENT_U32:
+		if (req->bound) {
+			uint32_t bound = (uint32_t)req->bound;
+			/* 2^32 mod bound */
+			uint32_t threshold = (0U - bound) % bound;
+			uint32_t *val = (uint32_t *)buf;
+
+			for (i = 0; i < req->count; i++) {
+				while (val[i] < threshold) {
+					ret = drng_chacha20_get(drng,
+							(uint8_t *)&val[i],
+							sizeof(val[i]));
+					if (ret)
+						return ret;
+				}
+				val[i] %= bound;
+			}
+		}
+		break;
+	case DRNG_CHACHA20_CLIENT_U64:
+		if (req->bound) {
+			uint64_t bound = req->bound;
+			/* 2^64 mod bound */
+			uint64_t threshold = (0ULL - bound) % bound;
+			uint64_t *val = (uint64_t *)buf;
+
+			for (i = 0; i < req->count; i++) {
+				while (val[i] < threshold) {
+					ret = drng_chacha20_get(drng,
+							(uint8_t *)&val[i],
+							sizeof(val[i]));
+					if (ret)
+						return ret;
+				}
+				val[i] %= bound;
+			}
+		}
+		break;
+	case DRNG_CHACHA20_CLIENT_DOUBLE:
+		{
+			uint64_t *val = (uint64_t *)buf;
+			double *d = (double *)buf;
+
+			for (i = 0; i < req->count; i++)
+				d[i] = (double)(val[i] >> 11) * 0x1.0p-53;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+static void drngd_kill_client(struct drngd *d, struct drngd_client *client)
+{
+	if (client->dead)
+		return;
+
+	client->dead = 1;
+	client->next_dead = d->dead;
+	d->dead = client;
+}
+
+static void drngd_reap_clients(struct drngd *d)
+{
+	while (d->dead) {
+		struct drngd_client *client = d->dead;
+
+		d->dead = client->next_dead;
+		epoll_ctl(d->efd, EPOLL_CTL_DEL, client->fd, NULL);
+		close(client->fd);
+		drng_chacha20_child_zero(&client->child);
+		free(client);
+	}
+}
+
+static void drngd_respond(struct drngd *d, struct drngd_client *client,
+			  int32_t status, uint8_t *data, uint32_t len)
+{
+	struct drng_chacha20_client_rsp rsp;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t ret;
+
+	if (client->dead)
+		return;
+
+	rsp.status = status;
+	rsp.len = status ? 0 : len;
+	iov[0].iov_base = &rsp;
+	iov[0].iov_len = sizeof(rsp);
+	iov[1].iov_base = data;
+	iov[1].iov_len = rsp.len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	/*
+	 * A client that does not collect its answers is dropped instead of
+	 * stalling all other clients.
+	 */
+	do {
+		ret = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		drngd_kill_client(d, client);
+}
+
+/* One generation pass for all requests collected in the batch */
+static void drngd_flush(struct drngd *d)
+{
+	uint32_t i;
+	int ret;
+
+	if (!d->nreqs)
+		return;
+
+	ret = drng_chacha20_get(d->master, d->batchbuf, d->batchlen);
+
+	for (i = 0; i < d->nreqs; i++) {
+		struct drngd_req *r = &d->reqs[i];
+		uint8_t *data = d->batchbuf + r->offset;
+
+		if (!ret)
+			ret = drngd_convert(d->master, &r->req, data);
+		drngd_respond(d, r->client, ret, data, r->len);
+	}
+
+	memset_secure(d->batchbuf, 0, d->batchlen);
+	d->batchlen = 0;
+	d->nreqs = 0;
+}
+
+/* Bulk requests are served from the DRNG child of the client */
+static void drngd_serve_child(struct drngd *d, struct drngd_client *client,
+			      struct drng_chacha20_client_req *req,
+			      uint32_t len)
+{
+	uint8_t buf[DRNG_CHACHA20_CLIENT_MAXLEN] __attribute__((aligned(8)));
+	int ret = 0;
+
+	if (!client->has_child) {
+		ret = drng_chacha20_split(d->master, &client->child);
+		client->has_child = !ret;
+	}
+	if (!ret) {
+		ret = drng_chacha20_child_get(&client->child, buf, len);
+		/* Budget of the child is exhausted: split off a new one */
+		if (ret == -EAGAIN) {
+			ret = drng_chacha20_split(d->master, &client->child);
+			if (!ret)
+				ret = drng_chacha20_child_get(&client->child,
+							      buf, len);
+		}
+	}
+	/* Values rejected by the conversion are replaced by the master */
+	if (!ret)
+		ret = drngd_convert(d->master, req, buf);
+
+	drngd_respond(d, client, ret, buf, len);
+	memset_secure(buf, 0, len);
+}
+
+static void drngd_read_client(struct drngd *d, struct drngd_client *client)
+{
+	unsigned int i;
+
+	for (i = 0; i < DRNGD_REQS_PER_ROUND && !client->dead; i++) {
+		struct drng_chacha20_client_req req;
+		uint32_t len;
+		ssize_t ret;
+
+		ret = recv(client->fd, &req, sizeof(req), MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				drngd_kill_client(d, client);
+			return;
+		}
+		if (ret == 0) {
+			drngd_kill_client(d, client);
+			return;
+		}
+
+		len = drngd_req_len(&req);
+		if (ret != sizeof(req) || !len) {
+			drngd_respond(d, client, -EINVAL, NULL, 0);
+			continue;
+		}
+
+		if (len >= DRNGD_CHILD_THRESHOLD) {
+			drngd_serve_child(d, client, &req, len);
+			continue;
+		}
+
+		if (d->nreqs == DRNGD_BATCH_REQS ||
+		    d->batchlen + len > DRNGD_BATCH_SIZE)
+			drngd_flush(d);
+
+		d->reqs[d->nreqs].client = client;
+		d->reqs[d->nreqs].req = req;
+		d->reqs[d->nreqs].len = len;
+		d->reqs[d->nreqs].offset = d->batchlen;
+		d->nreqs++;
+		/* Keep 8-byte alignment for the typed conversions */
+		d->batchlen += (len + 7) & ~7U;
+	}
+}
+
+static void drngd_accept(struct drngd *d)
+{
+	while (1) {
+		struct drngd_client *client;
+		struct epoll_event ev;
+		int fd = accept4(d->lfd, NULL, NULL,
+				 SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd < 0)
+			return;
+
+		client = calloc(1, sizeof(*client));
+		if (!client) {
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = client;
+		if (epoll_ctl(d->efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close(fd);
+			free(client);
+		}
+	}
+}
+
+/* Periodic replacement of the seed file covering an unclean shutdown */
+static void drngd_seedfile(struct drngd *d)
+{
+	time_t now;
+
+	if (!d->seedfile)
+		return;
+
+	now = time(NULL);
+	if (now < d->seedfile_next)
+		return;
+
+	if (drng_chacha20_seedfile_write(d->master, d->seedfile))
+		fprintf(stderr, "Cannot write seed file %s\n", d->seedfile);
+	d->seedfile_next = now + DRNGD_SEEDFILE_INTERVAL;
+}
+
+static int drngd_loop(struct drngd *d)
+{
+	struct epoll_event events[DRNGD_MAX_EVENTS];
+	int timeout = d->seedfile ? DRNGD_SEEDFILE_INTERVAL * 1000 : -1;
+
+	while (!drngd_stop) {
+		int i, n = epoll_wait(d->efd, events, DRNGD_MAX_EVENTS,
+				      timeout);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct drngd_client *client = events[i].data.ptr;
+
+			if (!client) {
+				drngd_accept(d);
+				continue;
+			}
+
+			if (events[i].events & EPOLLIN)
+				drngd_read_client(d, client);
+			else if (events[i].events &
+				 (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				drngd_kill_client(d, client);
+		}
+
+		drngd_flush(d);
+		drngd_reap_clients(d);
+		drngd_seedfile(d);
+	}
+
+	return 0;
+}
+
+static int drngd_listen(struct drngd *d, const char *path, mode_t mode)
+{
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	d->lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			0);
+	if (d->lfd < 0)
+		return -errno;
+
+	unlink(path);
+	if (bind(d->lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		return -errno;
+	if (chmod(path, mode) < 0)
+		return -errno;
+	if (listen(d->lfd, SOMAXCONN) < 0)
+		return -errno;
+
+	d->efd = epoll_create1(EPOLL_CLOEXEC);
+	if (d->efd < 0)
+		return -errno;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(d->efd, EPOLL_CTL_ADD, d->lfd, &ev) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s socket] [-m mode] [-f seedfile]\n",
+		name);
+	fprintf(stderr, "\t-s socket\tpath name of the socket (default %s)\n",
+		DRNG_CHACHA20_CLIENT_SOCKET);
+	fprintf(stderr, "\t-m mode\t\toctal access mode of the socket (default 0666)\n");
+	fprintf(stderr, "\t-f seedfile\tseed file read at start and written hourly and at exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = DRNG_CHACHA20_CLIENT_SOCKET, *seedfile = NULL;
+	mode_t mode = 0666;
+	struct sigaction sa;
+	struct drngd *d;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "s:m:f:h")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'm':
+			mode = (mode_t)strtoul(optarg, NULL, 8);
+			break;
+		case 'f':
+			seedfile = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = drngd_sighandler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return 1;
+	d->lfd = -1;
+	d->efd = -1;
+
+	d->batchbuf = aligned_alloc(64, DRNGD_BATCH_SIZE);
+	if (!d->batchbuf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	/* prevent paging out of the random numbers to swap space */
+	mlock(d->batchbuf, DRNGD_BATCH_SIZE);
+
+	if (seedfile) {
+		ret = drng_chacha20_init_seedfile(&d->master, seedfile);
+		d->seedfile = seedfile;
+		d->seedfile_next = time(NULL) + DRNGD_SEEDFILE_INTERVAL;
+	} else {
+		ret = drng_chacha20_init(&d->master);
+	}
+	if (ret) {
+		fprintf(stderr, "Allocation of DRNG failed: %d\n", ret);
+		goto out;
+	}
+
+	ret = drngd_listen(d, path, mode);
+	if (ret) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", path,
+			strerror(-ret));
+		goto out;
+	}
+
+	ret = drngd_loop(d);
+
+	unlink(path);
+
+	/* Clean shutdown: the seed of the next start */
+	d->seedfile_next = 0;
+	drngd_seedfile(d);
+
+out:
+	if (d->efd >= 0)
+		close(d->efd);
+	if (d->lfd >= 0)
+		close(d->lfd);
+	if (d->master)
+		drng_chacha20_destroy(d->master);
+	if (d->batchbuf) {
+		memset_secure(d->batchbuf, 0, DRNGD_BATCH_SIZE);
+		free(d->batchbuf);
+	}
+	free(d);
+
+	return ret ? 1 : 0;
+}
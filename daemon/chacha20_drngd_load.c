@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * chacha20_drngd_load -- load test client for chacha20_drngd
+ *
+ * A number of client threads issue requests to the daemon for the given
+ * duration. The achieved number of requests per second and the latency
+ * percentiles of the requests are reported. With -i, each request is
+ * served by an in-process drng_chacha20_init / drng_chacha20_get /
+ * drng_chacha20_destroy sequence instead which resembles the cost a
+ * short-lived process pays without the daemon.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chacha20_drng.h"
+
+struct load_thread {
+	pthread_t thread;
+	const char *path;
+	uint32_t len;
+	uint32_t type;
+	int inprocess;
+	uint64_t *lat;
+	uint64_t nlat;
+	uint64_t maxlat;
+	int ret;
+};
+
+static volatile int load_stop = 0;
+
+static inline uint64_t load_nstime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int load_record(struct load_thread *t, uint64_t ns)
+{
+	if (t->nlat == t->maxlat) {
+		uint64_t *tmp;
+
+		t->maxlat = t->maxlat ? t->maxlat * 2 : 65536;
+		tmp = realloc(t->lat, t->maxlat * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+		t->lat = tmp;
+	}
+	t->lat[t->nlat++] = ns;
+
+	return 0;
+}
+
+static int load_request(struct chacha20_drng_client *client, uint32_t type,
+			uint8_t *buf, uint32_t len)
+{
+	switch (type) {
+	case DRNG_CHACHA20_CLIENT_U32:
+		return drng_chacha20_client_get_u32(client, (uint32_t *)buf,
+						    len / sizeof(uint32_t),
+						    1000);
+	case DRNG_CHACHA20_CLIENT_U64:
+		return drng_chacha20_client_get_u64(client, (uint64_t *)buf,
+						    len / sizeof(uint64_t), 0);
+	case DRNG_CHACHA20_CLIENT_DOUBLE:
+		return drng_chacha20_client_get_double(client, (double *)buf,
+						       len / sizeof(double));
+	default:
+		return drng_chacha20_client_get(client, buf, len);
+	}
+}
+
+static void *load_worker(void *arg)
+{
+	struct load_thread *t = arg;
+	struct chacha20_drng_client *client = NULL;
+	uint8_t *buf;
+
+	buf = aligned_alloc(8, (t->len + 7) & ~7U);
+	if (!buf) {
+		t->ret = -ENOMEM;
+		return NULL;
+	}
+
+	if (!t->inprocess) {
+		t->ret = drng_chacha20_client_connect(&client, t->path);
+		if (t->ret)
+			goto out;
+	}
+
+	while (!load_stop) {
+		uint64_t start = load_nstime();
+
+		if (t->inprocess) {
+			struct chacha20_drng *drng;
+
+			t->ret = drng_chacha20_init(&drng);
+			if (t->ret)
+				break;
+			t->ret = drng_chacha20_get(drng, buf, t->len);
+			drng_chacha20_destroy(drng);
+		} else {
+			t->ret = load_request(client, t->type, buf, t->len);
+		}
+		if (t->ret)
+			break;
+
+		t->ret = load_record(t, load_nstime() - start);
+		if (t->ret)
+			break;
+	}
+
+out:
+	drng_chacha20_client_disconnect(client);
+	free(buf);
+	return NULL;
+}
+
+static int load_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t load_percentile(uint64_t *lat, uint64_t n, double p)
+{
+	uint64_t idx = (uint64_t)(p * (double)(n - 1) / 100.0);
+
+	return lat[idx];
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s socket] [-c clients] [-d seconds] [-l bytes] [-t type] [-i]\n",
+		name);
+	fprintf(stderr, "\t-t type\t0 bytes, 1 u32 below 1000, 2 u64, 3 double\n");
+	fprintf(stderr, "\t-i\tin-process init/get/destroy per request instead of daemon\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = DRNG_CHACHA20_CLIENT_SOCKET;
+	unsigned long clients = 4, duration = 5, len = 32, type = 0;
+	struct load_thread *threads;
+	uint64_t *lat, nlat = 0, start, elapsed;
+	unsigned long i;
+	int opt, inprocess = 0, ret = 0;
+
+	while ((opt = getopt(argc, argv, "s:c:d:l:t:ih")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'c':
+			clients = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			len = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			type = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			inprocess = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!clients || !len || len > UINT32_MAX ||
+	    type > DRNG_CHACHA20_CLIENT_DOUBLE) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	threads = calloc(clients, sizeof(*threads));
+	if (!threads)
+		return 1;
+
+	start = load_nstime();
+	for (i = 0; i < clients; i++) {
+		threads[i].path = path;
+		threads[i].len = (uint32_t)len;
+		threads[i].type = (uint32_t)type;
+		threads[i].inprocess = inprocess;
+		if (pthread_create(&threads[i].thread, NULL, load_worker,
+				   &threads[i])) {
+			printf("Thread creation failed\n");
+			return 1;
+		}
+	}
+
+	sleep(duration);
+	load_stop = 1;
+
+	for (i = 0; i < clients; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].ret) {
+			printf("Client %lu failed: %s\n", i,
+			       strerror(-threads[i].ret));
+			ret = 1;
+		}
+		nlat += threads[i].nlat;
+	}
+	elapsed = load_nstime() - start;
+
+	lat = malloc((nlat ? nlat : 1) * sizeof(*lat));
+	if (!lat)
+		return 1;
+	nlat = 0;
+	for (i = 0; i < clients; i++) {
+		memcpy(lat + nlat, threads[i].lat,
+		       threads[i].nlat * sizeof(*lat));
+		nlat += threads[i].nlat;
+		free(threads[i].lat);
+	}
+	free(threads);
+
+	if (!nlat) {
+		printf("No requests completed\n");
+		free(lat);
+		return 1;
+	}
+
+	qsort(lat, nlat, sizeof(*lat), load_cmp);
+
+	printf("%-12s|%8s|%6s|%12s|%10s|%10s|%10s|%10s|%10s\n",
+	       "mode", "clients", "bytes", "requests/s", "p50 ns", "p90 ns",
+	       "p99 ns", "p99.9 ns", "max ns");
+	printf("%-12s|%8lu|%6lu|%12lu|%10lu|%10lu|%10lu|%10lu|%10lu\n",
+	       inprocess ? "in-process" : "daemon", clients, len,
+	       (unsigned long)(nlat * 1000000000ULL / elapsed),
+	       (unsigned long)load_percentile(lat, nlat, 50),
+	       (unsigned long)load_percentile(lat, nlat, 90),
+	       (unsigned long)load_percentile(lat, nlat, 99),
+	       (unsigned long)load_percentile(lat, nlat, 99.9),
+	       (unsigned long)lat[nlat - 1]);
+
+	free(lat);
+
+	return ret;
+}
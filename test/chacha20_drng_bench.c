@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Single-thread benchmark of drng_chacha20_get: the request size is swept in
+ * powers of two, each size is measured with an aligned and an unaligned
+ * output buffer. For every configuration the throughput and the latency
+ * distribution of the individual calls is reported.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chacha20_drng.h"
+#include "cp_perf.h"
+#include "cp_util.h"
+
+#define BENCH_MAX_SAMPLES	(1UL<<20)
+
+enum bench_format {
+	BENCH_TEXT,
+	BENCH_CSV,
+	BENCH_JSON,
+};
+
+struct bench_result {
+	uint32_t size;
+	int aligned;
+	uint64_t bytes_per_sec;
+	uint64_t bytes;
+	struct cp_stats stats;
+	struct cp_perf perf;
+};
+
+struct bench_cfg {
+	uint32_t minsize;
+	uint32_t maxsize;
+	int aligned;
+	int unaligned;
+	uint64_t warmup_ns;
+	uint64_t duration_ns;
+	uint64_t min_samples;
+	int cpu;
+	enum bench_format format;
+	int perf;
+	struct cp_perf counters;
+};
+
+static int bench_one(struct chacha20_drng *drng, struct bench_cfg *cfg,
+		     uint8_t *buf, uint32_t size, uint64_t *lat,
+		     struct bench_result *res)
+{
+	uint64_t start, total = 0, n = 0;
+	int ret;
+
+	/* Warm up caches, branch predictors and the CPU frequency */
+	start = cp_nstime();
+	do {
+		ret = drng_chacha20_get(drng, buf, size);
+		if (ret)
+			return ret;
+	} while (cp_nstime() - start < cfg->warmup_ns);
+
+	cp_cpusetup();
+	cp_perf_reset(&cfg->counters);
+	if (cfg->perf)
+		cp_perf_start(&cfg->counters);
+	while ((total < cfg->duration_ns || n < cfg->min_samples) &&
+	       n < BENCH_MAX_SAMPLES) {
+		uint64_t t = cp_nstime();
+
+		ret = drng_chacha20_get(drng, buf, size);
+		t = cp_nstime() - t;
+		if (ret)
+			return ret;
+
+		lat[n++] = t;
+		total += t;
+	}
+	if (cfg->perf)
+		cp_perf_stop(&cfg->counters);
+	res->perf = cfg->counters;
+	res->bytes = (uint64_t)size * n;
+
+	res->size = size;
+	res->bytes_per_sec = (uint64_t)((double)size * (double)n *
+					1000000000.0 /
+					(double)(total ? total : 1));
+	cp_stats(lat, n, &res->stats);
+
+	return 0;
+}
+
+static void bench_print(FILE *out, struct bench_cfg *cfg,
+			struct bench_result *res, unsigned int nres)
+{
+	char version[50];
+	unsigned int i;
+
+	drng_chacha20_versionstring(version, sizeof(version));
+
+	switch (cfg->format) {
+	case BENCH_CSV:
+		fprintf(out, "version,cpu,size,aligned,samples,bytes_per_sec,mean_ns,min_ns,p50_ns,p99_ns,p999_ns,max_ns");
+		if (cfg->perf)
+			cp_perf_print_header(out, CP_PERF_CSV);
+		fprintf(out, "\n");
+		for (i = 0; i < nres; i++) {
+			struct cp_stats *st = &res[i].stats;
+
+			fprintf(out, "%s,%d,%u,%d,%lu,%lu,%.1f,%lu,%lu,%lu,%lu,%lu",
+				version, cfg->cpu, res[i].size,
+				res[i].aligned, (unsigned long)st->samples,
+				(unsigned long)res[i].bytes_per_sec,
+				st->mean, (unsigned long)st->min,
+				(unsigned long)st->p50,
+				(unsigned long)st->p99,
+				(unsigned long)st->p999,
+				(unsigned long)st->max);
+			if (cfg->perf)
+				cp_perf_print(out, &res[i].perf, res[i].bytes,
+					      CP_PERF_CSV);
+			fprintf(out, "\n");
+		}
+		break;
+	case BENCH_JSON:
+		fprintf(out, "{\n  \"version\": \"%s\",\n  \"clock\": \"CLOCK_MONOTONIC\",\n  \"cpu\": %d,\n  \"results\": [\n",
+			version, cfg->cpu);
+		for (i = 0; i < nres; i++) {
+			struct cp_stats *st = &res[i].stats;
+
+			fprintf(out, "    { \"size\": %u, \"aligned\": %s, \"samples\": %lu, \"bytes_per_sec\": %lu, \"mean_ns\": %.1f, \"min_ns\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu",
+				res[i].size,
+				res[i].aligned ? "true" : "false",
+				(unsigned long)st->samples,
+				(unsigned long)res[i].bytes_per_sec,
+				st->mean, (unsigned long)st->min,
+				(unsigned long)st->p50,
+				(unsigned long)st->p99,
+				(unsigned long)st->p999,
+				(unsigned long)st->max);
+			if (cfg->perf)
+				cp_perf_print(out, &res[i].perf, res[i].bytes,
+					      CP_PERF_JSON);
+			fprintf(out, " }%s\n", (i + 1 < nres) ? "," : "");
+		}
+		fprintf(out, "  ]\n}\n");
+		break;
+	default:
+		fprintf(out, "%s, CPU %d, CLOCK_MONOTONIC\n", version, cfg->cpu);
+		fprintf(out, "%10s|%7s|%9s|%12s|%10s|%10s|%10s|%10s|%12s",
+			"size", "aligned", "samples", "throughput", "mean ns",
+			"p50 ns", "p99 ns", "p99.9 ns", "max ns");
+		if (cfg->perf)
+			cp_perf_print_header(out, CP_PERF_TEXT);
+		fprintf(out, "\n");
+		for (i = 0; i < nres; i++) {
+			struct cp_stats *st = &res[i].stats;
+			char tp[24];
+
+			cp_bytes2string(res[i].bytes_per_sec, tp, sizeof(tp));
+			strncat(tp, "/s", sizeof(tp) - strlen(tp) - 1);
+			fprintf(out, "%10u|%7s|%9lu|%12s|%10.0f|%10lu|%10lu|%10lu|%12lu",
+				res[i].size, res[i].aligned ? "yes" : "no",
+				(unsigned long)st->samples, tp, st->mean,
+				(unsigned long)st->p50,
+				(unsigned long)st->p99,
+				(unsigned long)st->p999,
+				(unsigned long)st->max);
+			if (cfg->perf)
+				cp_perf_print(out, &res[i].perf, res[i].bytes,
+					      CP_PERF_TEXT);
+			fprintf(out, "\n");
+		}
+		break;
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "\t-s bytes\tsmallest request size (default 1)\n");
+	fprintf(stderr, "\t-S bytes\tlargest request size (default 67108864)\n");
+	fprintf(stderr, "\t-a\t\taligned output buffers only\n");
+	fprintf(stderr, "\t-u\t\tunaligned output buffers only\n");
+	fprintf(stderr, "\t-w ms\t\twarmup time per configuration (default 100)\n");
+	fprintf(stderr, "\t-d ms\t\tmeasurement time per configuration (default 500)\n");
+	fprintf(stderr, "\t-n samples\tminimum samples per configuration (default 5)\n");
+	fprintf(stderr, "\t-c cpu\t\tCPU to pin to, -1 disables pinning (default current CPU)\n");
+	fprintf(stderr, "\t-f format\ttext, csv or json (default text)\n");
+	fprintf(stderr, "\t-P\t\treport hardware performance counters per byte\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_cfg cfg = {
+		.minsize = 1,
+		.maxsize = 1U<<26,
+		.aligned = 1,
+		.unaligned = 1,
+		.warmup_ns = 100000000ULL,
+		.duration_ns = 500000000ULL,
+		.min_samples = 5,
+		.cpu = -2,
+		.format = BENCH_TEXT,
+	};
+	struct chacha20_drng *drng;
+	struct bench_result *res;
+	unsigned int nres = 0;
+	uint64_t size, *lat;
+	uint8_t *buf;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "s:S:auw:d:n:c:f:Ph")) != -1) {
+		switch (opt) {
+		case 's':
+			cfg.minsize = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			cfg.maxsize = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'a':
+			cfg.unaligned = 0;
+			break;
+		case 'P':
+			cfg.perf = 1;
+			break;
+		case 'u':
+			cfg.aligned = 0;
+			break;
+		case 'w':
+			cfg.warmup_ns = strtoull(optarg, NULL, 10) * 1000000ULL;
+			break;
+		case 'd':
+			cfg.duration_ns = strtoull(optarg, NULL, 10) *
+					  1000000ULL;
+			break;
+		case 'n':
+			cfg.min_samples = strtoull(optarg, NULL, 10);
+			break;
+		case 'c':
+			cfg.cpu = atoi(optarg);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				cfg.format = BENCH_CSV;
+			else if (!strcmp(optarg, "json"))
+				cfg.format = BENCH_JSON;
+			else if (!strcmp(optarg, "text"))
+				cfg.format = BENCH_TEXT;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!cfg.minsize || cfg.minsize > cfg.maxsize ||
+	    cfg.maxsize > (1U<<30) || (!cfg.aligned && !cfg.unaligned) ||
+	    !cfg.min_samples) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (cfg.cpu == -2)
+		cfg.cpu = cp_current_cpu();
+	if (cfg.cpu >= 0) {
+		ret = cp_pin_cpu(cfg.cpu);
+		if (ret) {
+			fprintf(stderr, "Pinning to CPU %d failed: %s\n",
+				cfg.cpu, strerror(-ret));
+			return 1;
+		}
+	}
+
+	/* One spare cache line allows the unaligned buffer */
+	buf = aligned_alloc(64, ((uint64_t)cfg.maxsize + 127) & ~63ULL);
+	lat = malloc(BENCH_MAX_SAMPLES * sizeof(*lat));
+	res = calloc(2 * 32, sizeof(*res));
+	if (!buf || !lat || !res) {
+		fprintf(stderr, "Allocation of memory failed\n");
+		return 1;
+	}
+	/* Fault in the pages before measuring */
+	memset(buf, 0, cfg.maxsize + 64);
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		fprintf(stderr, "Allocation of DRNG failed: %d\n", ret);
+		return 1;
+	}
+
+	if (cfg.perf && !cp_perf_open(&cfg.counters))
+		fprintf(stderr, "Hardware performance counters unavailable\n");
+
+	for (size = cfg.minsize; size <= cfg.maxsize; size <<= 1) {
+		if (cfg.aligned) {
+			res[nres].aligned = 1;
+			ret = bench_one(drng, &cfg, buf, (uint32_t)size, lat,
+					&res[nres]);
+			if (ret)
+				goto out;
+			nres++;
+		}
+		if (cfg.unaligned) {
+			res[nres].aligned = 0;
+			ret = bench_one(drng, &cfg, buf + 1, (uint32_t)size,
+					lat, &res[nres]);
+			if (ret)
+				goto out;
+			nres++;
+		}
+	}
+
+	bench_print(stdout, &cfg, res, nres);
+
+out:
+	if (ret)
+		fprintf(stderr, "Generation of random numbers failed: %d\n",
+			ret);
+	if (cfg.perf)
+		cp_perf_close(&cfg.counters);
+	drng_chacha20_destroy(drng);
+	free(res);
+	free(lat);
+	free(buf);
+
+	return ret ? 1 : 0;
+}
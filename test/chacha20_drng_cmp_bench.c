@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Comparison of drng_chacha20_get with the random number sources of the
+ * operating system and the C library.
+ *
+ * Generators:
+ *	drng		drng_chacha20_get, one DRNG handle per thread
+ *	getrandom	getrandom system call
+ *	urandom		read from /dev/urandom, one file descriptor per thread
+ *	arc4random	arc4random_buf of glibc 2.36 and later
+ *	keystream	plain ChaCha20 keystream of the deterministic stream
+ *			mode without seeding, time stamps and state updates
+ *			per request
+ *
+ * For every thread count and request size, all generators are measured one
+ * after the other and reported in one table together with their throughput
+ * relative to the getrandom system call.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "chacha20_drng.h"
+#include "cp_util.h"
+
+#if defined(__GLIBC_PREREQ)
+# if __GLIBC_PREREQ(2, 36)
+#  define CMP_HAVE_ARC4RANDOM
+# endif
+#endif
+
+#define CMP_MAX_THREADS		1024
+#define CMP_MAX_SAMPLES		(1UL<<16)	/* per thread */
+#define CMP_MAX_SIZES		32
+
+enum cmp_gen {
+	CMP_DRNG,
+	CMP_GETRANDOM,
+	CMP_URANDOM,
+	CMP_ARC4RANDOM,
+	CMP_KEYSTREAM,
+	CMP_GENS,
+};
+
+static const char *cmp_gen_names[CMP_GENS] = {
+	"drng", "getrandom", "urandom", "arc4random", "keystream"
+};
+
+struct cmp_cfg {
+	uint32_t minsize;
+	uint32_t maxsize;
+	uint64_t duration_ns;
+	int gens[CMP_GENS];
+	int pin;
+	int format;		/* 0 text, 1 csv, 2 json */
+};
+
+struct cmp_result {
+	enum cmp_gen gen;
+	unsigned int threads;
+	uint32_t size;
+	uint64_t ops;
+	uint64_t bytes_per_sec;
+	struct cp_stats stats;
+};
+
+struct cmp_shared {
+	struct cmp_cfg *cfg;
+	enum cmp_gen gen;
+	uint32_t size;
+	pthread_barrier_t barrier;
+	volatile int stop;
+};
+
+struct cmp_thread {
+	struct cmp_shared *sh;
+	pthread_t thread;
+	unsigned int idx;
+	int ret;
+	uint64_t ops;
+	uint64_t nsamples;
+	uint64_t *lat;
+};
+
+/* Per-thread state of the generators */
+struct cmp_ctx {
+	struct chacha20_drng *drng;
+	struct chacha20_drng_det *det;
+	int fd;
+};
+
+static int cmp_gen_init(struct cmp_ctx *ctx, enum cmp_gen gen)
+{
+	uint8_t key[32];
+	int ret;
+
+	ctx->fd = -1;
+	switch (gen) {
+	case CMP_DRNG:
+		return drng_chacha20_init(&ctx->drng);
+	case CMP_URANDOM:
+		ctx->fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+		return ctx->fd < 0 ? -errno : 0;
+	case CMP_KEYSTREAM:
+		if (getrandom(key, sizeof(key), 0) != sizeof(key))
+			return -EFAULT;
+		ret = drng_chacha20_det_init(&ctx->det, key, sizeof(key), 0);
+		memset(key, 0, sizeof(key));
+		return ret;
+	default:
+		return 0;
+	}
+}
+
+static void cmp_gen_fini(struct cmp_ctx *ctx)
+{
+	if (ctx->drng)
+		drng_chacha20_destroy(ctx->drng);
+	if (ctx->det)
+		drng_chacha20_det_destroy(ctx->det);
+	if (ctx->fd >= 0)
+		close(ctx->fd);
+}
+
+/* Read the complete request, large requests return partial data */
+static int cmp_read(int fd, uint8_t *buf, uint32_t len, int sys)
+{
+	while (len) {
+		ssize_t ret = sys ? getrandom(buf, len, 0) :
+				    read(fd, buf, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret ? -errno : -EIO;
+		buf += ret;
+		len -= (uint32_t)ret;
+	}
+
+	return 0;
+}
+
+static int cmp_gen_get(struct cmp_ctx *ctx, enum cmp_gen gen, uint8_t *buf,
+		       uint32_t len)
+{
+	switch (gen) {
+	case CMP_DRNG:
+		return drng_chacha20_get(ctx->drng, buf, len);
+	case CMP_GETRANDOM:
+		return cmp_read(-1, buf, len, 1);
+	case CMP_URANDOM:
+		return cmp_read(ctx->fd, buf, len, 0);
+	case CMP_ARC4RANDOM:
+#ifdef CMP_HAVE_ARC4RANDOM
+		arc4random_buf(buf, len);
+		return 0;
+#else
+		return -EOPNOTSUPP;
+#endif
+	case CMP_KEYSTREAM:
+		return drng_chacha20_det_get(ctx->det, buf, len);
+	default:
+		return -EINVAL;
+	}
+}
+
+static void *cmp_thread_fn(void *arg)
+{
+	struct cmp_thread *t = arg;
+	struct cmp_shared *sh = t->sh;
+	struct cmp_ctx ctx;
+	uint8_t *buf = malloc(sh->size);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	memset(&ctx, 0, sizeof(ctx));
+	if (!buf)
+		t->ret = -ENOMEM;
+	else if (sh->cfg->pin)
+		t->ret = cp_pin_cpu((int)(t->idx % (cpus > 0 ? cpus : 1)));
+	if (!t->ret)
+		t->ret = cmp_gen_init(&ctx, sh->gen);
+	/* Fault in the pages and warm up the generator */
+	if (!t->ret)
+		t->ret = cmp_gen_get(&ctx, sh->gen, buf, sh->size);
+
+	pthread_barrier_wait(&sh->barrier);
+
+	while (!t->ret && !__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+		uint64_t start = cp_nstime();
+
+		t->ret = cmp_gen_get(&ctx, sh->gen, buf, sh->size);
+		/* Keep the most recent samples once the buffer is full */
+		t->lat[t->nsamples++ % CMP_MAX_SAMPLES] = cp_nstime() - start;
+		t->ops++;
+	}
+
+	cmp_gen_fini(&ctx);
+	free(buf);
+	return NULL;
+}
+
+static int cmp_run(struct cmp_cfg *cfg, enum cmp_gen gen, unsigned int threads,
+		   uint32_t size, struct cmp_result *res)
+{
+	struct cmp_shared sh;
+	struct cmp_thread *t;
+	uint64_t start, ns, nsamples = 0, *lat = NULL;
+	unsigned int i, started = 0;
+	int ret = 0;
+
+	t = calloc(threads, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	memset(&sh, 0, sizeof(sh));
+	sh.cfg = cfg;
+	sh.gen = gen;
+	sh.size = size;
+	/* The main thread joins the start barrier */
+	pthread_barrier_init(&sh.barrier, NULL, threads + 1);
+
+	for (i = 0; i < threads; i++) {
+		t[i].sh = &sh;
+		t[i].idx = i;
+		t[i].lat = malloc(CMP_MAX_SAMPLES * sizeof(uint64_t));
+		if (!t[i].lat) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		ret = -pthread_create(&t[i].thread, NULL, cmp_thread_fn, &t[i]);
+		if (ret) {
+			/* Cannot recover from a partially populated barrier */
+			fprintf(stderr, "Thread creation failed: %d\n", ret);
+			exit(1);
+		}
+		started++;
+	}
+
+	pthread_barrier_wait(&sh.barrier);
+	start = cp_nstime();
+	usleep(cfg->duration_ns / 1000);
+	__atomic_store_n(&sh.stop, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < started; i++)
+		pthread_join(t[i].thread, NULL);
+	ns = cp_nstime() - start;
+
+	memset(res, 0, sizeof(*res));
+	for (i = 0; i < threads; i++) {
+		if (t[i].ret && !ret)
+			ret = t[i].ret;
+		res->ops += t[i].ops;
+		nsamples += (t[i].nsamples < CMP_MAX_SAMPLES) ?
+			    t[i].nsamples : CMP_MAX_SAMPLES;
+	}
+	if (ret)
+		goto out;
+
+	lat = malloc((nsamples ? nsamples : 1) * sizeof(*lat));
+	if (!lat) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0, nsamples = 0; i < threads; i++) {
+		uint64_t n = (t[i].nsamples < CMP_MAX_SAMPLES) ?
+			     t[i].nsamples : CMP_MAX_SAMPLES;
+
+		memcpy(lat + nsamples, t[i].lat, n * sizeof(*lat));
+		nsamples += n;
+	}
+	cp_stats(lat, nsamples, &res->stats);
+
+	res->gen = gen;
+	res->threads = threads;
+	res->size = size;
+	res->bytes_per_sec = (uint64_t)((double)res->ops * (double)size *
+					1000000000.0 / (double)(ns ? ns : 1));
+
+out:
+	free(lat);
+	for (i = 0; i < threads; i++)
+		free(t[i].lat);
+	free(t);
+	pthread_barrier_destroy(&sh.barrier);
+
+	return ret;
+}
+
+/* Throughput relative to getrandom with the same threads and size */
+static double cmp_relative(struct cmp_result *res, unsigned int nres,
+			   struct cmp_result *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < nres; i++) {
+		if (res[i].gen == CMP_GETRANDOM &&
+		    res[i].threads == r->threads && res[i].size == r->size)
+			return res[i].bytes_per_sec ?
+			       (double)r->bytes_per_sec /
+			       (double)res[i].bytes_per_sec : 0.0;
+	}
+
+	return 0.0;
+}
+
+static void cmp_print(struct cmp_cfg *cfg, struct cmp_result *res,
+		      unsigned int nres)
+{
+	char version[50];
+	unsigned int i;
+
+	drng_chacha20_versionstring(version, sizeof(version));
+
+	switch (cfg->format) {
+	case 1:
+		printf("generator,threads,size,ops,bytes_per_sec,vs_getrandom,p50_ns,p99_ns,max_ns\n");
+		for (i = 0; i < nres; i++) {
+			struct cp_stats *st = &res[i].stats;
+
+			printf("%s,%u,%u,%lu,%lu,%.2f,%lu,%lu,%lu\n",
+			       cmp_gen_names[res[i].gen], res[i].threads,
+			       res[i].size, (unsigned long)res[i].ops,
+			       (unsigned long)res[i].bytes_per_sec,
+			       cmp_relative(res, nres, &res[i]),
+			       (unsigned long)st->p50, (unsigned long)st->p99,
+			       (unsigned long)st->max);
+		}
+		break;
+	case 2:
+		printf("{\n  \"version\": \"%s\",\n  \"clock\": \"CLOCK_MONOTONIC\",\n  \"results\": [\n",
+		       version);
+		for (i = 0; i < nres; i++) {
+			struct cp_stats *st = &res[i].stats;
+
+			printf("    { \"generator\": \"%s\", \"threads\": %u, \"size\": %u, \"ops\": %lu, \"bytes_per_sec\": %lu, \"vs_getrandom\": %.2f, \"p50_ns\": %lu, \"p99_ns\": %lu, \"max_ns\": %lu }%s\n",
+			       cmp_gen_names[res[i].gen], res[i].threads,
+			       res[i].size, (unsigned long)res[i].ops,
+			       (unsigned long)res[i].bytes_per_sec,
+			       cmp_relative(res, nres, &res[i]),
+			       (unsigned long)st->p50, (unsigned long)st->p99,
+			       (unsigned long)st->max,
+			       (i + 1 < nres) ? "," : "");
+		}
+		printf("  ]\n}\n");
+		break;
+	default:
+		printf("%s, CLOCK_MONOTONIC\n", version);
+		printf("%-10s|%8s|%10s|%12s|%14s|%9s|%10s|%10s|%12s\n",
+		       "generator", "threads", "size", "ops", "throughput",
+		       "vs getrnd", "p50 ns", "p99 ns", "max ns");
+		for (i = 0; i < nres; i++) {
+			struct cp_stats *st = &res[i].stats;
+			char tp[24];
+
+			/* Separate the groups of one thread count and size */
+			if (i && (res[i].size != res[i - 1].size ||
+				  res[i].threads != res[i - 1].threads))
+				printf("\n");
+			cp_bytes2string(res[i].bytes_per_sec, tp, sizeof(tp));
+			strncat(tp, "/s", sizeof(tp) - strlen(tp) - 1);
+			printf("%-10s|%8u|%10u|%12lu|%14s|%8.2fx|%10lu|%10lu|%12lu\n",
+			       cmp_gen_names[res[i].gen], res[i].threads,
+			       res[i].size, (unsigned long)res[i].ops, tp,
+			       cmp_relative(res, nres, &res[i]),
+			       (unsigned long)st->p50, (unsigned long)st->p99,
+			       (unsigned long)st->max);
+		}
+		break;
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "\t-g gen,gen,...\tdrng, getrandom, urandom, arc4random, keystream\n\t\t\t(default all available)\n");
+	fprintf(stderr, "\t-t n,n,...\tthread counts (default powers of two up to the number of CPUs)\n");
+	fprintf(stderr, "\t-s bytes\tsmallest request size (default 16)\n");
+	fprintf(stderr, "\t-S bytes\tlargest request size (default 1048576)\n");
+	fprintf(stderr, "\t-d ms\t\tduration per measurement (default 200)\n");
+	fprintf(stderr, "\t-p\t\tpin the threads to the CPUs\n");
+	fprintf(stderr, "\t-f format\ttext, csv or json (default text)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct cmp_cfg cfg = {
+		.minsize = 16,
+		.maxsize = 1U<<20,
+		.duration_ns = 200000000ULL,
+	};
+	struct cmp_result *res;
+	unsigned int threads[64], nthreads = 0, nres = 0, i, ngens = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t size;
+	int opt, ret = 0, g;
+
+	while ((opt = getopt(argc, argv, "g:t:s:S:d:pf:h")) != -1) {
+		switch (opt) {
+		case 'g': {
+			char *p = strtok(optarg, ",");
+
+			for (; p; p = strtok(NULL, ",")) {
+				for (g = 0; g < CMP_GENS; g++)
+					if (!strcmp(p, cmp_gen_names[g]))
+						break;
+				if (g == CMP_GENS) {
+					usage(argv[0]);
+					return 1;
+				}
+				cfg.gens[g] = 1;
+				ngens++;
+			}
+			break;
+		}
+		case 't': {
+			char *p = optarg;
+
+			while (*p && nthreads < 64) {
+				char *end;
+				unsigned long n = strtoul(p, &end, 10);
+
+				if (end == p || !n || n > CMP_MAX_THREADS) {
+					usage(argv[0]);
+					return 1;
+				}
+				threads[nthreads++] = (unsigned int)n;
+				p = (*end == ',') ? end + 1 : end;
+			}
+			break;
+		}
+		case 's':
+			cfg.minsize = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			cfg.maxsize = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			cfg.duration_ns = strtoull(optarg, NULL, 10) *
+					  1000000ULL;
+			break;
+		case 'p':
+			cfg.pin = 1;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				cfg.format = 1;
+			else if (!strcmp(optarg, "json"))
+				cfg.format = 2;
+			else if (strcmp(optarg, "text")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!cfg.minsize || cfg.minsize > cfg.maxsize ||
+	    cfg.maxsize > (1U<<30) || !cfg.duration_ns) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!ngens) {
+		for (g = 0; g < CMP_GENS; g++)
+			cfg.gens[g] = 1;
+	}
+#ifndef CMP_HAVE_ARC4RANDOM
+	if (cfg.gens[CMP_ARC4RANDOM])
+		fprintf(stderr, "arc4random_buf unavailable, skipped\n");
+	cfg.gens[CMP_ARC4RANDOM] = 0;
+#endif
+
+	if (!nthreads) {
+		unsigned int n;
+
+		for (n = 1; n <= (unsigned int)(cpus > 0 ? cpus : 1) &&
+			    nthreads < 64; n <<= 1)
+			threads[nthreads++] = n;
+	}
+
+	res = calloc(64 * CMP_MAX_SIZES * CMP_GENS, sizeof(*res));
+	if (!res)
+		return 1;
+
+	for (i = 0; i < nthreads; i++) {
+		for (size = cfg.minsize; size <= cfg.maxsize; size <<= 1) {
+			for (g = 0; g < CMP_GENS; g++) {
+				if (!cfg.gens[g])
+					continue;
+
+				ret = cmp_run(&cfg, g, threads[i],
+					      (uint32_t)size, &res[nres]);
+				if (ret) {
+					fprintf(stderr, "%s with %u threads and %lu bytes failed: %d\n",
+						cmp_gen_names[g], threads[i],
+						(unsigned long)size, ret);
+					goto out;
+				}
+				nres++;
+			}
+		}
+	}
+
+	cmp_print(&cfg, res, nres);
+
+out:
+	free(res);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Benchmark of the C++ wrapper chacha20_drng.hpp: the buffered
+ * UniformRandomBitGenerator is compared with std::mt19937_64 and with one
+ * drng_chacha20_get call per random number for raw random numbers, a
+ * <random> distribution, std::shuffle and bulk fills.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+#include "chacha20_drng.hpp"
+
+namespace {
+
+/* Prevents the compiler from discarding the generated numbers */
+inline void bench_use(uint64_t val)
+{
+	__asm__ __volatile__("" : : "r" (val));
+}
+
+/* Unbuffered generator calling the C API for every random number */
+class raw_drng {
+public:
+	typedef uint64_t result_type;
+
+	static constexpr result_type min()
+	{
+		return 0;
+	}
+
+	static constexpr result_type max()
+	{
+		return UINT64_MAX;
+	}
+
+	raw_drng()
+	{
+		if (drng_chacha20_init(&drng_))
+			throw std::runtime_error("drng_chacha20_init");
+	}
+
+	~raw_drng()
+	{
+		drng_chacha20_destroy(drng_);
+	}
+
+	raw_drng(const raw_drng &) = delete;
+	raw_drng &operator=(const raw_drng &) = delete;
+
+	result_type operator()()
+	{
+		result_type val;
+
+		drng_chacha20_get(drng_, reinterpret_cast<uint8_t *>(&val),
+				  sizeof(val));
+		return val;
+	}
+
+	void fill(void *out, std::size_t len)
+	{
+		drng_chacha20_get(drng_, static_cast<uint8_t *>(out),
+				  static_cast<uint32_t>(len));
+	}
+
+private:
+	struct chacha20_drng *drng_;
+};
+
+/* Adapter giving std::mt19937_64 a fill operation */
+class mt_drng : public std::mt19937_64 {
+public:
+	mt_drng() : std::mt19937_64(std::random_device()()) { }
+
+	void fill(void *out, std::size_t len)
+	{
+		uint8_t *p = static_cast<uint8_t *>(out);
+
+		while (len) {
+			uint64_t val = (*this)();
+			std::size_t todo = std::min(len, sizeof(val));
+
+			std::memcpy(p, &val, todo);
+			p += todo;
+			len -= todo;
+		}
+	}
+};
+
+struct bench_cfg {
+	std::chrono::nanoseconds duration;
+	bool csv;
+};
+
+/*
+ * Invoke the operation in batches until the duration is exceeded and report
+ * the operations and bytes per second.
+ */
+template <typename Op>
+void bench_run(const bench_cfg &cfg, const char *generator, const char *test,
+	       uint64_t bytes_per_op, Op op)
+{
+	typedef std::chrono::steady_clock clock;
+	std::chrono::nanoseconds total(0);
+	uint64_t ops = 0, batch = 1;
+
+	/* Warmup */
+	op();
+
+	while (total < cfg.duration) {
+		clock::time_point start = clock::now();
+
+		for (uint64_t i = 0; i < batch; i++)
+			op();
+		total += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				clock::now() - start);
+		ops += batch;
+		if (batch < (1UL << 20))
+			batch <<= 1;
+	}
+
+	double secs = static_cast<double>(total.count()) / 1e9;
+	double ops_s = static_cast<double>(ops) / secs;
+	double mb_s = ops_s * static_cast<double>(bytes_per_op) /
+		      (1024.0 * 1024.0);
+
+	if (cfg.csv)
+		std::printf("%s,%s,%lu,%.0f,%.2f,%.2f\n", generator, test,
+			    static_cast<unsigned long>(ops), ops_s, mb_s,
+			    1e9 / ops_s);
+	else
+		std::printf("%-12s|%-14s|%14.0f|%12.2f|%10.2f\n", generator,
+			    test, ops_s, mb_s, 1e9 / ops_s);
+}
+
+template <typename Gen>
+void bench_generator(const bench_cfg &cfg, const char *name, Gen &gen)
+{
+	std::uniform_int_distribution<uint32_t> dist(0, 999);
+	std::vector<uint32_t> deck(1000);
+	std::vector<uint8_t> buf(65536);
+
+	std::iota(deck.begin(), deck.end(), 0);
+
+	bench_run(cfg, name, "operator()", sizeof(typename Gen::result_type),
+		  [&] { bench_use(gen()); });
+	bench_run(cfg, name, "uniform_int", 0,
+		  [&] { bench_use(dist(gen)); });
+	bench_run(cfg, name, "shuffle_1000", 0,
+		  [&] { std::shuffle(deck.begin(), deck.end(), gen); });
+	bench_run(cfg, name, "fill_64", 64,
+		  [&] { gen.fill(buf.data(), 64); bench_use(buf[0]); });
+	bench_run(cfg, name, "fill_65536", buf.size(),
+		  [&] { gen.fill(buf.data(), buf.size());
+			bench_use(buf[0]); });
+}
+
+void usage(const char *name)
+{
+	std::fprintf(stderr, "Usage: %s [options]\n", name);
+	std::fprintf(stderr, "\t-d ms\t\tmeasurement time per test (default 200)\n");
+	std::fprintf(stderr, "\t-f format\ttext or csv (default text)\n");
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	bench_cfg cfg = { std::chrono::milliseconds(200), false };
+	char version[50];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:f:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			cfg.duration = std::chrono::milliseconds(
+						std::strtoul(optarg, NULL, 10));
+			break;
+		case 'f':
+			if (!std::strcmp(optarg, "csv")) {
+				cfg.csv = true;
+			} else if (std::strcmp(optarg, "text")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	drng_chacha20_versionstring(version, sizeof(version));
+	if (cfg.csv) {
+		std::printf("generator,test,ops,ops_per_sec,mb_per_sec,ns_per_op\n");
+	} else {
+		std::printf("%s\n", version);
+		std::printf("%-12s|%-14s|%14s|%12s|%10s\n", "generator", "test",
+			    "ops/s", "MB/s", "ns/op");
+	}
+
+	try {
+		mt_drng mt;
+		raw_drng raw;
+		drng_chacha20::drng64 drng64;
+		drng_chacha20::drng32 drng32;
+
+		bench_generator(cfg, "mt19937_64", mt);
+		bench_generator(cfg, "raw_c", raw);
+		bench_generator(cfg, "drng64", drng64);
+		bench_generator(cfg, "drng32", drng32);
+		/* Includes the thread-local lookup in every call */
+		bench_run(cfg, "thread_drng", "operator()", sizeof(uint64_t),
+			  [] { bench_use(drng_chacha20::thread_drng<>()()); });
+	} catch (const std::exception &e) {
+		std::fprintf(stderr, "Benchmark failed: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Test of the C++ wrapper chacha20_drng.hpp: a child process must not hand
+ * out the random numbers buffered by the parent before fork(2).
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "chacha20_drng.hpp"
+
+namespace {
+
+/*
+ * Obtain the next 32 bytes with a random number generator from parent and
+ * child after the buffer was filled in the parent
+ */
+template <typename Gen>
+bool fork_differs(Gen gen)
+{
+	uint8_t parent[32], child[32];
+	int fds[2], status;
+	bool ok;
+	pid_t pid;
+
+	if (pipe(fds))
+		return false;
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (!pid) {
+		close(fds[0]);
+		try {
+			gen(child);
+		} catch (...) {
+			_exit(1);
+		}
+		if (write(fds[1], child, sizeof(child)) != sizeof(child))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+
+	ok = true;
+	try {
+		gen(parent);
+	} catch (...) {
+		ok = false;
+	}
+	if (read(fds[0], child, sizeof(child)) != sizeof(child))
+		ok = false;
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		ok = false;
+
+	return ok && std::memcmp(parent, child, sizeof(parent));
+}
+
+} /* anonymous namespace */
+
+int main()
+{
+	drng_chacha20::drng32 rng32;
+	auto &rng = drng_chacha20::thread_drng();
+
+	/* Fill the buffers in the parent */
+	rng();
+	rng32();
+
+	if (!fork_differs([&rng](uint8_t *out) {
+			for (unsigned int i = 0; i < 4; i++) {
+				uint64_t val = rng();
+
+				std::memcpy(out + i * sizeof(val), &val,
+					    sizeof(val));
+			}
+		})) {
+		std::printf("Child repeats the random numbers of thread_drng()\n");
+		return 1;
+	}
+
+	if (!fork_differs([&rng32](uint8_t *out) {
+			rng32.fill(out, 32);
+		})) {
+		std::printf("Child repeats the random numbers of fill()\n");
+		return 1;
+	}
+
+	std::printf("C++ fork test passed\n");
+
+	return 0;
+}
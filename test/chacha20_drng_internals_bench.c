@@ -0,0 +1,815 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Benchmark of the individual processing stages of the ChaCha20 DRNG: the
+ * ChaCha20 block operation, the state update, the seeding, the generation,
+ * the time stamp, the reseed and each seed source. The results are reported
+ * in nanoseconds per call and CPU cycles per call and per byte.
+ *
+ * This application links an object of chacha20_drng.c compiled with
+ * CHACHA20_DRNG_INTERNALS.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chacha20_drng_internals.h"
+#include "cp_perf.h"
+#include "cp_util.h"
+
+/* A batch of calls between two time stamps lasts at least this long */
+#define IBENCH_MIN_BATCH_NS	50000ULL
+
+/* Handles of the multi-instance stages, e.g. one per connection */
+#define IBENCH_HANDLES	16
+
+struct ibench_ctx {
+	struct chacha20_drng *drng;
+	struct chacha20_drng **drngs;
+	uint8_t *buf;
+	uint32_t len;
+};
+
+struct ibench_stage {
+	const char *name;
+	uint32_t len;
+	int (*fn)(struct ibench_ctx *ctx);
+};
+
+struct ibench_result {
+	const struct ibench_stage *stage;
+	int status;
+	uint64_t calls;
+	double ns_per_call;
+	double cycles_per_call;
+	struct cp_perf perf;
+};
+
+static int ibench_block(struct ibench_ctx *ctx)
+{
+	drng_chacha20_int_block(ctx->drng, (uint32_t *)ctx->buf);
+	return 0;
+}
+
+static int ibench_update(struct ibench_ctx *ctx)
+{
+	drng_chacha20_int_update(ctx->drng);
+	return 0;
+}
+
+static int ibench_seed(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_int_seed(ctx->drng, ctx->buf, ctx->len);
+}
+
+static int ibench_generate(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_int_generate(ctx->drng, ctx->buf, ctx->len);
+}
+
+static int ibench_get(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_get(ctx->drng, ctx->buf, ctx->len);
+}
+
+static int ibench_get_time(struct ibench_ctx *ctx)
+{
+	time_t sec;
+	uint32_t nsec;
+
+	(void)ctx;
+	drng_chacha20_int_get_time(&sec, &nsec);
+	return 0;
+}
+
+static int ibench_reseed(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_reseed(ctx->drng, NULL, 0);
+}
+
+static int ibench_src_ret(int ret, uint32_t len)
+{
+	if (ret < 0)
+		return ret;
+	return ((uint32_t)ret == len) ? 0 : -EFAULT;
+}
+
+static int ibench_getrandom(struct ibench_ctx *ctx)
+{
+	return ibench_src_ret(drng_chacha20_int_getrandom(ctx->buf, ctx->len),
+			      ctx->len);
+}
+
+static int ibench_jent(struct ibench_ctx *ctx)
+{
+	return ibench_src_ret(drng_chacha20_int_jent(ctx->buf, ctx->len),
+			      ctx->len);
+}
+
+static int ibench_devrandom(struct ibench_ctx *ctx)
+{
+	return ibench_src_ret(drng_chacha20_int_devrandom(ctx->buf, ctx->len),
+			      ctx->len);
+}
+
+static int ibench_xor(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_xor(ctx->drng, ctx->buf, ctx->len);
+}
+
+static int ibench_xor_unaligned(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_xor(ctx->drng, ctx->buf + 1, ctx->len);
+}
+
+/* Baseline: generation into a temporary buffer followed by the XOR */
+static int ibench_get_xor(struct ibench_ctx *ctx)
+{
+	uint8_t tmp[4096];
+	uint32_t i;
+	int ret = drng_chacha20_get(ctx->drng, tmp, ctx->len);
+
+	if (ret)
+		return ret;
+	for (i = 0; i < ctx->len; i++)
+		ctx->buf[i] ^= tmp[i];
+	return 0;
+}
+
+/*
+ * The XOR generation must change the state like the generation and XOR the
+ * generated bytes for aligned and unaligned buffers.
+ */
+static int ibench_xor_check(struct chacha20_drng *drng,
+			    struct chacha20_drng *ref)
+{
+	uint8_t out[300], exp[300];
+	uint32_t len, off, round, i;
+	int ret;
+
+	for (len = 0; len <= 260; len++) {
+		for (off = 0; off < 4; off++) {
+			drng_chacha20_int_copy(ref, drng);
+
+			/* The second round verifies the new state */
+			for (round = 0; round < 2; round++) {
+				for (i = 0; i < len; i++)
+					out[off + i] = (uint8_t)(i * 7 + 1);
+				ret = drng_chacha20_int_generate_xor(drng,
+						out + off, len);
+				ret |= drng_chacha20_int_generate(ref, exp,
+								  len);
+				if (ret)
+					return ret;
+				for (i = 0; i < len; i++) {
+					if ((out[off + i] ^ exp[i]) !=
+					    (uint8_t)(i * 7 + 1))
+						return -EFAULT;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Parsing of random numbers into 64 bit integers: from a copy obtained with
+ * drng_chacha20_get and in place with drng_chacha20_borrow
+ */
+static volatile uint64_t ibench_sink;
+
+static int ibench_copy_u64(struct ibench_ctx *ctx)
+{
+	uint64_t v, sum = 0;
+	uint32_t i;
+	int ret = drng_chacha20_get(ctx->drng, ctx->buf, ctx->len);
+
+	if (ret)
+		return ret;
+	for (i = 0; i < ctx->len; i += sizeof(v)) {
+		memcpy(&v, ctx->buf + i, sizeof(v));
+		sum += v;
+	}
+	ibench_sink = sum;
+	return 0;
+}
+
+static int ibench_borrow_u64(struct ibench_ctx *ctx)
+{
+	const uint8_t *ptr;
+	uint64_t v, sum = 0;
+	uint32_t i, len = ctx->len;
+	int ret = drng_chacha20_borrow(ctx->drng, &ptr, &len);
+
+	if (ret)
+		return ret;
+	for (i = 0; i < ctx->len; i += sizeof(v)) {
+		memcpy(&v, ptr + i, sizeof(v));
+		sum += v;
+	}
+	ibench_sink = sum;
+	return drng_chacha20_consume(ctx->drng, ctx->len);
+}
+
+/* Multi-instance stages: the size is the output of all IBENCH_HANDLES */
+static int ibench_get_each(struct ibench_ctx *ctx)
+{
+	uint32_t i, len = ctx->len / IBENCH_HANDLES;
+	int ret;
+
+	for (i = 0; i < IBENCH_HANDLES; i++) {
+		ret = drng_chacha20_get(ctx->drngs[i], ctx->buf + i * len, len);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int ibench_get_multi(struct ibench_ctx *ctx)
+{
+	uint32_t i, len = ctx->len / IBENCH_HANDLES;
+	uint8_t *outbufs[IBENCH_HANDLES];
+
+	for (i = 0; i < IBENCH_HANDLES; i++)
+		outbufs[i] = ctx->buf + i * len;
+	return drng_chacha20_get_multi(ctx->drngs, outbufs, len,
+				       IBENCH_HANDLES);
+}
+
+/*
+ * The vector lanes must deliver the output and the new state of the
+ * one-handle path for all request sizes and any number of handles.
+ */
+static int ibench_multi_check(struct chacha20_drng **drngs,
+			      struct chacha20_drng **ref)
+{
+	uint8_t out[IBENCH_HANDLES][64], exp[64];
+	uint8_t *outbufs[IBENCH_HANDLES];
+	uint32_t len, num, i, round, nsec = 0x12345678;
+	int ret;
+
+	for (i = 0; i < IBENCH_HANDLES; i++)
+		outbufs[i] = out[i];
+
+	for (len = 1; len <= 64; len++) {
+		for (num = 1; num <= IBENCH_HANDLES; num++) {
+			for (i = 0; i < num; i++)
+				drng_chacha20_int_copy(ref[i], drngs[i]);
+
+			/* The second round verifies the new states */
+			for (round = 0; round < 2; round++, nsec++) {
+				ret = drng_chacha20_int_generate_multi(drngs,
+					outbufs, len, nsec, num);
+				if (ret)
+					return ret;
+				for (i = 0; i < num; i++) {
+					ret = drng_chacha20_int_seed(ref[i],
+						(uint8_t *)&nsec, sizeof(nsec));
+					ret |= drng_chacha20_int_generate(
+						ref[i], exp, len);
+					if (ret)
+						return ret;
+					if (memcmp(out[i], exp, len))
+						return -EFAULT;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Tokens generated by one call of the token stages */
+#define IBENCH_TOKENS	64
+
+static int ibench_uuid4(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_uuid4(ctx->drng, (char *)ctx->buf, IBENCH_TOKENS);
+}
+
+static int ibench_uuid7(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_uuid7(ctx->drng, (char *)ctx->buf, IBENCH_TOKENS);
+}
+
+static int ibench_hex(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_hex(ctx->drng, (char *)ctx->buf,
+				 ctx->len / IBENCH_TOKENS - 1, IBENCH_TOKENS);
+}
+
+static int ibench_base64url(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_base64url(ctx->drng, (char *)ctx->buf,
+				       ctx->len / IBENCH_TOKENS - 1,
+				       IBENCH_TOKENS);
+}
+
+static int ibench_alnum(struct ibench_ctx *ctx)
+{
+	return drng_chacha20_token(ctx->drng,
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		(char *)ctx->buf, ctx->len / IBENCH_TOKENS - 1, IBENCH_TOKENS);
+}
+
+/* Baseline: one DRNG request per token and a bytewise hex conversion */
+static int ibench_hex_naive(struct ibench_ctx *ctx)
+{
+	static const char hex[] = "0123456789abcdef";
+	uint32_t len = ctx->len / IBENCH_TOKENS - 1, i, j;
+	char *out = (char *)ctx->buf;
+	uint8_t bin[64];
+	int ret;
+
+	for (i = 0; i < IBENCH_TOKENS; i++, out += len + 1) {
+		ret = drng_chacha20_get(ctx->drng, bin, len / 2);
+		if (ret)
+			return ret;
+		for (j = 0; j < len / 2; j++) {
+			out[j * 2] = hex[bin[j] >> 4];
+			out[j * 2 + 1] = hex[bin[j] & 0x0f];
+		}
+		out[len] = '\0';
+	}
+	return 0;
+}
+
+/* The seed source sizes match the requests of drng_chacha20_reseed */
+static const struct ibench_stage ibench_stages[] = {
+	{ "block",		DRNG_CHACHA20_INT_BLOCKSIZE,	ibench_block },
+	{ "update",		DRNG_CHACHA20_INT_BLOCKSIZE,	ibench_update },
+	{ "seed",		32,				ibench_seed },
+	{ "seed",		64,				ibench_seed },
+	{ "seed",		1024,				ibench_seed },
+	{ "seed",		4096,				ibench_seed },
+	{ "generate",		16,				ibench_generate },
+	{ "generate",		64,				ibench_generate },
+	{ "generate",		4096,				ibench_generate },
+	{ "get",		16,				ibench_get },
+	{ "get",		4096,				ibench_get },
+	{ "get_xor",		64,				ibench_get_xor },
+	{ "xor",		64,				ibench_xor },
+	{ "get_xor",		4096,				ibench_get_xor },
+	{ "xor",		4096,				ibench_xor },
+	{ "xor_unaligned",	4095,				ibench_xor_unaligned },
+	{ "copy_u64",		DRNG_CHACHA20_BORROW_SIZE,	ibench_copy_u64 },
+	{ "borrow_u64",		DRNG_CHACHA20_BORROW_SIZE,	ibench_borrow_u64 },
+	{ "copy_u64",		64,				ibench_copy_u64 },
+	{ "borrow_u64",		64,				ibench_borrow_u64 },
+	{ "get_each",		IBENCH_HANDLES * 16,		ibench_get_each },
+	{ "get_multi",		IBENCH_HANDLES * 16,		ibench_get_multi },
+	{ "get_each",		IBENCH_HANDLES * 64,		ibench_get_each },
+	{ "get_multi",		IBENCH_HANDLES * 64,		ibench_get_multi },
+	{ "get_time",		0,				ibench_get_time },
+	{ "reseed",		0,				ibench_reseed },
+	{ "src_getrandom",	32,				ibench_getrandom },
+	{ "src_jent",		64,				ibench_jent },
+	{ "src_devrandom",	32,				ibench_devrandom },
+	/* Token stages: the size is the output of IBENCH_TOKENS strings */
+	{ "uuid4",		IBENCH_TOKENS * 37,		ibench_uuid4 },
+	{ "uuid7",		IBENCH_TOKENS * 37,		ibench_uuid7 },
+	{ "hex_naive",		IBENCH_TOKENS * 33,		ibench_hex_naive },
+	{ "hex",		IBENCH_TOKENS * 33,		ibench_hex },
+	{ "base64url",		IBENCH_TOKENS * 44,		ibench_base64url },
+	{ "alnum",		IBENCH_TOKENS * 23,		ibench_alnum },
+};
+
+#define IBENCH_STAGES	(sizeof(ibench_stages) / sizeof(ibench_stages[0]))
+
+static int ibench_run(struct chacha20_drng *drng, struct chacha20_drng **drngs,
+		      uint8_t *buf, const struct ibench_stage *stage,
+		      uint64_t duration_ns, struct cp_perf *perf,
+		      struct ibench_result *res)
+{
+	struct ibench_ctx ctx = { drng, drngs, buf, stage->len };
+	uint64_t batch = 1, calls = 0, total_ns = 0, total_cycles = 0;
+	int ret;
+
+	res->stage = stage;
+
+	/* Warmup and check for the availability of the stage */
+	ret = stage->fn(&ctx);
+	if (ret) {
+		res->status = ret;
+		return ret;
+	}
+
+	cp_cpusetup();
+	if (perf) {
+		cp_perf_reset(perf);
+		cp_perf_start(perf);
+	}
+	while (total_ns < duration_ns) {
+		uint64_t i, ns, cycles;
+
+		ns = cp_nstime();
+		cycles = cp_cycles();
+		for (i = 0; i < batch; i++) {
+			ret = stage->fn(&ctx);
+			if (ret) {
+				if (perf)
+					cp_perf_stop(perf);
+				res->status = ret;
+				return ret;
+			}
+		}
+		cycles = cp_cycles() - cycles;
+		ns = cp_nstime() - ns;
+
+		calls += batch;
+		total_ns += ns;
+		total_cycles += cycles;
+
+		/* Amortize the time stamp overhead for fast stages */
+		if (ns < IBENCH_MIN_BATCH_NS)
+			batch <<= 1;
+	}
+	if (perf) {
+		cp_perf_stop(perf);
+		res->perf = *perf;
+	}
+
+	res->status = 0;
+	res->calls = calls;
+	res->ns_per_call = (double)total_ns / (double)calls;
+	res->cycles_per_call = (double)total_cycles / (double)calls;
+
+	return 0;
+}
+
+static const char *ibench_status(int status)
+{
+	if (!status)
+		return "ok";
+	if (status == -EOPNOTSUPP)
+		return "unavailable";
+	return "error";
+}
+
+static void ibench_print(int json, int cpu, int perf,
+			 struct ibench_result *res, unsigned int nres)
+{
+	char version[50];
+	unsigned int i;
+
+	drng_chacha20_versionstring(version, sizeof(version));
+
+	if (json)
+		printf("{\n  \"version\": \"%s\",\n  \"clock\": \"CLOCK_MONOTONIC\",\n  \"cycles\": %s,\n  \"cpu\": %d,\n  \"results\": [\n",
+		       version, cp_cycles() ? "\"rdtsc\"" : "null", cpu);
+	else {
+		printf("stage,bytes,status,calls,ns_per_call,cycles_per_call,cycles_per_byte");
+		if (perf)
+			cp_perf_print_header(stdout, CP_PERF_CSV);
+		printf("\n");
+	}
+
+	for (i = 0; i < nres; i++) {
+		const struct ibench_stage *st = res[i].stage;
+		double cpb = st->len ? res[i].cycles_per_call / st->len : 0;
+
+		if (json)
+			printf("    { \"stage\": \"%s\", \"bytes\": %u, \"status\": \"%s\", \"calls\": %lu, \"ns_per_call\": %.2f, \"cycles_per_call\": %.2f, \"cycles_per_byte\": %.3f",
+			       st->name, st->len, ibench_status(res[i].status),
+			       (unsigned long)res[i].calls,
+			       res[i].ns_per_call, res[i].cycles_per_call,
+			       cpb);
+		else
+			printf("%s,%u,%s,%lu,%.2f,%.2f,%.3f",
+			       st->name, st->len, ibench_status(res[i].status),
+			       (unsigned long)res[i].calls,
+			       res[i].ns_per_call, res[i].cycles_per_call,
+			       cpb);
+		if (perf)
+			cp_perf_print(stdout, &res[i].perf,
+				      res[i].calls * st->len,
+				      json ? CP_PERF_JSON : CP_PERF_CSV);
+		if (json)
+			printf(" }%s\n", (i + 1 < nres) ? "," : "");
+		else
+			printf("\n");
+	}
+
+	if (json)
+		printf("  ]\n}\n");
+}
+
+/*
+ * Worst-case latency of drng_chacha20_get compared to
+ * drng_chacha20_get_deadline while a reseed is made due every reseed_every
+ * calls.
+ */
+static int ibench_deadline(struct chacha20_drng *drng, uint8_t *buf,
+			   uint64_t budget_ns, uint32_t iterations,
+			   uint32_t reseed_every)
+{
+	uint64_t *lat = calloc(iterations, sizeof(*lat));
+	unsigned int mode;
+	int ret = 0;
+
+	if (!lat)
+		return -ENOMEM;
+
+	printf("function,budget_ns,calls,p50_ns,p99_ns,p999_ns,max_ns,deferred,missed\n");
+	for (mode = 0; mode < 2; mode++) {
+		struct cp_stats stats;
+		uint64_t deferred = 0, missed = 0;
+		uint32_t i;
+
+		for (i = 0; i < iterations; i++) {
+			uint64_t start, end;
+
+			if (!(i % reseed_every))
+				drng_chacha20_int_age(drng, 601);
+
+			start = cp_nstime();
+			if (mode)
+				ret = drng_chacha20_get_deadline(drng, buf, 64,
+							start + budget_ns);
+			else
+				ret = drng_chacha20_get(drng, buf, 64);
+			end = cp_nstime();
+			if (ret < 0)
+				goto out;
+
+			if (ret == DRNG_CHACHA20_RESEED_DEFERRED)
+				deferred++;
+			if (end > start + budget_ns)
+				missed++;
+			lat[i] = end - start;
+		}
+		ret = 0;
+
+		cp_stats(lat, iterations, &stats);
+		printf("%s,%lu,%u,%lu,%lu,%lu,%lu,%lu,%lu\n",
+		       mode ? "get_deadline" : "get",
+		       (unsigned long)budget_ns, iterations,
+		       (unsigned long)stats.p50, (unsigned long)stats.p99,
+		       (unsigned long)stats.p999, (unsigned long)stats.max,
+		       (unsigned long)deferred, (unsigned long)missed);
+	}
+
+out:
+	free(lat);
+	return ret;
+}
+
+/*
+ * Throughput in random bits per second of the bit API compared with one
+ * drng_chacha20_get call per decision.
+ */
+static int ibench_bits(struct chacha20_drng *drng, uint32_t iterations)
+{
+	static const struct {
+		const char *name;
+		uint32_t nbits;
+		int get;
+	} modes[] = {
+		{ "get_bool",		1,	0 },
+		{ "get_bits",		8,	0 },
+		{ "get_bits",		64,	0 },
+		{ "get_byte",		1,	1 },
+		{ "get_u64",		64,	1 },
+	};
+	uint64_t v, sum = 0;
+	unsigned int m;
+	int ret;
+
+	printf("function,bits_per_call,calls,ns_per_call,mbit_per_s\n");
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		uint64_t start, ns;
+		uint32_t i;
+
+		cp_cpusetup();
+		start = cp_nstime();
+		for (i = 0; i < iterations; i++) {
+			if (modes[m].get) {
+				/* Baseline: one request of whole bytes */
+				v = 0;
+				ret = drng_chacha20_get(drng, (uint8_t *)&v,
+						(modes[m].nbits + 7) / 8);
+			} else if (modes[m].nbits == 1) {
+				ret = drng_chacha20_get_bool(drng);
+				v = (uint64_t)ret;
+				ret = (ret < 0) ? ret : 0;
+			} else {
+				ret = drng_chacha20_get_bits(drng,
+							     modes[m].nbits,
+							     &v);
+			}
+			if (ret)
+				return ret;
+			sum += v;
+		}
+		ns = cp_nstime() - start;
+
+		printf("%s,%u,%u,%.2f,%.2f\n", modes[m].name, modes[m].nbits,
+		       iterations, (double)ns / iterations,
+		       ns ? (double)iterations * modes[m].nbits * 1000.0 / ns :
+			    0);
+	}
+	ibench_sink = sum;
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "\t-d ms\t\tmeasurement time per stage (default 200)\n");
+	fprintf(stderr, "\t-c cpu\t\tCPU to pin to, -1 disables pinning (default current CPU)\n");
+	fprintf(stderr, "\t-s stage\tonly run the given stage\n");
+	fprintf(stderr, "\t-f format\tcsv or json (default csv)\n");
+	fprintf(stderr, "\t-P\t\treport hardware performance counters per byte\n");
+	fprintf(stderr, "\t-D ns\t\tcompare the latency of get and get_deadline with\n\t\t\tthe given deadline budget instead of the stages\n");
+	fprintf(stderr, "\t-n calls\tcalls of the deadline comparison (default 100000)\n");
+	fprintf(stderr, "\t-r calls\tmake a reseed due every given calls (default 100)\n");
+	fprintf(stderr, "\t-B\t\tcompare the bit API with drng_chacha20_get in bits/s\n\t\t\tinstead of the stages, -n sets the calls\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ibench_result res[IBENCH_STAGES];
+	struct chacha20_drng *drng, *drngs[IBENCH_HANDLES] = { NULL };
+	struct chacha20_drng *ref[IBENCH_HANDLES] = { NULL };
+	struct cp_perf perf;
+	uint64_t duration_ns = 200000000ULL, budget_ns = 0;
+	uint32_t iterations = 100000, reseed_every = 100;
+	const char *only = NULL;
+	unsigned int i, nres = 0;
+	int opt, ret, json = 0, cpu = -2, failed = 0, use_perf = 0, bits = 0;
+	uint8_t *buf;
+
+	while ((opt = getopt(argc, argv, "d:c:s:f:D:n:r:BPh")) != -1) {
+		switch (opt) {
+		case 'P':
+			use_perf = 1;
+			break;
+		case 'B':
+			bits = 1;
+			break;
+		case 'D':
+			budget_ns = strtoull(optarg, NULL, 10);
+			break;
+		case 'n':
+			iterations = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			reseed_every = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration_ns = strtoull(optarg, NULL, 10) * 1000000ULL;
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 's':
+			only = optarg;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "json"))
+				json = 1;
+			else if (strcmp(optarg, "csv")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (cpu == -2)
+		cpu = cp_current_cpu();
+	if (cpu >= 0) {
+		ret = cp_pin_cpu(cpu);
+		if (ret) {
+			fprintf(stderr, "Pinning to CPU %d failed: %s\n", cpu,
+				strerror(-ret));
+			return 1;
+		}
+	}
+
+	memset(res, 0, sizeof(res));
+	buf = aligned_alloc(64, 4096);
+	if (!buf) {
+		fprintf(stderr, "Allocation of memory failed\n");
+		return 1;
+	}
+	memset(buf, 0, 4096);
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		fprintf(stderr, "Allocation of DRNG failed: %d\n", ret);
+		free(buf);
+		return 1;
+	}
+
+	if (bits) {
+		ret = iterations ? ibench_bits(drng, iterations) : -EINVAL;
+		if (ret) {
+			fprintf(stderr, "Bit API comparison failed: %d\n", ret);
+			failed = 1;
+		}
+		goto out;
+	}
+
+	if (budget_ns) {
+		if (!iterations || !reseed_every) {
+			usage(argv[0]);
+			failed = 1;
+			goto out;
+		}
+		ret = ibench_deadline(drng, buf, budget_ns, iterations,
+				      reseed_every);
+		if (ret) {
+			fprintf(stderr, "Deadline comparison failed: %d\n",
+				ret);
+			failed = 1;
+		}
+		goto out;
+	}
+
+	for (i = 0; i < IBENCH_HANDLES; i++) {
+		ret = drng_chacha20_init(&drngs[i]);
+		if (!ret)
+			ret = drng_chacha20_init(&ref[i]);
+		if (ret) {
+			fprintf(stderr, "Allocation of DRNG failed: %d\n", ret);
+			failed = 1;
+			goto out;
+		}
+	}
+	ret = ibench_xor_check(drngs[0], ref[0]);
+	if (ret) {
+		fprintf(stderr, "XOR generation check failed: %d\n", ret);
+		failed = 1;
+		goto out;
+	}
+	ret = ibench_multi_check(drngs, ref);
+	if (ret) {
+		fprintf(stderr, "Multi-instance generation check failed: %d\n",
+			ret);
+		failed = 1;
+		goto out;
+	}
+
+	if (use_perf && !cp_perf_open(&perf))
+		fprintf(stderr, "Hardware performance counters unavailable\n");
+
+	for (i = 0; i < IBENCH_STAGES; i++) {
+		if (only && strcmp(only, ibench_stages[i].name))
+			continue;
+
+		ret = ibench_run(drng, drngs, buf, &ibench_stages[i],
+				 duration_ns, use_perf ? &perf : NULL,
+				 &res[nres]);
+		if (ret && ret != -EOPNOTSUPP) {
+			fprintf(stderr, "Stage %s failed: %d\n",
+				ibench_stages[i].name, ret);
+			failed = 1;
+		}
+		nres++;
+	}
+
+	if (use_perf)
+		cp_perf_close(&perf);
+
+	ibench_print(json, cpu, use_perf, res, nres);
+
+out:
+	for (i = 0; i < IBENCH_HANDLES; i++) {
+		if (drngs[i])
+			drng_chacha20_destroy(drngs[i]);
+		if (ref[i])
+			drng_chacha20_destroy(ref[i]);
+	}
+	drng_chacha20_destroy(drng);
+	free(buf);
+
+	return failed;
+}
@@ -0,0 +1,755 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Multi-threaded scalability and contention benchmark of the ChaCha20 DRNG.
+ *
+ * Scenarios:
+ *	percpu	one DRNG handle per thread
+ *	churn	allocation, use and destruction of handles in a loop
+ *	shared	one DRNG handle shared by all threads serialized by a mutex
+ *	storm	one handle per thread, all handles reach the reseed threshold
+ *		at the same time in each round
+ *	pool	one NUMA pool shared by all threads, requests are served by the
+ *		node of the calling CPU
+ *	fill	one thread filling buffers of the request size with
+ *		drng_chacha20_pool_fill, the thread count is the number of
+ *		pool instances per node
+ *
+ * For each scenario and thread count, the aggregate throughput and the
+ * latency percentiles of all operations of all threads are reported. For the
+ * pool scenario, the throughput of the threads of every node is reported in
+ * addition.
+ *
+ * This application links an object of chacha20_drng.c compiled with
+ * CHACHA20_DRNG_INTERNALS to age the handles for the reseed storm.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chacha20_drng_internals.h"
+#include "cp_perf.h"
+#include "cp_util.h"
+
+#define MT_MAX_THREADS		1024
+#define MT_MAX_CPUS		4096
+#define MT_MAX_SAMPLES		(1UL<<16)	/* per thread */
+#define MT_STORM_CALLS		1000		/* calls per storm round */
+
+enum mt_mode {
+	MT_PERCPU,
+	MT_CHURN,
+	MT_SHARED,
+	MT_STORM,
+	MT_POOL,
+	MT_FILL,
+	MT_MODES,
+};
+
+static const char *mt_mode_names[MT_MODES] = {
+	"percpu", "churn", "shared", "storm", "pool", "fill"
+};
+
+struct mt_cfg {
+	uint32_t chunk;
+	uint64_t duration_ns;
+	uint32_t storm_rounds;
+	int numa_node;		/* -1: all nodes */
+	int spread;		/* distribute threads round robin over nodes */
+	int pin;
+	int format;		/* 0 text, 1 csv, 2 json */
+	int perf;		/* report hardware performance counters */
+	int *cpus;		/* CPU of each thread index, NULL: no pinning */
+	int ncpus;
+};
+
+struct mt_shared {
+	struct mt_cfg *cfg;
+	enum mt_mode mode;
+	struct chacha20_drng *drng;	/* MT_SHARED */
+	pthread_mutex_t lock;		/* MT_SHARED */
+	struct chacha20_drng_pool *pool;	/* MT_POOL, MT_FILL */
+	pthread_barrier_t barrier;
+	volatile int stop;
+};
+
+struct mt_thread {
+	struct mt_shared *sh;
+	pthread_t thread;
+	unsigned int idx;
+	int node;		/* pool node index of the thread */
+	int ret;
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t nsamples;
+	uint64_t *lat;
+	struct cp_perf perf;
+};
+
+static inline void mt_record(struct mt_thread *t, uint64_t ns)
+{
+	/* Keep the most recent samples once the sample buffer is full */
+	t->lat[t->nsamples++ % MT_MAX_SAMPLES] = ns;
+	t->ops++;
+}
+
+/* Hardware counters only cover the measured calls of each thread */
+static inline void mt_perf_start(struct mt_thread *t)
+{
+	if (t->sh->cfg->perf)
+		cp_perf_start(&t->perf);
+}
+
+static inline void mt_perf_stop(struct mt_thread *t)
+{
+	if (t->sh->cfg->perf)
+		cp_perf_stop(&t->perf);
+}
+
+static void mt_run_percpu(struct mt_thread *t, uint8_t *buf)
+{
+	struct mt_shared *sh = t->sh;
+	struct chacha20_drng *drng;
+
+	t->ret = drng_chacha20_init(&drng);
+	pthread_barrier_wait(&sh->barrier);
+	if (t->ret)
+		return;
+
+	mt_perf_start(t);
+	while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+		uint64_t start = cp_nstime();
+
+		t->ret = drng_chacha20_get(drng, buf, sh->cfg->chunk);
+		mt_record(t, cp_nstime() - start);
+		if (t->ret)
+			break;
+		t->bytes += sh->cfg->chunk;
+	}
+	mt_perf_stop(t);
+
+	drng_chacha20_destroy(drng);
+}
+
+static void mt_run_churn(struct mt_thread *t, uint8_t *buf)
+{
+	struct mt_shared *sh = t->sh;
+
+	pthread_barrier_wait(&sh->barrier);
+
+	mt_perf_start(t);
+	while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+		struct chacha20_drng *drng;
+		uint64_t start = cp_nstime();
+
+		t->ret = drng_chacha20_init(&drng);
+		if (t->ret)
+			break;
+		t->ret = drng_chacha20_get(drng, buf, sh->cfg->chunk);
+		drng_chacha20_destroy(drng);
+		mt_record(t, cp_nstime() - start);
+		if (t->ret)
+			break;
+		t->bytes += sh->cfg->chunk;
+	}
+	mt_perf_stop(t);
+}
+
+static void mt_run_shared(struct mt_thread *t, uint8_t *buf)
+{
+	struct mt_shared *sh = t->sh;
+
+	pthread_barrier_wait(&sh->barrier);
+
+	mt_perf_start(t);
+	while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+		uint64_t start = cp_nstime();
+
+		pthread_mutex_lock(&sh->lock);
+		t->ret = drng_chacha20_get(sh->drng, buf, sh->cfg->chunk);
+		pthread_mutex_unlock(&sh->lock);
+		mt_record(t, cp_nstime() - start);
+		if (t->ret)
+			break;
+		t->bytes += sh->cfg->chunk;
+	}
+	mt_perf_stop(t);
+}
+
+static void mt_run_storm(struct mt_thread *t, uint8_t *buf)
+{
+	struct mt_shared *sh = t->sh;
+	struct chacha20_drng *drng;
+	uint32_t round, i;
+	int ret = drng_chacha20_init(&drng);
+
+	/* All threads execute all rounds to keep the barrier balanced */
+	for (round = 0; round < sh->cfg->storm_rounds; round++) {
+		if (!ret)
+			drng_chacha20_int_age(drng, 601);
+		pthread_barrier_wait(&sh->barrier);
+
+		mt_perf_start(t);
+		for (i = 0; !ret && i < MT_STORM_CALLS; i++) {
+			uint64_t start = cp_nstime();
+
+			ret = drng_chacha20_get(drng, buf, sh->cfg->chunk);
+			mt_record(t, cp_nstime() - start);
+			t->bytes += sh->cfg->chunk;
+		}
+		mt_perf_stop(t);
+	}
+
+	if (!ret)
+		drng_chacha20_destroy(drng);
+	t->ret = ret;
+}
+
+static void mt_run_pool(struct mt_thread *t, uint8_t *buf)
+{
+	struct mt_shared *sh = t->sh;
+
+	pthread_barrier_wait(&sh->barrier);
+
+	mt_perf_start(t);
+	while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+		uint64_t start = cp_nstime();
+
+		t->ret = drng_chacha20_pool_get(sh->pool, buf, sh->cfg->chunk);
+		mt_record(t, cp_nstime() - start);
+		if (t->ret)
+			break;
+		t->bytes += sh->cfg->chunk;
+	}
+	mt_perf_stop(t);
+}
+
+static void mt_run_fill(struct mt_thread *t, uint8_t *buf)
+{
+	struct mt_shared *sh = t->sh;
+
+	pthread_barrier_wait(&sh->barrier);
+
+	mt_perf_start(t);
+	while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+		uint64_t start = cp_nstime();
+
+		t->ret = drng_chacha20_pool_fill(sh->pool, buf, sh->cfg->chunk);
+		mt_record(t, cp_nstime() - start);
+		if (t->ret)
+			break;
+		t->bytes += sh->cfg->chunk;
+	}
+	mt_perf_stop(t);
+}
+
+static void *mt_thread_fn(void *arg)
+{
+	struct mt_thread *t = arg;
+	struct mt_shared *sh = t->sh;
+	uint8_t *buf = malloc(sh->cfg->chunk);
+
+	if (!buf)
+		t->ret = -ENOMEM;
+	else if (sh->cfg->cpus)
+		t->ret = cp_pin_cpu(sh->cfg->cpus[t->idx % sh->cfg->ncpus]);
+	if (!t->ret && sh->pool) {
+		int cpu = cp_current_cpu();
+
+		t->node = (cpu < 0) ? 0 :
+			  drng_chacha20_pool_cpu_node(sh->pool, (uint32_t)cpu);
+	}
+
+	/* Counters are per thread, unavailable counters are reported empty */
+	if (sh->cfg->perf)
+		cp_perf_open(&t->perf);
+
+	if (t->ret) {
+		/* Still participate in the barriers */
+		free(buf);
+		if (sh->mode == MT_STORM) {
+			uint32_t round;
+
+			for (round = 0; round < sh->cfg->storm_rounds; round++)
+				pthread_barrier_wait(&sh->barrier);
+		} else {
+			pthread_barrier_wait(&sh->barrier);
+		}
+		if (sh->cfg->perf)
+			cp_perf_close(&t->perf);
+		return NULL;
+	}
+
+	switch (sh->mode) {
+	case MT_PERCPU:
+		mt_run_percpu(t, buf);
+		break;
+	case MT_CHURN:
+		mt_run_churn(t, buf);
+		break;
+	case MT_SHARED:
+		mt_run_shared(t, buf);
+		break;
+	case MT_STORM:
+		mt_run_storm(t, buf);
+		break;
+	case MT_POOL:
+		mt_run_pool(t, buf);
+		break;
+	case MT_FILL:
+		mt_run_fill(t, buf);
+		break;
+	default:
+		break;
+	}
+
+	if (sh->cfg->perf)
+		cp_perf_close(&t->perf);
+	free(buf);
+	return NULL;
+}
+
+static void mt_print_header(struct mt_cfg *cfg)
+{
+	char version[50];
+
+	drng_chacha20_versionstring(version, sizeof(version));
+
+	switch (cfg->format) {
+	case 1:
+		printf("mode,threads,node,chunk,ops,ops_per_sec,bytes_per_sec,p50_ns,p99_ns,p999_ns,max_ns");
+		if (cfg->perf)
+			cp_perf_print_header(stdout, CP_PERF_CSV);
+		printf("\n");
+		break;
+	case 2:
+		printf("{\n  \"version\": \"%s\",\n  \"clock\": \"CLOCK_MONOTONIC\",\n  \"numa_node\": %d,\n  \"spread\": %s,\n  \"results\": [\n",
+		       version, cfg->numa_node, cfg->spread ? "true" : "false");
+		break;
+	default:
+		printf("%s, chunk size %u bytes\n", version, cfg->chunk);
+		printf("%-7s|%8s|%5s|%12s|%12s|%14s|%10s|%10s|%10s|%12s",
+		       "mode", "threads", "node", "ops", "ops/s", "throughput",
+		       "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+		if (cfg->perf)
+			cp_perf_print_header(stdout, CP_PERF_TEXT);
+		printf("\n");
+		break;
+	}
+}
+
+/* The node -1 denotes the aggregate of all threads */
+static void mt_print(struct mt_cfg *cfg, enum mt_mode mode,
+		     unsigned int threads, int node, uint64_t ops,
+		     uint64_t bytes, uint64_t ns, struct cp_stats *st,
+		     struct cp_perf *perf, int last)
+{
+	double secs = (double)ns / 1000000000.0;
+	uint64_t ops_s = (uint64_t)((double)ops / secs);
+	uint64_t bytes_s = (uint64_t)((double)bytes / secs);
+	char tp[24], nodestr[12];
+
+	switch (cfg->format) {
+	case 1:
+		printf("%s,%u,%d,%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu",
+		       mt_mode_names[mode], threads, node, cfg->chunk,
+		       (unsigned long)ops, (unsigned long)ops_s,
+		       (unsigned long)bytes_s, (unsigned long)st->p50,
+		       (unsigned long)st->p99, (unsigned long)st->p999,
+		       (unsigned long)st->max);
+		if (cfg->perf)
+			cp_perf_print(stdout, perf, bytes, CP_PERF_CSV);
+		printf("\n");
+		break;
+	case 2:
+		printf("    { \"mode\": \"%s\", \"threads\": %u, \"node\": %d, \"chunk\": %u, \"ops\": %lu, \"ops_per_sec\": %lu, \"bytes_per_sec\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu",
+		       mt_mode_names[mode], threads, node, cfg->chunk,
+		       (unsigned long)ops, (unsigned long)ops_s,
+		       (unsigned long)bytes_s, (unsigned long)st->p50,
+		       (unsigned long)st->p99, (unsigned long)st->p999,
+		       (unsigned long)st->max);
+		if (cfg->perf)
+			cp_perf_print(stdout, perf, bytes, CP_PERF_JSON);
+		printf(" }%s\n", last ? "" : ",");
+		break;
+	default:
+		cp_bytes2string(bytes_s, tp, sizeof(tp));
+		strncat(tp, "/s", sizeof(tp) - strlen(tp) - 1);
+		if (node < 0)
+			snprintf(nodestr, sizeof(nodestr), "all");
+		else
+			snprintf(nodestr, sizeof(nodestr), "%d", node);
+		printf("%-7s|%8u|%5s|%12lu|%12lu|%14s|%10lu|%10lu|%10lu|%12lu",
+		       mt_mode_names[mode], threads, nodestr, (unsigned long)ops,
+		       (unsigned long)ops_s, tp, (unsigned long)st->p50,
+		       (unsigned long)st->p99, (unsigned long)st->p999,
+		       (unsigned long)st->max);
+		if (cfg->perf)
+			cp_perf_print(stdout, perf, bytes, CP_PERF_TEXT);
+		printf("\n");
+		break;
+	}
+}
+
+/* Report the threads of one pool node or of all nodes (node -1) */
+static int mt_report(struct mt_cfg *cfg, enum mt_mode mode,
+		     unsigned int threads, struct mt_thread *t,
+		     unsigned int nthreads, int node, uint64_t ns, int last)
+{
+	struct cp_stats stats;
+	struct cp_perf perf;
+	uint64_t ops = 0, bytes = 0, nsamples = 0, *lat;
+	unsigned int i;
+
+	memset(&perf, 0, sizeof(perf));
+	for (i = 0; i < nthreads; i++) {
+		if (node >= 0 && t[i].node != node)
+			continue;
+		ops += t[i].ops;
+		bytes += t[i].bytes;
+		cp_perf_add(&perf, &t[i].perf);
+		nsamples += (t[i].nsamples < MT_MAX_SAMPLES) ?
+			    t[i].nsamples : MT_MAX_SAMPLES;
+	}
+
+	lat = malloc((nsamples ? nsamples : 1) * sizeof(*lat));
+	if (!lat)
+		return -ENOMEM;
+	for (i = 0, nsamples = 0; i < nthreads; i++) {
+		uint64_t n = (t[i].nsamples < MT_MAX_SAMPLES) ?
+			     t[i].nsamples : MT_MAX_SAMPLES;
+
+		if (node >= 0 && t[i].node != node)
+			continue;
+		memcpy(lat + nsamples, t[i].lat, n * sizeof(*lat));
+		nsamples += n;
+	}
+	cp_stats(lat, nsamples, &stats);
+
+	mt_print(cfg, mode, threads, node, ops, bytes, ns, &stats, &perf, last);
+	free(lat);
+
+	return 0;
+}
+
+static int mt_run(struct mt_cfg *cfg, enum mt_mode mode, unsigned int threads,
+		  int last)
+{
+	struct mt_shared sh;
+	struct mt_thread *t;
+	/* The fill scenario uses the thread count as pool instances per node */
+	unsigned int nthreads = (mode == MT_FILL) ? 1 : threads;
+	uint64_t start, ns;
+	unsigned int i, started = 0, nodes = 0;
+	int ret = 0;
+
+	t = calloc(nthreads, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	memset(&sh, 0, sizeof(sh));
+	sh.cfg = cfg;
+	sh.mode = mode;
+	pthread_mutex_init(&sh.lock, NULL);
+	/* The main thread joins the start barrier */
+	pthread_barrier_init(&sh.barrier, NULL,
+			     nthreads + (mode == MT_STORM ? 0 : 1));
+
+	if (mode == MT_SHARED) {
+		ret = drng_chacha20_init(&sh.drng);
+		if (ret)
+			goto out;
+	}
+	if (mode == MT_POOL || mode == MT_FILL) {
+		ret = drng_chacha20_pool_alloc(&sh.pool,
+					       (mode == MT_FILL) ? threads : 0);
+		if (ret)
+			goto out;
+		nodes = drng_chacha20_pool_nodes(sh.pool);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		t[i].sh = &sh;
+		t[i].idx = i;
+		t[i].lat = malloc(MT_MAX_SAMPLES * sizeof(uint64_t));
+		if (!t[i].lat) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	start = cp_nstime();
+	for (i = 0; i < nthreads; i++) {
+		ret = -pthread_create(&t[i].thread, NULL, mt_thread_fn, &t[i]);
+		if (ret) {
+			/* Cannot recover from a partially populated barrier */
+			fprintf(stderr, "Thread creation failed: %d\n", ret);
+			exit(1);
+		}
+		started++;
+	}
+
+	if (mode != MT_STORM) {
+		pthread_barrier_wait(&sh.barrier);
+		start = cp_nstime();
+		usleep(cfg->duration_ns / 1000);
+		__atomic_store_n(&sh.stop, 1, __ATOMIC_RELAXED);
+	}
+
+	for (i = 0; i < started; i++)
+		pthread_join(t[i].thread, NULL);
+	ns = cp_nstime() - start;
+
+	for (i = 0; i < nthreads; i++) {
+		if (t[i].ret && !ret)
+			ret = t[i].ret;
+	}
+	if (ret)
+		goto out;
+
+	ret = mt_report(cfg, mode, threads, t, nthreads, -1, ns,
+			last && mode != MT_POOL);
+	for (i = 0; !ret && mode == MT_POOL && i < nodes; i++)
+		ret = mt_report(cfg, mode, threads, t, nthreads, (int)i, ns,
+				last && i == nodes - 1);
+
+out:
+	for (i = 0; i < nthreads; i++)
+		free(t[i].lat);
+	free(t);
+	if (sh.drng)
+		drng_chacha20_destroy(sh.drng);
+	drng_chacha20_pool_free(sh.pool);
+	pthread_barrier_destroy(&sh.barrier);
+	pthread_mutex_destroy(&sh.lock);
+
+	return ret;
+}
+
+/* Assemble the CPUs the threads are pinned to */
+static int mt_cpus(struct mt_cfg *cfg)
+{
+	int nodes[256], nnodes, i;
+
+	cfg->cpus = calloc(MT_MAX_CPUS, sizeof(int));
+	if (!cfg->cpus)
+		return -ENOMEM;
+
+	if (cfg->numa_node >= 0) {
+		cfg->ncpus = cp_node_cpus(cfg->numa_node, cfg->cpus,
+					  MT_MAX_CPUS);
+		return cfg->ncpus > 0 ? 0 : (cfg->ncpus ? cfg->ncpus : -ENODEV);
+	}
+
+	nnodes = cp_online_nodes(nodes, 256);
+	if (nnodes <= 0)
+		return nnodes ? nnodes : -ENODEV;
+
+	if (!cfg->spread) {
+		/* Fill node after node */
+		for (i = 0; i < nnodes && cfg->ncpus < MT_MAX_CPUS; i++) {
+			int n = cp_node_cpus(nodes[i], cfg->cpus + cfg->ncpus,
+					     MT_MAX_CPUS - cfg->ncpus);
+
+			if (n > 0)
+				cfg->ncpus += n;
+		}
+	} else {
+		/* Round robin over the nodes */
+		int (*node_cpus)[MT_MAX_CPUS / 16] =
+			calloc(nnodes, sizeof(*node_cpus));
+		int *cnt = calloc(nnodes, sizeof(int));
+		int j, added = 1;
+
+		if (!node_cpus || !cnt) {
+			free(node_cpus);
+			free(cnt);
+			return -ENOMEM;
+		}
+		for (i = 0; i < nnodes; i++) {
+			cnt[i] = cp_node_cpus(nodes[i], node_cpus[i],
+					      MT_MAX_CPUS / 16);
+			if (cnt[i] < 0)
+				cnt[i] = 0;
+		}
+		for (j = 0; added && cfg->ncpus < MT_MAX_CPUS; j++) {
+			added = 0;
+			for (i = 0; i < nnodes && cfg->ncpus < MT_MAX_CPUS;
+			     i++) {
+				if (j < cnt[i]) {
+					cfg->cpus[cfg->ncpus++] =
+						node_cpus[i][j];
+					added = 1;
+				}
+			}
+		}
+		free(node_cpus);
+		free(cnt);
+	}
+
+	return cfg->ncpus > 0 ? 0 : -ENODEV;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "\t-t n,n,...\tthread counts (default powers of two up to the number of CPUs)\n");
+	fprintf(stderr, "\t-m mode\t\tpercpu, churn, shared, storm, pool, fill or all\n\t\t\t(default all)\n");
+	fprintf(stderr, "\t-s bytes\trequest size (default 64)\n");
+	fprintf(stderr, "\t-d ms\t\tduration per measurement (default 1000)\n");
+	fprintf(stderr, "\t-r rounds\treseed storm rounds of %u calls (default 20)\n",
+		MT_STORM_CALLS);
+	fprintf(stderr, "\t-N node\t\tpin the threads to the CPUs of the NUMA node\n");
+	fprintf(stderr, "\t-S\t\tpin the threads round robin over all NUMA nodes\n");
+	fprintf(stderr, "\t-p\t\tpin the threads node after node to all CPUs\n");
+	fprintf(stderr, "\t-f format\ttext, csv or json (default text)\n");
+	fprintf(stderr, "\t-P\t\treport hardware performance counters per byte\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct mt_cfg cfg = {
+		.chunk = 64,
+		.duration_ns = 1000000000ULL,
+		.storm_rounds = 20,
+		.numa_node = -1,
+	};
+	unsigned int threads[64], nthreads = 0, i;
+	int opt, ret = 0, mode = -1, m, nruns, run = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "t:m:s:d:r:N:Spf:Ph")) != -1) {
+		switch (opt) {
+		case 'P':
+			cfg.perf = 1;
+			break;
+		case 't': {
+			char *p = optarg;
+
+			while (*p && nthreads < 64) {
+				char *end;
+				unsigned long n = strtoul(p, &end, 10);
+
+				if (end == p || !n || n > MT_MAX_THREADS) {
+					usage(argv[0]);
+					return 1;
+				}
+				threads[nthreads++] = (unsigned int)n;
+				p = (*end == ',') ? end + 1 : end;
+			}
+			break;
+		}
+		case 'm':
+			for (m = 0; m < MT_MODES; m++)
+				if (!strcmp(optarg, mt_mode_names[m]))
+					mode = m;
+			if (mode < 0 && strcmp(optarg, "all")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			cfg.chunk = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			cfg.duration_ns = strtoull(optarg, NULL, 10) *
+					  1000000ULL;
+			break;
+		case 'r':
+			cfg.storm_rounds = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'N':
+			cfg.numa_node = atoi(optarg);
+			cfg.pin = 1;
+			break;
+		case 'S':
+			cfg.spread = 1;
+			cfg.pin = 1;
+			break;
+		case 'p':
+			cfg.pin = 1;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				cfg.format = 1;
+			else if (!strcmp(optarg, "json"))
+				cfg.format = 2;
+			else if (strcmp(optarg, "text")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!cfg.chunk || !cfg.duration_ns || !cfg.storm_rounds) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!nthreads) {
+		unsigned int n;
+
+		for (n = 1; n <= (unsigned int)(cpus > 0 ? cpus : 1) &&
+			    nthreads < 64; n <<= 1)
+			threads[nthreads++] = n;
+	}
+
+	if (cfg.pin) {
+		ret = mt_cpus(&cfg);
+		if (ret) {
+			fprintf(stderr, "Obtaining the CPUs to pin to failed: %d\n",
+				ret);
+			free(cfg.cpus);
+			return 1;
+		}
+	}
+
+	nruns = nthreads * ((mode < 0) ? MT_MODES : 1);
+	mt_print_header(&cfg);
+	for (m = 0; m < MT_MODES; m++) {
+		if (mode >= 0 && m != mode)
+			continue;
+
+		for (i = 0; i < nthreads; i++) {
+			ret = mt_run(&cfg, m, threads[i], ++run == nruns);
+			if (ret) {
+				fprintf(stderr, "%s with %u threads failed: %d\n",
+					mt_mode_names[m], threads[i], ret);
+				goto out;
+			}
+		}
+	}
+	if (cfg.format == 2)
+		printf("  ]\n}\n");
+
+out:
+	free(cfg.cpus);
+	return ret ? 1 : 0;
+}
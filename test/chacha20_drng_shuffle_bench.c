@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Throughput of drng_chacha20_shuffle and drng_chacha20_sample_indices.
+ *
+ * The shuffle is measured for a sweep of array sizes with a Fisher-Yates
+ * shuffle calling drng_chacha20_get for every index (naive), the in-place
+ * Fisher-Yates shuffle with batched bounded integers (fy), the cache-blocked
+ * shuffle (blocked) and the library selection (auto). The sampling is
+ * measured for a sweep of k with the bitmap and the hash table tracking as
+ * well as the library selection. Every result is verified.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chacha20_drng_internals.h"
+#include "cp_util.h"
+
+enum sbench_shuffle {
+	SBENCH_NAIVE,
+	SBENCH_FY,
+	SBENCH_BLOCKED,
+	SBENCH_AUTO,
+	SBENCH_SHUFFLES,
+};
+
+static const char *sbench_shuffle_names[SBENCH_SHUFFLES] = {
+	"naive", "fy", "blocked", "auto"
+};
+
+static const char *sbench_sample_names[] = {
+	"auto", "bitmap", "hash"
+};
+
+struct sbench_cfg {
+	uint64_t duration_ns;
+	size_t minmemb;
+	size_t maxmemb;
+	size_t naive_max;
+	size_t esize;
+	size_t block_bytes;
+	size_t n;
+	int shuffle;
+	int sample;
+	int csv;
+};
+
+/* Fisher-Yates shuffle with one drng_chacha20_get call per index */
+static int sbench_naive(struct chacha20_drng *drng, uint8_t *base,
+			size_t nmemb, size_t size)
+{
+	uint8_t tmp[64];
+	size_t i;
+
+	if (size > sizeof(tmp))
+		return -EINVAL;
+
+	for (i = nmemb - 1; i > 0; i--) {
+		uint64_t x, bound = i + 1, threshold = (0ULL - bound) % bound;
+		size_t j;
+		int ret;
+
+		do {
+			ret = drng_chacha20_get(drng, (uint8_t *)&x, sizeof(x));
+			if (ret)
+				return ret;
+		} while (x < threshold);
+		j = (size_t)(x % bound);
+
+		memcpy(tmp, base + i * size, size);
+		memcpy(base + i * size, base + j * size, size);
+		memcpy(base + j * size, tmp, size);
+	}
+
+	return 0;
+}
+
+static int sbench_shuffle_one(struct sbench_cfg *cfg,
+			      struct chacha20_drng *drng,
+			      enum sbench_shuffle alg, uint8_t *base,
+			      size_t nmemb)
+{
+	switch (alg) {
+	case SBENCH_NAIVE:
+		return sbench_naive(drng, base, nmemb, cfg->esize);
+	case SBENCH_FY:
+		return drng_chacha20_int_shuffle(drng, base, nmemb, cfg->esize,
+						 SIZE_MAX);
+	case SBENCH_BLOCKED:
+		return drng_chacha20_int_shuffle(drng, base, nmemb, cfg->esize,
+						 cfg->block_bytes);
+	case SBENCH_AUTO:
+	default:
+		return drng_chacha20_shuffle(drng, base, nmemb, cfg->esize);
+	}
+}
+
+/* The first 4 bytes of each element hold its original index */
+static int sbench_verify_perm(const uint8_t *base, size_t nmemb, size_t size)
+{
+	uint8_t *seen = calloc(1, nmemb);
+	size_t i;
+	int ret = 0;
+
+	if (!seen)
+		return -ENOMEM;
+
+	for (i = 0; i < nmemb; i++) {
+		uint32_t idx;
+
+		memcpy(&idx, base + i * size, sizeof(idx));
+		if (idx >= nmemb || seen[idx]++) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	free(seen);
+	return ret;
+}
+
+static void sbench_print(struct sbench_cfg *cfg, const char *op,
+			 const char *alg, size_t n, size_t k, uint64_t runs,
+			 uint64_t ns)
+{
+	double per_sec = (double)k * (double)runs * 1e9 / (double)ns;
+
+	if (cfg->csv)
+		printf("%s,%s,%lu,%lu,%lu,%lu,%.0f,%.2f\n", op, alg,
+		       (unsigned long)n, (unsigned long)k,
+		       (unsigned long)cfg->esize, (unsigned long)runs, per_sec,
+		       1e9 / per_sec);
+	else
+		printf("%-8s|%-8s|%12lu|%12lu|%8lu|%14.0f|%10.2f\n", op, alg,
+		       (unsigned long)n, (unsigned long)k, (unsigned long)runs,
+		       per_sec, 1e9 / per_sec);
+}
+
+static int sbench_shuffle(struct sbench_cfg *cfg, struct chacha20_drng *drng)
+{
+	size_t nmemb, i;
+	int ret = 0;
+
+	for (nmemb = cfg->minmemb; nmemb <= cfg->maxmemb; nmemb <<= 1) {
+		uint8_t *base = malloc(nmemb * cfg->esize);
+		unsigned int alg;
+
+		if (!base)
+			return -ENOMEM;
+
+		for (alg = 0; alg < SBENCH_SHUFFLES; alg++) {
+			uint64_t total = 0, runs = 0;
+
+			if (alg == SBENCH_NAIVE && nmemb > cfg->naive_max)
+				continue;
+
+			memset(base, 0, nmemb * cfg->esize);
+			for (i = 0; i < nmemb; i++) {
+				uint32_t idx = (uint32_t)i;
+
+				memcpy(base + i * cfg->esize, &idx,
+				       sizeof(idx));
+			}
+
+			while (total < cfg->duration_ns || !runs) {
+				uint64_t start = cp_nstime();
+
+				ret = sbench_shuffle_one(cfg, drng, alg, base,
+							 nmemb);
+				total += cp_nstime() - start;
+				runs++;
+				if (ret)
+					break;
+			}
+			if (!ret)
+				ret = sbench_verify_perm(base, nmemb,
+							 cfg->esize);
+			if (ret) {
+				fprintf(stderr, "Shuffle %s of %lu elements failed: %d\n",
+					sbench_shuffle_names[alg],
+					(unsigned long)nmemb, ret);
+				free(base);
+				return ret;
+			}
+
+			sbench_print(cfg, "shuffle", sbench_shuffle_names[alg],
+				     nmemb, nmemb, runs, total);
+		}
+
+		free(base);
+		if (nmemb > SIZE_MAX / 2)
+			break;
+	}
+
+	return 0;
+}
+
+static int sbench_verify_sample(const size_t *idx, size_t n, size_t k)
+{
+	uint8_t *seen = calloc(1, n / 8 + 1);
+	size_t i;
+	int ret = 0;
+
+	if (!seen)
+		return -ENOMEM;
+
+	for (i = 0; i < k; i++) {
+		if (idx[i] >= n || (seen[idx[i] / 8] & (1 << (idx[i] % 8)))) {
+			ret = -EFAULT;
+			break;
+		}
+		seen[idx[i] / 8] |= (uint8_t)(1 << (idx[i] % 8));
+	}
+
+	free(seen);
+	return ret;
+}
+
+static int sbench_sample(struct sbench_cfg *cfg, struct chacha20_drng *drng)
+{
+	size_t k, *out = malloc(cfg->n * sizeof(*out));
+	int ret = 0;
+
+	if (!out)
+		return -ENOMEM;
+
+	for (k = 1; k <= cfg->n; k = (k * 4 > cfg->n && k < cfg->n) ?
+						cfg->n : k * 4) {
+		int method;
+
+		for (method = DRNG_CHACHA20_INT_SAMPLE_AUTO;
+		     method <= DRNG_CHACHA20_INT_SAMPLE_HASH; method++) {
+			uint64_t total = 0, runs = 0;
+
+			while (total < cfg->duration_ns || !runs) {
+				uint64_t start = cp_nstime();
+
+				ret = drng_chacha20_int_sample(drng, cfg->n, k,
+							       out, method);
+				total += cp_nstime() - start;
+				runs++;
+				if (ret)
+					break;
+			}
+			if (!ret)
+				ret = sbench_verify_sample(out, cfg->n, k);
+			if (ret) {
+				fprintf(stderr, "Sampling %s of %lu indices failed: %d\n",
+					sbench_sample_names[method],
+					(unsigned long)k, ret);
+				goto out;
+			}
+
+			sbench_print(cfg, "sample", sbench_sample_names[method],
+				     cfg->n, k, runs, total);
+		}
+
+		if (k == cfg->n)
+			break;
+	}
+
+out:
+	free(out);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "\t-m mode\t\tshuffle, sample or all (default all)\n");
+	fprintf(stderr, "\t-s n\t\tsmallest shuffled array in elements (default 1024)\n");
+	fprintf(stderr, "\t-S n\t\tlargest shuffled array in elements (default 16777216)\n");
+	fprintf(stderr, "\t-e bytes\telement size, at least 4 (default 4)\n");
+	fprintf(stderr, "\t-b bytes\tblock size of the blocked shuffle (default L2 cache size)\n");
+	fprintf(stderr, "\t-N n\t\tlargest array of the naive shuffle (default 1048576)\n");
+	fprintf(stderr, "\t-n n\t\tpopulation size of the sampling (default 16777216)\n");
+	fprintf(stderr, "\t-d ms\t\tmeasurement time per configuration (default 200)\n");
+	fprintf(stderr, "\t-c cpu\t\tCPU to pin to, -1 disables pinning (default current CPU)\n");
+	fprintf(stderr, "\t-f format\ttext or csv (default text)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct sbench_cfg cfg = {
+		.duration_ns = 200000000ULL,
+		.minmemb = 1024,
+		.maxmemb = 1 << 24,
+		.naive_max = 1 << 20,
+		.esize = sizeof(uint32_t),
+		.n = 1 << 24,
+		.shuffle = 1,
+		.sample = 1,
+	};
+	struct chacha20_drng *drng;
+	char version[50];
+	long l2 = -1;
+	int opt, ret, cpu = -2;
+
+	while ((opt = getopt(argc, argv, "m:s:S:e:b:N:n:d:c:f:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			cfg.shuffle = !strcmp(optarg, "shuffle") ||
+				      !strcmp(optarg, "all");
+			cfg.sample = !strcmp(optarg, "sample") ||
+				     !strcmp(optarg, "all");
+			if (!cfg.shuffle && !cfg.sample) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			cfg.minmemb = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			cfg.maxmemb = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			cfg.esize = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			cfg.block_bytes = strtoul(optarg, NULL, 10);
+			break;
+		case 'N':
+			cfg.naive_max = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			cfg.n = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			cfg.duration_ns = strtoull(optarg, NULL, 10) *
+					  1000000ULL;
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				cfg.csv = 1;
+			else if (strcmp(optarg, "text")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (cfg.minmemb < 2 || cfg.minmemb > cfg.maxmemb ||
+	    cfg.maxmemb > UINT32_MAX || cfg.esize < sizeof(uint32_t) ||
+	    cfg.esize > 64 || !cfg.n) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!cfg.block_bytes) {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+		l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+		cfg.block_bytes = (l2 > 0) ? (size_t)l2 : (1UL << 20);
+	}
+
+	if (cpu == -2)
+		cpu = cp_current_cpu();
+	if (cpu >= 0) {
+		ret = cp_pin_cpu(cpu);
+		if (ret) {
+			fprintf(stderr, "Pinning to CPU %d failed: %s\n", cpu,
+				strerror(-ret));
+			return 1;
+		}
+	}
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		fprintf(stderr, "Allocation of DRNG failed: %d\n", ret);
+		return 1;
+	}
+
+	drng_chacha20_versionstring(version, sizeof(version));
+	if (cfg.csv) {
+		printf("operation,algorithm,n,k,element_size,runs,elements_per_sec,ns_per_element\n");
+	} else {
+		printf("%s, element size %lu bytes, block size %lu bytes\n",
+		       version, (unsigned long)cfg.esize,
+		       (unsigned long)cfg.block_bytes);
+		printf("%-8s|%-8s|%12s|%12s|%8s|%14s|%10s\n", "op",
+		       "algo", "n", "k", "runs", "elements/s", "ns/elem");
+	}
+
+	if (cfg.shuffle)
+		ret = sbench_shuffle(&cfg, drng);
+	if (!ret && cfg.sample)
+		ret = sbench_sample(&cfg, drng);
+
+	drng_chacha20_destroy(drng);
+
+	return ret ? 1 : 0;
+}
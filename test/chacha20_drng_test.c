@@ -25,8 +25,16 @@
 #include <time.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "chacha20_drng.h"
+#include "chacha20_drng_internals.h"
+#include "cp_perf.h"
+#include "cp_util.h"
 
 static uint8_t hex_char(unsigned int bin, int u)
 {
@@ -115,106 +123,1349 @@ static int basic_test(void)
 	return 0;
 }
 
-static int gen_test(void)
+static int prefetch_test(void)
+{
+	struct chacha20_drng *drng;
+	uint8_t buf[1000], large[16 * 4096];
+	uint64_t underruns;
+	uint32_t epoch;
+	unsigned int i;
+	int ret;
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		return 1;
+	}
+
+	ret = drng_chacha20_prefetch_enable(drng, 4096, -1);
+	if (ret) {
+		printf("Enabling prefetching failed: %d\n", ret);
+		drng_chacha20_destroy(drng);
+		return 1;
+	}
+
+	for (i = 0; i < 100; i++) {
+		if (drng_chacha20_get(drng, buf, sizeof(buf))) {
+			printf("Getting random numbers failed\n");
+			drng_chacha20_destroy(drng);
+			return 1;
+		}
+	}
+
+	bin2print(buf, 10, "Prefetched random number");
+	printf("Prefetch underruns: %lu\n",
+	       (unsigned long)drng_chacha20_prefetch_underruns(drng));
+
+	/*
+	 * A threshold reseed performed by the synchronous generation of an
+	 * underrun or of drng_chacha20_xor reseeds the refill thread. The
+	 * request exceeds the buffers of 4096 bytes many times, it is repeated
+	 * in the unlikely case that the refill thread kept up with it.
+	 */
+	for (i = 0; i < 10; i++) {
+		underruns = drng_chacha20_prefetch_underruns(drng);
+		epoch = drng_chacha20_int_prefetch_epoch(drng);
+		drng_chacha20_int_age(drng, 601);
+		if (drng_chacha20_get(drng, large, sizeof(large))) {
+			printf("Getting random numbers failed\n");
+			drng_chacha20_destroy(drng);
+			return 1;
+		}
+		if (drng_chacha20_prefetch_underruns(drng) != underruns)
+			break;
+		/* The threshold reseed is performed by the next request */
+		drng_chacha20_get(drng, buf, sizeof(buf));
+	}
+	if (drng_chacha20_int_prefetch_epoch(drng) != epoch + 1) {
+		printf("Reseed of an underrun does not reach the prefetch buffers\n");
+		drng_chacha20_destroy(drng);
+		return 1;
+	}
+	epoch = drng_chacha20_int_prefetch_epoch(drng);
+	drng_chacha20_int_age(drng, 601);
+	if (drng_chacha20_xor(drng, buf, sizeof(buf)) ||
+	    drng_chacha20_int_prefetch_epoch(drng) != epoch + 1) {
+		printf("Reseed of an XOR does not reach the prefetch buffers\n");
+		drng_chacha20_destroy(drng);
+		return 1;
+	}
+
+	drng_chacha20_prefetch_disable(drng);
+	if (drng_chacha20_get(drng, buf, sizeof(buf))) {
+		printf("Getting random numbers failed\n");
+		drng_chacha20_destroy(drng);
+		return 1;
+	}
+
+	/* Destruction must also terminate the refill thread */
+	ret = drng_chacha20_prefetch_enable(drng, 4096, 0);
+	drng_chacha20_destroy(drng);
+	if (ret) {
+		printf("Enabling prefetching failed: %d\n", ret);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int det_test(void)
+{
+	struct chacha20_drng_det *det;
+	uint8_t key[DRNG_CHACHA20_DET_KEYLEN];
+	uint8_t state[DRNG_CHACHA20_DET_STATELEN];
+	uint8_t ref[1000], buf[1000];
+	uint32_t i, len;
+	int ret;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = (uint8_t)i;
+
+	ret = drng_chacha20_det_init(&det, key, sizeof(key), 1);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		return 1;
+	}
+
+	if (drng_chacha20_det_get(det, ref, sizeof(ref)))
+		goto err;
+
+	/* Splitting the request must not change the stream */
+	drng_chacha20_det_seek(det, 0);
+	for (i = 0, len = 1; i < sizeof(buf); i += len, len += 7) {
+		if (len > sizeof(buf) - i)
+			len = sizeof(buf) - i;
+		if (drng_chacha20_det_get(det, buf + i, len))
+			goto err;
+	}
+	if (memcmp(ref, buf, sizeof(ref))) {
+		printf("Split requests deliver different stream\n");
+		goto err;
+	}
+
+	/* Seek into the middle of a block, unaligned output buffer */
+	drng_chacha20_det_seek(det, 333);
+	if (drng_chacha20_det_get(det, buf + 1, 600) ||
+	    memcmp(ref + 333, buf + 1, 600)) {
+		printf("Seek delivers different stream\n");
+		goto err;
+	}
+	if (drng_chacha20_det_tell(det) != 933) {
+		printf("Unexpected stream position\n");
+		goto err;
+	}
+
+	/* Save the state, generate, restore and generate again */
+	drng_chacha20_det_seek(det, 100);
+	drng_chacha20_det_save(det, state);
+	if (drng_chacha20_det_get(det, buf, 100))
+		goto err;
+	drng_chacha20_det_seek(det, 0);
+	if (drng_chacha20_det_restore(det, state) ||
+	    drng_chacha20_det_get(det, buf + 100, 100) ||
+	    memcmp(buf, buf + 100, 100) || memcmp(buf, ref + 100, 100)) {
+		printf("Restore delivers different stream\n");
+		goto err;
+	}
+
+	/* XOR in split requests masks with the stream, the same XOR unmasks */
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = (uint8_t)(i * 3);
+	drng_chacha20_det_seek(det, 0);
+	for (i = 0, len = 1; i < sizeof(buf); i += len, len += 13) {
+		if (len > sizeof(buf) - i)
+			len = sizeof(buf) - i;
+		if (drng_chacha20_det_xor(det, buf + i, len))
+			goto err;
+	}
+	for (i = 0; i < sizeof(buf); i++) {
+		if (buf[i] != (uint8_t)(ref[i] ^ (uint8_t)(i * 3))) {
+			printf("XOR delivers different stream\n");
+			goto err;
+		}
+	}
+	drng_chacha20_det_seek(det, 0);
+	if (drng_chacha20_det_xor(det, buf, sizeof(buf)))
+		goto err;
+	for (i = 0; i < sizeof(buf); i++) {
+		if (buf[i] != (uint8_t)(i * 3)) {
+			printf("XOR does not unmask the data\n");
+			goto err;
+		}
+	}
+
+	bin2print(ref, 10, "Deterministic stream");
+	drng_chacha20_det_destroy(det);
+
+	return 0;
+
+err:
+	drng_chacha20_det_destroy(det);
+	return 1;
+}
+
+static int child_test(void)
+{
+	struct chacha20_drng *drng;
+	struct chacha20_drng_child child1, child2, grandchild;
+	uint8_t buf1[40], buf2[40], buf3[40];
+	int ret;
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		return 1;
+	}
+
+	if (drng_chacha20_split(drng, &child1) ||
+	    drng_chacha20_split(drng, &child2) ||
+	    drng_chacha20_child_split(&child1, &grandchild) ||
+	    drng_chacha20_child_get(&child1, buf1, sizeof(buf1)) ||
+	    drng_chacha20_child_get(&child2, buf2, sizeof(buf2)) ||
+	    drng_chacha20_child_get(&grandchild, buf3, sizeof(buf3))) {
+		printf("Child DRNG operation failed\n");
+		ret = 1;
+		goto out;
+	}
+
+	if (!memcmp(buf1, buf2, sizeof(buf1)) ||
+	    !memcmp(buf1, buf3, sizeof(buf1)) ||
+	    !memcmp(buf2, buf3, sizeof(buf2))) {
+		printf("Child DRNGs deliver identical data\n");
+		ret = 1;
+		goto out;
+	}
+
+	bin2print(buf1, 10, "Child random number");
+
+out:
+	drng_chacha20_child_zero(&child1);
+	drng_chacha20_child_zero(&child2);
+	drng_chacha20_child_zero(&grandchild);
+	drng_chacha20_destroy(drng);
+
+	return ret;
+}
+
+static uint64_t stats_hist_sum(const uint64_t *hist)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < DRNG_CHACHA20_STATS_BUCKETS; i++)
+		sum += hist[i];
+
+	return sum;
+}
+
+static int stats_test(void)
+{
+	struct chacha20_drng *drng;
+	struct drng_chacha20_stats stats;
+	uint8_t buf[100];
+	int ret;
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		return 1;
+	}
+
+	if (drng_chacha20_get(drng, buf, sizeof(buf)) ||
+	    drng_chacha20_get(drng, buf, 16) ||
+	    drng_chacha20_reseed(drng, NULL, 0)) {
+		printf("Generation failed\n");
+		ret = 1;
+		goto out;
+	}
+
+	ret = drng_chacha20_get_stats(drng, &stats);
+	if (ret == -EOPNOTSUPP) {
+		printf("Statistics not compiled in\n");
+		ret = 0;
+		goto out;
+	}
+
+	/* 100 bytes: 2 blocks plus update, 16 bytes: 1 block, 2 seed blocks */
+	if (ret || stats.get_calls != 2 ||
+	    stats.generated_bytes != sizeof(buf) + 16 ||
+	    stats.reseeds_explicit != 2 || stats.reseed_failures ||
+	    stats_hist_sum(stats.get_latency) != 2 ||
+	    stats_hist_sum(stats.reseed_latency) != 2 ||
+	    stats.blocks < 6) {
+		printf("Statistics are inconsistent\n");
+		ret = 1;
+		goto out;
+	}
+
+	printf("Statistics: %lu get calls, %lu bytes, %lu blocks, %lu reseeds\n",
+	       (unsigned long)stats.get_calls,
+	       (unsigned long)stats.generated_bytes,
+	       (unsigned long)stats.blocks,
+	       (unsigned long)stats.reseeds_explicit);
+
+out:
+	drng_chacha20_destroy(drng);
+
+	return ret;
+}
+
+static void event_cb(const struct drng_chacha20_event *ev, void *priv)
+{
+	unsigned int *events = priv;
+
+	if (ev->type <= DRNG_CHACHA20_EVENT_SELFTEST)
+		events[ev->type]++;
+}
+
+static int event_test(void)
+{
+	struct chacha20_drng *drng;
+	unsigned int events[DRNG_CHACHA20_EVENT_SELFTEST + 1] = { 0 };
+	uint8_t buf[16];
+	int ret;
+
+	drng_chacha20_set_event_cb(event_cb, events);
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		drng_chacha20_set_event_cb(NULL, NULL);
+		return 1;
+	}
+
+	ret = drng_chacha20_get(drng, buf, sizeof(buf));
+	drng_chacha20_set_event_cb(NULL, NULL);
+	drng_chacha20_get(drng, buf, sizeof(buf));
+	drng_chacha20_destroy(drng);
+	if (ret) {
+		printf("Generation failed\n");
+		return 1;
+	}
+
+	if (events[DRNG_CHACHA20_EVENT_SELFTEST] != 2 ||
+	    events[DRNG_CHACHA20_EVENT_RESEED_START] != 1 ||
+	    events[DRNG_CHACHA20_EVENT_RESEED_END] != 1 ||
+	    !events[DRNG_CHACHA20_EVENT_SEED_SOURCE] ||
+	    events[DRNG_CHACHA20_EVENT_GET_ENTRY] != 1 ||
+	    events[DRNG_CHACHA20_EVENT_GET_EXIT] != 1) {
+		printf("Unexpected number of events\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static uint64_t deadline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int deadline_test(void)
+{
+	struct chacha20_drng *drng;
+	uint8_t buf[32], zero[32] = { 0 };
+	uint64_t now;
+	int ret;
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		return 1;
+	}
+
+	now = deadline_now();
+
+	/* No reseed is due: an expired deadline does not matter */
+	memset(buf, 0, sizeof(buf));
+	ret = drng_chacha20_get_deadline(drng, buf, sizeof(buf), now) ||
+	      !memcmp(buf, zero, sizeof(buf)) ||
+	      drng_chacha20_get_deadline(drng, buf, sizeof(buf),
+					 now + 1000000000ULL);
+	if (ret) {
+		printf("Generation with deadline failed\n");
+		goto out;
+	}
+
+	/* Due reseed with an expired deadline is deferred */
+	drng_chacha20_int_age(drng, 601);
+	memset(buf, 0, sizeof(buf));
+	ret = drng_chacha20_get_deadline(drng, buf, sizeof(buf), now);
+	if (ret != DRNG_CHACHA20_RESEED_DEFERRED ||
+	    !memcmp(buf, zero, sizeof(buf))) {
+		printf("Due reseed not deferred: %d\n", ret);
+		ret = 1;
+		goto out;
+	}
+
+	/* The next call with sufficient budget catches up on the reseed */
+	ret = drng_chacha20_get_deadline(drng, buf, sizeof(buf),
+					 deadline_now() + 10000000000ULL);
+	if (!ret)
+		ret = drng_chacha20_get_deadline(drng, buf, sizeof(buf), now);
+	if (ret) {
+		printf("Deferred reseed not performed: %d\n", ret);
+		ret = 1;
+		goto out;
+	}
+
+	/* Beyond the hard limits, the reseed cannot be deferred */
+	drng_chacha20_int_age(drng, 3601);
+	memset(buf, 0, sizeof(buf));
+	ret = drng_chacha20_get_deadline(drng, buf, sizeof(buf), now);
+	if (ret != -EAGAIN || memcmp(buf, zero, sizeof(buf))) {
+		printf("Reseed beyond the time limit deferred: %d\n", ret);
+		ret = 1;
+		goto out;
+	}
+	ret = drng_chacha20_get(drng, buf, sizeof(buf));
+	if (ret)
+		goto out;
+
+	drng_chacha20_int_generated(drng, (1ULL << 30) + 1);
+	ret = drng_chacha20_get_deadline(drng, buf, sizeof(buf), now);
+	if (ret != DRNG_CHACHA20_RESEED_DEFERRED) {
+		printf("Byte limit reseed not deferred: %d\n", ret);
+		ret = 1;
+		goto out;
+	}
+	drng_chacha20_int_generated(drng, (1ULL << 32) + 1);
+	ret = drng_chacha20_get_deadline(drng, buf, sizeof(buf), now);
+	if (ret != -EAGAIN) {
+		printf("Reseed beyond the byte limit deferred: %d\n", ret);
+		ret = 1;
+		goto out;
+	}
+	ret = 0;
+
+out:
+	drng_chacha20_destroy(drng);
+
+	return ret ? 1 : 0;
+}
+
+/* Check that the selected indices are distinct and below n */
+static int sample_check(const size_t *idx, size_t n, size_t k)
+{
+	size_t i, j;
+
+	for (i = 0; i < k; i++) {
+		if (idx[i] >= n)
+			return 1;
+		for (j = 0; j < i; j++)
+			if (idx[i] == idx[j])
+				return 1;
+	}
+
+	return 0;
+}
+
+static int shuffle_test(void)
+{
+	struct chacha20_drng *drng;
+	uint32_t perm[24 * 24], elem[4], *big = NULL;
+	uint8_t rec[1000 * 3], *seen = NULL;
+	size_t idx[100], hits[5];
+	unsigned int i, j, code, nperm = 0;
+	const size_t nbig = 100000;
+	int ret;
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		return 1;
+	}
+
+	/* All 24 permutations of 4 elements must be about equally likely */
+	memset(perm, 0, sizeof(perm));
+	for (i = 0; i < 48000; i++) {
+		for (j = 0; j < 4; j++)
+			elem[j] = j;
+		ret = drng_chacha20_shuffle(drng, elem, 4, sizeof(elem[0]));
+		if (ret)
+			goto out;
+		for (j = 0, code = 0; j < 4; j++)
+			code = code * 4 + elem[j];
+		perm[code]++;
+	}
+	for (i = 0; i < 256; i++) {
+		if (!perm[i])
+			continue;
+		nperm++;
+		/* Expected 2000 with a standard deviation of 44 */
+		if (perm[i] < 1600 || perm[i] > 2400) {
+			printf("Shuffle not uniform: %u permutations of %u\n",
+			       perm[i], i);
+			ret = 1;
+			goto out;
+		}
+	}
+	if (nperm != 24) {
+		printf("Shuffle produced %u different permutations\n", nperm);
+		ret = 1;
+		goto out;
+	}
+
+	/* No element must be lost or duplicated */
+	big = malloc(nbig * sizeof(*big));
+	seen = calloc(1, nbig);
+	if (!big || !seen) {
+		ret = 1;
+		goto out;
+	}
+	for (i = 0; i < nbig; i++)
+		big[i] = i;
+	ret = drng_chacha20_shuffle(drng, big, nbig, sizeof(*big));
+	if (ret)
+		goto out;
+	for (i = 0, j = 0; i < nbig; i++) {
+		if (big[i] >= nbig || seen[big[i]]++) {
+			printf("Shuffle lost elements\n");
+			ret = 1;
+			goto out;
+		}
+		j += (big[i] == i);
+	}
+	if (j > 100) {
+		printf("Shuffle left %u elements in place\n", j);
+		ret = 1;
+		goto out;
+	}
+
+	/* Element sizes other than 4 and 8 bytes */
+	for (i = 0; i < 1000; i++) {
+		rec[i * 3] = (uint8_t)i;
+		rec[i * 3 + 1] = (uint8_t)(i >> 8);
+		rec[i * 3 + 2] = (uint8_t)(rec[i * 3] ^ rec[i * 3 + 1]);
+	}
+	ret = drng_chacha20_shuffle(drng, rec, 1000, 3);
+	if (ret)
+		goto out;
+	for (i = 0, j = 0; i < 1000; i++) {
+		if (rec[i * 3 + 2] != (rec[i * 3] ^ rec[i * 3 + 1])) {
+			printf("Shuffle corrupted elements\n");
+			ret = 1;
+			goto out;
+		}
+		j += rec[i * 3] | (rec[i * 3 + 1] << 8);
+	}
+	if (j != 999 * 1000 / 2) {
+		printf("Shuffle lost elements\n");
+		ret = 1;
+		goto out;
+	}
+
+	/* Sampling with bitmap (dense) and hash table (sparse) tracking */
+	ret = drng_chacha20_sample_indices(drng, 10, 3, idx) ||
+	      sample_check(idx, 10, 3) ||
+	      drng_chacha20_sample_indices(drng, 100, 100, idx) ||
+	      sample_check(idx, 100, 100) ||
+	      drng_chacha20_sample_indices(drng, (size_t)1 << 30, 100, idx) ||
+	      sample_check(idx, (size_t)1 << 30, 100) ||
+	      drng_chacha20_sample_indices(drng, 10, 11, idx) != -EINVAL;
+	if (ret) {
+		printf("Sampling failed\n");
+		goto out;
+	}
+
+	/* Every index must be about equally likely to be selected */
+	memset(hits, 0, sizeof(hits));
+	for (i = 0; i < 50000; i++) {
+		ret = drng_chacha20_sample_indices(drng, 5, 2, idx);
+		if (ret)
+			goto out;
+		hits[idx[0]]++;
+		hits[idx[1]]++;
+	}
+	for (i = 0; i < 5; i++) {
+		/* Expected 20000 with a standard deviation of 110 */
+		if (hits[i] < 19000 || hits[i] > 21000) {
+			printf("Sampling not uniform: index %u selected %lu times\n",
+			       i, (unsigned long)hits[i]);
+			ret = 1;
+			goto out;
+		}
+	}
+
+out:
+	free(big);
+	free(seen);
+	drng_chacha20_destroy(drng);
+
+	return ret;
+}
+
+static int token_uuid_check(const char *uuid, char version)
+{
+	unsigned int i;
+
+	for (i = 0; i < DRNG_CHACHA20_UUID_STRLEN - 1; i++) {
+		if (i == 8 || i == 13 || i == 18 || i == 23) {
+			if (uuid[i] != '-')
+				return 1;
+		} else if (!strchr("0123456789abcdef", uuid[i]) || !uuid[i]) {
+			return 1;
+		}
+	}
+	if (uuid[36] || uuid[14] != version || !strchr("89ab", uuid[19]))
+		return 1;
+
+	return 0;
+}
+
+/* Every character of the alphabet must occur about equally often */
+static int token_count_check(const char *tokens, uint32_t len, uint32_t count,
+			     const char *alphabet, unsigned long min,
+			     unsigned long max)
+{
+	unsigned long hits[256];
+	uint32_t i, j;
+
+	memset(hits, 0, sizeof(hits));
+	for (i = 0; i < count; i++, tokens += len + 1) {
+		if (tokens[len])
+			return 1;
+		for (j = 0; j < len; j++)
+			hits[(uint8_t)tokens[j]]++;
+	}
+	for (i = 1; i < 256; i++) {
+		int valid = !!strchr(alphabet, (int)i);
+
+		if ((!valid && hits[i]) ||
+		    (valid && (hits[i] < min || hits[i] > max))) {
+			printf("Token character %u occurs %lu times\n", i,
+			       hits[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int token_test(void)
+{
+	const char *hex = "0123456789abcdef";
+	const char *b64 =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	struct chacha20_drng *drng;
+	char *buf, alphabet[201], large[258];
+	unsigned long long ms;
+	uint32_t i, len;
+	int ret;
+
+	ret = drng_chacha20_init(&drng);
+	if (ret) {
+		printf("Allocation failed: %d\n", ret);
+		return 1;
+	}
+	buf = malloc(200000 + 1000);
+	if (!buf) {
+		ret = 1;
+		goto out;
+	}
+
+	ret = drng_chacha20_uuid4(drng, buf, 1000);
+	if (ret)
+		goto out;
+	for (i = 0; i < 1000; i++) {
+		ret = token_uuid_check(buf + i * DRNG_CHACHA20_UUID_STRLEN,
+				       '4');
+		if (ret) {
+			printf("Invalid UUIDv4 %s\n",
+			       buf + i * DRNG_CHACHA20_UUID_STRLEN);
+			goto out;
+		}
+	}
+	if (!memcmp(buf, buf + DRNG_CHACHA20_UUID_STRLEN,
+		    DRNG_CHACHA20_UUID_STRLEN)) {
+		printf("Duplicate UUIDs\n");
+		ret = 1;
+		goto out;
+	}
+
+	/* The time stamp must be about the current time */
+	ret = drng_chacha20_uuid7(drng, buf, 10);
+	if (ret)
+		goto out;
+	for (i = 0; i < 10; i++) {
+		ret = token_uuid_check(buf + i * DRNG_CHACHA20_UUID_STRLEN,
+				       '7');
+		if (ret) {
+			printf("Invalid UUIDv7 %s\n",
+			       buf + i * DRNG_CHACHA20_UUID_STRLEN);
+			goto out;
+		}
+	}
+	buf[13] = '\0';
+	memmove(buf + 8, buf + 9, 5);
+	ms = strtoull(buf, NULL, 16);
+	if (ms / 1000 + 10 < (unsigned long long)time(NULL) ||
+	    ms / 1000 > (unsigned long long)time(NULL) + 10) {
+		printf("UUIDv7 time stamp %llu off\n", ms);
+		ret = 1;
+		goto out;
+	}
+
+	/* All token lengths modulo the 8 characters processed at once */
+	for (len = 1; len <= 17; len++) {
+		ret = drng_chacha20_hex(drng, buf, len, 3) ||
+		      token_count_check(buf, len, 3, hex, 0, ULONG_MAX) ||
+		      drng_chacha20_base64url(drng, buf, len, 3) ||
+		      token_count_check(buf, len, 3, b64, 0, ULONG_MAX);
+		if (ret) {
+			printf("Invalid token of length %u\n", len);
+			goto out;
+		}
+	}
+
+	/* Expected 4000 and 2000 with a standard deviation of 61 and 44 */
+	ret = drng_chacha20_hex(drng, buf, 32, 2000) ||
+	      token_count_check(buf, 32, 2000, hex, 3600, 4400) ||
+	      drng_chacha20_base64url(drng, buf, 43, 2976) ||
+	      token_count_check(buf, 43, 2976, b64, 1750, 2250);
+	if (ret) {
+		printf("Encoded tokens not uniform\n");
+		goto out;
+	}
+
+	/* Rejection with 8 bit and 16 bit random numbers */
+	for (i = 0; i < 200; i++)
+		alphabet[i] = (char)(i + 1);
+	alphabet[200] = '\0';
+	ret = drng_chacha20_token(drng, "abc", buf, 30, 1000) ||
+	      token_count_check(buf, 30, 1000, "abc", 9500, 10500) ||
+	      drng_chacha20_token(drng, alphabet, buf, 199, 1000) ||
+	      token_count_check(buf, 199, 1000, alphabet, 850, 1150);
+	if (ret) {
+		printf("Alphabet tokens not uniform\n");
+		goto out;
+	}
+
+	/* More characters than distinct byte values */
+	memset(large, 'a', sizeof(large) - 1);
+	large[sizeof(large) - 1] = '\0';
+	if (drng_chacha20_hex(drng, buf, 0, 1) != -EINVAL ||
+	    drng_chacha20_token(drng, "a", buf, 1, 1) != -EINVAL ||
+	    drng_chacha20_token(drng, large, buf, 1, 1) != -EINVAL) {
+		printf("Invalid token parameters accepted\n");
+		ret = 1;
+	}
+
+out:
+	free(buf);
+	drng_chacha20_destroy(drng);
+
+	return ret;
+}
+
+static int pool_test(void)
+{
+	struct chacha20_drng_pool *pool;
+	uint8_t buf[64], *big = NULL;
+	const size_t len = 8 << 20;
+	size_t i, j;
+	uint32_t nodes;
+	int ret;
+
+	ret = drng_chacha20_pool_alloc(&pool, 2);
+	if (ret) {
+		printf("Pool allocation failed: %d\n", ret);
+		return 1;
+	}
+
+	nodes = drng_chacha20_pool_nodes(pool);
+	ret = !nodes || drng_chacha20_pool_cpu_node(pool, 0) < 0 ||
+	      drng_chacha20_pool_get(pool, buf, sizeof(buf)) ||
+	      drng_chacha20_pool_get_node(pool, nodes - 1, buf, sizeof(buf)) ||
+	      drng_chacha20_pool_get_node(pool, nodes, buf,
+					  sizeof(buf)) != -EINVAL;
+	if (ret) {
+		printf("Pool request failed\n");
+		goto out;
+	}
+
+	/* The parallel fill must write every page */
+	big = calloc(1, len);
+	if (!big) {
+		ret = 1;
+		goto out;
+	}
+	ret = drng_chacha20_pool_fill(pool, big, len);
+	if (ret)
+		goto out;
+	for (i = 0; i < len; i += 4096) {
+		for (j = 0; j < 4096 && !big[i + j]; j++)
+			;
+		if (j == 4096) {
+			printf("Pool fill left page %lu empty\n",
+			       (unsigned long)(i / 4096));
+			ret = 1;
+			goto out;
+		}
+	}
+	if (!memcmp(big, big + len / 2, 64)) {
+		printf("Pool fill repeated random numbers\n");
+		ret = 1;
+	}
+
+out:
+	free(big);
+	drng_chacha20_pool_free(pool);
+
+	return ret;
+}
+
+/* Child process of the fork test: sends its random numbers to the parent */
+static void fork_test_child(struct chacha20_drng *drng, int fd,
+			    uint32_t prefetch, const uint8_t *borrowed)
+{
+	uint8_t buf[64];
+	int ret;
+
+	/* Prefetch buffers, borrow buffer and seeder are inherited */
+	if (drng_chacha20_int_mappings(drng) != (prefetch ? 5 : 2))
+		_exit(1);
+
+	ret = drng_chacha20_get(drng, buf, sizeof(buf));
+
+	/* The inherited mappings are released even if the handle was wiped */
+	if (!ret && (drng_chacha20_int_mappings(drng) ||
+		     !msync((void *)borrowed, 1, MS_ASYNC) || errno != ENOMEM))
+		_exit(1);
+
+	/* The prefetch thread of the parent is not inherited */
+	if (!ret && prefetch)
+		ret = drng_chacha20_prefetch_enable(drng, 4096, -1);
+	if (!ret)
+		ret = drng_chacha20_get(drng, buf + 32, 32);
+	if (ret || write(fd, buf, sizeof(buf)) != sizeof(buf))
+		_exit(1);
+	drng_chacha20_destroy(drng);
+	_exit(0);
+}
+
+static int fork_test(void)
+{
+	struct chacha20_drng *drng;
+	const uint8_t *borrowed;
+	uint8_t parent[64], child[64];
+	uint32_t prefetch, len;
+	int ret = 0;
+
+	for (prefetch = 0; prefetch < 2 && !ret; prefetch++) {
+		int fds[2], status;
+		pid_t pid;
+
+		ret = drng_chacha20_init(&drng);
+		if (ret)
+			return 1;
+		if (prefetch)
+			ret = drng_chacha20_prefetch_enable(drng, 4096, -1);
+		/* The fresh borrow buffer starts at its page */
+		len = DRNG_CHACHA20_BORROW_SIZE;
+		if (!ret && drng_chacha20_seeded_fd(drng) < 0)
+			ret = 1;
+		if (!ret)
+			ret = drng_chacha20_borrow(drng, &borrowed, &len);
+		if (ret || drng_chacha20_get(drng, parent, 16) || pipe(fds)) {
+			drng_chacha20_destroy(drng);
+			return 1;
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			close(fds[0]);
+			close(fds[1]);
+			drng_chacha20_destroy(drng);
+			return 1;
+		}
+		if (!pid) {
+			close(fds[0]);
+			fork_test_child(drng, fds[1], prefetch, borrowed);
+		}
+		close(fds[1]);
+
+		ret = drng_chacha20_get(drng, parent, sizeof(parent));
+		if (read(fds[0], child, sizeof(child)) != sizeof(child))
+			ret = 1;
+		close(fds[0]);
+		if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			ret = 1;
+		drng_chacha20_destroy(drng);
+		if (ret)
+			break;
+
+		/* Parent and child must not share a DRNG state */
+		if (!memcmp(parent, child, 32) ||
+		    !memcmp(parent + 32, child + 32, 32)) {
+			printf("Child repeats the random numbers of the parent\n");
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
+
+static uint64_t test_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int seedfile_read(const char *path, uint8_t *seed, size_t len)
+{
+	FILE *f = fopen(path, "r");
+	size_t ret;
+
+	if (!f)
+		return 1;
+	ret = fread(seed, 1, len, f);
+	fclose(f);
+
+	return ret != len;
+}
+
+/* Cold start latency with and without a seed file */
+static int seedfile_test(void)
+{
+	char path[] = "/tmp/chacha20_drng_seedXXXXXX";
+	struct chacha20_drng *drng;
+	uint8_t old[64], new[64], buf[32];
+	uint64_t start, init_ns, seedfile_ns;
+	int fd, ret;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	/* No other handle exists: the seed sources are initialized again */
+	start = test_time_ns();
+	ret = drng_chacha20_init(&drng);
+	init_ns = test_time_ns() - start;
+	if (ret)
+		goto out;
+	drng_chacha20_destroy(drng);
+
+	/* The empty seed file is filled by the first start */
+	ret = drng_chacha20_init_seedfile(&drng, path);
+	if (ret)
+		goto out;
+	drng_chacha20_destroy(drng);
+	ret = seedfile_read(path, old, sizeof(old));
+	if (ret)
+		goto out;
+
+	start = test_time_ns();
+	ret = drng_chacha20_init_seedfile(&drng, path);
+	seedfile_ns = test_time_ns() - start;
+	if (ret)
+		goto out;
+
+	/* The seed must be overwritten at start and by every write */
+	ret = seedfile_read(path, new, sizeof(new)) ||
+	      !memcmp(old, new, sizeof(old)) ||
+	      drng_chacha20_get(drng, buf, sizeof(buf)) ||
+	      drng_chacha20_seedfile_write(drng, path) ||
+	      seedfile_read(path, old, sizeof(old)) ||
+	      !memcmp(old, new, sizeof(old));
+	drng_chacha20_destroy(drng);
+	if (ret) {
+		printf("Seed file was not replaced\n");
+		goto out;
+	}
+
+	printf("Cold start: init %lu ns, seed file %lu ns\n",
+	       (unsigned long)init_ns, (unsigned long)seedfile_ns);
+
+out:
+	unlink(path);
+	return ret ? 1 : 0;
+}
+
+/* The background seeding must complete and signal its eventfd */
+static int nonblock_test(void)
+{
+	struct chacha20_drng *drng;
+	struct pollfd pfd;
+	uint8_t buf[32];
+	uint64_t start, init_ns;
+	int ret, status;
+	pid_t pid;
+
+	start = test_time_ns();
+	ret = drng_chacha20_init_nonblock(&drng);
+	init_ns = test_time_ns() - start;
+	if (ret)
+		return 1;
+
+	/*
+	 * The seeder thread waits for the /dev/random seed source held by the
+	 * test and still runs at fork: in a child, only the handle references
+	 * the seed sources and releases them when destroyed.
+	 */
+	ret = drng_chacha20_int_seeder_start(drng);
+	if (ret && ret != -EBUSY)
+		goto out;
+	drng_chacha20_int_seed_lock(1);
+	pid = fork();
+	/* The lock is reinitialized in the child */
+	if (pid)
+		drng_chacha20_int_seed_lock(0);
+	if (pid < 0) {
+		ret = 1;
+		goto out;
+	}
+	if (!pid) {
+		if (drng_chacha20_int_seed_users() != 1 ||
+		    drng_chacha20_get(drng, buf, sizeof(buf)))
+			_exit(1);
+		drng_chacha20_destroy(drng);
+		_exit(drng_chacha20_int_seed_users() != 0);
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		printf("Child keeps the seed sources of the seeder thread\n");
+		ret = 1;
+		goto out;
+	}
+
+	/* Usable before the full seed is present */
+	ret = drng_chacha20_get(drng, buf, sizeof(buf));
+	if (ret)
+		goto out;
+
+	pfd.fd = drng_chacha20_seeded_fd(drng);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0 || poll(&pfd, 1, 60000) != 1) {
+		printf("Background seeding did not complete\n");
+		ret = 1;
+		goto out;
+	}
+	ret = drng_chacha20_seeded(drng) != 1 ||
+	      drng_chacha20_get(drng, buf, sizeof(buf));
+	if (ret)
+		goto out;
+
+	printf("Non-blocking init: %lu ns\n", (unsigned long)init_ns);
+
+out:
+	drng_chacha20_destroy(drng);
+	return ret ? 1 : 0;
+}
+
+/*
+ * Multi-instance generation: a handle with prefetching, a duplicate handle and
+ * requests beyond one block take the one-handle path. All outputs differ.
+ */
+#define MULTI_HANDLES	6
+#define MULTI_ENTRIES	(MULTI_HANDLES + 1)
+
+static int multi_test(void)
+{
+	static const uint32_t lens[] = { 16, 64, 100 };
+	struct chacha20_drng *drngs[MULTI_ENTRIES] = { NULL };
+	struct drng_chacha20_stats stats;
+	uint8_t buf[MULTI_ENTRIES][100], *outbufs[MULTI_ENTRIES];
+	unsigned int i, j, k;
+	int ret = 0;
+
+	for (i = 0; i < MULTI_HANDLES; i++) {
+		ret = drng_chacha20_init(&drngs[i]);
+		if (ret)
+			goto out;
+	}
+	drngs[MULTI_HANDLES] = drngs[1];
+	ret = drng_chacha20_prefetch_enable(drngs[2], 4096, -1);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < MULTI_ENTRIES; i++)
+		outbufs[i] = buf[i];
+
+	for (k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+		memset(buf, 0, sizeof(buf));
+		ret = drng_chacha20_get_multi(drngs, outbufs, lens[k],
+					      MULTI_ENTRIES);
+		if (ret)
+			goto out;
+
+		for (i = 0; i < MULTI_ENTRIES; i++) {
+			for (j = i + 1; j < MULTI_ENTRIES; j++) {
+				if (!memcmp(buf[i], buf[j], lens[k])) {
+					printf("Identical output of entries %u and %u\n",
+					       i, j);
+					ret = 1;
+					goto out;
+				}
+			}
+		}
+	}
+
+	if (drng_chacha20_get_multi(NULL, outbufs, 16, 1) != -EINVAL) {
+		ret = 1;
+		goto out;
+	}
+
+	/* The duplicate handle is served twice per call */
+	ret = drng_chacha20_get_stats(drngs[1], &stats);
+	if (ret == -EOPNOTSUPP) {
+		ret = 0;
+	} else if (ret || stats.get_calls != 6 ||
+		   stats.generated_bytes != 2 * (16 + 64 + 100)) {
+		printf("Statistics are inconsistent\n");
+		ret = 1;
+	}
+
+out:
+	for (i = 0; i < MULTI_HANDLES; i++) {
+		if (drngs[i])
+			drng_chacha20_destroy(drngs[i]);
+	}
+	return ret ? 1 : 0;
+}
+
+/* Masking with random numbers for aligned and unaligned buffers */
+static int xor_test(void)
 {
+	static const uint8_t zero[300];
 	struct chacha20_drng *drng;
+	uint8_t buf[301], prev[301];
+	uint32_t off;
+	int ret;
 
-	if (drng_chacha20_init(&drng)) {
-		printf("Allocation failed\n");
+	ret = drng_chacha20_init(&drng);
+	if (ret)
 		return 1;
-	}
 
-	while(1) {
-		uint8_t tmp[32];
-
-		if (drng_chacha20_get(drng, tmp, sizeof(tmp))) {
-			printf("Getting random numbers failed\n");
-			return 1;
+	for (off = 0; off < 2; off++) {
+		memset(buf, 0, sizeof(buf));
+		ret = drng_chacha20_xor(drng, buf + off, 300);
+		memcpy(prev, buf, sizeof(prev));
+		ret |= drng_chacha20_xor(drng, buf + off, 300);
+		ret |= drng_chacha20_xor(drng, buf + off, 0);
+		if (ret || !memcmp(prev + off, zero, 300) ||
+		    !memcmp(buf + off, zero, 300) ||
+		    !memcmp(buf + off, prev + off, 300) ||
+		    buf[off ? 0 : 300]) {
+			printf("XOR with random numbers failed\n");
+			ret = 1;
+			break;
 		}
-		fwrite(&tmp, sizeof(tmp), 1, stdout);
 	}
 
 	drng_chacha20_destroy(drng);
-
-	return 0;
+	return ret ? 1 : 0;
 }
 
-static inline uint64_t cp_ts2u64(struct timespec *ts)
+/* Window handling of the borrowed random numbers */
+static int borrow_test(void)
 {
-	uint64_t upper = ts->tv_sec;
+	static const uint8_t zero[16];
+	struct chacha20_drng *drng;
+	const uint8_t *ptr, *first;
+	uint8_t buf[16];
+	uint32_t len = 0;
+	int ret;
 
-	upper = upper << 32;
-	return (upper | ts->tv_nsec);
-}
+	ret = drng_chacha20_init(&drng);
+	if (ret)
+		return 1;
 
-/*
- * This is x86 specific to reduce the CPU jitter
- */
-static inline void cp_cpusetup(void)
-{
-#ifdef __X8664___
-	asm volatile("cpuid"::"a" (0), "c" (0): "memory");
-	asm volatile("cpuid"::"a" (0), "c" (0): "memory");
-	asm volatile("cpuid"::"a" (0), "c" (0): "memory");
-#endif
-}
+	ret = drng_chacha20_borrow(drng, &first, &len);
+	if (ret || len != DRNG_CHACHA20_BORROW_SIZE ||
+	    !memcmp(first, zero, sizeof(zero)))
+		goto err;
 
-static inline void cp_get_nstime(struct timespec *ts)
-{
-	clock_gettime(CLOCK_REALTIME, ts);
-}
+	/* Consumed bytes are wiped, the window advances */
+	len = 0;
+	if (drng_chacha20_consume(drng, 16) ||
+	    drng_chacha20_borrow(drng, &ptr, &len) ||
+	    ptr != first + 16 || len != DRNG_CHACHA20_BORROW_SIZE - 16 ||
+	    memcmp(first, zero, sizeof(zero)))
+		goto err;
 
-static inline void cp_start_time(struct timespec *ts)
-{
-	cp_cpusetup();
-	cp_get_nstime(ts);
+	/* A window shorter than requested is refilled */
+	len = 100;
+	if (drng_chacha20_consume(drng, DRNG_CHACHA20_BORROW_SIZE - 66) ||
+	    drng_chacha20_borrow(drng, &ptr, &len) ||
+	    ptr != first || len != DRNG_CHACHA20_BORROW_SIZE)
+		goto err;
+
+	if (drng_chacha20_consume(drng, DRNG_CHACHA20_BORROW_SIZE + 1) !=
+	    -EINVAL)
+		goto err;
+	len = DRNG_CHACHA20_BORROW_SIZE + 1;
+	if (drng_chacha20_borrow(drng, &ptr, &len) != -EINVAL)
+		goto err;
+
+	/* A reseed discards the unconsumed random numbers */
+	len = 0;
+	if (drng_chacha20_consume(drng, 8) ||
+	    drng_chacha20_reseed(drng, NULL, 0) ||
+	    drng_chacha20_borrow(drng, &ptr, &len) ||
+	    ptr != first || len != DRNG_CHACHA20_BORROW_SIZE)
+		goto err;
+
+	/* So does the automatic reseed of another call on the handle */
+	len = 0;
+	drng_chacha20_int_generated(drng, (1ULL << 30) + 1);
+	if (drng_chacha20_consume(drng, 8) ||
+	    drng_chacha20_get(drng, buf, sizeof(buf)) ||
+	    drng_chacha20_borrow(drng, &ptr, &len) ||
+	    ptr != first || len != DRNG_CHACHA20_BORROW_SIZE)
+		goto err;
+
+	/* A due reseed is performed before the window is refilled */
+	len = 0;
+	drng_chacha20_int_age(drng, 601);
+	if (drng_chacha20_consume(drng, 8) ||
+	    drng_chacha20_borrow(drng, &ptr, &len) ||
+	    ptr != first || len != DRNG_CHACHA20_BORROW_SIZE)
+		goto err;
+	len = 0;
+	if (drng_chacha20_consume(drng, 8) ||
+	    drng_chacha20_borrow(drng, &ptr, &len) || ptr != first + 8)
+		goto err;
+
+	drng_chacha20_destroy(drng);
+	return 0;
+
+err:
+	drng_chacha20_destroy(drng);
+	return 1;
 }
 
-static inline void cp_end_time(struct timespec *ts)
+/* Value ranges, distribution and fork safety of the bit reservoir */
+static int bits_test(void)
 {
-	cp_get_nstime(ts);
+	struct chacha20_drng *drng;
+	const uint8_t *ptr, *first;
+	uint8_t buf[16];
+	uint64_t v, parent, child;
+	uint32_t i, n, len, ones = 0;
+	int fds[2], status, ret;
+	pid_t pid;
+
+	ret = drng_chacha20_init(&drng);
+	if (ret)
+		return 1;
+
+	if (drng_chacha20_get_bits(drng, 0, &v) != -EINVAL ||
+	    drng_chacha20_get_bits(drng, 65, &v) != -EINVAL)
+		goto err;
+
+	/*
+	 * An automatic reseed discards the reservoir: the next bit is taken
+	 * from the refilled borrow buffer, whose first 8 bytes are consumed.
+	 */
+	len = 0;
+	if (drng_chacha20_get_bits(drng, 1, &v) ||
+	    drng_chacha20_borrow(drng, &first, &len))
+		goto err;
+	first -= sizeof(v);
+	drng_chacha20_int_generated(drng, (1ULL << 30) + 1);
+	len = 0;
+	if (drng_chacha20_get(drng, buf, sizeof(buf)) ||
+	    drng_chacha20_get_bits(drng, 1, &v) ||
+	    drng_chacha20_borrow(drng, &ptr, &len) ||
+	    ptr != first + sizeof(v)) {
+		printf("Reservoir survives the automatic reseed\n");
+		goto err;
+	}
+
+	for (n = 1; n <= 64; n++) {
+		for (i = 0; i < 100; i++) {
+			if (drng_chacha20_get_bits(drng, n, &v) ||
+			    (n < 64 && v >> n))
+				goto err;
+		}
+	}
+
+	/* 10 standard deviations of the binomial distribution */
+	for (i = 0; i < 10000; i++) {
+		ret = drng_chacha20_get_bool(drng);
+		if (ret < 0)
+			goto err;
+		ones += (uint32_t)ret;
+	}
+	if (ones < 4500 || ones > 5500) {
+		printf("Biased random bits: %u of 10000 set\n", ones);
+		goto err;
+	}
+
+	/* A child must not serve the bits left in the reservoir */
+	if (drng_chacha20_get_bits(drng, 1, &v) || pipe(fds))
+		goto err;
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		goto err;
+	}
+	if (!pid) {
+		close(fds[0]);
+		if (drng_chacha20_get_bits(drng, 63, &child) ||
+		    write(fds[1], &child, sizeof(child)) != sizeof(child))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	ret = drng_chacha20_get_bits(drng, 63, &parent);
+	if (read(fds[0], &child, sizeof(child)) != sizeof(child))
+		ret = 1;
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		ret = 1;
+	if (ret || parent == child) {
+		printf("Child repeats the random bits of the parent\n");
+		goto err;
+	}
+
+	drng_chacha20_destroy(drng);
+	return 0;
+
+err:
+	drng_chacha20_destroy(drng);
+	return 1;
 }
 
-/*
- * Convert an integer value into a string value that displays the integer
- * in either bytes, kB, or MB
- *
- * @bytes value to convert -- input
- * @str already allocated buffer for converted string -- output
- * @strlen size of str
- */
-static void cp_bytes2string(uint64_t bytes, char *str, size_t strlen)
+static int gen_test(void)
 {
-	if (1UL<<30 < bytes) {
-		uint64_t abs = (bytes>>30);
-		uint64_t part = ((bytes - (abs<<30)) / (10000000));
-		snprintf(str, strlen, "%lu.%lu GB", (unsigned long)abs,
-			 (unsigned long)part);
-		return;
+	struct chacha20_drng *drng;
 
-	} else if (1UL<<20 < bytes) {
-		uint64_t abs = (bytes>>20);
-		uint64_t part = ((bytes - (abs<<20)) / (10000));
-		snprintf(str, strlen, "%lu.%lu MB", (unsigned long)abs,
-			 (unsigned long)part);
-		return;
-	} else if (1UL<<10 < bytes) {
-		uint64_t abs = (bytes>>10);
-		uint64_t part = ((bytes - (abs<<10)) / (10));
-		snprintf(str, strlen, "%lu.%lu kB", (unsigned long)abs,
-			 (unsigned long)part);
-		return;
+	if (drng_chacha20_init(&drng)) {
+		printf("Allocation failed\n");
+		return 1;
+	}
+
+	while(1) {
+		uint8_t tmp[32];
+
+		if (drng_chacha20_get(drng, tmp, sizeof(tmp))) {
+			printf("Getting random numbers failed\n");
+			return 1;
+		}
+		fwrite(&tmp, sizeof(tmp), 1, stdout);
 	}
-	snprintf(str, strlen, "%lu B", (unsigned long)bytes);
-	str[strlen - 1] = '\0';
+
+	drng_chacha20_destroy(drng);
+
+	return 0;
 }
 
-static void cp_print_status(uint64_t rounds, uint64_t tottime,
+static void cp_print_status(uint64_t rounds, uint64_t totaltime,
 			    uint32_t byteperop, int raw)
 {
 	uint64_t processed_bytes = rounds * byteperop;
-	uint64_t totaltime = tottime>>32;
-	uint64_t ops = 0;
+	uint64_t bytes_per_sec, ops;
 	char *testname = "ChaCha20 DRNG";
 
 	if (!totaltime) {
@@ -222,35 +1473,38 @@ static void cp_print_status(uint64_t rounds, uint64_t tottime,
 		return;
 	}
 
-	ops = rounds / totaltime;
+	/* totaltime is given in nanoseconds */
+	bytes_per_sec = (uint64_t)((double)processed_bytes * 1000000000.0 /
+				   (double)totaltime);
+	ops = (uint64_t)((double)rounds * 1000000000.0 / (double)totaltime);
 
 	if (raw) {
 		printf("%s,%lu,%lu,%lu\n", testname,
 		       (unsigned long)processed_bytes,
-		       (unsigned long)(processed_bytes/totaltime),
+		       (unsigned long)bytes_per_sec,
 		       (unsigned long)ops);
 	} else {
 		#define VALLEN 23
 		char byteseconds[VALLEN + 1];
 
 		memset(byteseconds, 0, sizeof(byteseconds));
-		cp_bytes2string((processed_bytes / totaltime), byteseconds,
-				(VALLEN + 1));
+		cp_bytes2string(bytes_per_sec, byteseconds, (VALLEN + 1));
 		printf("%-20s|%12lu bytes|%*s/s|%lu ops/s\n",
 		       testname, (unsigned long)processed_bytes, VALLEN,
 		       byteseconds, (unsigned long)ops);
 	}
 }
 
-static int time_test(uint64_t chunksize)
+static int time_test(uint64_t chunksize, uint32_t prefetch)
 {
-	uint64_t nano = 1;
-	uint64_t testduration;
+	uint64_t testduration = 10ULL * 1000000000ULL;
 	uint64_t totaltime = 0;
 	uint64_t rounds = 0;
 	unsigned int i = 0;
 	struct chacha20_drng *drng;
+	struct cp_perf perf;
 	uint8_t *tmp;
+	int perf_avail;
 
 	tmp = malloc(chunksize);
 	if (!tmp) {
@@ -264,32 +1518,357 @@ static int time_test(uint64_t chunksize)
 		return 1;
 	}
 
-	nano = nano << 32;
-	testduration = nano * 10;
+	if (prefetch && drng_chacha20_prefetch_enable(drng, prefetch, -1)) {
+		printf("Enabling prefetching failed\n");
+		drng_chacha20_destroy(drng);
+		free(tmp);
+		return 1;
+	}
 
 	/* prime the test */
 	for (i = 0; i < 10; i++)
 		drng_chacha20_get(drng, tmp, chunksize);
 
+	/* Hardware counters cover the entire measurement loop if available */
+	perf_avail = cp_perf_open(&perf);
+	cp_perf_start(&perf);
 	while (totaltime < testduration) {
-		struct timespec start;
-		struct timespec end;
+		uint64_t start;
 
-		cp_get_nstime(&start);
+		cp_cpusetup();
+		start = cp_nstime();
 		drng_chacha20_get(drng, tmp, chunksize);
-		cp_get_nstime(&end);
-		totaltime += (cp_ts2u64(&end) - cp_ts2u64(&start));
+		totaltime += cp_nstime() - start;
 		rounds++;
 	}
+	cp_perf_stop(&perf);
+	cp_perf_close(&perf);
+
+	if (prefetch)
+		printf("Prefetch underruns: %lu of %lu requests\n",
+		       (unsigned long)drng_chacha20_prefetch_underruns(drng),
+		       (unsigned long)rounds);
 
 	drng_chacha20_destroy(drng);
 	free(tmp);
 
 	cp_print_status(rounds, totaltime, chunksize, 0);
 
+	if (perf_avail) {
+		printf("Per byte:           ");
+		cp_perf_print_header(stdout, CP_PERF_TEXT);
+		printf("\n                    ");
+		cp_perf_print(stdout, &perf, rounds * chunksize, CP_PERF_TEXT);
+		printf("\n");
+	} else {
+		printf("Hardware performance counters unavailable\n");
+	}
+
 	return 0;
 }
 
+#define SHM_TEST_DURATION	5000000000ULL	/* 5 seconds per phase */
+
+/*
+ * One consumer process: obtain random numbers from the shared memory ring
+ * buffer followed by obtaining them from a DRNG instance of its own.
+ */
+static int shm_consumer(int fd, int ring_fd, uint32_t consumer,
+			uint32_t chunksize)
+{
+	struct chacha20_drng_shm *shm;
+	struct chacha20_drng *drng;
+	uint64_t start, shm_ops = 0, get_ops = 0;
+	uint8_t *tmp;
+	int ret;
+
+	tmp = malloc(chunksize);
+	if (!tmp)
+		return 1;
+
+	ret = drng_chacha20_shm_attach(&shm, fd, ring_fd);
+	if (ret) {
+		printf("Attaching to ring buffer failed: %d\n", ret);
+		free(tmp);
+		return 1;
+	}
+
+	start = cp_nstime();
+	while (cp_nstime() - start < SHM_TEST_DURATION) {
+		ret = drng_chacha20_shm_get(shm, tmp, chunksize);
+		if (ret) {
+			printf("Getting random numbers failed: %d\n", ret);
+			break;
+		}
+		shm_ops++;
+	}
+	drng_chacha20_shm_detach(shm);
+
+	if (drng_chacha20_init(&drng)) {
+		printf("Allocation of DRNG failed\n");
+		free(tmp);
+		return 1;
+	}
+
+	start = cp_nstime();
+	while (cp_nstime() - start < SHM_TEST_DURATION) {
+		drng_chacha20_get(drng, tmp, chunksize);
+		get_ops++;
+	}
+	drng_chacha20_destroy(drng);
+	free(tmp);
+
+	printf("consumer %3u|%12lu shm ops/s|%12lu drng_chacha20_get ops/s\n",
+	       consumer, (unsigned long)(shm_ops * 1000000000ULL /
+					 SHM_TEST_DURATION),
+	       (unsigned long)(get_ops * 1000000000ULL / SHM_TEST_DURATION));
+	fflush(stdout);
+
+	return ret ? 1 : 0;
+}
+
+static int shm_test(uint32_t consumers, uint32_t chunksize)
+{
+	struct chacha20_drng_shm_producer *producer;
+	pid_t producer_pid;
+	uint32_t i;
+	int ret, status, failed = 0;
+
+	ret = drng_chacha20_shm_producer_alloc(&producer, consumers, 1<<16, 0);
+	if (ret) {
+		printf("Allocation of shared memory failed: %d\n", ret);
+		return 1;
+	}
+
+	producer_pid = fork();
+	if (producer_pid < 0) {
+		drng_chacha20_shm_producer_free(producer);
+		return 1;
+	}
+	if (!producer_pid) {
+		struct chacha20_drng *drng;
+
+		if (drng_chacha20_init(&drng))
+			_exit(1);
+		ret = drng_chacha20_shm_producer_run(producer, drng);
+		drng_chacha20_destroy(drng);
+		_exit(ret ? 1 : 0);
+	}
+
+	fflush(stdout);
+	for (i = 0; i < consumers; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			failed = 1;
+			break;
+		}
+		if (!pid)
+			_exit(shm_consumer(drng_chacha20_shm_producer_fd(producer),
+				drng_chacha20_shm_producer_ring_fd(producer, i),
+				i, chunksize));
+	}
+
+	/* i holds the number of forked consumers */
+	while (i) {
+		pid_t pid = wait(&status);
+
+		if (pid < 0)
+			break;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+		if (pid == producer_pid)
+			break;
+		i--;
+	}
+
+	drng_chacha20_shm_producer_stop(producer);
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	}
+
+	drng_chacha20_shm_producer_free(producer);
+
+	return failed;
+}
+
+/*
+ * A consumer storing a tail ahead of the head into its ring buffer must not
+ * cause the producer to write out of bounds.
+ */
+static int shm_corrupt_test(void)
+{
+	struct chacha20_drng_shm_producer *producer;
+	struct chacha20_drng_shm *shm;
+	uint8_t buf[32];
+	pid_t pid;
+	int ret, status, failed = 0;
+
+	ret = drng_chacha20_shm_producer_alloc(&producer, 2, 4096, 0);
+	if (ret)
+		return 1;
+
+	if (drng_chacha20_shm_producer_ring_fd(producer, 2) != -EINVAL) {
+		drng_chacha20_shm_producer_free(producer);
+		return 1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		drng_chacha20_shm_producer_free(producer);
+		return 1;
+	}
+	if (!pid) {
+		struct chacha20_drng *drng;
+
+		if (drng_chacha20_init(&drng))
+			_exit(1);
+		ret = drng_chacha20_shm_producer_run(producer, drng);
+		drng_chacha20_destroy(drng);
+		_exit(ret ? 1 : 0);
+	}
+
+	ret = drng_chacha20_shm_attach(&shm,
+			drng_chacha20_shm_producer_fd(producer),
+			drng_chacha20_shm_producer_ring_fd(producer, 0));
+	if (ret) {
+		failed = 1;
+	} else {
+		if (drng_chacha20_shm_get(shm, buf, sizeof(buf)))
+			failed = 1;
+		drng_chacha20_int_shm_corrupt(shm);
+		usleep(100000);
+		drng_chacha20_shm_detach(shm);
+	}
+
+	/* The producer must still serve the second consumer */
+	ret = drng_chacha20_shm_attach(&shm,
+			drng_chacha20_shm_producer_fd(producer),
+			drng_chacha20_shm_producer_ring_fd(producer, 1));
+	if (ret) {
+		failed = 1;
+	} else {
+		if (drng_chacha20_shm_get(shm, buf, sizeof(buf)))
+			failed = 1;
+		drng_chacha20_shm_detach(shm);
+	}
+
+	drng_chacha20_shm_producer_stop(producer);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		failed = 1;
+
+	drng_chacha20_shm_producer_free(producer);
+
+	return failed;
+}
+
+struct split_thread {
+	pthread_t thread;
+	struct chacha20_drng_child child;
+	uint64_t tasks;
+	int ret;
+};
+
+/* Worker of the fork/join test: every task splits off its own child */
+static void *split_worker(void *arg)
+{
+	struct split_thread *t = arg;
+	uint64_t i;
+
+	for (i = 0; i < t->tasks; i++) {
+		struct chacha20_drng_child task;
+		uint8_t buf[32];
+
+		t->ret = drng_chacha20_child_split(&t->child, &task);
+		if (t->ret)
+			break;
+		t->ret = drng_chacha20_child_get(&task, buf, sizeof(buf));
+		drng_chacha20_child_zero(&task);
+		if (t->ret)
+			break;
+	}
+
+	drng_chacha20_child_zero(&t->child);
+
+	return NULL;
+}
+
+static int split_test(uint32_t threads, uint64_t tasks)
+{
+	struct chacha20_drng *drng;
+	struct chacha20_drng_child child;
+	struct split_thread *t;
+	uint64_t start, split_ns, task_ns, init_ns, i;
+	uint32_t j;
+	int ret = 0;
+
+	t = calloc(threads, sizeof(*t));
+	if (!t)
+		return 1;
+
+	if (drng_chacha20_init(&drng)) {
+		printf("Allocation of DRNG failed\n");
+		free(t);
+		return 1;
+	}
+
+	/* Cost of one split */
+	start = cp_nstime();
+	for (i = 0; i < tasks; i++)
+		drng_chacha20_split(drng, &child);
+	split_ns = (cp_nstime() - start) / tasks;
+	drng_chacha20_child_zero(&child);
+
+	/* Fork: one child per worker, join after all tasks are done */
+	start = cp_nstime();
+	for (j = 0; j < threads; j++) {
+		drng_chacha20_split(drng, &t[j].child);
+		t[j].tasks = tasks / threads;
+		if (pthread_create(&t[j].thread, NULL, split_worker, &t[j])) {
+			printf("Thread creation failed\n");
+			threads = j;
+			ret = 1;
+			break;
+		}
+	}
+	for (j = 0; j < threads; j++) {
+		pthread_join(t[j].thread, NULL);
+		if (t[j].ret) {
+			printf("Child DRNG operation failed: %d\n", t[j].ret);
+			ret = 1;
+		}
+	}
+	task_ns = cp_nstime() - start;
+
+	/* Baseline: one fully initialized DRNG per task */
+	start = cp_nstime();
+	for (i = 0; i < 1000; i++) {
+		struct chacha20_drng *task;
+		uint8_t buf[32];
+
+		if (drng_chacha20_init(&task)) {
+			ret = 1;
+			break;
+		}
+		drng_chacha20_get(task, buf, sizeof(buf));
+		drng_chacha20_destroy(task);
+	}
+	init_ns = (cp_nstime() - start) / 1000;
+
+	drng_chacha20_destroy(drng);
+	free(t);
+
+	printf("split: %lu ns|fork/join %u threads: %lu tasks/s|init per task: %lu ns\n",
+	       (unsigned long)split_ns, threads,
+	       (unsigned long)((tasks / threads) * threads * 1000000000ULL /
+			       (task_ns ? task_ns : 1)),
+	       (unsigned long)init_ns);
+
+	return ret;
+}
+
 static int generate_bytes(uint32_t bytes, uint32_t blocksize)
 {
 	struct chacha20_drng *drng;
@@ -333,6 +1912,91 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 		printf("Basic test passed\n");
+		if (prefetch_test()) {
+			printf("Prefetch test failed\n");
+			return 1;
+		}
+		printf("Prefetch test passed\n");
+		if (det_test()) {
+			printf("Deterministic stream test failed\n");
+			return 1;
+		}
+		printf("Deterministic stream test passed\n");
+		if (child_test()) {
+			printf("Child DRNG test failed\n");
+			return 1;
+		}
+		printf("Child DRNG test passed\n");
+		if (stats_test()) {
+			printf("Statistics test failed\n");
+			return 1;
+		}
+		printf("Statistics test passed\n");
+		if (event_test()) {
+			printf("Event test failed\n");
+			return 1;
+		}
+		printf("Event test passed\n");
+		if (deadline_test()) {
+			printf("Deadline test failed\n");
+			return 1;
+		}
+		printf("Deadline test passed\n");
+		if (shuffle_test()) {
+			printf("Shuffle and sampling test failed\n");
+			return 1;
+		}
+		printf("Shuffle and sampling test passed\n");
+		if (token_test()) {
+			printf("Token test failed\n");
+			return 1;
+		}
+		printf("Token test passed\n");
+		if (pool_test()) {
+			printf("NUMA pool test failed\n");
+			return 1;
+		}
+		printf("NUMA pool test passed\n");
+		if (fork_test()) {
+			printf("Fork test failed\n");
+			return 1;
+		}
+		printf("Fork test passed\n");
+		if (seedfile_test()) {
+			printf("Seed file test failed\n");
+			return 1;
+		}
+		printf("Seed file test passed\n");
+		if (nonblock_test()) {
+			printf("Non-blocking initialization test failed\n");
+			return 1;
+		}
+		printf("Non-blocking initialization test passed\n");
+		if (multi_test()) {
+			printf("Multi-instance generation test failed\n");
+			return 1;
+		}
+		printf("Multi-instance generation test passed\n");
+		if (xor_test()) {
+			printf("XOR test failed\n");
+			return 1;
+		}
+		printf("XOR test passed\n");
+		if (borrow_test()) {
+			printf("Borrow test failed\n");
+			return 1;
+		}
+		printf("Borrow test passed\n");
+		if (bits_test()) {
+			printf("Random bits test failed\n");
+			return 1;
+		}
+		printf("Random bits test passed\n");
+		if (shm_corrupt_test()) {
+			printf("Shared memory corruption test failed\n");
+			return 1;
+		}
+		printf("Shared memory corruption test passed\n");
 	} else if (!strncmp(argv[1], "-g", 2)) {
 		gen_test();
 	} else if (!strncmp(argv[1], "-o", 2) && (argc == 3 || argc == 4)) {
@@ -354,16 +2018,51 @@ int main(int argc, char *argv[])
 
 		return generate_bytes((uint32_t)bytes, (uint32_t)blocksize);
 	} else if (!strncmp(argv[1], "-t", 2)) {
-		unsigned long chunksize = 32;
+		unsigned long chunksize = 32, prefetch = 0;
 
-		if (argc == 3) {
+		if (argc >= 3) {
 			chunksize = strtoul(argv[2], NULL, 10);
 			if (chunksize == ULONG_MAX && errno == ERANGE) {
 				printf("strtoul conversion failed\n");
 				return 1;
 			}
 		}
-		time_test(chunksize);
+		/* optional size of prefetch buffers */
+		if (argc == 4) {
+			prefetch = strtoul(argv[3], NULL, 10);
+			if (prefetch > UINT_MAX) {
+				printf("prefetch buffer size too large\n");
+				return 1;
+			}
+		}
+		time_test(chunksize, (uint32_t)prefetch);
+	} else if (!strncmp(argv[1], "-s", 2)) {
+		unsigned long consumers = 4, chunksize = 32;
+
+		if (argc >= 3)
+			consumers = strtoul(argv[2], NULL, 10);
+		if (argc == 4)
+			chunksize = strtoul(argv[3], NULL, 10);
+		if (!consumers || consumers > 1024 || !chunksize ||
+		    chunksize > UINT_MAX) {
+			printf("invalid consumer number or chunk size\n");
+			return 1;
+		}
+
+		return shm_test((uint32_t)consumers, (uint32_t)chunksize);
+	} else if (!strncmp(argv[1], "-f", 2)) {
+		unsigned long threads = 4, tasks = 1000000;
+
+		if (argc >= 3)
+			threads = strtoul(argv[2], NULL, 10);
+		if (argc == 4)
+			tasks = strtoul(argv[3], NULL, 10);
+		if (!threads || threads > 1024 || tasks < threads) {
+			printf("invalid thread or task number\n");
+			return 1;
+		}
+
+		return split_test((uint32_t)threads, tasks);
 	} else {
 		printf("Unknown test\n");
 	}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cp_perf.h"
+
+struct cp_perf_attr {
+	uint32_t type;
+	uint64_t config;
+	const char *csv;
+	const char *text;
+};
+
+#define CP_PERF_CACHE(cache)						\
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |			\
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct cp_perf_attr cp_perf_attrs[CP_PERF_EVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+	  "hw_cycles_per_byte", "cyc/B" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+	  "hw_instructions_per_byte", "ins/B" },
+	{ PERF_TYPE_HW_CACHE, CP_PERF_CACHE(PERF_COUNT_HW_CACHE_L1D),
+	  "hw_l1d_misses_per_byte", "L1D/B" },
+	{ PERF_TYPE_HW_CACHE, CP_PERF_CACHE(PERF_COUNT_HW_CACHE_LL),
+	  "hw_llc_misses_per_byte", "LLC/B" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+	  "hw_branch_misses_per_byte", "brm/B" },
+};
+
+static int cp_perf_open_one(const struct cp_perf_attr *a, int exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = a->type;
+	attr.config = a->config;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+	attr.exclude_kernel = exclude_kernel;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1,
+			    PERF_FLAG_FD_CLOEXEC);
+}
+
+int cp_perf_open(struct cp_perf *perf)
+{
+	unsigned int i;
+	int n = 0;
+
+	memset(perf, 0, sizeof(*perf));
+	for (i = 0; i < CP_PERF_EVENTS; i++) {
+		perf->fd[i] = cp_perf_open_one(&cp_perf_attrs[i], 0);
+
+		/* Unprivileged users may only count user space */
+		if (perf->fd[i] < 0 && (errno == EACCES || errno == EPERM))
+			perf->fd[i] = cp_perf_open_one(&cp_perf_attrs[i], 1);
+		if (perf->fd[i] >= 0) {
+			perf->avail |= 1U << i;
+			n++;
+		}
+	}
+
+	return n;
+}
+
+void cp_perf_close(struct cp_perf *perf)
+{
+	unsigned int i;
+
+	for (i = 0; i < CP_PERF_EVENTS; i++) {
+		if (perf->fd[i] >= 0)
+			close(perf->fd[i]);
+		perf->fd[i] = -1;
+	}
+}
+
+void cp_perf_reset(struct cp_perf *perf)
+{
+	memset(perf->val, 0, sizeof(perf->val));
+}
+
+void cp_perf_start(struct cp_perf *perf)
+{
+	unsigned int i;
+
+	for (i = 0; i < CP_PERF_EVENTS; i++) {
+		if (perf->fd[i] < 0)
+			continue;
+		ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void cp_perf_stop(struct cp_perf *perf)
+{
+	unsigned int i;
+
+	for (i = 0; i < CP_PERF_EVENTS; i++) {
+		uint64_t v[3];
+
+		if (perf->fd[i] < 0)
+			continue;
+		ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perf->fd[i], v, sizeof(v)) != sizeof(v))
+			continue;
+
+		/* Scale the value if the counter was multiplexed */
+		if (v[2] && v[2] < v[1])
+			v[0] = (uint64_t)((double)v[0] * (double)v[1] /
+					  (double)v[2]);
+		perf->val[i] += v[0];
+	}
+}
+
+void cp_perf_add(struct cp_perf *dst, const struct cp_perf *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < CP_PERF_EVENTS; i++)
+		dst->val[i] += src->val[i];
+	dst->avail |= src->avail;
+}
+
+void cp_perf_print_header(FILE *out, int format)
+{
+	unsigned int i;
+
+	for (i = 0; i < CP_PERF_EVENTS; i++) {
+		if (format == CP_PERF_CSV)
+			fprintf(out, ",%s", cp_perf_attrs[i].csv);
+		else if (format == CP_PERF_TEXT)
+			fprintf(out, "|%9s", cp_perf_attrs[i].text);
+	}
+
+	if (format == CP_PERF_CSV)
+		fprintf(out, ",hw_ipc");
+	else if (format == CP_PERF_TEXT)
+		fprintf(out, "|%6s", "IPC");
+}
+
+static void cp_perf_print_val(FILE *out, const char *name, int avail,
+			      double val, int format)
+{
+	switch (format) {
+	case CP_PERF_CSV:
+		if (avail)
+			fprintf(out, ",%.4f", val);
+		else
+			fprintf(out, ",");
+		break;
+	case CP_PERF_JSON:
+		if (avail)
+			fprintf(out, ", \"%s\": %.4f", name, val);
+		else
+			fprintf(out, ", \"%s\": null", name);
+		break;
+	default:
+		if (avail)
+			fprintf(out, "|%9.4f", val);
+		else
+			fprintf(out, "|%9s", "-");
+		break;
+	}
+}
+
+void cp_perf_print(FILE *out, const struct cp_perf *perf, uint64_t bytes,
+		   int format)
+{
+	unsigned int i;
+	int ipc_avail = ((perf->avail & (1U << CP_PERF_CYCLES)) &&
+			 (perf->avail & (1U << CP_PERF_INSTRUCTIONS)) &&
+			 perf->val[CP_PERF_CYCLES]);
+
+	for (i = 0; i < CP_PERF_EVENTS; i++)
+		cp_perf_print_val(out, cp_perf_attrs[i].csv,
+				  (perf->avail & (1U << i)) && bytes,
+				  bytes ? (double)perf->val[i] / (double)bytes :
+					  0, format);
+
+	if (format == CP_PERF_TEXT) {
+		if (ipc_avail)
+			fprintf(out, "|%6.2f",
+				(double)perf->val[CP_PERF_INSTRUCTIONS] /
+				(double)perf->val[CP_PERF_CYCLES]);
+		else
+			fprintf(out, "|%6s", "-");
+	} else
+		cp_perf_print_val(out, "hw_ipc", ipc_avail, ipc_avail ?
+				  (double)perf->val[CP_PERF_INSTRUCTIONS] /
+				  (double)perf->val[CP_PERF_CYCLES] : 0,
+				  format);
+}
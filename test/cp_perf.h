@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _CP_PERF_H
+#define _CP_PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Hardware performance counters of the calling thread obtained with
+ * perf_event_open(2). Events which cannot be opened (missing permissions,
+ * virtualized hosts, unsupported hardware) are reported as unavailable.
+ */
+
+enum cp_perf_event {
+	CP_PERF_CYCLES,
+	CP_PERF_INSTRUCTIONS,
+	CP_PERF_L1D_MISSES,
+	CP_PERF_LLC_MISSES,
+	CP_PERF_BRANCH_MISSES,
+	CP_PERF_EVENTS,
+};
+
+struct cp_perf {
+	int fd[CP_PERF_EVENTS];
+	unsigned int avail;		/* bit mask of the opened events */
+	uint64_t val[CP_PERF_EVENTS];	/* scaled if events were multiplexed */
+};
+
+/* Output formats of cp_perf_print and cp_perf_print_header */
+#define CP_PERF_TEXT	0
+#define CP_PERF_CSV	1
+#define CP_PERF_JSON	2
+
+/*
+ * Open the counters for the calling thread
+ *
+ * @perf [out] counter state
+ * @return number of available counters, 0 if no counter is available
+ */
+int cp_perf_open(struct cp_perf *perf);
+
+/* Close the counters */
+void cp_perf_close(struct cp_perf *perf);
+
+/* Reset the accumulated counter values */
+void cp_perf_reset(struct cp_perf *perf);
+
+/* Start counting */
+void cp_perf_start(struct cp_perf *perf);
+
+/* Stop counting and accumulate the counter values */
+void cp_perf_stop(struct cp_perf *perf);
+
+/* Add the counter values and the available events of src to dst */
+void cp_perf_add(struct cp_perf *dst, const struct cp_perf *src);
+
+/*
+ * Print the header of the metrics per byte: a CSV header part with a leading
+ * comma or a text table header part. Nothing is printed for JSON.
+ */
+void cp_perf_print_header(FILE *out, int format);
+
+/*
+ * Print cycles, instructions, L1D misses, LLC misses and branch misses per
+ * byte and the instructions per cycle: CSV and JSON fields with a leading
+ * comma or text table columns. Unavailable values are left empty, reported
+ * as null or "-".
+ */
+void cp_perf_print(FILE *out, const struct cp_perf *perf, uint64_t bytes,
+		   int format);
+
+#endif /* _CP_PERF_H */
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cp_util.h"
+
+int cp_pin_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return -EINVAL;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int cp_current_cpu(void)
+{
+	int cpu = sched_getcpu();
+
+	return (cpu < 0) ? -errno : cpu;
+}
+
+/* Parse a sysfs list of the form "0-3,8,10-11" */
+static int cp_read_list(const char *path, int *vals, int maxvals)
+{
+	char line[4096], *p;
+	FILE *f = fopen(path, "r");
+	int n = 0;
+
+	if (!f)
+		return -errno;
+	if (!fgets(line, sizeof(line), f)) {
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+
+	p = line;
+	while (*p && *p != '\n') {
+		char *end;
+		long first = strtol(p, &end, 10), last;
+
+		if (end == p)
+			return -EINVAL;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -EINVAL;
+		}
+		for (; first <= last && n < maxvals; first++)
+			vals[n++] = (int)first;
+		p = end;
+		if (*p == ',')
+			p++;
+	}
+
+	return n;
+}
+
+int cp_node_cpus(int node, int *cpus, int maxcpus)
+{
+	char path[64];
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	ret = cp_read_list(path, cpus, maxcpus);
+
+	/* Without NUMA support, node 0 covers all CPUs */
+	if (ret == -ENOENT && !node)
+		ret = cp_read_list("/sys/devices/system/cpu/online", cpus,
+				   maxcpus);
+
+	return ret;
+}
+
+int cp_online_nodes(int *nodes, int maxnodes)
+{
+	int ret = cp_read_list("/sys/devices/system/node/online", nodes,
+			       maxnodes);
+
+	if (ret == -ENOENT && maxnodes > 0) {
+		nodes[0] = 0;
+		ret = 1;
+	}
+
+	return ret;
+}
+
+static int cp_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+uint64_t cp_percentile(const uint64_t *sorted, uint64_t n, double p)
+{
+	double r = p / 100.0 * (double)n;
+	uint64_t rank;
+
+	if (!n)
+		return 0;
+
+	rank = (uint64_t)r;
+	if ((double)rank < r)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+	if (rank > n)
+		rank = n;
+
+	return sorted[rank - 1];
+}
+
+void cp_stats(uint64_t *lat, uint64_t n, struct cp_stats *stats)
+{
+	long double sum = 0;
+	uint64_t i;
+
+	stats->samples = n;
+	if (!n) {
+		stats->min = stats->p50 = stats->p99 = stats->p999 = 0;
+		stats->max = 0;
+		stats->mean = 0;
+		return;
+	}
+
+	qsort(lat, n, sizeof(*lat), cp_cmp_u64);
+
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+
+	stats->min = lat[0];
+	stats->p50 = cp_percentile(lat, n, 50);
+	stats->p99 = cp_percentile(lat, n, 99);
+	stats->p999 = cp_percentile(lat, n, 99.9);
+	stats->max = lat[n - 1];
+	stats->mean = (double)(sum / n);
+}
+
+void cp_bytes2string(uint64_t bytes, char *str, size_t strlen)
+{
+	static const char *unit[] = { "GB", "MB", "kB" };
+	unsigned int i, shift;
+
+	for (i = 0, shift = 30; i < 3; i++, shift -= 10) {
+		if ((1ULL<<shift) < bytes) {
+			uint64_t abs = (bytes>>shift);
+			/* two decimal places of the remainder */
+			uint64_t part = ((bytes - (abs<<shift)) * 100) >> shift;
+
+			snprintf(str, strlen, "%lu.%02lu %s",
+				 (unsigned long)abs, (unsigned long)part,
+				 unit[i]);
+			return;
+		}
+	}
+	snprintf(str, strlen, "%lu B", (unsigned long)bytes);
+	str[strlen - 1] = '\0';
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2016 - 2017, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see COPYING file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _CP_UTIL_H
+#define _CP_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Helper functions shared by the test and benchmark applications.
+ */
+
+/* Time stamp in nanoseconds from the monotonic clock */
+static inline uint64_t cp_nstime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * This is x86 specific to reduce the CPU jitter: serialize the instruction
+ * stream before a measurement starts.
+ */
+static inline void cp_cpusetup(void)
+{
+#ifdef __x86_64__
+	unsigned int a = 0, b, c = 0, d;
+
+	__asm__ __volatile__("cpuid" : "+a" (a), "=b" (b), "+c" (c), "=d" (d)
+			     : : "memory");
+#endif
+}
+
+/*
+ * CPU cycle counter -- returns 0 on architectures without a user space
+ * accessible counter.
+ */
+static inline uint64_t cp_cycles(void)
+{
+#ifdef __x86_64__
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+/* Latency statistics in nanoseconds */
+struct cp_stats {
+	uint64_t samples;
+	uint64_t min;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+	double mean;
+};
+
+/*
+ * Pin the calling thread to the given CPU
+ *
+ * @cpu [in] CPU number
+ * @return 0 on success, < 0 on error
+ */
+int cp_pin_cpu(int cpu);
+
+/*
+ * Obtain the CPU the calling thread currently executes on
+ *
+ * @return CPU number, < 0 on error
+ */
+int cp_current_cpu(void);
+
+/*
+ * Obtain the CPUs of a NUMA node from sysfs
+ *
+ * @node [in] NUMA node number
+ * @cpus [out] CPU numbers of the node
+ * @maxcpus [in] number of entries in cpus
+ * @return number of CPUs, < 0 on error
+ */
+int cp_node_cpus(int node, int *cpus, int maxcpus);
+
+/*
+ * Obtain the online NUMA nodes from sysfs -- without NUMA support, node 0 is
+ * reported
+ *
+ * @nodes [out] NUMA node numbers
+ * @maxnodes [in] number of entries in nodes
+ * @return number of NUMA nodes, < 0 on error
+ */
+int cp_online_nodes(int *nodes, int maxnodes);
+
+/*
+ * Calculate the latency statistics of the given samples
+ *
+ * @lat [in] latency samples in nanoseconds -- the array is sorted in place
+ * @n [in] number of samples
+ * @stats [out] calculated statistics
+ */
+void cp_stats(uint64_t *lat, uint64_t n, struct cp_stats *stats);
+
+/*
+ * Obtain the given percentile of sorted samples using the nearest-rank
+ * method
+ *
+ * @sorted [in] sorted samples
+ * @n [in] number of samples
+ * @p [in] percentile (0 < p <= 100)
+ */
+uint64_t cp_percentile(const uint64_t *sorted, uint64_t n, double p);
+
+/*
+ * Convert an integer value into a string value that displays the integer
+ * in either bytes, kB, MB or GB
+ *
+ * @bytes value to convert -- input
+ * @str already allocated buffer for converted string -- output
+ * @strlen size of str
+ */
+void cp_bytes2string(uint64_t bytes, char *str, size_t strlen);
+
+#endif /* _CP_UTIL_H */